@@ -0,0 +1,399 @@
+/* Microbenchmarks for the VFS, scheduler, shell dispatch and persistence.
+
+   Build from the repository root:
+     gcc -O2 bench/sos_bench.c -o sos_bench -lpthread
+
+   The core source is included directly so its static functions can be
+   driven without the shell front end. Every benchmark times
+   batches of operations; ns/op and ops/sec come from the total, the
+   percentiles from the per-batch averages. Results are printed as JSON,
+   one benchmark per line. With --baseline the median of each benchmark
+   is compared against an earlier --save-baseline file and the exit
+   status is 1 if any got slower than the threshold allows. vfs_mt_<T>t
+   runs a read-heavy mix on 1, 2, 4 ... --threads threads to show how the
+   lock-free read path scales. POSIX only. */
+#include "../sos_core.c"
+
+#define BENCH_MAX 32
+
+typedef struct {
+    char name[48];
+    unsigned long long ops;
+    double ns_per_op, ops_per_sec, p50, p90, p99, max;
+} bench_result_t;
+
+static bench_result_t results[BENCH_MAX];
+static int nresults = 0;
+
+static int cfg_files = 100;
+static size_t cfg_size = 1024;
+static int cfg_tasks = 32;
+static unsigned long long cfg_ops = 200000;
+static char cfg_mix[256] = "echo,write,append,cat,ls,grep,pipe";
+static int cfg_threads = 0;            /* 0: online CPUs */
+static int cfg_write_pct = 5;
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef void (*bench_fn)(unsigned long long i);
+
+/* runs fn ops times in batches of 'batch', after a short warmup */
+static void bench_run(const char* name, bench_fn fn, unsigned long long ops, unsigned batch) {
+    if (nresults >= BENCH_MAX || ops == 0) return;
+    if (batch == 0) batch = 1;
+    size_t nsamples = (size_t)((ops + batch - 1) / batch);
+    double* samples = malloc(nsamples * sizeof(double));
+    if (!samples) return;
+    for (unsigned long long i = 0; i < ops / 10; ++i) fn(i);
+    unsigned long long total = 0, done = 0;
+    for (size_t s = 0; s < nsamples; ++s) {
+        unsigned long long n = ops - done < batch ? ops - done : batch;
+        unsigned long long t0 = now_ns();
+        for (unsigned long long k = 0; k < n; ++k) fn(done + k);
+        unsigned long long dt = now_ns() - t0;
+        samples[s] = (double)dt / (double)n;
+        total += dt;
+        done += n;
+    }
+    qsort(samples, nsamples, sizeof(double), cmp_double);
+    bench_result_t* r = &results[nresults++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->ops = ops;
+    r->ns_per_op = (double)total / (double)ops;
+    r->ops_per_sec = total ? 1e9 * (double)ops / (double)total : 0;
+    r->p50 = samples[nsamples / 2];
+    r->p90 = samples[(size_t)(nsamples * 0.90)];
+    r->p99 = samples[(size_t)(nsamples * 0.99)];
+    r->max = samples[nsamples - 1];
+    free(samples);
+    fprintf(stderr, "  %-22s %12.1f ns/op\n", r->name, r->ns_per_op);
+}
+
+/* fixtures */
+static char** file_names;
+static char* payload;
+static strbuf_t sink;
+static sh_io_t sink_io = { NULL, NULL, &sink, 0 };
+
+static void vfs_reset() {
+    VFS_LOCK();
+    vfs_clear_locked();
+    VFS_UNLOCK();
+}
+
+static void vfs_populate() {
+    vfs_reset();
+    for (int i = 0; i < cfg_files; ++i) vfs_write_bytes(file_names[i], payload, cfg_size);
+}
+
+static vfile_t* volatile find_sink;
+
+static void op_find_hit(unsigned long long i) {
+    find_sink = vfs_find(file_names[(i * 7919) % (unsigned long long)cfg_files]);
+}
+
+static void op_find_miss(unsigned long long i) {
+    (void)i;
+    find_sink = vfs_find("no-such-file.txt");
+}
+
+static void op_append(unsigned long long i) {
+    vfs_append_bytes(file_names[i % (unsigned long long)cfg_files], "0123456789abcdef\n", 17);
+}
+
+static void op_read_copy(unsigned long long i) {
+    sink.len = 0;
+    vfs_read_copy(file_names[i % (unsigned long long)cfg_files], &sink);
+}
+
+static void op_tick(unsigned long long i) {
+    (void)i;
+    scheduler_tick();
+}
+
+static const char* mix_cmds[16];
+static int nmix = 0;
+
+static void op_execute(unsigned long long i) {
+    sink.len = 0;
+    shell_execute(mix_cmds[i % (unsigned long long)nmix]);
+}
+
+/* saves skip a clean VFS, so every iteration changes one file first */
+static void op_save(unsigned long long i) {
+    vfs_write_bytes(file_names[i % (unsigned long long)cfg_files], payload, cfg_size);
+    vfs_save_state();
+}
+
+static void op_load(unsigned long long i) {
+    (void)i;
+    vfs_init();
+}
+
+/* Concurrent VFS stress: T threads each run cfg_ops operations on random
+   files, cfg_write_pct percent of them overwrites and the rest
+   vfs_read_copy(). Run for T = 1, 2, 4 ... cfg_threads; ops_per_sec is the
+   aggregate, percentiles come from per-thread batch averages. */
+typedef struct {
+    pthread_t th;
+    sos_ctx_t* ctx;
+    unsigned seed;
+    double* samples;
+    size_t nsamples;
+} mt_worker_t;
+
+#define MT_BATCH 100
+
+static void* mt_worker(void* arg) {
+    mt_worker_t* w = arg;
+    strbuf_t buf = {0};
+    sos_cur = w->ctx;
+    unsigned long long done = 0;
+    while (done < cfg_ops) {
+        unsigned long long n = cfg_ops - done < MT_BATCH ? cfg_ops - done : MT_BATCH;
+        unsigned long long t0 = now_ns();
+        for (unsigned long long k = 0; k < n; ++k) {
+            w->seed = w->seed * 1103515245u + 12345u;
+            unsigned r = w->seed >> 8;
+            const char* name = file_names[r % (unsigned)cfg_files];
+            if ((int)((r >> 12) % 100) < cfg_write_pct) vfs_write_bytes(name, payload, cfg_size);
+            else { buf.len = 0; vfs_read_copy(name, &buf); }
+        }
+        w->samples[w->nsamples++] = (double)(now_ns() - t0) / (double)n;
+        done += n;
+    }
+    sb_free(&buf);
+    return NULL;
+}
+
+static void bench_mt(int nthreads) {
+    if (nresults >= BENCH_MAX || cfg_ops == 0) return;
+    size_t per = (size_t)((cfg_ops + MT_BATCH - 1) / MT_BATCH);
+    mt_worker_t* ws = calloc((size_t)nthreads, sizeof(*ws));
+    double* all = malloc((size_t)nthreads * per * sizeof(double));
+    if (!ws || !all) { free(ws); free(all); return; }
+    unsigned long long t0 = now_ns();
+    int started = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        ws[i].ctx = sos_cur;
+        ws[i].seed = 0x9e3779b9u * (unsigned)(i + 1);
+        ws[i].samples = all + (size_t)i * per;
+        if (pthread_create(&ws[i].th, NULL, mt_worker, &ws[i]) != 0) break;
+        started++;
+    }
+    size_t nsamples = 0;
+    for (int i = 0; i < started; ++i) {
+        pthread_join(ws[i].th, NULL);
+        memmove(all + nsamples, ws[i].samples, ws[i].nsamples * sizeof(double));
+        nsamples += ws[i].nsamples;
+    }
+    unsigned long long wall = now_ns() - t0;
+    if (started == 0 || nsamples == 0) { free(ws); free(all); return; }
+    qsort(all, nsamples, sizeof(double), cmp_double);
+    bench_result_t* r = &results[nresults++];
+    snprintf(r->name, sizeof(r->name), "vfs_mt_%dt", started);
+    r->ops = cfg_ops * (unsigned long long)started;
+    r->ns_per_op = (double)wall / (double)cfg_ops;
+    r->ops_per_sec = 1e9 * (double)r->ops / (double)wall;
+    r->p50 = all[nsamples / 2];
+    r->p90 = all[(size_t)(nsamples * 0.90)];
+    r->p99 = all[(size_t)(nsamples * 0.99)];
+    r->max = all[nsamples - 1];
+    fprintf(stderr, "  %-22s %12.0f ops/sec\n", r->name, r->ops_per_sec);
+    free(ws);
+    free(all);
+}
+
+static const char* mix_command(const char* key) {
+    if (strcmp(key, "echo") == 0) return "echo hello from the benchmark";
+    if (strcmp(key, "write") == 0) return "write bench_w.txt overwritten by the benchmark";
+    if (strcmp(key, "append") == 0) return "append bench_a.txt appended line";
+    if (strcmp(key, "cat") == 0) return "cat f0";
+    if (strcmp(key, "ls") == 0) return "ls";
+    if (strcmp(key, "grep") == 0) return "grep needle f1";
+    if (strcmp(key, "wc") == 0) return "wc f2";
+    if (strcmp(key, "pipe") == 0) return "cat f0 | grep needle | wc";
+    if (strcmp(key, "ps") == 0) return "ps";
+    return NULL;
+}
+
+/* baseline: the same JSON this program prints, one benchmark per line.
+   Runs are compared on the median batch, which is far less noisy than
+   the mean for the slower benchmarks. */
+static int baseline_lookup(const char* text, const char* name, double* ns) {
+    char key[96];
+    snprintf(key, sizeof(key), "\"name\": \"%.48s\"", name);
+    const char* p = strstr(text, key);
+    if (!p) return 0;
+    p = strstr(p, "\"p50_ns\": ");
+    return p && sscanf(p + 10, "%lf", ns) == 1;
+}
+
+static void config_json(char* out, size_t sz) {
+    snprintf(out, sz, "{\"files\": %d, \"size\": %zu, \"tasks\": %d, \"ops\": %llu, \"mix\": \"%s\", \"threads\": %d, \"write_pct\": %d}",
+             cfg_files, cfg_size, cfg_tasks, cfg_ops, cfg_mix, cfg_threads, cfg_write_pct);
+}
+
+static void write_json(FILE* f) {
+    char config[512];
+    config_json(config, sizeof(config));
+    fprintf(f, "{\"config\": %s,\n", config);
+    fprintf(f, " \"benchmarks\": [\n");
+    for (int i = 0; i < nresults; ++i) {
+        bench_result_t* r = &results[i];
+        fprintf(f, "  {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, "
+                   "\"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f}%s\n",
+                r->name, r->ops, r->ns_per_op, r->ops_per_sec, r->p50, r->p90, r->p99, r->max,
+                i + 1 < nresults ? "," : "");
+    }
+    fprintf(f, " ]}\n");
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: sos_bench [--files N] [--size BYTES] [--tasks N] [--ops N] [--mix cmd,cmd,...]\n"
+        "                 [--threads N] [--write-pct P]\n"
+        "                 [--filter TEXT] [--out FILE] [--save-baseline FILE]\n"
+        "                 [--baseline FILE] [--threshold PCT]\n"
+        "mix commands: echo write append cat ls grep wc pipe ps\n");
+}
+
+int main(int argc, char** argv) {
+    const char *out_path = NULL, *save_path = NULL, *base_path = NULL, *filter = NULL;
+    double threshold = 10.0;
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!v && strcmp(a, "--help") != 0) { usage(); return 2; }
+        if (strcmp(a, "--files") == 0) cfg_files = atoi(v);
+        else if (strcmp(a, "--size") == 0) cfg_size = (size_t)strtoull(v, NULL, 10);
+        else if (strcmp(a, "--tasks") == 0) cfg_tasks = atoi(v);
+        else if (strcmp(a, "--ops") == 0) cfg_ops = strtoull(v, NULL, 10);
+        else if (strcmp(a, "--mix") == 0) snprintf(cfg_mix, sizeof(cfg_mix), "%s", v);
+        else if (strcmp(a, "--threads") == 0) cfg_threads = atoi(v);
+        else if (strcmp(a, "--write-pct") == 0) cfg_write_pct = atoi(v);
+        else if (strcmp(a, "--filter") == 0) filter = v;
+        else if (strcmp(a, "--out") == 0) out_path = v;
+        else if (strcmp(a, "--save-baseline") == 0) save_path = v;
+        else if (strcmp(a, "--baseline") == 0) base_path = v;
+        else if (strcmp(a, "--threshold") == 0) threshold = atof(v);
+        else { usage(); return 2; }
+        i++;
+    }
+    if (cfg_files < 1) cfg_files = 1;
+    if (cfg_files > FS_MAX_FILES) cfg_files = FS_MAX_FILES;
+    if (cfg_size > FS_MAX_CONTENT) cfg_size = FS_MAX_CONTENT;
+    if (cfg_tasks > MAX_TASKS) cfg_tasks = MAX_TASKS;
+    if (cfg_threads <= 0) cfg_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cfg_threads < 1) cfg_threads = 1;
+    if (cfg_threads > 64) cfg_threads = 64;
+
+    char* mixcopy = strdup(cfg_mix);
+    for (char* tok = strtok(mixcopy, ","); tok && nmix < 16; tok = strtok(NULL, ",")) {
+        const char* c = mix_command(tok);
+        if (!c) { fprintf(stderr, "unknown mix command: %s\n", tok); usage(); return 2; }
+        mix_cmds[nmix++] = c;
+    }
+
+    char* base_text = NULL;
+    if (base_path) {
+        FILE* bf = fopen(base_path, "rb");
+        if (!bf) { fprintf(stderr, "cannot read baseline %s\n", base_path); return 2; }
+        strbuf_t b = {0};
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), bf)) > 0) sb_append(&b, chunk, n);
+        sb_append(&b, "", 0);
+        fclose(bf);
+        base_text = b.data;
+    }
+
+    /* persistence benchmarks write the state file into the working directory */
+    char cwd[4096], tmpdir[] = "/tmp/sos_bench.XXXXXX";
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(tmpdir) || chdir(tmpdir) != 0) { perror("bench dir"); return 2; }
+
+    sos_cur = sos_create("bench_state.dat");
+    if (!sos_cur) return 2;
+    file_names = calloc((size_t)cfg_files, sizeof(char*));
+    payload = malloc(cfg_size + 1);
+    for (size_t i = 0; i < cfg_size; ++i) payload[i] = (i % 64 == 63) ? '\n' : (i % 97 == 5 ? 'n' : 'a' + (char)(i % 26));
+    if (cfg_size > 16) memcpy(payload + cfg_size / 2, "needle", 6);
+    payload[cfg_size] = '\0';
+    for (int i = 0; i < cfg_files; ++i) {
+        char name[MAX_NAME];
+        snprintf(name, sizeof(name), "f%d", i);
+        file_names[i] = strdup(name);
+    }
+    for (int i = 0; i < cfg_tasks; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "bench%d", i);
+        spawn_message_task(name, 1u << 30, "never printed");
+    }
+    sh_io = &sink_io;
+
+#define WANT(n) (!filter || strstr((n), filter))
+    fprintf(stderr, "sos_bench: %d files x %zu bytes, %d tasks, %llu ops\n", cfg_files, cfg_size, cfg_tasks, cfg_ops);
+    vfs_populate();
+    if (WANT("vfs_find_hit")) bench_run("vfs_find_hit", op_find_hit, cfg_ops * 10, 1000);
+    if (WANT("vfs_find_miss")) bench_run("vfs_find_miss", op_find_miss, cfg_ops * 10, 1000);
+    if (WANT("vfs_read_copy")) bench_run("vfs_read_copy", op_read_copy, cfg_ops, 100);
+    if (WANT("vfs_append")) { bench_run("vfs_append", op_append, cfg_ops, 100); vfs_populate(); }
+    if (WANT("scheduler_tick")) bench_run("scheduler_tick", op_tick, cfg_ops, 100);
+    if (WANT("shell_execute")) { bench_run("shell_execute", op_execute, cfg_ops / 10, 10); vfs_populate(); }
+    unsigned long long pops = cfg_ops / 1000 ? cfg_ops / 1000 : 1;
+    if (WANT("vfs_save_state")) bench_run("vfs_save_state", op_save, pops, 1);
+    if (WANT("vfs_load_state")) { vfs_save_state(); bench_run("vfs_load_state", op_load, pops, 1); }
+    if (WANT("vfs_mt")) {
+        vfs_populate();
+        for (int t = 1; t <= cfg_threads; t = t * 2 > cfg_threads && t != cfg_threads ? cfg_threads : t * 2) bench_mt(t);
+    }
+#undef WANT
+
+    sh_io = NULL;
+    sos_destroy(sos_cur);
+    remove("bench_state.dat");
+    if (chdir(cwd) != 0 || rmdir(tmpdir) != 0) perror("bench dir cleanup");
+
+    write_json(stdout);
+    if (out_path) {
+        FILE* f = fopen(out_path, "w");
+        if (f) { write_json(f); fclose(f); }
+    }
+    if (save_path) {
+        FILE* f = fopen(save_path, "w");
+        if (!f) { fprintf(stderr, "cannot write baseline %s\n", save_path); return 2; }
+        write_json(f);
+        fclose(f);
+        fprintf(stderr, "baseline saved to %s\n", save_path);
+    }
+    int regressions = 0;
+    if (base_text) {
+        char config[512];
+        config_json(config, sizeof(config));
+        fprintf(stderr, "compared with %s (threshold %.1f%%):\n", base_path, threshold);
+        if (!strstr(base_text, config)) fprintf(stderr, "  warning: the baseline was recorded with a different configuration\n");
+        for (int i = 0; i < nresults; ++i) {
+            double old;
+            if (!baseline_lookup(base_text, results[i].name, &old) || old <= 0) {
+                fprintf(stderr, "  %-22s (not in baseline)\n", results[i].name);
+                continue;
+            }
+            double delta = 100.0 * (results[i].p50 - old) / old;
+            int bad = delta > threshold;
+            regressions += bad;
+            fprintf(stderr, "  %-22s p50 %12.1f -> %12.1f ns  %+6.1f%%%s\n",
+                    results[i].name, old, results[i].p50, delta, bad ? "  REGRESSION" : "");
+        }
+        free(base_text);
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+/* Load generator for the loopback HTTP server (--http PORT / httpd).
+
+   Build from the repository root:
+     gcc -O2 bench/sos_httpload.c -o sos_httpload
+
+   Opens N keep-alive connections and keeps exactly one GET in flight on
+   each for the given duration (closed loop). With --revalidate every
+   request after the first carries the ETag it got back, so the server
+   answers 304 without sending the body; --range asks for a byte range.
+   With --pid it also reads the server's CPU time from /proc and reports
+   the CPU cost per request. Prints JSON in the same shape as sos_bench.
+   Linux. */
+#define _GNU_SOURCE     /* memmem */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+typedef struct {
+    int fd;
+    char buf[16384];            /* response head being collected */
+    size_t len;
+    unsigned long long skip;    /* body bytes still to discard */
+    unsigned long long sent_at;
+    char etag[64];
+} hl_conn_t;
+
+static const char *path = "/vfs/welcome.txt", *range = NULL;
+static int revalidate = 0;
+static unsigned long long responses[6];     /* by status class, 1xx..5xx */
+static unsigned long long body_bytes = 0;
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static int cmp_ull(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* utime + stime of a process in clock ticks, 0 if unreadable */
+static unsigned long long proc_cpu_ticks(int pid) {
+    char p[64], buf[1024];
+    snprintf(p, sizeof(p), "/proc/%d/stat", pid);
+    FILE* f = fopen(p, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    char* s = strrchr(buf, ')');
+    unsigned long long ut = 0, st = 0;
+    /* after "pid (comm)": state and 10 more fields come before utime */
+    if (!s || sscanf(s + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &ut, &st) != 2) return 0;
+    return ut + st;
+}
+
+static int connect_server(int port) {
+    struct sockaddr_in sa = {0};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((unsigned short)port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) { close(fd); return -1; }
+    int one = 1;
+    if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int send_request(hl_conn_t* c) {
+    char req[1024];
+    int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n", path);
+    if (range) n += snprintf(req + n, sizeof(req) - (size_t)n, "Range: %s\r\n", range);
+    if (revalidate && c->etag[0]) n += snprintf(req + n, sizeof(req) - (size_t)n, "If-None-Match: %s\r\n", c->etag);
+    n += snprintf(req + n, sizeof(req) - (size_t)n, "\r\n");
+    c->sent_at = now_ns();
+    return send(c->fd, req, (size_t)n, MSG_NOSIGNAL) == n ? 0 : -1;
+}
+
+/* feeds received bytes; returns 1 when a whole response has arrived */
+static int feed(hl_conn_t* c, const char* data, size_t n) {
+    if (c->skip) {
+        size_t take = n < c->skip ? n : (size_t)c->skip;
+        c->skip -= take;
+        body_bytes += take;
+        data += take;
+        n -= take;
+        if (c->skip == 0 && n == 0) return 1;
+        if (c->skip) return 0;
+    }
+    /* only the head is buffered; body bytes are just counted */
+    size_t before = c->len, copy = n < sizeof(c->buf) - c->len ? n : sizeof(c->buf) - c->len;
+    memcpy(c->buf + c->len, data, copy);
+    c->len += copy;
+    char* end = memmem(c->buf, c->len, "\r\n\r\n", 4);
+    if (!end) return c->len == sizeof(c->buf) ? -1 : 0;
+    *end = '\0';
+    int status = 0;
+    unsigned long long clen = 0;
+    sscanf(c->buf, "HTTP/1.%*d %d", &status);
+    for (char* line = strstr(c->buf, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) clen = strtoull(line + 17, NULL, 10);
+        else if (strncasecmp(line + 2, "ETag:", 5) == 0) sscanf(line + 7, " %63s", c->etag);
+    }
+    if (status >= 100 && status < 600) responses[status / 100]++;
+    if (status == 304 || status == 204) clen = 0;
+    size_t rest = before + n - (size_t)(end + 4 - c->buf);
+    c->len = 0;
+    if (rest > clen) return -1;      /* only one request is ever in flight */
+    body_bytes += rest;
+    c->skip = clen - rest;
+    return c->skip == 0;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: sos_httpload --port PORT [--conns N] [--seconds S] [--path /vfs/NAME]\n"
+        "                    [--range bytes=A-B] [--revalidate] [--pid SERVER_PID] [--out FILE]\n");
+}
+
+int main(int argc, char** argv) {
+    const char* out_path = NULL;
+    int port = 0, nconn = 16, pid = 0;
+    double seconds = 5;
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        if (strcmp(a, "--revalidate") == 0) { revalidate = 1; continue; }
+        const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!v) { usage(); return 2; }
+        if (strcmp(a, "--port") == 0) port = atoi(v);
+        else if (strcmp(a, "--conns") == 0) nconn = atoi(v);
+        else if (strcmp(a, "--seconds") == 0) seconds = atof(v);
+        else if (strcmp(a, "--path") == 0) path = v;
+        else if (strcmp(a, "--range") == 0) range = v;
+        else if (strcmp(a, "--pid") == 0) pid = atoi(v);
+        else if (strcmp(a, "--out") == 0) out_path = v;
+        else { usage(); return 2; }
+        i++;
+    }
+    if (port <= 0 || nconn < 1 || seconds <= 0) { usage(); return 2; }
+
+    hl_conn_t* cs = calloc((size_t)nconn, sizeof(*cs));
+    struct pollfd* pf = calloc((size_t)nconn, sizeof(*pf));
+    size_t lat_cap = 1 << 16, nlat = 0;
+    unsigned long long* lat = malloc(lat_cap * sizeof(*lat));
+    if (!cs || !pf || !lat) return 2;
+    for (int i = 0; i < nconn; ++i) {
+        cs[i].fd = connect_server(port);
+        if (cs[i].fd < 0) { fprintf(stderr, "connect: %s\n", strerror(errno)); return 2; }
+        pf[i].fd = cs[i].fd;
+        pf[i].events = POLLIN;
+    }
+
+    fprintf(stderr, "sos_httpload: %d connections, %.1f s, GET %s\n", nconn, seconds, path);
+    unsigned long long cpu0 = pid ? proc_cpu_ticks(pid) : 0;
+    unsigned long long t0 = now_ns(), end = t0 + (unsigned long long)(seconds * 1e9);
+    for (int i = 0; i < nconn; ++i) send_request(&cs[i]);
+    char buf[65536];
+    int open = nconn;
+    while (open > 0) {
+        if (poll(pf, (nfds_t)nconn, 1000) < 0 && errno != EINTR) break;
+        for (int i = 0; i < nconn; ++i) {
+            if (!(pf[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            hl_conn_t* c = &cs[i];
+            ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+            int done = n > 0 ? feed(c, buf, (size_t)n) : -1;
+            if (done == 0) continue;
+            unsigned long long now = now_ns();
+            if (done > 0) {
+                if (nlat == lat_cap) {
+                    unsigned long long* p = realloc(lat, lat_cap * 2 * sizeof(*lat));
+                    if (p) { lat = p; lat_cap *= 2; }
+                }
+                if (nlat < lat_cap) lat[nlat++] = now - c->sent_at;
+            }
+            if (done < 0 || now >= end || send_request(c) != 0) { close(c->fd); pf[i].fd = -1; open--; }
+        }
+    }
+    double elapsed = (now_ns() - t0) / 1e9;
+    unsigned long long cpu1 = pid ? proc_cpu_ticks(pid) : 0;
+    if (nlat == 0) { fprintf(stderr, "no responses completed\n"); return 1; }
+    qsort(lat, nlat, sizeof(*lat), cmp_ull);
+    double cpu_ns = pid ? (double)(cpu1 - cpu0) * 1e9 / (double)sysconf(_SC_CLK_TCK) : 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        FILE* f = pass ? (out_path ? fopen(out_path, "w") : NULL) : stdout;
+        if (!f) continue;
+        fprintf(f, "{\"config\": {\"conns\": %d, \"seconds\": %.1f, \"path\": \"%s\", \"range\": \"%s\", \"revalidate\": %d},\n",
+                nconn, seconds, path, range ? range : "", revalidate);
+        fprintf(f, " \"benchmarks\": [\n");
+        fprintf(f, "  {\"name\": \"http_get\", \"ops\": %zu, \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, "
+                   "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, "
+                   "\"status_2xx\": %llu, \"status_3xx\": %llu, \"status_4xx\": %llu, \"status_5xx\": %llu, "
+                   "\"body_bytes\": %llu",
+                nlat, elapsed * 1e9 / (double)nlat, (double)nlat / elapsed,
+                lat[nlat / 2], lat[(size_t)(nlat * 0.90)], lat[(size_t)(nlat * 0.99)], lat[nlat - 1],
+                responses[2], responses[3], responses[4], responses[5], body_bytes);
+        if (pid) fprintf(f, ", \"server_cpu_ns_per_op\": %.1f", cpu_ns / (double)nlat);
+        fprintf(f, "}\n ]}\n");
+        if (pass) fclose(f);
+    }
+    free(lat);
+    free(pf);
+    free(cs);
+    return 0;
+}
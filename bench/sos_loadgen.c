@@ -0,0 +1,197 @@
+/* Load generator for the multi-session server (--serve-unix/--serve-tcp).
+
+   Build from the repository root:
+     gcc -O2 bench/sos_loadgen.c -o sos_loadgen
+
+   Opens N sessions, logs each one in, then keeps exactly one command in
+   flight per session for the given duration (closed loop). A command is
+   complete when the session prompt arrives again. Prints commands/sec and
+   the latency percentiles as JSON, in the same shape as sos_bench. Linux. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define PROMPT_TAIL "\x1b[0m$ "
+#define MAX_CMDS 16
+
+typedef struct {
+    int fd;
+    int ready;                  /* logged in and waiting for the first command */
+    char tail[8];               /* last bytes received, to spot the prompt */
+    size_t taillen;
+    unsigned long long sent_at;
+    unsigned long long done;
+    int next;
+} lg_session_t;
+
+static const char* cmds[MAX_CMDS];
+static int ncmds = 0;
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static int cmp_ull(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int connect_server(const char* unix_path, int port) {
+    int fd;
+    if (unix_path) {
+        struct sockaddr_un sa = {0};
+        sa.sun_family = AF_UNIX;
+        snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", unix_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) { close(fd); return -1; }
+    } else {
+        struct sockaddr_in sa = {0};
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons((unsigned short)port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) { close(fd); return -1; }
+        int one = 1;
+        if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static int send_line(int fd, const char* line) {
+    char buf[2048];
+    int n = snprintf(buf, sizeof(buf), "%s\n", line);
+    return send(fd, buf, (size_t)n, MSG_NOSIGNAL) == n ? 0 : -1;
+}
+
+/* feeds received bytes; returns 1 when they end with a prompt */
+static int saw_prompt(lg_session_t* s, const char* data, size_t n) {
+    const size_t keep = sizeof(PROMPT_TAIL) - 1;
+    if (n >= keep) {
+        memcpy(s->tail, data + n - keep, keep);
+        s->taillen = keep;
+    } else {
+        size_t drop = s->taillen + n > keep ? s->taillen + n - keep : 0;
+        memmove(s->tail, s->tail + drop, s->taillen - drop);
+        memcpy(s->tail + s->taillen - drop, data, n);
+        s->taillen = s->taillen - drop + n;
+    }
+    return s->taillen == keep && memcmp(s->tail, PROMPT_TAIL, keep) == 0;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: sos_loadgen (--unix PATH | --tcp PORT) [--sessions N] [--seconds S]\n"
+        "                   [--cmd LINE]... [--out FILE]\n"
+        "default command: echo hello\n");
+}
+
+int main(int argc, char** argv) {
+    const char *unix_path = NULL, *out_path = NULL;
+    int port = 0, nsess = 16;
+    double seconds = 5;
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!v) { usage(); return 2; }
+        if (strcmp(a, "--unix") == 0) unix_path = v;
+        else if (strcmp(a, "--tcp") == 0) port = atoi(v);
+        else if (strcmp(a, "--sessions") == 0) nsess = atoi(v);
+        else if (strcmp(a, "--seconds") == 0) seconds = atof(v);
+        else if (strcmp(a, "--cmd") == 0 && ncmds < MAX_CMDS) cmds[ncmds++] = v;
+        else if (strcmp(a, "--out") == 0) out_path = v;
+        else { usage(); return 2; }
+        i++;
+    }
+    if ((!unix_path && port <= 0) || nsess < 1 || seconds <= 0) { usage(); return 2; }
+    if (ncmds == 0) cmds[ncmds++] = "echo hello";
+
+    lg_session_t* ss = calloc((size_t)nsess, sizeof(*ss));
+    struct pollfd* pf = calloc((size_t)nsess, sizeof(*pf));
+    size_t lat_cap = 1 << 16, nlat = 0;
+    unsigned long long* lat = malloc(lat_cap * sizeof(*lat));
+    if (!ss || !pf || !lat) return 2;
+    for (int i = 0; i < nsess; ++i) {
+        char user[32];
+        ss[i].fd = connect_server(unix_path, port);
+        if (ss[i].fd < 0) { fprintf(stderr, "connect: %s\n", strerror(errno)); return 2; }
+        snprintf(user, sizeof(user), "load%d", i);
+        send_line(ss[i].fd, user);
+        ss[i].next = i % ncmds;
+        pf[i].fd = ss[i].fd;
+        pf[i].events = POLLIN;
+    }
+
+    char buf[65536];
+    unsigned long long t0 = 0, end = 0;
+    int ready = 0, open = nsess;
+    fprintf(stderr, "sos_loadgen: %d sessions, %.1f s\n", nsess, seconds);
+    while (open > 0) {
+        if (poll(pf, (nfds_t)nsess, 1000) < 0 && errno != EINTR) break;
+        unsigned long long now = now_ns();
+        for (int i = 0; i < nsess; ++i) {
+            if (!(pf[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            lg_session_t* s = &ss[i];
+            ssize_t n = recv(s->fd, buf, sizeof(buf), 0);
+            if (n <= 0) { close(s->fd); pf[i].fd = -1; open--; continue; }
+            if (!saw_prompt(s, buf, (size_t)n)) continue;
+            if (!s->ready) {
+                s->ready = 1;
+                if (++ready < nsess) continue;
+                /* everyone is logged in: start the clock and every session */
+                t0 = now_ns();
+                end = t0 + (unsigned long long)(seconds * 1e9);
+                for (int k = 0; k < nsess; ++k) {
+                    ss[k].sent_at = now_ns();
+                    send_line(ss[k].fd, cmds[ss[k].next]);
+                }
+                continue;
+            }
+            if (nlat == lat_cap) {
+                unsigned long long* p = realloc(lat, lat_cap * 2 * sizeof(*lat));
+                if (p) { lat = p; lat_cap *= 2; }
+            }
+            if (nlat < lat_cap) lat[nlat++] = now - s->sent_at;
+            s->done++;
+            if (now >= end) { send_line(s->fd, "exit"); continue; }
+            s->next = (s->next + 1) % ncmds;
+            s->sent_at = now_ns();
+            send_line(s->fd, cmds[s->next]);
+        }
+    }
+    double elapsed = (now_ns() - t0) / 1e9;
+    if (nlat == 0 || t0 == 0) { fprintf(stderr, "no commands completed\n"); return 1; }
+    qsort(lat, nlat, sizeof(*lat), cmp_ull);
+    char mix[512] = "";
+    for (int i = 0; i < ncmds; ++i) {
+        strncat(mix, cmds[i], sizeof(mix) - strlen(mix) - 2);
+        if (i + 1 < ncmds) strcat(mix, ",");
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        FILE* f = pass ? (out_path ? fopen(out_path, "w") : NULL) : stdout;
+        if (!f) continue;
+        fprintf(f, "{\"config\": {\"sessions\": %d, \"seconds\": %.1f, \"transport\": \"%s\", \"mix\": \"%s\"},\n",
+                nsess, seconds, unix_path ? "unix" : "tcp", mix);
+        fprintf(f, " \"benchmarks\": [\n");
+        fprintf(f, "  {\"name\": \"server_roundtrip\", \"ops\": %zu, \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, "
+                   "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}\n",
+                nlat, elapsed * 1e9 / (double)nlat, (double)nlat / elapsed,
+                lat[nlat / 2], lat[(size_t)(nlat * 0.90)], lat[(size_t)(nlat * 0.99)], lat[nlat - 1]);
+        fprintf(f, " ]}\n");
+        if (pass) fclose(f);
+    }
+    free(lat);
+    free(pf);
+    free(ss);
+    return 0;
+}
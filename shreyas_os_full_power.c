@@ -1,622 +1,200 @@
+/* Shreyas OS interactive shell: boot screen, login and the prompt loop.
+   The VFS, tasks and commands live in sos_core.c (see sos.h). */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <ctype.h>
 
 #ifdef _WIN32
 #include <windows.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "Ws2_32.lib")
 #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
 #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
 #endif
 #else
 #include <unistd.h>
-#include <ifaddrs.h>
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/utsname.h>
-#include <pthread.h>
+#include <termios.h>
+#include <signal.h>
+#include <poll.h>
 #endif
 
-/* Configuration */
-#define FS_MAX_FILES 128
-#define FS_MAX_CONTENT 8192
-#define MAX_TASKS 48
-#define MAX_NAME 96
-#define MAX_MSG 1024
-#define CMD_HISTORY 128
+#include "sos.h"
+
 #define VFS_STATE_FILE "vfs_state.dat"
 #define PROMPT_BUFSZ 1024
 
-typedef struct {
-    char name[MAX_NAME];
-    char content[FS_MAX_CONTENT];
-    int used;
-} vfile_t;
-
-static vfile_t vfs[FS_MAX_FILES];
-
-typedef void (*builtin_fn)(void);
-
-typedef struct {
-    int id;
-    char name[MAX_NAME];
-    int type;
-    builtin_fn fn;
-    char msg[MAX_MSG];
-    unsigned interval;
-    unsigned ticks;
-    int active;
-} task_t;
-
-static task_t tasks[MAX_TASKS];
-static int task_count = 0;
-static int next_task_id = 1;
-static int running = 1;
-static time_t start_time;
-static char env_USER[64] = "Tony";
-static char env_HOSTNAME[128] = "ShreyasOS";
-static char env_PWD[256] = "/";
-
-static char cmd_history[CMD_HISTORY][1024];
-static int hist_pos = 0;
-static int hist_size = 0;
+static sos_ctx_t *os;
+static int fast_boot = 0;
 
 /* Helper: cross-platform sleep in milliseconds */
 static void sleep_ms(int ms) {
 #ifdef _WIN32
-    Sleep((DWORD)ms);
+    Sleep(ms);
 #else
     usleep(ms * 1000);
 #endif
 }
 
-/* History */
-static void save_history_line(const char *line) {
-    if (!line) return;
-    strncpy(cmd_history[hist_pos], line, sizeof(cmd_history[0]) - 1);
-    cmd_history[hist_pos][sizeof(cmd_history[0]) - 1] = '\0';
-    hist_pos = (hist_pos + 1) % CMD_HISTORY;
-    if (hist_size < CMD_HISTORY) hist_size++;
-}
-static void show_history() {
-    int i;
-    int start = (hist_pos - hist_size + CMD_HISTORY) % CMD_HISTORY;
-    for (i = 0; i < hist_size; ++i) {
-        int idx = (start + i) % CMD_HISTORY;
-        printf("%3d  %s\n", i+1, cmd_history[idx]);
-    }
-}
-
-/* VFS persistence - write/read entire vfs array for simplicity */
-static void vfs_save_state() {
-    FILE *f = fopen(VFS_STATE_FILE, "wb");
-    if (!f) return;
-    int files = FS_MAX_FILES;
-    fwrite(&files, sizeof(int), 1, f);
-    fwrite(vfs, sizeof(vfile_t), FS_MAX_FILES, f);
-    fclose(f);
-}
-
-static void vfs_load_state() {
-    FILE *f = fopen(VFS_STATE_FILE, "rb");
-    if (!f) return;
-    int files = 0;
-    if (fread(&files, sizeof(int), 1, f) != 1) { fclose(f); return; }
-    size_t got = fread(vfs, sizeof(vfile_t), FS_MAX_FILES, f);
-    (void)got;
-    fclose(f);
-}
-
-/* VFS */
-static void vfs_init() {
-    for (int i = 0; i < FS_MAX_FILES; ++i) {
-        vfs[i].used = 0;
-        vfs[i].name[0] = '\0';
-        vfs[i].content[0] = '\0';
-    }
-    vfs_load_state();
-    if (!vfs[0].used) {
-        strncpy(vfs[0].name, "welcome.txt", sizeof(vfs[0].name)-1);
-        strncpy(vfs[0].content, "Shreyas Systems - Shreyas' OS powering Shreyas INDUSTRIES.\n", sizeof(vfs[0].content)-1);
-        vfs[0].content[sizeof(vfs[0].content)-1] = '\0';
-        vfs[0].used = 1;
-    }
-}
-
-static vfile_t* vfs_find(const char* name) {
-    if (!name || name[0] == '\0') return NULL;
-    for (int i = 0; i < FS_MAX_FILES; ++i) {
-        if (vfs[i].used && strcmp(vfs[i].name, name) == 0) return &vfs[i];
-    }
-    return NULL;
-}
-
-static int vfs_create_slot() {
-    for (int i = 0; i < FS_MAX_FILES; ++i) if (!vfs[i].used) return i;
-    return -1;
-}
-
-static void vfs_list() {
-    printf("Files:\n");
-    for (int i = 0; i < FS_MAX_FILES; ++i) if (vfs[i].used) printf(" - %s\n", vfs[i].name);
-}
-
-static void vfs_write(const char* name, const char* data) {
-    if (!name || name[0]=='\0') return;
-    vfile_t* f = vfs_find(name);
-    if (!f) {
-        int idx = vfs_create_slot();
-        if (idx < 0) { printf("VFS full\n"); return; }
-        f = &vfs[idx];
-        memset(f,0,sizeof(*f));
-        strncpy(f->name, name, sizeof(f->name)-1);
-        f->name[sizeof(f->name)-1] = '\0';
-        f->used = 1;
-    }
-    if (data) {
-        strncpy(f->content, data, sizeof(f->content)-1);
-        f->content[sizeof(f->content)-1] = '\0';
-    } else f->content[0] = '\0';
-}
-
-static void vfs_append(const char* name, const char* data) {
-    if (!name) return;
-    vfile_t* f = vfs_find(name);
-    if (!f) { vfs_write(name, data); return; }
-    size_t cur = strlen(f->content);
-    size_t add = data ? strlen(data) : 0;
-    if (cur + add + 1 > sizeof(f->content)) add = (sizeof(f->content)-1) - cur;
-    if (add > 0) strncat(f->content, data, add);
-}
-
-static int vfs_remove(const char* name) {
-    vfile_t* f = vfs_find(name);
-    if (!f) return 0;
-    f->used = 0;
-    f->name[0] = '\0';
-    f->content[0] = '\0';
-    return 1;
-}
-
-/* tasks and scheduler */
-static void task_clock_builtin() {
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    printf("[clock] %02d:%02d:%02d\n", tm.tm_hour, tm.tm_min, tm.tm_sec);
-}
-
-static void task_heartbeat_builtin() {
-    static int hb = 0;
-    hb++;
-    if (hb % 5 == 0) printf("[heartbeat] system alive...\n");
-}
-
-static void task_logger_builtin() {
-    printf("[logger] simple logger tick\n");
-}
-
-static int find_free_task_slot() {
-    for (int i = 0; i < MAX_TASKS; ++i) if (tasks[i].id == 0) return i;
-    for (int i = 0; i < MAX_TASKS; ++i) if (!tasks[i].active) return i;
-    return -1;
-}
-
-static int spawn_builtin(const char* name, builtin_fn fn) {
-    if (task_count >= MAX_TASKS) return 0;
-    int idx = find_free_task_slot();
-    if (idx == -1) return 0;
-    tasks[idx].id = next_task_id++;
-    strncpy(tasks[idx].name, name, sizeof(tasks[idx].name)-1);
-    tasks[idx].name[sizeof(tasks[idx].name)-1] = '\0';
-    tasks[idx].type = 0;
-    tasks[idx].fn = fn;
-    tasks[idx].msg[0] = '\0';
-    tasks[idx].interval = 0;
-    tasks[idx].ticks = 0;
-    tasks[idx].active = 1;
-    task_count++;
-    return tasks[idx].id;
-}
-
-static int spawn_message_task(const char* name, unsigned interval, const char* message) {
-    if (task_count >= MAX_TASKS) return 0;
-    int idx = find_free_task_slot();
-    if (idx == -1) return 0;
-    tasks[idx].id = next_task_id++;
-    strncpy(tasks[idx].name, name, sizeof(tasks[idx].name)-1);
-    tasks[idx].name[sizeof(tasks[idx].name)-1] = '\0';
-    tasks[idx].type = 1;
-    tasks[idx].fn = NULL;
-    strncpy(tasks[idx].msg, message ? message : "", sizeof(tasks[idx].msg)-1);
-    tasks[idx].msg[sizeof(tasks[idx].msg)-1] = '\0';
-    if (interval == 0) interval = 1;
-    tasks[idx].interval = interval;
-    tasks[idx].ticks = 0;
-    tasks[idx].active = 1;
-    task_count++;
-    return tasks[idx].id;
-}
-
-static task_t* task_find_by_id(int id) {
-    for (int i = 0; i < MAX_TASKS; ++i) if (tasks[i].id == id) return &tasks[i];
-    return NULL;
-}
-
-static void scheduler_tick() {
-    for (int i = 0; i < MAX_TASKS; ++i) {
-        if (tasks[i].id == 0 || !tasks[i].active) continue;
-        tasks[i].ticks++;
-        if (tasks[i].type == 0 && tasks[i].fn) tasks[i].fn();
-        else if (tasks[i].type == 1) {
-            if (tasks[i].interval > 0 && (tasks[i].ticks % tasks[i].interval) == 0) {
-                printf("[task %d: %s] %s\n", tasks[i].id, tasks[i].name, tasks[i].msg);
-            }
-        }
-    }
-}
-
-/* utilities prototypes */
-static void show_help();
-static void show_ps();
-static void kill_task(int id);
-static void suspend_task(int id);
-static void resume_task(int id);
-static void show_uptime();
-static void power_button_ui();
-static void clear_screen();
-static void read_line(char* buf, size_t sz);
-static void cmd_edit(const char* filename);
-static void export_to_disk(const char* diskfile, const char* vfsfile);
-static void import_from_disk(const char* vfsfile, const char* diskfile);
-static void show_ips();
-static void compile_file(const char* filename);
-static void run_command(const char* cmdrest);
-
-/* minimal sysinfo */
-static void cmd_sysinfo() {
+/* Helper: monotonic clock in microseconds */
+static unsigned long long now_us() {
 #ifdef _WIN32
-    SYSTEM_INFO si;
-    GetSystemInfo(&si);
-    printf("CPU cores (Logical): %u\n", si.dwNumberOfProcessors);
-    MEMORYSTATUSEX ms; ms.dwLength = sizeof(ms);
-    GlobalMemoryStatusEx(&ms);
-    printf("Memory: %llu MB total, %llu MB available\n", (unsigned long long)(ms.ullTotalPhys/1024/1024), (unsigned long long)(ms.ullAvailPhys/1024/1024));
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (unsigned long long)(cnt.QuadPart / freq.QuadPart) * 1000000ULL
+         + (unsigned long long)(cnt.QuadPart % freq.QuadPart) * 1000000ULL / (unsigned long long)freq.QuadPart;
 #else
-    long cores = sysconf(_SC_NPROCESSORS_ONLN);
-    printf("CPU cores (Logical): %ld\n", cores);
-    long pages = sysconf(_SC_PHYS_PAGES);
-    long page_size = sysconf(_SC_PAGE_SIZE);
-    if (pages > 0 && page_size > 0) {
-        unsigned long long total = (unsigned long long)pages * (unsigned long long)page_size;
-        printf("Memory approx: %llu MB\n", (unsigned long long)(total / 1024 / 1024));
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
 #endif
-    show_uptime();
 }
 
-/* calendar - simple textual month calendar */
-static void cmd_cal(int year, int month) {
-    if (month < 1 || month > 12) { printf("Invalid month\n"); return; }
-    struct tm tm = {0};
-    tm.tm_mday = 1;
-    tm.tm_mon = month - 1;
-    tm.tm_year = year - 1900;
-    mktime(&tm);
-    int start_wday = tm.tm_wday; /* 0=Sun */
-    int mdays;
-    if (month==2) {
-        int y = year;
-        int leap = ( (y%4==0 && y%100!=0) || (y%400==0) );
-        mdays = leap ? 29 : 28;
-    } else if (month==4 || month==6 || month==9 || month==11) mdays = 30;
-    else mdays = 31;
-    printf("     %d-%02d\n", year, month);
-    printf("Su Mo Tu We Th Fr Sa\n");
-    int day = 1;
-    for (int i = 0; i < start_wday; ++i) printf("   ");
-    for (int i = start_wday; i < 7; ++i) {
-        printf("%2d ", day++);
-    }
-    printf("\n");
-    while (day <= mdays) {
-        for (int i = 0; i < 7 && day <= mdays; ++i) {
-            printf("%2d ", day++);
-        }
-        printf("\n");
-    }
-}
-
-/* whoami/hostname/date */
-static void cmd_whoami() { printf("%s\n", env_USER); }
-static void cmd_hostname() { printf("%s\n", env_HOSTNAME); }
-static void cmd_date() {
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    char buf[128];
-    strftime(buf, sizeof(buf), "%a %b %d %H:%M:%S %Y", &tm);
-    printf("%s\n", buf);
-}
-
-/* show uptime */
-static void show_uptime() {
-    time_t now = time(NULL);
-    long diff = (long)difftime(now, start_time);
-    int days = diff / (24*3600);
-    int hours = (diff % (24*3600)) / 3600;
-    int mins = (diff % 3600) / 60;
-    int secs = diff % 60;
-    printf("Uptime: %d days, %02d:%02d:%02d\n", days, hours, mins, secs);
-}
-
-/* power UI */
-static void power_button_ui() {
-    printf("\n+-----------------------+\n");
-    printf("|       [ POWER ]       |\n");
-    printf("+-----------------------+\n");
-    printf("Press 'p' then Enter to power off, or just press Enter to cancel: ");
-    char buf[16];
-    if (!fgets(buf, sizeof(buf), stdin)) return;
-    if (buf[0] == 'p' || buf[0] == 'P') {
-        printf("Power button pressed. Shutting down Shreyas OS...\n");
-        vfs_save_state();
-        running = 0;
-    } else printf("Power cancelled.\n");
-}
-
-/* clear */
-static void clear_screen() {
+/* Helper: monotonic clock in nanoseconds, for per-command latencies */
+static unsigned long long now_ns() {
 #ifdef _WIN32
-    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hOut == INVALID_HANDLE_VALUE) { printf("\n"); return; }
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(hOut, &csbi)) { system("cls"); return; }
-    DWORD cellCount = csbi.dwSize.X * csbi.dwSize.Y;
-    COORD homeCoords = {0,0};
-    DWORD count;
-    FillConsoleOutputCharacter(hOut, ' ', cellCount, homeCoords, &count);
-    SetConsoleCursorPosition(hOut, homeCoords);
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (unsigned long long)(cnt.QuadPart / freq.QuadPart) * 1000000000ULL
+         + (unsigned long long)(cnt.QuadPart % freq.QuadPart) * 1000000000ULL / (unsigned long long)freq.QuadPart;
 #else
-    printf("\x1b[2J\x1b[H");
-    fflush(stdout);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
 #endif
 }
 
-/* read line safe */
-static void read_line(char* buf, size_t sz) {
-    if (!fgets(buf, (int)sz, stdin)) { buf[0] = '\0'; return; }
-    buf[strcspn(buf, "\n")] = '\0';
+/* Helper: wall clock in microseconds since the epoch */
+static unsigned long long wall_us() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
 }
 
-/* editor */
-static void cmd_edit(const char* filename) {
-    if (!filename || filename[0]=='\0') { printf("Usage: edit <file>\n"); return; }
-    vfile_t* f = vfs_find(filename);
-    char buffer[FS_MAX_CONTENT];
-    if (f) strncpy(buffer, f->content, sizeof(buffer)-1); else buffer[0] = '\0';
-    printf("Entering editor for '%s'. Type a single dot '.' on a line to finish.\n", filename);
-    printf("Current content:\n----\n%s\n----\n", buffer);
-    char line[512];
-    size_t pos = 0;
-    buffer[0] = '\0';
-    while (1) {
-        if (!fgets(line, sizeof(line), stdin)) break;
-        if (strcmp(line, ".\n") == 0 || strcmp(line, ".\r\n") == 0 || (line[0]=='.' && line[1]=='\0')) break;
-        size_t add = strlen(line);
-        if (pos + add + 1 >= sizeof(buffer)) add = (sizeof(buffer)-1) - pos;
-        if (add > 0) {
-            strncat(buffer, line, add);
-            pos += add;
-        }
-        if (pos >= sizeof(buffer)-1) break;
-    }
-    vfs_write(filename, buffer);
-    printf("Saved '%s' (%zu bytes)\n", filename, strlen(buffer));
-}
+/* boot profile - time spent in each startup phase of the last (re)boot */
+#define BOOT_MAX_PHASES 8
+static struct { const char* phase; unsigned long long us; } boot_prof[BOOT_MAX_PHASES];
+static int boot_prof_n = 0;
+static unsigned long long boot_total_us = 0;
 
-/* import/export */
-static void export_to_disk(const char* diskfile, const char* vfsfile) {
-    if (!diskfile || !vfsfile) { printf("Usage: export <file_on_disk> <vfs_file>\n"); return; }
-    vfile_t* f = vfs_find(vfsfile);
-    if (!f) { printf("VFS file not found: %s\n", vfsfile); return; }
-    FILE* fp = fopen(diskfile, "wb");
-    if (!fp) { printf("Failed to open disk file for writing: %s\n", diskfile); return; }
-    fwrite(f->content, 1, strlen(f->content), fp);
-    fclose(fp);
-    printf("Exported %s -> %s\n", vfsfile, diskfile);
+static void show_boot_profile() {
+    if (boot_prof_n == 0) { sos_printf("No boot profile recorded\n"); return; }
+    sos_printf("Boot profile (%s boot):\n", fast_boot ? "fast" : "animated");
+    for (int i = 0; i < boot_prof_n; ++i)
+        sos_printf("  %-16s %10.3f ms\n", boot_prof[i].phase, boot_prof[i].us / 1000.0);
+    sos_printf("  %-16s %10.3f ms\n", "total", boot_total_us / 1000.0);
 }
 
-static void import_from_disk(const char* vfsfile, const char* diskfile) {
-    if (!diskfile || !vfsfile) { printf("Usage: import <vfs_file> <file_on_disk>\n"); return; }
-    FILE* fp = fopen(diskfile, "rb");
-    if (!fp) { printf("Failed to open disk file: %s\n", diskfile); return; }
-    char buf[FS_MAX_CONTENT];
-    size_t n = fread(buf, 1, sizeof(buf)-1, fp);
-    buf[n] = '\0';
-    fclose(fp);
-    vfs_write(vfsfile, buf);
-    printf("Imported %s -> %s (%zu bytes)\n", diskfile, vfsfile, n);
+static void print_sync_info(const char* what, const sos_sync_info_t* in) {
+    sos_printf("%s: %u files checked, %u updated, %u removed, %llu bytes sent, %llu bytes reused, %llu mutations\n",
+               what, in->files, in->updated, in->removed, in->literal_bytes, in->matched_bytes, in->mutations);
 }
 
-/* IP display (no packet manipulation) */
-static void show_ips() {
-#ifdef _WIN32
-    WSADATA wsa;
-    if (WSAStartup(MAKEWORD(2,2), &wsa) != 0) { printf("WSAStartup failed\n"); return; }
-    char name[256];
-    if (gethostname(name, sizeof(name)) == SOCKET_ERROR) { printf("Unable to get host name\n"); WSACleanup(); return; }
-    struct hostent *he = gethostbyname(name);
-    if (!he) { printf("gethostbyname failed\n"); WSACleanup(); return; }
-    printf("Local IPv4 addresses:\n");
-    char **addr_list = he->h_addr_list;
-    for (int i = 0; addr_list[i] != NULL; ++i) {
-        struct in_addr addr;
-        memcpy(&addr.s_addr, addr_list[i], sizeof(addr.s_addr));
-        printf(" - %s\n", inet_ntoa(addr));
+/* sync [-f] <host:port|socket> | sync stop | sync */
+static void sync_command(sos_ctx_t* ctx, const char* args) {
+    sos_sync_info_t in;
+    if (strcmp(args, "stop") == 0) { sos_sync_stop(); sos_printf("Replication stopped\n"); return; }
+    if (args[0] == '\0') {
+        sos_sync_status(&in);
+        print_sync_info(in.following ? "Following" : "Last sync", &in);
+        return;
     }
-    WSACleanup();
-#else
-    struct ifaddrs *ifaddr, *ifa;
-    if (getifaddrs(&ifaddr) == -1) { printf("getifaddrs failed\n"); return; }
-    printf("Local IP addresses:\n");
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        if (!ifa->ifa_addr) continue;
-        if (ifa->ifa_addr->sa_family == AF_INET) {
-            char host[NI_MAXHOST];
-            int s = getnameinfo(ifa->ifa_addr, sizeof(struct sockaddr_in), host, NI_MAXHOST, NULL, 0, NI_NUMERICSERV);
-            if (s == 0) printf(" - %s: %s\n", ifa->ifa_name, host);
-        }
-    }
-    freeifaddrs(ifaddr);
-#endif
-    printf("Note: This command only displays local addresses. Manipulating live packets is not provided.\n");
-}
-
-/* compile/run from VFS */
-static void compile_file(const char* filename) {
-    if (!filename || filename[0]=='\0') { printf("Usage: compile <file.c>\n"); return; }
-    vfile_t* f = vfs_find(filename);
-    if (!f) { printf("File not found in VFS: %s\n", filename); return; }
-    char tmpdisk[256], outfile[256];
-    time_t t = time(NULL);
-    snprintf(tmpdisk, sizeof(tmpdisk), "shreyas_tmp_%ld.c", (long)t);
-#ifdef _WIN32
-    snprintf(outfile, sizeof(outfile), "shreyas_out_%ld.exe", (long)t);
-#else
-    snprintf(outfile, sizeof(outfile), "shreyas_out_%ld", (long)t);
-#endif
-    FILE* fp = fopen(tmpdisk, "wb");
-    if (!fp) { printf("Failed to create temp file %s\n", tmpdisk); return; }
-    fwrite(f->content, 1, strlen(f->content), fp);
-    fclose(fp);
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd), "gcc \"%s\" -o \"%s\" 2> shreyas_compile_err.txt", tmpdisk, outfile);
-    int rc = system(cmd);
-    FILE* errf = fopen("shreyas_compile_err.txt", "rb");
-    if (errf) {
-        char errbuf[4096];
-        size_t n = fread(errbuf,1,sizeof(errbuf)-1,errf);
-        errbuf[n] = '\0';
-        fclose(errf);
-        if (n > 0) printf("Compiler output:\n%s\n", errbuf);
-        else printf("Compiled successfully to %s\n", outfile);
-    } else {
-        if (rc == 0) printf("Compiled successfully to %s\n", outfile);
-        else printf("Compile finished with code %d\n", rc);
-    }
-    printf("Temporary source: %s\n", tmpdisk);
-}
-
-static void run_command(const char* cmdrest) {
-    if (!cmdrest || cmdrest[0]=='\0') { printf("Usage: run <command>\n"); return; }
-    printf("Running command: %s\n", cmdrest);
-    int rc = system(cmdrest);
-    printf("Command exited with code %d\n", rc);
-}
-
-/* core help/man */
-static void show_help() {
-    printf("\x1b[36mShreyas OS - Command Reference (short)\x1b[0m\n");
-    printf("  help                                - show this help menu\n");
-    printf("  ls                                  - list all files in virtual FS\n");
-    printf("  cat <file>                          - display contents of a file\n");
-    printf("  write <file> <text>                 - create/overwrite a file with text\n");
-    printf("  append <file> <text>                - append text to a file\n");
-    printf("  touch <file>                        - create an empty file\n");
-    printf("  rm <file>                           - delete a file\n");
-    printf("  edit <file>                         - interactively edit a file\n");
-    printf("  spawn <builtin>                     - start builtin task (clock, heartbeat, logger)\n");
-    printf("  addtask <name> <interval> <message> - create repeating message task\n");
-    printf("  ps                                  - list running tasks\n");
-    printf("  killtask <id>                       - terminate a task by id\n");
-    printf("  suspend <id>                        - suspend a task\n");
-    printf("  resume <id>                         - resume a suspended task\n");
-    printf("  uptime                              - show system uptime\n");
-    printf("  poweroff                            - shutdown the OS (saves state)\n");
-    printf("  reboot                              - reboot the OS\n");
-    printf("  powerbtn                            - emulate pressing power button\n");
-    printf("  clear                               - clear the terminal screen\n");
-    printf("  echo <text>                         - print text to console\n");
-    printf("  version                             - show OS version\n");
-    printf("  compile <file>                      - compile C source file in VFS\n");
-    printf("  run <command>                       - run a system command\n");
-    printf("  ip                                  - display local IP addresses\n");
-    printf("  export <file_on_disk> <vfs_file>    - save a VFS file to disk\n");
-    printf("  import <vfs_file> <file_on_disk>    - load a file from disk into VFS\n");
-    printf("  date                                - show date/time\n");
-    printf("  cal [month] [year]                  - show calendar for month/year\n");
-    printf("  sysinfo                             - show basic CPU/memory/uptime\n");
-    printf("  whoami                              - display current user\n");
-    printf("  hostname                            - display hostname\n");
-    printf("  history                             - show command history\n");
-    printf("  !!                                   - repeat last command\n");
-    printf("  man <cmd>                           - short manual for command\n");
+    int follow = strncmp(args, "-f ", 3) == 0;
+    const char* target = follow ? args + 3 + strspn(args + 3, " ") : args;
+    if (sos_sync(ctx, target, follow, &in) != 0) { sos_printf("Sync from %s failed\n", target); return; }
+    print_sync_info(follow ? "Synced, now following" : "Synced", &in);
+}
+
+/* Session traces. --record FILE logs the login name and every command
+   line with its offset from the start of the recording, and copies the
+   VFS state it starts from to FILE.vfs. --replay FILE runs the lines
+   again on an instance made from a copy of that state, with the virtual
+   clock at each line's recorded time, as fast as possible or at --speed
+   N times the recorded pace, and reports commands/sec and latency
+   percentiles per command. Lines typed into interactive commands (edit,
+   powerbtn) are not recorded; during a replay those commands see end of
+   input. Format: "#sos-trace 1 <start, us since the epoch>", then one
+   "<offset us> <L|C> <text>" line per login name (L) or command (C). */
+#define TRACE_MAGIC "#sos-trace 1"
+#define REPLAY_GROUPS 64
+
+static FILE* trace_out;
+static unsigned long long trace_t0;
+
+static int copy_file(const char* from, const char* to) {
+    FILE* in = fopen(from, "rb");
+    if (!in) return -1;
+    FILE* out = fopen(to, "wb");
+    if (!out) { fclose(in); return -1; }
+    char buf[65536];
+    size_t n;
+    int ok = 1;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) ok &= fwrite(buf, 1, n, out) == n;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+static int trace_open(const char* path) {
+    char snap[512];
+    snprintf(snap, sizeof(snap), "%s.vfs", path);
+    remove(snap);
+    copy_file(VFS_STATE_FILE, snap);    /* no state file: the replay starts empty too */
+    trace_out = fopen(path, "w");
+    if (!trace_out) return -1;
+    trace_t0 = now_us();
+    fprintf(trace_out, "%s %llu\n", TRACE_MAGIC, wall_us());
+    fflush(trace_out);
+    return 0;
 }
 
-/* man pages (short) */
-static void cmd_man(const char* cmd) {
-    if (!cmd || cmd[0] == '\0') { printf("Usage: man <cmd>\n"); return; }
-    if (strcmp(cmd, "ls")==0) printf("ls: list files in virtual filesystem\n");
-    else if (strcmp(cmd, "cat")==0) printf("cat <file>: print file contents\n");
-    else if (strcmp(cmd, "write")==0) printf("write <file> <text>: create/overwrite file\n");
-    else if (strcmp(cmd, "compile")==0) printf("compile <file>: compile C source inside VFS using system gcc\n");
-    else printf("No manual entry for %s\n", cmd);
+static void trace_line(char kind, const char* text) {
+    if (!trace_out) return;
+    fprintf(trace_out, "%llu %c %s\n", now_us() - trace_t0, kind, text);
+    fflush(trace_out);
 }
 
-/* ps/kill/suspend/resume */
-static void show_ps() {
-    printf("Tasks (max %d):\n", MAX_TASKS);
-    for (int i = 0; i < MAX_TASKS; ++i) {
-        if (tasks[i].id != 0) {
-            printf(" ID=%d | %-12s | type=%s | ticks=%u | interval=%u | %s\n",
-                   tasks[i].id,
-                   tasks[i].name,
-                   (tasks[i].type == 0) ? "builtin" : "message",
-                   tasks[i].ticks,
-                   tasks[i].interval,
-                   tasks[i].active ? "active" : "suspended");
-        }
+/* commands that belong to the front end rather than the core */
+static int shell_command_hook(sos_ctx_t* ctx, const char* cmd, const char* args, void* user) {
+    (void)user;
+    if (strcmp(cmd, "bootprof") == 0) { show_boot_profile(); return 1; }
+    if (strcmp(cmd, "fastboot") == 0) {
+        if (strncmp(args, "on", 2) == 0) fast_boot = 1;
+        else if (strncmp(args, "off", 3) == 0) fast_boot = 0;
+        else if (args[0] != '\0') { sos_printf("Usage: fastboot [on|off]\n"); return 1; }
+        sos_printf("Fast boot is %s\n", fast_boot ? "on" : "off");
+        return 1;
     }
-}
-
-static void kill_task(int id) {
-    for (int i = 0; i < MAX_TASKS; ++i) {
-        if (tasks[i].id == id) {
-            tasks[i].active = 0;
-            tasks[i].id = 0;
-            tasks[i].name[0] = '\0';
-            tasks[i].msg[0] = '\0';
-            tasks[i].fn = NULL;
-            tasks[i].ticks = 0;
-            task_count--;
-            printf("Task %d removed.\n", id);
-            return;
-        }
+    if (strcmp(cmd, "sync") == 0) { sync_command(ctx, args); return 1; }
+    if (strcmp(cmd, "httpd") == 0) {
+        if (strcmp(args, "stop") == 0) sos_http_stop();
+        else if (args[0] >= '0' && args[0] <= '9') {
+            if (sos_http_start(ctx, atoi(args)) != 0) { sos_printf("Cannot start the HTTP server on port %s\n", args); return 1; }
+        } else if (args[0] != '\0') { sos_printf("Usage: httpd [PORT|stop]\n"); return 1; }
+        if (sos_http_port()) sos_printf("Serving http://127.0.0.1:%d/vfs/\n", sos_http_port());
+        else sos_printf("HTTP server is stopped\n");
+        return 1;
     }
-    printf("Task %d not found.\n", id);
+    return 0;
 }
 
-static void suspend_task(int id) {
-    task_t* t = task_find_by_id(id);
-    if (!t) { printf("Task %d not found.\n", id); return; }
-    t->active = 0;
-    printf("Task %d suspended.\n", id);
+/* read line safe */
+static void read_line(char* buf, size_t sz) {
+    if (!fgets(buf, (int)sz, stdin)) { buf[0] = '\0'; return; }
+    buf[strcspn(buf, "\n")] = '\0';
 }
 
-static void resume_task(int id) {
-    task_t* t = task_find_by_id(id);
-    if (!t) { printf("Task %d not found.\n", id); return; }
-    t->active = 1;
-    printf("Task %d resumed.\n", id);
-}
+#ifndef _WIN32
+/* Ctrl-C during a command stops its scripts; at the prompt, or pressed
+   again, it ends the shell as before */
+static volatile sig_atomic_t in_command;    /* 0 at the prompt, 1 running, 2 interrupted */
 
-/* scheduler wrapper */
-static void scheduler_tick_wrapper() { scheduler_tick(); }
+static void on_sigint(int sig) {
+    if (in_command == 1) { in_command = 2; sos_interrupt(os); return; }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+#endif
 
 /* Enable ANSI for Windows - safe */
 static void enable_ansi_on_windows() {
@@ -630,9 +208,18 @@ static void enable_ansi_on_windows() {
 #endif
 }
 
+static void clear_screen() {
+    printf("\x1b[2J\x1b[H");
+    fflush(stdout);
+}
+
 /* print futuristic boot - uses sleep_ms rather than nanosleep for portability */
 static void print_futuristic_boot() {
     enable_ansi_on_windows();
+    if (fast_boot) {
+        printf("\x1b[36mShreyas Systems\x1b[0m \x1b[90m(fast boot)\x1b[0m\n");
+        return;
+    }
     clear_screen();
     printf("\x1b[36m"); /* cyan */
     printf("  ____  _  _  _  _  _____  _   _  _   _  ____  __  __\n");
@@ -676,94 +263,33 @@ static void print_futuristic_boot() {
 
 /* prompt builder */
 static void build_prompt(char *out, size_t outsz) {
-    time_t t = time(NULL);
+    time_t t = (time_t)sos_time(os);
     struct tm tm = *localtime(&t);
-    snprintf(out, outsz, "\x1b[36m[%s@%s %02d:%02d:%02d]\x1b[0m$ ", env_USER, env_HOSTNAME, tm.tm_hour, tm.tm_min, tm.tm_sec);
-}
-
-/* shell executor */
-static void shell_execute(const char* line) {
-    if (!line) return;
-    char cmd[128] = {0};
-    char a1[512] = {0};
-    char a2[1536] = {0};
-    sscanf(line, "%127s %511s %1535[^\n]", cmd, a1, a2);
-    if (strcmp(cmd, "help") == 0) show_help();
-    else if (strcmp(cmd, "ls") == 0) vfs_list();
-    else if (strcmp(cmd, "cat") == 0) {
-        if (a1[0]=='\0') printf("Usage: cat <file>\n");
-        else { vfile_t* f = vfs_find(a1); if (f) printf("%s\n", f->content); else printf("File not found: %s\n", a1); }
-    }
-    else if (strcmp(cmd, "write") == 0) {
-        if (a1[0] == '\0' || a2[0] == '\0') printf("Usage: write <file> <text>\n");
-        else { vfs_write(a1, a2); printf("Written to %s\n", a1); }
-    }
-    else if (strcmp(cmd, "append") == 0) {
-        if (a1[0] == '\0' || a2[0] == '\0') printf("Usage: append <file> <text>\n");
-        else { vfs_append(a1, a2); printf("Appended to %s\n", a1); }
-    }
-    else if (strcmp(cmd, "touch") == 0) {
-        if (a1[0] == '\0') printf("Usage: touch <file>\n");
-        else { vfs_write(a1, ""); printf("Touched %s\n", a1); }
-    }
-    else if (strcmp(cmd, "rm") == 0) {
-        if (a1[0] == '\0') printf("Usage: rm <file>\n");
-        else { if (vfs_remove(a1)) printf("Removed %s\n", a1); else printf("File not found: %s\n", a1); }
-    }
-    else if (strcmp(cmd, "spawn") == 0) {
-        if (strcmp(a1, "clock")==0) { int id = spawn_builtin("clock", task_clock_builtin); if (id) printf("Spawned clock (id=%d)\n", id); else printf("Failed to spawn\n"); }
-        else if (strcmp(a1, "heartbeat")==0) { int id = spawn_builtin("heartbeat", task_heartbeat_builtin); if (id) printf("Spawned heartbeat (id=%d)\n", id); else printf("Failed to spawn\n"); }
-        else if (strcmp(a1, "logger")==0) { int id = spawn_builtin("logger", task_logger_builtin); if (id) printf("Spawned logger (id=%d)\n", id); else printf("Failed to spawn\n"); }
-        else printf("Unknown builtin: %s\n", a1);
-    }
-    else if (strcmp(cmd, "addtask") == 0) {
-        char name[MAX_NAME] = {0}; unsigned interval = 1; char msg[MAX_MSG] = {0};
-        if (sscanf(line, "%*s %63s %u %511[^\n]", name, &interval, msg) >= 2) {
-            if (name[0] == '\0' || msg[0] == '\0') printf("Usage: addtask <name> <interval> <message>\n");
-            else { int id = spawn_message_task(name, interval, msg); if (id) printf("Added message task '%s' id=%d interval=%u\n", name, id, interval); else printf("Task limit reached.\n"); }
-        } else printf("Usage: addtask <name> <interval> <message>\n");
-    }
-    else if (strcmp(cmd, "ps") == 0) show_ps();
-    else if (strcmp(cmd, "killtask") == 0) { int id = atoi(a1); if (id<=0) printf("Usage: killtask <id>\n"); else kill_task(id); }
-    else if (strcmp(cmd, "suspend") == 0) { int id = atoi(a1); if (id<=0) printf("Usage: suspend <id>\n"); else suspend_task(id); }
-    else if (strcmp(cmd, "resume") == 0) { int id = atoi(a1); if (id<=0) printf("Usage: resume <id>\n"); else resume_task(id); }
-    else if (strcmp(cmd, "uptime")==0) show_uptime();
-    else if (strcmp(cmd, "poweroff")==0) { printf("Shutting down Shreyas OS...\n"); vfs_save_state(); running = 0; }
-    else if (strcmp(cmd, "reboot")==0) { printf("Rebooting Shreyas OS...\n"); vfs_save_state(); /* simple reboot: restart main loop by exit flag */ running = 2; }
-    else if (strcmp(cmd, "powerbtn")==0) power_button_ui();
-    else if (strcmp(cmd, "clear")==0) clear_screen();
-    else if (strcmp(cmd, "echo")==0) { if (a1[0]=='\0') printf("\n"); else { if (a2[0] != '\0') printf("%s %s\n", a1, a2); else printf("%s\n", a1); } }
-    else if (strcmp(cmd, "version")==0) printf("Shreyas OS Enhanced v2.0 - Stark Kernel CLI\n");
-    else if (strcmp(cmd, "edit")==0) cmd_edit(a1);
-    else if (strcmp(cmd, "compile")==0) compile_file(a1);
-    else if (strcmp(cmd, "run")==0) { if (a1[0]=='\0') run_command(a2); else { char cmdbuf[2048]; if (a2[0] != '\0') snprintf(cmdbuf, sizeof(cmdbuf), "%s %s", a1, a2); else snprintf(cmdbuf, sizeof(cmdbuf), "%s", a1); run_command(cmdbuf); } }
-    else if (strcmp(cmd, "ip")==0) show_ips();
-    else if (strcmp(cmd, "export")==0) { if (a1[0] && a2[0]) export_to_disk(a1,a2); else printf("Usage: export <file_on_disk> <vfs_file>\n"); }
-    else if (strcmp(cmd, "import")==0) { if (a1[0] && a2[0]) import_from_disk(a1,a2); else printf("Usage: import <vfs_file> <file_on_disk>\n"); }
-    else if (strcmp(cmd, "date")==0) cmd_date();
-    else if (strcmp(cmd, "cal")==0) {
-        int m = 0, y = 0;
-        if (a1[0]=='\0') { time_t t = time(NULL); struct tm tm = *localtime(&t); m = tm.tm_mon+1; y = tm.tm_year+1900; }
-        else if (sscanf(a1, "%d", &m)==1) { if (a2[0]=='\0') { time_t t = time(NULL); struct tm tm = *localtime(&t); y = tm.tm_year+1900; } else sscanf(a2, "%d", &y); }
-        cmd_cal(y, m);
-    }
-    else if (strcmp(cmd, "sysinfo")==0) cmd_sysinfo();
-    else if (strcmp(cmd, "whoami")==0) cmd_whoami();
-    else if (strcmp(cmd, "hostname")==0) cmd_hostname();
-    else if (strcmp(cmd, "history")==0) show_history();
-    else if (strcmp(cmd, "!!")==0) {
-        if (hist_size==0) printf("No history\n");
-        else {
-            int last = (hist_pos - 1 + CMD_HISTORY) % CMD_HISTORY;
-            char tmp[1024]; strncpy(tmp, cmd_history[last], sizeof(tmp)-1);
-            printf("Repeating: %s\n", tmp);
-            shell_execute(tmp);
-        }
+    snprintf(out, outsz, "\x1b[36m[%s@%s %02d:%02d:%02d]\x1b[0m$ ",
+             sos_getenv(os, "USER"), sos_getenv(os, "HOSTNAME"), tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/* at a terminal, runs watch reactions to changes made while the prompt
+   waits (HTTP, replication, jobs) instead of after the next command. A
+   terminal hands over one line per read, so stdio holds nothing unread
+   when this polls. */
+static void wait_for_line(char* prompt, size_t sz) {
+#ifndef _WIN32
+    int wfd = sos_watch_fd(os);
+    if (wfd < 0 || !isatty(STDIN_FILENO)) return;
+    for (;;) {
+        struct pollfd pf[2] = { { STDIN_FILENO, POLLIN, 0 }, { wfd, POLLIN, 0 } };
+        if (poll(pf, 2, -1) < 0 || pf[0].revents || !pf[1].revents) return;
+        printf("\n");
+        sos_tick(os);
+        build_prompt(prompt, sz);
+        printf("%s", prompt);
+        fflush(stdout);
     }
-    else if (strcmp(cmd, "man")==0) cmd_man(a1);
-    else if (strcmp(cmd, "")==0) { /* ignore */ }
-    else printf("Unknown command: %s. Try 'help'.\n", cmd);
-    scheduler_tick_wrapper();
+#else
+    (void)prompt;
+    (void)sz;
+#endif
 }
 
 /* login */
@@ -772,9 +298,10 @@ static void login_sequence() {
     printf("\x1b[96mShreyas Systems Login\x1b[0m\n");
     printf("login: ");
     fflush(stdout);
-    if (!fgets(user, sizeof(user), stdin)) { strcpy(env_USER, "Tony"); return; }
+    if (!fgets(user, sizeof(user), stdin)) { sos_setenv(os, "USER", "Tony"); return; }
     user[strcspn(user, "\n")] = '\0';
-    if (user[0] != '\0') strncpy(env_USER, user, sizeof(env_USER)-1);
+    if (user[0] != '\0') sos_setenv(os, "USER", user);
+    trace_line('L', user);     /* never the password */
     printf("Password: ");
 #ifdef _WIN32
     /* no echo on Windows */
@@ -786,57 +313,282 @@ static void login_sequence() {
     if (!fgets(pass, sizeof(pass), stdin)) pass[0] = '\0';
     SetConsoleMode(h, mode);
 #else
-    system("stty -echo");
+    /* toggle echo with termios directly rather than forking stty twice */
+    struct termios saved;
+    int tty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (tty) {
+        struct termios noecho = saved;
+        noecho.c_lflag &= ~(tcflag_t)ECHO;
+        tcsetattr(STDIN_FILENO, TCSANOW, &noecho);
+    }
     char pass[128];
     if (!fgets(pass, sizeof(pass), stdin)) pass[0] = '\0';
-    system("stty echo");
+    if (tty) tcsetattr(STDIN_FILENO, TCSANOW, &saved);
 #endif
-    printf("\nWelcome %s.\n", env_USER);
+    printf("\nWelcome %s.\n", sos_getenv(os, "USER"));
 }
 
-/* tiny hostname detection */
-static void detect_hostname() {
-#ifdef _WIN32
-    char name[128];
-    if (gethostname(name, sizeof(name)) == 0) strncpy(env_HOSTNAME, name, sizeof(env_HOSTNAME)-1);
-#else
-    struct utsname un;
-    if (uname(&un) == 0) strncpy(env_HOSTNAME, un.nodename, sizeof(env_HOSTNAME)-1);
+/* cold boot creates the instance; reboot reloads its VFS from disk */
+static void vfs_boot() {
+    if (os) { sos_vfs_reload(os); return; }
+    os = sos_create(VFS_STATE_FILE);
+    if (!os) { fprintf(stderr, "Out of memory\n"); exit(1); }
+    sos_set_command_hook(os, shell_command_hook, NULL);
+}
+
+static void spawn_default_tasks() {
+    sos_task_spawn_builtin(os, "clock");
+    sos_task_spawn_builtin(os, "heartbeat");
+}
+
+static void boot_step(const char* phase, void (*fn)(void)) {
+    unsigned long long t0 = now_us();
+    fn();
+    if (boot_prof_n < BOOT_MAX_PHASES) {
+        boot_prof[boot_prof_n].phase = phase;
+        boot_prof[boot_prof_n].us = now_us() - t0;
+        boot_prof_n++;
+    }
+}
+
+static void detect_hostname() { sos_detect_hostname(os); }
+
+/* cold boot and reboot; the login step only runs on cold boot */
+static void boot_system(int with_login) {
+    unsigned long long t0 = now_us();
+    boot_prof_n = 0;
+    boot_step("boot screen", print_futuristic_boot);
+    boot_step("vfs_init", vfs_boot);
+    boot_step("detect_hostname", detect_hostname);
+    if (with_login) boot_step("login", login_sequence);
+    boot_step("task spawn", spawn_default_tasks);
+    boot_total_us = now_us() - t0;
+}
+
+typedef struct {
+    char name[16];
+    unsigned long long* ns;
+    size_t n, cap;
+} replay_group_t;
+
+static int cmp_ull(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void group_add(replay_group_t* g, unsigned long long ns) {
+    if (g->n == g->cap) {
+        size_t cap = g->cap ? g->cap * 2 : 256;
+        unsigned long long* p = realloc(g->ns, cap * sizeof(*p));
+        if (!p) return;
+        g->ns = p;
+        g->cap = cap;
+    }
+    g->ns[g->n++] = ns;
+}
+
+static int cmp_group_count(const void* a, const void* b) {
+    const replay_group_t *x = a, *y = b;
+    return x->n < y->n ? 1 : x->n > y->n ? -1 : strcmp(x->name, y->name);
+}
+
+static void replay_report(FILE* f, int json, const char* path, double speed, replay_group_t* g, int ng, double secs) {
+    if (json) {
+        fprintf(f, "{\"config\": {\"trace\": \"%s\", \"speed\": %g},\n \"benchmarks\": [\n", path, speed);
+    } else {
+        char pace[32];
+        if (speed > 0) snprintf(pace, sizeof(pace), "%gx", speed);
+        else snprintf(pace, sizeof(pace), "max");
+        fprintf(f, "Replayed %zu commands from %s in %.3f s (%.1f commands/s, speed %s)\n",
+                g[0].n, path, secs, secs > 0 ? g[0].n / secs : 0.0, pace);
+        fprintf(f, "%-14s %8s %10s %10s %10s %10s\n", "command", "count", "p50 us", "p90 us", "p99 us", "max us");
+    }
+    for (int i = 0; i < ng; ++i) {
+        replay_group_t* r = &g[i];
+        if (r->n == 0) continue;
+        unsigned long long sum = 0;
+        for (size_t k = 0; k < r->n; ++k) sum += r->ns[k];
+        unsigned long long p50 = r->ns[r->n / 2], p90 = r->ns[(size_t)(r->n * 0.90)],
+                           p99 = r->ns[(size_t)(r->n * 0.99)], max = r->ns[r->n - 1];
+        if (json)
+            fprintf(f, "  {\"name\": \"replay_%s\", \"ops\": %zu, \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, "
+                       "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu}%s\n",
+                    r->name, r->n, (double)sum / (double)r->n, secs > 0 ? r->n / secs : 0.0,
+                    p50, p90, p99, max, i + 1 < ng ? "," : "");
+        else
+            fprintf(f, "%-14s %8zu %10.1f %10.1f %10.1f %10.1f\n", r->name, r->n, p50 / 1e3, p90 / 1e3, p99 / 1e3, max / 1e3);
+    }
+    if (json) fprintf(f, " ]}\n");
+}
+
+/* feeds a recorded trace to a fresh instance; see "Session traces" */
+static int replay(const char* path, double speed, const char* out_path) {
+    FILE* in = fopen(path, "r");
+    char line[4096];
+    unsigned long long start = 0;
+    if (!in || !fgets(line, sizeof(line), in) || strncmp(line, TRACE_MAGIC " ", strlen(TRACE_MAGIC) + 1) != 0
+        || (start = strtoull(line + strlen(TRACE_MAGIC) + 1, NULL, 10)) == 0) {
+        fprintf(stderr, "Not a session trace: %s\n", path);
+        if (in) fclose(in);
+        return 1;
+    }
+    /* the replay works on a copy, so the recorded state stays as it was */
+    char snap[512], run[512], tmp[520];
+    snprintf(snap, sizeof(snap), "%s.vfs", path);
+    snprintf(run, sizeof(run), "%s.vfs.replay", path);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", run);
+    remove(run);
+    copy_file(snap, run);
+    os = sos_create(run);
+    if (!os) { fclose(in); return 1; }
+    sos_set_command_hook(os, shell_command_hook, NULL);
+    sos_clock_set(os, start);
+    spawn_default_tasks();
+#ifndef _WIN32
+    if (!freopen("/dev/null", "r", stdin)) fclose(stdin);
+#endif
+
+    replay_group_t groups[REPLAY_GROUPS + 1];
+    int ngroups = 1;
+    memset(groups, 0, sizeof(groups));
+    strcpy(groups[0].name, "all");
+    unsigned long long t0 = now_ns();
+    while (sos_state(os) != SOS_HALTED && fgets(line, sizeof(line), in)) {
+        char* text;
+        unsigned long long off = strtoull(line, &text, 10);
+        if (text == line || text[0] != ' ' || (text[1] != 'L' && text[1] != 'C')) continue;
+        char kind = text[1];
+        text += text[2] == ' ' ? 3 : 2;
+        text[strcspn(text, "\n")] = '\0';
+        if (speed > 0) {
+            unsigned long long due = t0 + (unsigned long long)(off * 1000.0 / speed), now = now_ns();
+            if (due > now + 1000000ULL) sleep_ms((int)((due - now) / 1000000ULL));
+        }
+        sos_clock_set(os, start + off);
+        if (kind == 'L') { if (text[0]) sos_setenv(os, "USER", text); continue; }
+        if (text[0] == '\0') { sos_tick(os); continue; }
+        char* out = NULL;
+        unsigned long long c0 = now_ns();
+        sos_exec(os, text, &out, NULL);
+        unsigned long long ns = now_ns() - c0;
+        sos_free(out);
+
+        char word[sizeof(groups[0].name)] = {0};
+        sscanf(text, "%15s", word);
+        int g = 1;
+        while (g < ngroups && strcmp(groups[g].name, word) != 0) g++;
+        if (g == ngroups && ngroups <= REPLAY_GROUPS) strcpy(groups[ngroups++].name, word);
+        group_add(&groups[0], ns);
+        if (g < ngroups) group_add(&groups[g], ns);
+        if (sos_state(os) == SOS_REBOOT) {
+            sos_vfs_reload(os);
+            sos_set_state(os, SOS_RUNNING);
+        }
+    }
+    double secs = (now_ns() - t0) / 1e9;
+    fclose(in);
+    sos_destroy(os);
+    os = NULL;
+    remove(run);
+    remove(tmp);
+
+    for (int i = 0; i < ngroups; ++i) qsort(groups[i].ns, groups[i].n, sizeof(unsigned long long), cmp_ull);
+    qsort(groups + 1, (size_t)(ngroups - 1), sizeof(groups[0]), cmp_group_count);
+    /* the report goes to stderr, clear of what the tasks print */
+    replay_report(stderr, 0, path, speed, groups, ngroups, secs);
+    FILE* f = out_path ? fopen(out_path, "w") : NULL;
+    if (f) { replay_report(f, 1, path, speed, groups, ngroups, secs); fclose(f); }
+    for (int i = 0; i < ngroups; ++i) free(groups[i].ns);
+    return groups[0].n ? 0 : 1;
+}
+
+/* server mode: no boot screen or login; sessions log in over the socket */
+static int serve(const char* unix_path, int tcp_port, int http_port, const char* primary) {
+    vfs_boot();
+    detect_hostname();
+    if (http_port > 0 && sos_http_start(os, http_port) != 0) return 1;
+    if (primary && sos_sync(os, primary, 1, NULL) != 0) { fprintf(stderr, "Cannot replicate %s\n", primary); return 1; }
+    /* commands that prompt on the terminal (edit, powerbtn) see end of input */
+#ifndef _WIN32
+    if (!freopen("/dev/null", "r", stdin)) fclose(stdin);
 #endif
+    int rc = sos_serve(os, unix_path, tcp_port);
+    sos_sync_stop();
+    sos_http_stop();
+    sos_vfs_save(os);
+    sos_destroy(os);
+    return rc == 0 ? 0 : 1;
 }
 
 /* main */
-int main(void) {
-    start_time = time(NULL);
+int main(int argc, char** argv) {
+    int print_profile = 0, tcp_port = 0, http_port = 0;
+    double speed = 0;
+    const char* unix_path = NULL;
+    const char* primary = NULL;
+    const char *record = NULL, *replay_path = NULL, *out_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--fast")==0) fast_boot = 1;
+        else if (strcmp(argv[i], "--boot-profile")==0) print_profile = 1;
+        else if (strcmp(argv[i], "--serve-unix")==0 && i + 1 < argc) unix_path = argv[++i];
+        else if (strcmp(argv[i], "--serve-tcp")==0 && i + 1 < argc) tcp_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--http")==0 && i + 1 < argc) http_port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--replicate")==0 && i + 1 < argc) primary = argv[++i];
+        else if (strcmp(argv[i], "--record")==0 && i + 1 < argc) record = argv[++i];
+        else if (strcmp(argv[i], "--replay")==0 && i + 1 < argc) replay_path = argv[++i];
+        else if (strcmp(argv[i], "--speed")==0 && i + 1 < argc) speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "--out")==0 && i + 1 < argc) out_path = argv[++i];
+    }
+    if (getenv("SHREYAS_FASTBOOT")) fast_boot = 1;
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);   /* a child closing its stdin early must not kill the shell */
+    signal(SIGINT, on_sigint);
+#endif
+    if (unix_path || tcp_port > 0) return serve(unix_path, tcp_port, http_port, primary);
+    if (replay_path) return replay(replay_path, speed, out_path);
+    if (record && trace_open(record) != 0) { fprintf(stderr, "Cannot record to %s\n", record); return 1; }
     enable_ansi_on_windows();
-    print_futuristic_boot();
-    vfs_init();
-    detect_hostname();
-    login_sequence();
-    spawn_builtin("clock", task_clock_builtin);
-    spawn_builtin("heartbeat", task_heartbeat_builtin);
+    boot_system(1);
+    if (http_port > 0 && sos_http_start(os, http_port) == 0) printf("Serving http://127.0.0.1:%d/vfs/\n", http_port);
+    if (primary && sos_sync(os, primary, 1, NULL) == 0) printf("Replicating %s\n", primary);
+    if (print_profile) show_boot_profile();
     char line[2048];
     while (1) {
-        if (!running) break;
-        if (running == 2) {
+        if (sos_state(os) == SOS_HALTED) break;
+        if (sos_state(os) == SOS_REBOOT) {
             /* reboot: re-run boot sequence */
-            running = 1;
-            print_futuristic_boot();
-            vfs_init();
-            detect_hostname();
-            spawn_builtin("clock", task_clock_builtin);
-            spawn_builtin("heartbeat", task_heartbeat_builtin);
+            sos_set_state(os, SOS_RUNNING);
+            boot_system(0);
+            if (print_profile) show_boot_profile();
         }
         char prompt[PROMPT_BUFSZ];
         build_prompt(prompt, sizeof(prompt));
         printf("%s", prompt);
         fflush(stdout);
+        wait_for_line(prompt, sizeof(prompt));
         read_line(line, sizeof(line));
-        if (line[0] == '\0') { scheduler_tick_wrapper(); continue; }
-        save_history_line(line);
-        shell_execute(line);
+        if (line[0] == '\0' && feof(stdin)) break;     /* end of input ends the session */
+        if (line[0] == '\0') { trace_line('C', ""); sos_tick(os); continue; }
+        if (line[0] == '!') {
+            /* history keeps the expanded command, not the event */
+            if (!sos_history_expand(line, sizeof(line))) continue;
+            printf("Repeating: %s\n", line);
+        }
+        trace_line('C', line);
+        sos_history_add(line);
+#ifndef _WIN32
+        in_command = 1;
+#endif
+        sos_exec(os, line, NULL, NULL);
+#ifndef _WIN32
+        in_command = 0;
+#endif
     }
     printf("Shreyas OS exited.\n");
-    vfs_save_state();
+    if (trace_out) fclose(trace_out);
+    sos_sync_stop();
+    sos_http_stop();
+    sos_vfs_save(os);
+    sos_destroy(os);
     return 0;
 }
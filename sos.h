@@ -0,0 +1,227 @@
+/* sos.h - embeddable Shreyas OS core.
+
+   The VFS, task scheduler and command engine live in sos_core.c behind
+   an explicit context handle, so a program can run several independent
+   instances in one process and call them at function-call speed instead
+   of driving the shell over stdin/stdout. shreyas_os_full_power.c is the
+   interactive front end built on this API.
+
+   Each sos_ctx_t owns its files, tasks and environment. The compile
+   cache, background builds/jobs and command history are shared by the
+   whole process. Calls on one context must not overlap, except the
+   sos_vfs_* file calls, which any number of threads may make at once;
+   different contexts may be used from different threads. Embedders on POSIX
+   should ignore SIGPIPE, as the shell does, before running commands
+   that talk to child processes. */
+#ifndef SOS_H
+#define SOS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sos_ctx sos_ctx_t;
+typedef struct sos_tx sos_tx_t;
+
+/* sos_state() values */
+enum { SOS_HALTED = 0, SOS_RUNNING = 1, SOS_REBOOT = 2 };
+
+/* extra shell commands: return nonzero if 'cmd' was handled. 'args' is
+   the rest of the line. Output should go through sos_printf(). */
+typedef int (*sos_command_fn)(sos_ctx_t* ctx, const char* cmd, const char* args, void* user);
+
+/* state_path is where the VFS is persisted; NULL or "" keeps it in memory.
+   An existing state file is loaded. Returns NULL on allocation failure. */
+sos_ctx_t* sos_create(const char* state_path);
+void sos_destroy(sos_ctx_t* ctx);
+
+/* VFS. Names are at most 95 bytes; contents are binary-safe.
+   Return 0 on success, -1 on error (not found, bad name, VFS full). */
+int sos_vfs_write(sos_ctx_t* ctx, const char* name, const void* data, size_t len);
+int sos_vfs_append(sos_ctx_t* ctx, const char* name, const void* data, size_t len);
+/* *data is a NUL-terminated copy to release with sos_free() */
+int sos_vfs_read(sos_ctx_t* ctx, const char* name, char** data, size_t* len);
+/* byte ranges: pread copies up to len bytes from offset like
+   sos_vfs_read(); pwrite creates the file if needed and zero-fills any
+   gap past its end; truncate cuts the file or zero-extends it. Changes
+   cost the size of the range, not of the file. */
+int sos_vfs_pread(sos_ctx_t* ctx, const char* name, size_t offset, size_t len, char** data, size_t* got);
+int sos_vfs_pwrite(sos_ctx_t* ctx, const char* name, size_t offset, const void* data, size_t len);
+int sos_vfs_truncate(sos_ctx_t* ctx, const char* name, size_t size);
+/* file descriptors with buffered cursors. An open file stays usable
+   after sos_vfs_remove() until it is closed; sequential reads and writes
+   go through a per-fd buffer (writes are visible to others after a
+   flush: a seek, read, close or full buffer). Calls made while a builtin
+   task runs use that task's table, which is closed with the task. An fd
+   must not be used by two threads at once. All return -1 on error. */
+enum { SOS_O_READ = 1, SOS_O_WRITE = 2, SOS_O_CREATE = 4, SOS_O_TRUNC = 8, SOS_O_APPEND = 16 };
+enum { SOS_SEEK_SET = 0, SOS_SEEK_CUR = 1, SOS_SEEK_END = 2 };
+int sos_fd_open(sos_ctx_t* ctx, const char* name, int flags);
+long long sos_fd_read(sos_ctx_t* ctx, int fd, void* buf, size_t len);
+long long sos_fd_write(sos_ctx_t* ctx, int fd, const void* buf, size_t len);
+long long sos_fd_seek(sos_ctx_t* ctx, int fd, long long offset, int whence);
+int sos_fd_close(sos_ctx_t* ctx, int fd);
+/* zero-copy read: *data points at the file's current bytes (not
+   NUL-terminated), which stay valid and unchanged until
+   sos_vfs_unpin(*pin) even if the file is rewritten or removed. The pair
+   (*version, *len) changes whenever the content does. */
+int sos_vfs_pin(sos_ctx_t* ctx, const char* name, const char** data, size_t* len,
+                unsigned long long* version, void** pin);
+void sos_vfs_unpin(void* pin);
+int sos_vfs_remove(sos_ctx_t* ctx, const char* name);
+/* calls fn for every file in name order; returns the number of files */
+int sos_vfs_list(sos_ctx_t* ctx, void (*fn)(const char* name, size_t size, void* user), void* user);
+/* waits for a background save, then writes the state file unless
+   nothing changed since the last one */
+int sos_vfs_save(sos_ctx_t* ctx);
+/* saves from a forked child while the caller carries on: the child's pid
+   (or the running one's), 0 if nothing changed, -1 on error. The child is
+   collected by a later sos_tick/sos_exec or save. On Windows the save
+   runs in the foreground. */
+int sos_vfs_bgsave(sos_ctx_t* ctx);
+/* background-saves changes every seconds, checked on ticks; 0 = off */
+int sos_vfs_autosave(sos_ctx_t* ctx, unsigned seconds);
+/* discards the in-memory VFS and reloads it from the state file */
+int sos_vfs_reload(sos_ctx_t* ctx);
+/* caps the memory held by file contents (0 = no cap, the default). Past
+   it, the least recently used bodies move to a temporary backing file
+   and are read back on their next access. */
+int sos_vfs_budget(sos_ctx_t* ctx, unsigned long long bytes);
+
+/* transactions. Writes, appends and removes through a transaction are
+   staged privately (reads through it see them) and sos_tx_commit applies
+   them all at once: lists and state saves see all of them or none, and
+   the batch is persisted by one background save. Commit returns 0, or
+   -1 with nothing applied if a staged file was changed by someone else
+   meanwhile, or the VFS is full; either way the transaction is freed. */
+sos_tx_t* sos_tx_begin(sos_ctx_t* ctx);
+int sos_tx_write(sos_tx_t* tx, const char* name, const void* data, size_t len);
+int sos_tx_append(sos_tx_t* tx, const char* name, const void* data, size_t len);
+int sos_tx_remove(sos_tx_t* tx, const char* name);
+/* *data is malloc'd and NUL-terminated; free it with free() */
+int sos_tx_read(sos_tx_t* tx, const char* name, char** data, size_t* len);
+int sos_tx_commit(sos_tx_t* tx);
+void sos_tx_abort(sos_tx_t* tx);
+
+/* tasks. Spawn calls return the task id, or 0 if the table is full. */
+int sos_task_spawn(sos_ctx_t* ctx, const char* name, unsigned interval, const char* message);
+/* builtin is "clock", "heartbeat" or "logger" */
+int sos_task_spawn_builtin(sos_ctx_t* ctx, const char* builtin);
+/* runs command as a shell line after each change to the file pattern (or
+   to any file starting with pattern minus a trailing '*'), on the next
+   tick; "{}" in command becomes the changed name. Changes made by any
+   thread are queued; sos_exec ticks after its command. */
+int sos_watch(sos_ctx_t* ctx, const char* pattern, const char* command);
+/* readable while reactions wait for a tick, e.g. after an HTTP PUT or a
+   replicated change; poll it and call sos_tick, which empties it. -1 on
+   Windows. */
+int sos_watch_fd(sos_ctx_t* ctx);
+int sos_task_kill(sos_ctx_t* ctx, int id);
+void sos_tick(sos_ctx_t* ctx);
+
+/* runs one shell line (pipelines and redirections included) followed by
+   a scheduler tick. With out == NULL output goes to stdout; otherwise
+   *out receives a NUL-terminated buffer to release with sos_free(). */
+int sos_exec(sos_ctx_t* ctx, const char* line, char** out, size_t* outlen);
+/* as sos_exec, on behalf of a session whose user differs from USER
+   (whoami reports 'user'); NULL behaves like sos_exec */
+int sos_exec_as(sos_ctx_t* ctx, const char* user, const char* line, char** out, size_t* outlen);
+/* prints to the output of the command being run (pipe, capture or stdout) */
+int sos_printf(const char* fmt, ...);
+void sos_set_command_hook(sos_ctx_t* ctx, sos_command_fn fn, void* user);
+
+/* multi-session server (sos_server.c, Linux): listens on a Unix socket
+   and/or 127.0.0.1:tcp_port (0 = off) and runs line-oriented shell
+   sessions on ctx until a session powers it off or SIGINT/SIGTERM.
+   Replicas (see sos_sync) may log in too; the mutation hook is ctx's
+   while it runs. Returns 0 after a clean shutdown, -1 if it could not
+   listen. */
+int sos_serve(sos_ctx_t* ctx, const char* unix_path, int tcp_port);
+
+/* loopback HTTP/1.1 file server (sos_http.c, Linux) on 127.0.0.1:port,
+   run by a background thread: GET/HEAD /vfs/<name> with Range and
+   If-None-Match, PUT and DELETE /vfs/<name>, and GET /vfs/ for a listing.
+   One per process. Start returns 0 once listening, -1 if it could not
+   listen or is already running; port reports 0 when stopped. */
+int sos_http_start(sos_ctx_t* ctx, int port);
+void sos_http_stop(void);
+int sos_http_port(void);
+
+/* replication (sos_sync.c). The primary is any instance running
+   sos_serve(): a session whose login line is "@replica" speaks the sync
+   protocol instead of the shell. sos_sync() (POSIX) makes ctx a copy of
+   the primary at target, "host:port" or a Unix socket path: only files
+   whose digest differs are fetched, and large ones as rsync-style block
+   deltas against the local copy. With follow, a background thread then
+   applies the primary's mutations as they happen until sos_sync_stop().
+   Returns 0 once the initial sync is done, -1 on error or if already
+   following. info (optional) receives the transfer counts. */
+typedef struct {
+    unsigned files, updated, removed;
+    unsigned long long literal_bytes, matched_bytes, mutations;
+    int following;
+} sos_sync_info_t;
+int sos_sync(sos_ctx_t* ctx, const char* target, int follow, sos_sync_info_t* info);
+void sos_sync_stop(void);
+/* counts of the current (or last) follower */
+void sos_sync_status(sos_sync_info_t* info);
+
+/* primary side, for servers: consumes the complete request frames at the
+   start of in and emits the replies; returns the bytes consumed. *follow
+   is set once the replica asks for mutations, which are framed with
+   sos_sync_mutation() and sent in the order the hook reports them. */
+typedef void (*sos_emit_fn)(void* user, const void* data, size_t n);
+size_t sos_sync_serve(sos_ctx_t* ctx, const char* in, size_t len, int* follow, sos_emit_fn emit, void* user);
+void sos_sync_mutation(int op, const char* name, unsigned long long offset, const void* data, size_t len,
+                       sos_emit_fn emit, void* user);
+
+/* mutation hook: called after every change to ctx's VFS, on the thread
+   that made it and with that file's write lock held (removes included),
+   so one file's changes arrive in order. It must not modify the VFS. For APPEND,
+   offset is where data landed, for PWRITE where it was written and for
+   TRUNCATE the new size; RESET means the VFS was reloaded. */
+enum { SOS_MUT_WRITE = 1, SOS_MUT_APPEND = 2, SOS_MUT_REMOVE = 3, SOS_MUT_RESET = 4,
+       SOS_MUT_PWRITE = 5, SOS_MUT_TRUNCATE = 6 };
+typedef void (*sos_mutation_fn)(sos_ctx_t* ctx, int op, const char* name, unsigned long long offset,
+                                const void* data, size_t len, void* user);
+void sos_set_mutation_hook(sos_ctx_t* ctx, sos_mutation_fn fn, void* user);
+
+/* environment: "USER" and "HOSTNAME" */
+const char* sos_getenv(sos_ctx_t* ctx, const char* key);
+int sos_setenv(sos_ctx_t* ctx, const char* key, const char* value);
+/* HOSTNAME starts as "ShreyasOS"; this sets it to the host's name */
+int sos_detect_hostname(sos_ctx_t* ctx);
+
+/* operational counters (process-wide) plus this context's VFS occupancy,
+   as key=value lines or JSON; *out is released with sos_free() */
+int sos_stats(sos_ctx_t* ctx, int json, char** out, size_t* outlen);
+/* counts a command the embedder handles itself, like the server's "who" */
+void sos_stats_command(const char* name);
+
+int sos_state(sos_ctx_t* ctx);
+void sos_set_state(sos_ctx_t* ctx, int state);
+/* stops the scripts running on ctx, from any thread or a signal handler;
+   cleared when the next outermost sos_exec starts */
+void sos_interrupt(sos_ctx_t* ctx);
+
+/* virtual clock for replaying traces: date, uptime, cal and the clock
+   task read unix_us (microseconds since the epoch) instead of the wall
+   clock; 0 goes back to the wall clock. sos_time() is the instance's
+   current time in seconds. */
+void sos_clock_set(sos_ctx_t* ctx, unsigned long long unix_us);
+long long sos_time(sos_ctx_t* ctx);
+
+/* persistent command history (process-wide) */
+void sos_history_add(const char* line);
+/* expands a leading !!, !N, !?text or !prefix event in place; 0 if none matched */
+int sos_history_expand(char* line, size_t sz);
+
+void sos_free(void* p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
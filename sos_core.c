@@ -0,0 +1,7820 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#else
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/utsname.h>
+#include <pthread.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+
+#include "sos.h"
+
+/* Configuration */
+#define FS_MAX_FILES 128
+#define FS_MAX_CONTENT (64u << 20)     /* per-file size limit */
+#define FS_LEGACY_CONTENT 8192          /* content size in the v1 state file */
+#define MAX_TASKS 48
+#define MAX_NAME 96
+#define MAX_MSG 1024
+#define CMD_HISTORY 128
+#define HISTORY_FILE "shreyas_history"
+#define HIST_ARENA_BYTES (8u << 20)
+#define HIST_MAX_ENTRIES (1u << 19)
+#define HIST_TRI_BITS 14                /* trigram index buckets: 1 << bits */
+#define SHPIPE_CAP 65536
+#define SH_MAX_STAGES 16
+#define BCACHE_DIR "shreyas_cache"
+#define BCACHE_BUDGET (64ull << 20)
+#define BCACHE_MAX_ENTRIES 256
+#define BUILD_DIR "shreyas_build"
+#define MAX_BUILDS 4
+#define MAX_JOBS 16
+#define STATS_FILE ".stats"            /* synthetic, read-only */
+#define BUILD_MAX_UNITS 64
+#define VMSTAT_RING 240                /* samples kept by the vmstat sampler */
+#define VMSTAT_SHOW 20
+#define VFD_MAX 64                     /* open files per fd table */
+#define VFD_BUF 65536                  /* per-fd read-ahead / write-behind buffer */
+
+#if defined(_MSC_VER)
+#define SOS_TLS __declspec(thread)
+#else
+#define SOS_TLS __thread
+#endif
+
+/* a file's bytes; may hold binary data */
+typedef struct {
+    size_t cap;
+    size_t size;        /* published with a release store */
+    unsigned long long id;  /* unique per blob; with size it names the content */
+    unsigned refs;      /* the owning file's reference plus sos_vfs_pin() holders */
+    unsigned seq;       /* odd while bytes below size change in place */
+    char data[];        /* cap bytes plus a NUL terminator */
+} vblob_t;
+
+#define NAME_INDEX_LEVELS 8     /* skip list levels: 4^8 names before it degrades */
+
+typedef struct vfile {
+    char name[MAX_NAME];    /* fixed for the entry's lifetime */
+    vblob_t* blob;          /* replaced under mtx, read with an acquire load; NULL while evicted */
+    unsigned refs;          /* the namespace slot's reference plus open fds */
+    int unlinked;           /* out of the namespace; changes are not reported */
+    int hot;                /* set on every access, cleared by the eviction sweep */
+    long long cold_off;     /* while evicted: the body's place in the backing store, */
+    size_t cold_size;       /* its size and the id of the blob it came from */
+    unsigned long long cold_id;
+    unsigned long long saved_id;    /* (blob id, size) in the state file; */
+    size_t saved_size;              /* the file is dirty while they differ */
+    long long ctime, mtime, atime;  /* sos_now_us() at creation, last change, last read */
+    unsigned long long reads;
+    struct vfile* next[NAME_INDEX_LEVELS];  /* name index links, under vfs_mtx */
+#ifndef _WIN32
+    pthread_mutex_t mtx;    /* serializes writers of this file */
+#endif
+} vfile_t;
+
+/* linked entries ordered by name: a skip list changed only under the
+   namespace lock, so listings are range scans instead of sorting the table */
+typedef struct {
+    vfile_t* head[NAME_INDEX_LEVELS];
+    unsigned rng;
+    int count;
+} name_index_t;
+
+/* backing store for file bodies evicted under a memory budget */
+typedef struct { long long off, len; } tier_extent_t;
+
+typedef struct {
+    size_t budget;              /* resident body bytes allowed; 0 = no limit */
+    FILE* store;                /* anonymous temporary file, opened on first eviction */
+    long long end;
+    tier_extent_t* holes;       /* free ranges below end, sorted and coalesced */
+    size_t nholes, capholes;
+    int hand;                   /* CLOCK position in the slot table */
+#ifndef _WIN32
+    pthread_mutex_t io_mtx;     /* the store and its holes; always taken last */
+    pthread_mutex_t sweep_mtx;  /* one eviction sweep at a time */
+#endif
+} tier_t;
+
+/* a linked entry and its content as of a state file image */
+typedef struct {
+    int slot;
+    vfile_t* f;                 /* compared with the slot, never dereferenced */
+    unsigned long long id;
+    size_t size;
+} vfs_snap_t;
+
+/* background saves: a forked child writes the image from its copy-on-write
+   view of memory while the parent keeps running */
+typedef struct {
+    int pid;                    /* the saving child, 0 when none */
+    int announce;               /* report the outcome (started by hand) */
+    unsigned interval;          /* autosave period in seconds, 0 = off */
+    unsigned dirty;             /* files changed when the child was forked */
+    int pending;                /* another save was asked for while it ran */
+    unsigned long long started, last_try, last_ok;  /* now_us() */
+    unsigned long long removals;                    /* covered by the child's image */
+    vfs_snap_t snap[FS_MAX_FILES];
+    int nsnap;
+#ifndef _WIN32
+    pthread_mutex_t mtx;        /* saves and the child; taken before vfs_mtx */
+#endif
+} bgsave_t;
+
+/* Pipeline stages, job output and server sessions touch the VFS from
+   several threads. Lookups and reads take no lock: entries and blobs are
+   reclaimed only after every reader that could see them has left its
+   rcu_enter() section. Writers lock the one file they change; creating
+   and removing entries takes the namespace lock. */
+#ifndef _WIN32
+#define VFS_LOCK() pthread_mutex_lock(&sos_cur->vfs_mtx)
+#define VFS_UNLOCK() pthread_mutex_unlock(&sos_cur->vfs_mtx)
+#define FILE_LOCK(f) pthread_mutex_lock(&(f)->mtx)
+#define FILE_UNLOCK(f) pthread_mutex_unlock(&(f)->mtx)
+#else
+#define VFS_LOCK() ((void)0)
+#define VFS_UNLOCK() ((void)0)
+#define FILE_LOCK(f) ((void)0)
+#define FILE_UNLOCK(f) ((void)0)
+#endif
+
+/* Pipeline stages run task commands side by side, so claiming and
+   releasing slots and the commands that walk or change the table hold
+   the task lock. scheduler_tick runs between command lines and takes
+   it only through those. Taken before the watch, job and VFS locks. */
+#ifndef _WIN32
+#define TASKS_LOCK() pthread_mutex_lock(&sos_cur->tasks_mtx)
+#define TASKS_UNLOCK() pthread_mutex_unlock(&sos_cur->tasks_mtx)
+#else
+#define TASKS_LOCK() ((void)0)
+#define TASKS_UNLOCK() ((void)0)
+#endif
+
+/* an open file: a counted reference on the entry, a cursor, and one
+   buffer used either as a read-ahead window or to collect writes */
+typedef struct {
+    vfile_t* f;
+    int flags;              /* SOS_O_* */
+    size_t pos;
+    char* buf;              /* VFD_BUF bytes, allocated on first use */
+    size_t rstart, rlen;    /* read-ahead: file bytes [rstart, rstart + rlen) */
+    size_t wstart, wlen;    /* write-behind: bytes for [wstart, wstart + wlen) */
+} vfd_t;
+
+typedef struct {
+    vfd_t* fd[VFD_MAX];
+#ifndef _WIN32
+    pthread_mutex_t mtx;    /* slot allocation and lookup */
+#endif
+} vfd_table_t;
+
+typedef void (*builtin_fn)(void);
+
+enum { TASK_BUILTIN = 0, TASK_MESSAGE = 1, TASK_BUILD = 2, TASK_JOB = 3, TASK_WATCH = 4 };
+
+/* a watch task's subscription and its queue of changes not yet run; the
+   reaction is the task's msg, with "{}" replaced by the changed name */
+#define WATCH_BUCKETS 64
+#define WATCH_QUEUE 64
+
+typedef struct { int op; char name[MAX_NAME]; } watch_event_t;
+
+typedef struct watch {
+    struct watch* next;         /* index bucket chain */
+    int prefix;                 /* key matches every name that starts with it */
+    char key[MAX_NAME];
+    watch_event_t q[WATCH_QUEUE];
+    unsigned head, count, dropped;
+} watch_t;
+
+typedef struct {
+    watch_t* bucket[WATCH_BUCKETS];     /* by FNV-1a of the key */
+    unsigned short nlen[MAX_NAME];      /* prefix watches per key length */
+    int count;                          /* writers skip the index while 0 */
+#ifndef _WIN32
+    pthread_mutex_t mtx;
+    int wake[2];                        /* readable while reactions are queued (sos_watch_fd) */
+    int woken;                          /* a byte is in wake; under mtx */
+#endif
+} watch_index_t;
+
+typedef struct {
+    int id;
+    char name[MAX_NAME];
+    int type;
+    builtin_fn fn;
+    char msg[MAX_MSG];
+    unsigned interval;
+    unsigned ticks;
+    int active;
+    int job;            /* TASK_BUILD: index into builds[]; TASK_JOB: into bgjobs[] */
+    vfd_table_t* fds;   /* files opened while the task ran; closed with it */
+    watch_t* watch;     /* TASK_WATCH */
+} task_t;
+
+/* compiled scripts by file name and content version */
+#define SC_CACHE 16
+
+typedef struct sc_prog sc_prog_t;
+
+typedef struct {
+    char name[MAX_NAME];
+    unsigned long long id;      /* blob id and size the program was compiled from */
+    size_t size;
+    sc_prog_t* prog;
+    unsigned long long used;
+} sc_cached_t;
+
+typedef struct {
+    sc_cached_t e[SC_CACHE];
+    unsigned long long clock;
+#ifndef _WIN32
+    pthread_mutex_t mtx;
+#endif
+} sc_cache_t;
+
+/* One OS instance: its VFS, task table and shell environment. Code
+   running for an instance (API calls, pipeline stages, the job I/O
+   thread) points sos_cur at it first. */
+struct sos_ctx {
+    vfile_t* vfs[FS_MAX_FILES];     /* RCU-published entries, NULL = free slot */
+#ifndef _WIN32
+    pthread_mutex_t vfs_mtx;        /* namespace: creating and removing entries */
+#endif
+    task_t tasks[MAX_TASKS];
+#ifndef _WIN32
+    pthread_mutex_t tasks_mtx;      /* recursive: the task table, for pipeline stages */
+#endif
+    int task_count;
+    int next_task_id;
+    int running;                /* SOS_HALTED / SOS_RUNNING / SOS_REBOOT */
+    int interrupted;            /* sos_interrupt(): stops running scripts; atomic */
+    time_t start_time;
+    unsigned long long clock_us;    /* virtual clock (sos_clock_set), 0 = wall clock */
+    char env_USER[64];
+    char env_HOSTNAME[128];
+    char state_path[256];       /* "" keeps the VFS in memory only */
+    sos_command_fn hook;
+    void* hook_user;
+    sos_mutation_fn mut_hook;   /* called by writers on any thread: acquire load */
+    void* mut_user;
+    vfd_table_t fds;            /* files opened by the shell and API callers */
+    watch_index_t watches;
+    tier_t tier;
+    unsigned long long removals, saved_removals;   /* under vfs_mtx: files removed in total / as of the state file */
+    name_index_t names;         /* under vfs_mtx */
+    sos_tx_t* shell_tx;         /* begin ... commit/abort from the shell */
+    unsigned commit_seq;        /* odd while tx_commit switches files; under vfs_mtx */
+    sc_cache_t scripts;
+    bgsave_t bgsave;
+};
+
+static SOS_TLS sos_ctx_t *sos_cur;
+
+/* Helper: cross-platform sleep in milliseconds */
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+/* Helper: monotonic clock in microseconds */
+static unsigned long long now_us() {
+#ifdef _WIN32
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (unsigned long long)(cnt.QuadPart / freq.QuadPart) * 1000000ULL
+         + (unsigned long long)(cnt.QuadPart % freq.QuadPart) * 1000000ULL / (unsigned long long)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+#endif
+}
+
+/* Helper: the instance's idea of now, virtual during a replay */
+static time_t sos_now() {
+    unsigned long long v = __atomic_load_n(&sos_cur->clock_us, __ATOMIC_RELAXED);
+    return v ? (time_t)(v / 1000000ULL) : time(NULL);
+}
+
+/* the same clock in microseconds, for file times */
+static long long sos_now_us() {
+    unsigned long long v = __atomic_load_n(&sos_cur->clock_us, __ATOMIC_RELAXED);
+    if (v) return (long long)v;
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Helper: 64-bit FNV-1a, chainable through 'h' (start with FNV64_INIT) */
+#define FNV64_INIT 0xcbf29ce484222325ULL
+static unsigned long long fnv1a64(const void *data, size_t n, unsigned long long h) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 0x100000001b3ULL; }
+    return h;
+}
+
+/* Helper: host file size, or -1 if it does not exist */
+static long long disk_file_size(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    return (long long)st.st_size;
+}
+
+static int disk_mkdir(const char *path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+/* Growable byte buffer (always NUL-terminated once anything was appended) */
+typedef struct {
+    char *data;
+    size_t len, cap;
+} strbuf_t;
+
+/* room for n more bytes and the terminator; 0 if out of memory */
+static int sb_reserve(strbuf_t *sb, size_t n) {
+    if (sb->len + n + 1 > sb->cap) {
+        size_t ncap = sb->cap ? sb->cap : 256;
+        while (ncap < sb->len + n + 1) ncap *= 2;
+        char *p = realloc(sb->data, ncap);
+        if (!p) return 0;
+        sb->data = p;
+        sb->cap = ncap;
+    }
+    return 1;
+}
+
+static void sb_append(strbuf_t *sb, const char *data, size_t n) {
+    if (!sb_reserve(sb, n)) return;
+    if (n) memcpy(sb->data + sb->len, data, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+static void sb_free(strbuf_t *sb) {
+    free(sb->data);
+    sb->data = NULL;
+    sb->len = sb->cap = 0;
+}
+
+/* In-memory pipe between pipeline stages: a bounded ring buffer. Writers
+   block while it is full and readers block while it is empty, so stages
+   run concurrently with backpressure. On Windows stages run one after the
+   other, so the buffer grows instead of blocking. */
+typedef struct {
+    char *buf;
+    size_t cap, head, len;
+    int wclosed, rclosed;
+#ifndef _WIN32
+    pthread_mutex_t mu;
+    pthread_cond_t not_empty, not_full;
+#endif
+} shpipe_t;
+
+#ifndef _WIN32
+#define SHPIPE_LOCK(p) pthread_mutex_lock(&(p)->mu)
+#define SHPIPE_UNLOCK(p) pthread_mutex_unlock(&(p)->mu)
+#define SHPIPE_WAKE(c) pthread_cond_broadcast(c)
+#else
+#define SHPIPE_LOCK(p) ((void)0)
+#define SHPIPE_UNLOCK(p) ((void)0)
+#define SHPIPE_WAKE(c) ((void)0)
+#endif
+
+static int shpipe_init(shpipe_t *p) {
+    memset(p, 0, sizeof(*p));
+    p->cap = SHPIPE_CAP;
+    p->buf = malloc(p->cap);
+    if (!p->buf) return 0;
+#ifndef _WIN32
+    pthread_mutex_init(&p->mu, NULL);
+    pthread_cond_init(&p->not_empty, NULL);
+    pthread_cond_init(&p->not_full, NULL);
+#endif
+    return 1;
+}
+
+static void shpipe_destroy(shpipe_t *p) {
+    free(p->buf);
+    p->buf = NULL;
+#ifndef _WIN32
+    pthread_mutex_destroy(&p->mu);
+    pthread_cond_destroy(&p->not_empty);
+    pthread_cond_destroy(&p->not_full);
+#endif
+}
+
+#ifdef _WIN32
+static int shpipe_grow(shpipe_t *p) {
+    size_t ncap = p->cap * 2;
+    char *nb = malloc(ncap);
+    if (!nb) return 0;
+    for (size_t i = 0; i < p->len; ++i) nb[i] = p->buf[(p->head + i) % p->cap];
+    free(p->buf);
+    p->buf = nb;
+    p->cap = ncap;
+    p->head = 0;
+    return 1;
+}
+#endif
+
+/* returns -1 once the reading stage has gone away */
+static int shpipe_write(shpipe_t *p, const char *data, size_t n) {
+    SHPIPE_LOCK(p);
+    while (n > 0) {
+        if (p->rclosed) { SHPIPE_UNLOCK(p); return -1; }
+        if (p->len == p->cap) {
+#ifndef _WIN32
+            pthread_cond_wait(&p->not_full, &p->mu);
+            continue;
+#else
+            if (!shpipe_grow(p)) { SHPIPE_UNLOCK(p); return -1; }
+#endif
+        }
+        size_t tail = (p->head + p->len) % p->cap;
+        size_t chunk = p->cap - p->len;
+        if (chunk > p->cap - tail) chunk = p->cap - tail;
+        if (chunk > n) chunk = n;
+        memcpy(p->buf + tail, data, chunk);
+        p->len += chunk;
+        data += chunk;
+        n -= chunk;
+        SHPIPE_WAKE(&p->not_empty);
+    }
+    SHPIPE_UNLOCK(p);
+    return 0;
+}
+
+/* returns 0 at end of stream */
+static size_t shpipe_read(shpipe_t *p, char *out, size_t n) {
+    size_t got = 0;
+    SHPIPE_LOCK(p);
+#ifndef _WIN32
+    while (p->len == 0 && !p->wclosed) pthread_cond_wait(&p->not_empty, &p->mu);
+#endif
+    while (got < n && p->len > 0) {
+        size_t chunk = p->cap - p->head;
+        if (chunk > p->len) chunk = p->len;
+        if (chunk > n - got) chunk = n - got;
+        memcpy(out + got, p->buf + p->head, chunk);
+        p->head = (p->head + chunk) % p->cap;
+        p->len -= chunk;
+        got += chunk;
+    }
+    if (got) SHPIPE_WAKE(&p->not_full);
+    SHPIPE_UNLOCK(p);
+    return got;
+}
+
+static void shpipe_close_write(shpipe_t *p) {
+    SHPIPE_LOCK(p);
+    p->wclosed = 1;
+    SHPIPE_WAKE(&p->not_empty);
+    SHPIPE_UNLOCK(p);
+}
+
+static void shpipe_close_read(shpipe_t *p) {
+    SHPIPE_LOCK(p);
+    p->rclosed = 1;
+    SHPIPE_WAKE(&p->not_full);
+    SHPIPE_UNLOCK(p);
+}
+
+/* Shell I/O: builtins print through sh_printf/sh_write. Outside a pipeline
+   that is stdout; inside one it is the next stage's pipe or the buffer that
+   backs a '>'/'>>' redirection. */
+typedef struct {
+    shpipe_t *in;       /* previous stage, or NULL */
+    shpipe_t *out;      /* next stage, or NULL */
+    strbuf_t *capture;  /* redirection target, or NULL */
+    int broken;         /* the reader of out went away: the stage stops */
+} sh_io_t;
+
+static SOS_TLS sh_io_t *sh_io;
+/* user of the session running the command (sos_exec_as); NULL means USER */
+static SOS_TLS const char *sh_user;
+
+/* true once output is being discarded; long-running producers check it */
+static int sh_broken(void) { return sh_io && sh_io->broken; }
+
+static void sh_write(const char *data, size_t n) {
+    if (sh_io && sh_io->out) { if (!sh_io->broken && shpipe_write(sh_io->out, data, n) < 0) sh_io->broken = 1; }
+    else if (sh_io && sh_io->capture) sb_append(sh_io->capture, data, n);
+    else fwrite(data, 1, n, stdout);
+}
+
+static int sh_vprintf(const char *fmt, va_list ap) {
+    if (sh_broken()) return -1;
+    char small[1024];
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(small, sizeof(small), fmt, ap);
+    if (n < 0 || (size_t)n < sizeof(small)) {
+        if (n > 0) sh_write(small, (size_t)n);
+        va_end(again);
+        return n;
+    }
+    char *big = malloc((size_t)n + 1);
+    if (big) {
+        vsnprintf(big, (size_t)n + 1, fmt, again);
+        sh_write(big, (size_t)n);
+        free(big);
+    }
+    va_end(again);
+    return big ? n : -1;
+}
+
+static int sh_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = sh_vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+/* Operational counters. Every thread bumps its own block with plain
+   relaxed loads and stores (no locked instructions, no shared cache
+   lines); blocks are registered once per thread and summed when the
+   counters are read. A block is folded into stat_retired when its thread
+   exits, so short-lived pipeline stages do not pile up. */
+enum {
+    ST_VFS_LOOKUPS, ST_VFS_PROBES, ST_VFS_READS, ST_VFS_WRITES, ST_VFS_APPENDS, ST_VFS_REMOVES,
+    ST_VFS_PWRITES, ST_VFS_TRUNCATES, ST_VFS_BYTES_READ, ST_VFS_BYTES_WRITTEN,
+    ST_TIER_HITS, ST_TIER_MISSES, ST_TIER_EVICTIONS, ST_TIER_BYTES_OUT, ST_TIER_BYTES_IN,
+    ST_SCHED_TICKS, ST_TASK_RUNS, ST_WATCH_EVENTS, ST_WATCH_DROPPED, ST_COMMANDS,
+    ST_TX_COMMITS, ST_TX_ABORTS, ST_TX_CONFLICTS, ST_TX_FILES,
+    ST_SCRIPT_RUNS, ST_SCRIPT_COMPILES, ST_SCRIPT_CACHE_HITS, ST_SCRIPT_OPS,
+    ST_SAVES, ST_SAVE_BYTES, ST_SAVE_US, ST_SAVES_SKIPPED, ST_BGSAVES, ST_BGSAVE_FAILED, ST_FORK_US, ST_LOADS, ST_LOAD_BYTES, ST_LOAD_US,
+    ST_COUNT
+};
+
+static const char* const stat_names[ST_COUNT] = {
+    "vfs.lookups", "vfs.probes", "vfs.reads", "vfs.writes", "vfs.appends", "vfs.removes",
+    "vfs.pwrites", "vfs.truncates", "vfs.bytes_read", "vfs.bytes_written",
+    "tier.hits", "tier.misses", "tier.evictions", "tier.bytes_evicted", "tier.bytes_faulted",
+    "sched.ticks", "sched.task_runs", "sched.watch_events", "sched.watch_dropped", "shell.commands",
+    "tx.commits", "tx.aborts", "tx.conflicts", "tx.files",
+    "script.runs", "script.compiles", "script.cache_hits", "script.ops",
+    "persist.saves", "persist.save_bytes", "persist.save_us",
+    "persist.saves_skipped", "persist.bgsaves", "persist.bgsave_failed", "persist.fork_us",
+    "persist.loads", "persist.load_bytes", "persist.load_us",
+};
+
+/* per-command counters; sorted for bsearch, anything else counts as "other" */
+static const char* const stat_cmd_names[] = {
+    "abort", "addtask", "append", "autosave", "begin", "bgsave", "bootprof", "build", "buildcache", "cal", "cat",
+    "clear", "commit", "compile", "date", "echo", "edit", "export", "fastboot", "grep", "head", "help", "history", "hostname",
+    "httpd", "import", "ip", "jobs", "killtask", "ls", "lsof", "man", "patch", "powerbtn", "poweroff", "prompt", "ps",
+    "reboot", "resume", "rm", "run", "script", "sort", "spawn", "stat", "stats", "suspend", "sync", "sysinfo", "tail",
+    "tee", "touch", "truncate", "uniq", "uptime", "version", "vfs_budget", "vmstat", "wait", "watch", "wc", "who",
+    "whoami", "write",
+};
+#define ST_NCMDS ((int)(sizeof(stat_cmd_names) / sizeof(stat_cmd_names[0])))
+
+typedef struct stat_block {
+    unsigned long long v[ST_COUNT];
+    unsigned long long cmd[ST_NCMDS + 1];     /* last slot: other */
+    struct stat_block* next;
+} stat_block_t;
+
+#if defined(__GNUC__)
+#define STAT_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STAT_STORE(p, x) __atomic_store_n((p), (x), __ATOMIC_RELAXED)
+#else
+#define STAT_LOAD(p) (*(volatile unsigned long long*)(p))
+#define STAT_STORE(p, x) (*(volatile unsigned long long*)(p) = (x))
+#endif
+
+static SOS_TLS stat_block_t* stat_tls;
+static stat_block_t stat_retired;
+static stat_block_t* stat_blocks;
+#ifndef _WIN32
+static pthread_mutex_t stat_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stat_key;
+static pthread_once_t stat_once = PTHREAD_ONCE_INIT;
+
+static void stat_retire(void* arg) {
+    stat_block_t* b = arg;
+    pthread_mutex_lock(&stat_mtx);
+    for (stat_block_t** pp = &stat_blocks; *pp; pp = &(*pp)->next)
+        if (*pp == b) { *pp = b->next; break; }
+    for (int i = 0; i < ST_COUNT; ++i) stat_retired.v[i] += b->v[i];
+    for (int i = 0; i <= ST_NCMDS; ++i) stat_retired.cmd[i] += b->cmd[i];
+    pthread_mutex_unlock(&stat_mtx);
+    free(b);
+}
+
+static void stat_key_init() { pthread_key_create(&stat_key, stat_retire); }
+#endif
+
+/* first use on a thread: allocate and register its block */
+static stat_block_t* stat_attach() {
+#ifndef _WIN32
+    stat_block_t* b = calloc(1, sizeof(*b));
+    if (!b) return &stat_retired;   /* racy but harmless fallback */
+    pthread_once(&stat_once, stat_key_init);
+    pthread_setspecific(stat_key, b);
+    pthread_mutex_lock(&stat_mtx);
+    b->next = stat_blocks;
+    stat_blocks = b;
+    pthread_mutex_unlock(&stat_mtx);
+    stat_tls = b;
+#else
+    stat_tls = &stat_retired;
+#endif
+    return stat_tls;
+}
+
+static inline stat_block_t* stat_block() {
+    return stat_tls ? stat_tls : stat_attach();
+}
+
+#define STAT_ADD(id, n) do { \
+        unsigned long long* p_ = &stat_block()->v[id]; \
+        STAT_STORE(p_, STAT_LOAD(p_) + (unsigned long long)(n)); \
+    } while (0)
+#define STAT_INC(id) STAT_ADD(id, 1)
+
+static int stat_cmd_cmp(const void* key, const void* elem) {
+    return strcmp((const char*)key, *(const char* const*)elem);
+}
+
+/* a command's counter slot; ST_NCMDS for "other" */
+static int stat_command_index(const char* cmd) {
+    const char* const* hit = bsearch(cmd, stat_cmd_names, ST_NCMDS, sizeof(stat_cmd_names[0]), stat_cmd_cmp);
+    return hit ? (int)(hit - stat_cmd_names) : ST_NCMDS;
+}
+
+static void stat_command_at(int i) {
+    stat_block_t* b = stat_block();
+    STAT_STORE(&b->cmd[i], STAT_LOAD(&b->cmd[i]) + 1);
+    STAT_STORE(&b->v[ST_COMMANDS], STAT_LOAD(&b->v[ST_COMMANDS]) + 1);
+}
+
+static void stat_command(const char* cmd) {
+    stat_command_at(stat_command_index(cmd));
+}
+
+/* sums every live block and the retired totals */
+static void stat_collect(stat_block_t* out) {
+    memset(out, 0, sizeof(*out));
+#ifndef _WIN32
+    pthread_mutex_lock(&stat_mtx);
+#endif
+    for (int i = 0; i < ST_COUNT; ++i) out->v[i] = stat_retired.v[i];
+    for (int i = 0; i <= ST_NCMDS; ++i) out->cmd[i] = stat_retired.cmd[i];
+    for (stat_block_t* b = stat_blocks; b; b = b->next) {
+        for (int i = 0; i < ST_COUNT; ++i) out->v[i] += STAT_LOAD(&b->v[i]);
+        for (int i = 0; i <= ST_NCMDS; ++i) out->cmd[i] += STAT_LOAD(&b->cmd[i]);
+    }
+#ifndef _WIN32
+    pthread_mutex_unlock(&stat_mtx);
+#endif
+}
+
+/* History: entries are NUL-terminated lines packed back to back in a ring
+   arena, and hist_off[] maps a sequence number to its arena offset. The
+   index maps each trigram (hashed into 1 << HIST_TRI_BITS buckets) to the
+   ascending sequence numbers of the entries containing it. A search for
+   three or more characters walks only the shortest of its trigrams' lists
+   and compares text for those candidates; shorter needles scan entries.
+   Postings cost 4 bytes per distinct trigram per entry, at most four times
+   the live text, and evicted entries are trimmed from a list when it is
+   next touched or by a sweep once the total reaches twice the arena size.
+   If the index cannot grow it is dropped and searches scan.
+   The file on disk is append-only and is only read on first use. */
+typedef struct {
+    unsigned* seq;
+    unsigned start, n, cap;     /* [start, n) may still hold evicted entries */
+} hist_post_t;
+
+static char* hist_arena;
+static unsigned* hist_off;
+static hist_post_t* hist_idx;
+static size_t hist_postings = 0;    /* summed over every list's [start, n) */
+static unsigned long long hist_first = 1, hist_next = 1;   /* live: [first, next) */
+static size_t hist_tail = 0;
+static int hist_loaded = 0;
+static FILE* hist_fp;
+
+static unsigned hist_trigram(const char* s) {
+    unsigned h = ((unsigned)(unsigned char)s[0] << 16) | ((unsigned)(unsigned char)s[1] << 8) | (unsigned char)s[2];
+    return (h * 2654435761u) >> (32 - HIST_TRI_BITS);
+}
+
+/* drops postings for evicted entries from the front of a list */
+static void hist_trim(hist_post_t* p) {
+    unsigned s = p->start;
+    while (s < p->n && p->seq[s] < hist_first) s++;
+    hist_postings -= s - p->start;
+    if (s == p->n) p->start = p->n = 0;
+    else if (s > p->n / 2) {
+        memmove(p->seq, p->seq + s, (p->n - s) * sizeof(*p->seq));
+        p->n -= s;
+        p->start = 0;
+    } else p->start = s;
+}
+
+static void hist_idx_free() {
+    if (!hist_idx) return;
+    for (unsigned i = 0; i < (1u << HIST_TRI_BITS); ++i) free(hist_idx[i].seq);
+    free(hist_idx);
+    hist_idx = NULL;
+    hist_postings = 0;
+}
+
+static void hist_index(unsigned long long seq, const char* s, size_t n) {
+    for (size_t i = 0; hist_idx && i + 2 < n; ++i) {
+        hist_post_t* p = &hist_idx[hist_trigram(s + i)];
+        if (p->n > p->start && p->seq[p->n - 1] == (unsigned)seq) continue;
+        hist_trim(p);
+        if (p->n == p->cap) {
+            unsigned ncap = p->cap ? p->cap * 2 : 4;
+            unsigned* ns = realloc(p->seq, ncap * sizeof(*ns));
+            if (!ns) { hist_idx_free(); return; }
+            p->seq = ns;
+            p->cap = ncap;
+        }
+        p->seq[p->n++] = (unsigned)seq;
+        hist_postings++;
+    }
+    if (hist_idx && hist_postings >= 2 * (size_t)HIST_ARENA_BYTES)
+        for (unsigned i = 0; i < (1u << HIST_TRI_BITS); ++i) hist_trim(&hist_idx[i]);
+}
+
+static const char* hist_get(unsigned long long seq) {
+    if (seq < hist_first || seq >= hist_next) return NULL;
+    return hist_arena + hist_off[seq % HIST_MAX_ENTRIES];
+}
+
+static void hist_push(const char* line) {
+    size_t len = strlen(line), need = len + 1;
+    if (!hist_arena || need > HIST_ARENA_BYTES) return;
+    size_t at = hist_tail;
+    int wrap = at + need > HIST_ARENA_BYTES;
+    if (wrap) at = 0;
+    /* evict the oldest entries that sit in the bytes about to be reused */
+    while (hist_first < hist_next) {
+        size_t off = hist_off[hist_first % HIST_MAX_ENTRIES];
+        int reused = wrap ? (off >= hist_tail || off < need)
+                          : (off >= hist_tail && off < at + need);
+        if (!reused && hist_next - hist_first < HIST_MAX_ENTRIES) break;
+        hist_first++;
+    }
+    memcpy(hist_arena + at, line, need);
+    hist_off[hist_next % HIST_MAX_ENTRIES] = (unsigned)at;
+    hist_index(hist_next, line, len);
+    hist_next++;
+    hist_tail = at + need;
+}
+
+/* rewrites the file with only the entries still held in memory */
+static void hist_compact() {
+    FILE* f = fopen(HISTORY_FILE ".tmp", "wb");
+    if (!f) return;
+    for (unsigned long long q = hist_first; q < hist_next; ++q) { fputs(hist_get(q), f); fputc('\n', f); }
+    if (fclose(f) != 0) { remove(HISTORY_FILE ".tmp"); return; }
+    if (hist_fp) { fclose(hist_fp); hist_fp = NULL; }
+#ifdef _WIN32
+    remove(HISTORY_FILE);
+#endif
+    rename(HISTORY_FILE ".tmp", HISTORY_FILE);
+}
+
+static void hist_ensure_loaded() {
+    if (hist_loaded) return;
+    hist_loaded = 1;
+    hist_arena = malloc(HIST_ARENA_BYTES);
+    hist_off = malloc(HIST_MAX_ENTRIES * sizeof(*hist_off));
+    if (!hist_arena || !hist_off) {
+        free(hist_arena); free(hist_off);
+        hist_arena = NULL; hist_off = NULL;
+        return;
+    }
+    hist_idx = calloc(1u << HIST_TRI_BITS, sizeof(*hist_idx));
+    FILE* f = fopen(HISTORY_FILE, "rb");
+    if (!f) return;
+    /* only the tail of the file can fit in the arena */
+    long size = 0;
+    char line[2100];
+    if (fseek(f, 0, SEEK_END) == 0) size = ftell(f);
+    if (size > (long)HIST_ARENA_BYTES) {
+        fseek(f, size - (long)HIST_ARENA_BYTES, SEEK_SET);
+        if (!fgets(line, sizeof(line), f)) line[0] = '\0';   /* skip partial line */
+    } else fseek(f, 0, SEEK_SET);
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0]) hist_push(line);
+    }
+    fclose(f);
+    if (size > 2 * (long)HIST_ARENA_BYTES) hist_compact();
+}
+
+static void save_history_line(const char* line) {
+    if (!line || line[0] == '\0') return;
+    /* until someone looks at history, the file is the only copy */
+    if (hist_loaded) hist_push(line);
+    if (!hist_fp) hist_fp = fopen(HISTORY_FILE, "ab");
+    if (hist_fp) {
+        fputs(line, hist_fp);
+        fputc('\n', hist_fp);
+        fflush(hist_fp);
+    } else if (!hist_loaded) {
+        hist_ensure_loaded();
+        hist_push(line);
+    }
+}
+
+static int hist_match(unsigned long long q, const char* needle, size_t n, int prefix) {
+    const char* e = hist_get(q);
+    return prefix ? strncmp(e, needle, n) == 0 : strstr(e, needle) != NULL;
+}
+
+/* newest match older than 'before'; 0 if none. prefix=1 anchors at the start */
+static unsigned long long hist_search(const char* needle, int prefix, unsigned long long before) {
+    size_t n = strlen(needle);
+    if (before > hist_next) before = hist_next;
+    if (n < 3 || !hist_idx) {
+        for (unsigned long long q = before; q-- > hist_first; )
+            if (hist_match(q, needle, n, prefix)) return q;
+        return 0;
+    }
+    /* every match holds all of the needle's trigrams: walk the rarest */
+    hist_post_t* best = NULL;
+    for (size_t i = 0; i + 2 < n; ++i) {
+        hist_post_t* p = &hist_idx[hist_trigram(needle + i)];
+        hist_trim(p);
+        if (!best || p->n - p->start < best->n - best->start) best = p;
+    }
+    unsigned lo = best->start, hi = best->n;      /* first posting >= before */
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (best->seq[mid] < before) lo = mid + 1; else hi = mid;
+    }
+    while (lo-- > best->start)
+        if (hist_match(best->seq[lo], needle, n, prefix)) return best->seq[lo];
+    return 0;
+}
+
+/* history [N] | history <prefix> | history -r <text> */
+static void show_history(const char* args) {
+    hist_ensure_loaded();
+    if (!hist_arena) { sh_printf("History unavailable\n"); return; }
+    while (*args == ' ') args++;
+    int reverse = strncmp(args, "-r", 2) == 0 && (args[2] == ' ' || args[2] == '\0');
+    if (reverse) { args += 2; while (*args == ' ') args++; }
+    if (args[0] == '\0' && !reverse) {
+        unsigned long long q = hist_next - hist_first > CMD_HISTORY ? hist_next - CMD_HISTORY : hist_first;
+        for (; q < hist_next; ++q) sh_printf("%5llu  %s\n", q, hist_get(q));
+        return;
+    }
+    if (!reverse && strspn(args, "0123456789") == strlen(args)) {
+        unsigned long long cnt = strtoull(args, NULL, 10);
+        unsigned long long q = hist_next - hist_first > cnt ? hist_next - cnt : hist_first;
+        for (; q < hist_next; ++q) sh_printf("%5llu  %s\n", q, hist_get(q));
+        return;
+    }
+    /* searches list the newest CMD_HISTORY matches, oldest first (reverse: newest first) */
+    unsigned long long hits[CMD_HISTORY];
+    int nhits = 0;
+    for (unsigned long long q = hist_search(args, !reverse, hist_next); q && nhits < CMD_HISTORY; q = hist_search(args, !reverse, q))
+        hits[nhits++] = q;
+    if (nhits == 0) { sh_printf("No history matches '%s'\n", args); return; }
+    if (reverse) for (int i = 0; i < nhits; ++i) sh_printf("%5llu  %s\n", hits[i], hist_get(hits[i]));
+    else for (int i = nhits - 1; i >= 0; --i) sh_printf("%5llu  %s\n", hits[i], hist_get(hits[i]));
+}
+
+/* expands a leading !!, !N, !?text or !prefix event in place; the rest of
+   the line is kept. Returns 0 (after saying so) when nothing matches. */
+static int history_expand(char* line, size_t sz) {
+    hist_ensure_loaded();
+    size_t wlen = strcspn(line, " \t");
+    char word[256] = {0};
+    if (wlen >= sizeof(word) || !hist_arena) { sh_printf("%.*s: event not found\n", (int)wlen, line); return 0; }
+    memcpy(word, line + 1, wlen - 1);
+    unsigned long long q = 0;
+    if (strcmp(word, "!") == 0) q = hist_next > hist_first ? hist_next - 1 : 0;
+    else if (word[0] && strspn(word, "0123456789") == strlen(word)) q = hist_get(strtoull(word, NULL, 10)) ? strtoull(word, NULL, 10) : 0;
+    else if (word[0] == '?') q = word[1] ? hist_search(word + 1, 0, hist_next) : 0;
+    else if (word[0]) q = hist_search(word, 1, hist_next);
+    if (!q) { sh_printf("%.*s: event not found\n", (int)wlen, line); return 0; }
+    char out[2048];
+    snprintf(out, sizeof(out), "%s%s", hist_get(q), line + wlen);
+    strncpy(line, out, sz - 1);
+    line[sz - 1] = '\0';
+    return 1;
+}
+
+/* Epoch-based reclamation for VFS entries and blobs. A reader publishes
+   the epoch it entered in; retire() tags an object with the epoch at
+   unlink time and bumps the epoch, and the object is freed once every
+   reader still inside is from a later epoch. Readers touch only their own
+   record (one store and a fence per section); writers share a short lock
+   to queue retired objects and reclaim them in batches. */
+typedef struct rcu_reader {
+    unsigned long long epoch;           /* entered epoch + 1, 0 when outside */
+    struct rcu_reader* next;
+} rcu_reader_t;
+
+typedef struct {
+    void* p;
+    void (*fn)(void*);
+    unsigned long long epoch;
+    size_t bytes;
+} rcu_item_t;
+
+#define RCU_BATCH 32
+#define RCU_BATCH_BYTES (16u << 20)
+
+static unsigned long long rcu_epoch = 1;
+static rcu_reader_t* rcu_readers;
+static rcu_item_t* rcu_limbo;
+static size_t rcu_nlimbo, rcu_caplimbo, rcu_limbo_bytes;
+static SOS_TLS rcu_reader_t rcu_self;     /* lives in TLS: nothing to allocate */
+static SOS_TLS int rcu_registered, rcu_depth;
+#ifndef _WIN32
+static pthread_mutex_t rcu_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t rcu_key;
+static pthread_once_t rcu_once = PTHREAD_ONCE_INIT;
+#define RCU_LOCK() pthread_mutex_lock(&rcu_mtx)
+#define RCU_UNLOCK() pthread_mutex_unlock(&rcu_mtx)
+
+/* thread exit; TLS is still valid while key destructors run */
+static void rcu_detach(void* arg) {
+    RCU_LOCK();
+    for (rcu_reader_t** pp = &rcu_readers; *pp; pp = &(*pp)->next)
+        if (*pp == arg) { *pp = ((rcu_reader_t*)arg)->next; break; }
+    RCU_UNLOCK();
+}
+
+static void rcu_key_init() { pthread_key_create(&rcu_key, rcu_detach); }
+#else
+#define RCU_LOCK() ((void)0)
+#define RCU_UNLOCK() ((void)0)
+#endif
+
+static void rcu_attach() {
+#ifndef _WIN32
+    pthread_once(&rcu_once, rcu_key_init);
+    pthread_setspecific(rcu_key, &rcu_self);
+#endif
+    RCU_LOCK();
+    rcu_self.next = rcu_readers;
+    rcu_readers = &rcu_self;
+    RCU_UNLOCK();
+    rcu_registered = 1;
+}
+
+static void rcu_enter() {
+    if (rcu_depth++ > 0) return;
+    if (!rcu_registered) rcu_attach();
+    __atomic_store_n(&rcu_self.epoch, __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE) + 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void rcu_leave() {
+    if (--rcu_depth > 0) return;
+    __atomic_store_n(&rcu_self.epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* frees every queued object no reader can still see; rcu_mtx held */
+static void rcu_reclaim_locked() {
+    unsigned long long oldest = ~0ull;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (rcu_reader_t* r = rcu_readers; r; r = r->next) {
+        unsigned long long e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+        if (e && e - 1 < oldest) oldest = e - 1;
+    }
+    size_t keep = 0;
+    rcu_limbo_bytes = 0;
+    for (size_t i = 0; i < rcu_nlimbo; ++i) {
+        if (rcu_limbo[i].epoch < oldest) { rcu_limbo[i].fn(rcu_limbo[i].p); continue; }
+        rcu_limbo_bytes += rcu_limbo[i].bytes;
+        rcu_limbo[keep++] = rcu_limbo[i];
+    }
+    rcu_nlimbo = keep;
+}
+
+/* p must already be unreachable from the VFS */
+static void rcu_retire(void* p, void (*fn)(void*), size_t bytes) {
+    RCU_LOCK();
+    if (rcu_nlimbo == rcu_caplimbo) {
+        size_t cap = rcu_caplimbo ? rcu_caplimbo * 2 : 64;
+        rcu_item_t* n = realloc(rcu_limbo, cap * sizeof(*n));
+        if (!n) {
+            /* cannot queue it: wait for the readers instead */
+            RCU_UNLOCK();
+            unsigned long long e = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+            for (int busy = 1; busy; ) {
+                busy = 0;
+                RCU_LOCK();
+                for (rcu_reader_t* r = rcu_readers; r; r = r->next) {
+                    unsigned long long re = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+                    if (re && re - 1 <= e && r != &rcu_self) busy = 1;
+                }
+                RCU_UNLOCK();
+            }
+            fn(p);
+            return;
+        }
+        rcu_limbo = n;
+        rcu_caplimbo = cap;
+    }
+    rcu_item_t* it = &rcu_limbo[rcu_nlimbo++];
+    it->p = p;
+    it->fn = fn;
+    it->bytes = bytes;
+    it->epoch = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    rcu_limbo_bytes += bytes;
+    if (rcu_nlimbo >= RCU_BATCH || rcu_limbo_bytes >= RCU_BATCH_BYTES) rcu_reclaim_locked();
+    RCU_UNLOCK();
+}
+
+/* File storage. Appends copy past the end of a blob and then publish the
+   new size. Overwrites and truncates of an unpinned blob change it in
+   place inside a seq count (odd while running), and readers that copy
+   without a lock retry when seq moved under them; a pinned blob never
+   changes below its size, so such changes install a new blob and retire
+   the old one. Readers either copy from whatever blob they load or pin it
+   with a reference to use it after leaving the read section. */
+static unsigned long long blob_next_id;
+
+static vblob_t* blob_new(size_t cap) {
+    vblob_t* b = malloc(sizeof(vblob_t) + cap + 1);
+    if (!b) return NULL;
+    b->cap = cap;
+    b->size = 0;
+    b->id = __atomic_add_fetch(&blob_next_id, 1, __ATOMIC_RELAXED);
+    b->refs = 1;
+    b->seq = 0;
+    b->data[0] = '\0';
+    return b;
+}
+
+/* drops one reference; retiring a blob drops the file's */
+static void blob_unref(void* p) {
+    vblob_t* b = p;
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0) free(b);
+}
+
+/* takes a reference inside an RCU section; once an in-place change that
+   raced with it is over, the bytes below size stay fixed until unref */
+static void blob_pin(vblob_t* b) {
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&b->seq, __ATOMIC_SEQ_CST) & 1) {}
+}
+
+/* starts an in-place change below b's size, with the file lock held; 0
+   if b is pinned and has to be copied instead */
+static int blob_change_begin(vblob_t* b) {
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&b->refs, __ATOMIC_SEQ_CST) == 1) return 1;
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* the content is new, so the blob takes a new id */
+static void blob_change_end(vblob_t* b) {
+    __atomic_store_n(&b->id, __atomic_add_fetch(&blob_next_id, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* copies b's bytes [off, off + len), clipped to its size, into dst,
+   retrying while an in-place change overlaps the copy; call inside an
+   RCU section */
+static size_t blob_read(vblob_t* b, size_t off, char* dst, size_t len) {
+    for (;;) {
+        unsigned seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+        size_t size = __atomic_load_n(&b->size, __ATOMIC_ACQUIRE);
+        size_t n = off < size ? (len < size - off ? len : size - off) : 0;
+        if (seq & 1) continue;
+        if (n) memcpy(dst, b->data + off, n);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq) return n;
+    }
+}
+
+static size_t blob_copy(vblob_t* b, size_t off, size_t len, strbuf_t* out) {
+    size_t size = __atomic_load_n(&b->size, __ATOMIC_ACQUIRE);
+    size_t n = off < size ? (len < size - off ? len : size - off) : 0;
+    if (n == 0 || !sb_reserve(out, n)) return 0;
+    n = blob_read(b, off, out->data + out->len, n);
+    out->len += n;
+    out->data[out->len] = '\0';
+    return n;
+}
+
+/* Tiered storage. Under a budget (vfs_budget) the bodies of cold files
+   move to an anonymous backing file and their blob pointer becomes NULL;
+   the next access faults the body back in under the file lock, with its
+   old blob id, so versions and ETags do not change. Victims are picked by
+   a CLOCK sweep over the slot table: every access sets a file's hot bit
+   and the sweep clears it once before evicting. A pinned blob stays valid
+   for its holder after its file is evicted. Sweeps run after a write or
+   fault has released its file lock, and only try-lock their victims. */
+#ifndef _WIN32
+#define TIER_IO_LOCK(t) pthread_mutex_lock(&(t)->io_mtx)
+#define TIER_IO_UNLOCK(t) pthread_mutex_unlock(&(t)->io_mtx)
+#define TIER_SWEEP_TRYLOCK(t) (pthread_mutex_trylock(&(t)->sweep_mtx) == 0)
+#define TIER_SWEEP_UNLOCK(t) pthread_mutex_unlock(&(t)->sweep_mtx)
+#define FILE_TRYLOCK(f) (pthread_mutex_trylock(&(f)->mtx) == 0)
+#define tier_seek(fp, off) fseeko((fp), (off_t)(off), SEEK_SET)
+#else
+#define TIER_IO_LOCK(t) ((void)0)
+#define TIER_IO_UNLOCK(t) ((void)0)
+#define TIER_SWEEP_TRYLOCK(t) 1
+#define TIER_SWEEP_UNLOCK(t) ((void)0)
+#define FILE_TRYLOCK(f) 1
+#define tier_seek(fp, off) _fseeki64((fp), (off), SEEK_SET)
+#endif
+
+/* a range of len bytes in the store; -1 if it cannot be opened. io lock held */
+static long long tier_alloc(tier_t* t, long long len) {
+    for (size_t i = 0; i < t->nholes; ++i) {
+        tier_extent_t* h = &t->holes[i];
+        if (h->len < len) continue;
+        long long off = h->off;
+        h->off += len;
+        h->len -= len;
+        if (h->len == 0) memmove(h, h + 1, (t->nholes - i - 1) * sizeof(*h)), t->nholes--;
+        return off;
+    }
+    if (!t->store && !(t->store = tmpfile())) return -1;
+    long long off = t->end;
+    t->end += len;
+    return off;
+}
+
+/* io lock held */
+static void tier_free(tier_t* t, long long off, long long len) {
+    size_t i = 0;
+    while (i < t->nholes && t->holes[i].off < off) i++;
+    tier_extent_t* prev = i > 0 ? &t->holes[i - 1] : NULL;
+    tier_extent_t* next = i < t->nholes ? &t->holes[i] : NULL;
+    if (prev && prev->off + prev->len == off) {
+        prev->len += len;
+        if (next && prev->off + prev->len == next->off) {
+            prev->len += next->len;
+            memmove(next, next + 1, (t->nholes - i - 1) * sizeof(*next));
+            t->nholes--;
+        }
+    } else if (next && off + len == next->off) {
+        next->off = off;
+        next->len += len;
+    } else {
+        if (t->nholes == t->capholes) {
+            size_t cap = t->capholes ? t->capholes * 2 : 16;
+            tier_extent_t* n = realloc(t->holes, cap * sizeof(*n));
+            if (!n) return;     /* the range is lost until the store goes */
+            t->holes = n;
+            t->capholes = cap;
+        }
+        memmove(&t->holes[i + 1], &t->holes[i], (t->nholes - i) * sizeof(*t->holes));
+        t->holes[i].off = off;
+        t->holes[i].len = len;
+        t->nholes++;
+    }
+    if (t->nholes && t->holes[t->nholes - 1].off + t->holes[t->nholes - 1].len == t->end)
+        t->end = t->holes[--t->nholes].off;
+}
+
+/* reads n bytes of the store at off without moving the shared file
+   offset, so a forked child can read while the parent keeps using the
+   store; io lock held */
+static int tier_pread(tier_t* t, long long off, char* dst, size_t n) {
+#ifndef _WIN32
+    int fd = fileno(t->store);
+    while (n) {
+        ssize_t r = pread(fd, dst, n, (off_t)off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+        dst += r;
+        off += r;
+        n -= (size_t)r;
+    }
+    return 1;
+#else
+    return tier_seek(t->store, off) == 0 && fread(dst, 1, n, t->store) == n;
+#endif
+}
+
+/* forgets an evicted body that is no longer needed; the file lock is held */
+static void tier_forget_locked(vfile_t* f) {
+    tier_t* t = &sos_cur->tier;
+    if (f->blob || f->cold_size == 0) return;
+    TIER_IO_LOCK(t);
+    tier_free(t, f->cold_off, (long long)f->cold_size);
+    TIER_IO_UNLOCK(t);
+    f->cold_size = 0;
+}
+
+/* writes f's body to the store and drops it from memory; the file lock is held */
+static int tier_evict_locked(tier_t* t, vfile_t* f) {
+    vblob_t* b = f->blob;
+    size_t size = b->size;
+    TIER_IO_LOCK(t);
+    long long off = tier_alloc(t, (long long)size);
+    /* flushed at once so tier_pread() sees it */
+    int ok = off >= 0 && tier_seek(t->store, off) == 0 && fwrite(b->data, 1, size, t->store) == size && fflush(t->store) == 0;
+    if (!ok && off >= 0) tier_free(t, off, (long long)size);
+    TIER_IO_UNLOCK(t);
+    if (!ok) return 0;
+    f->cold_off = off;
+    f->cold_size = size;
+    f->cold_id = b->id;
+    __atomic_store_n(&f->blob, NULL, __ATOMIC_RELEASE);
+    rcu_retire(b, blob_unref, b->cap);
+    STAT_INC(ST_TIER_EVICTIONS);
+    STAT_ADD(ST_TIER_BYTES_OUT, size);
+    return 1;
+}
+
+/* f's blob, faulted back in if it was evicted; NULL if that fails. The
+   file lock is held. A body forgotten when its entry died comes back empty. */
+static vblob_t* tier_resident_locked(vfile_t* f) {
+    __atomic_store_n(&f->hot, 1, __ATOMIC_RELAXED);
+    if (f->blob) return f->blob;
+    tier_t* t = &sos_cur->tier;
+    size_t size = f->cold_size;
+    vblob_t* b = blob_new(size);
+    if (!b) return NULL;
+    TIER_IO_LOCK(t);
+    int ok = size == 0 || (tier_seek(t->store, f->cold_off) == 0 && fread(b->data, 1, size, t->store) == size);
+    if (ok && size) tier_free(t, f->cold_off, (long long)size);
+    TIER_IO_UNLOCK(t);
+    if (!ok) { free(b); return NULL; }
+    b->data[size] = '\0';
+    b->size = size;
+    if (f->cold_id) b->id = f->cold_id;
+    f->cold_size = 0;
+    __atomic_store_n(&f->blob, b, __ATOMIC_RELEASE);
+    STAT_INC(ST_TIER_MISSES);
+    STAT_ADD(ST_TIER_BYTES_IN, size);
+    return b;
+}
+
+/* memory held by resident bodies of linked files */
+static size_t tier_resident() {
+    size_t used = 0;
+    rcu_enter();
+    for (int i = 0; i < FS_MAX_FILES; ++i) {
+        vfile_t* f = __atomic_load_n(&sos_cur->vfs[i], __ATOMIC_ACQUIRE);
+        vblob_t* b = f ? __atomic_load_n(&f->blob, __ATOMIC_ACQUIRE) : NULL;
+        if (b) used += sizeof(vblob_t) + b->cap;
+    }
+    rcu_leave();
+    return used;
+}
+
+/* evicts cold bodies until the resident ones fit the budget; a no-op
+   without a budget. Call without any file lock held. */
+static void tier_balance() {
+    tier_t* t = &sos_cur->tier;
+    size_t budget = __atomic_load_n(&t->budget, __ATOMIC_RELAXED);
+    if (!budget || !TIER_SWEEP_TRYLOCK(t)) return;
+    size_t used = tier_resident();
+    rcu_enter();
+    /* two turns of the clock: the first may only clear hot bits */
+    for (int n = 0; used > budget && n < 2 * FS_MAX_FILES; ++n) {
+        vfile_t* f = __atomic_load_n(&sos_cur->vfs[t->hand], __ATOMIC_ACQUIRE);
+        t->hand = (t->hand + 1) % FS_MAX_FILES;
+        vblob_t* b = f ? __atomic_load_n(&f->blob, __ATOMIC_ACQUIRE) : NULL;
+        if (!b || __atomic_load_n(&b->size, __ATOMIC_ACQUIRE) == 0) continue;
+        if (__atomic_load_n(&f->hot, __ATOMIC_RELAXED)) { __atomic_store_n(&f->hot, 0, __ATOMIC_RELAXED); continue; }
+        if (!FILE_TRYLOCK(f)) continue;     /* busy, so not cold */
+        b = f->blob;
+        size_t freed = b ? sizeof(vblob_t) + b->cap : 0;
+        int ok = !b || b->size == 0 || tier_evict_locked(t, f);
+        FILE_UNLOCK(f);
+        if (!ok) break;
+        if (b && b->size) used -= freed < used ? freed : used;
+    }
+    rcu_leave();
+    TIER_SWEEP_UNLOCK(t);
+}
+
+/* f's blob for reading inside an RCU section, faulting it back in if it
+   was evicted; NULL only if that fails. Every read comes through here,
+   so it also counts the access; atime moves at most once a second. */
+static vblob_t* vfile_blob(vfile_t* f) {
+    long long now = sos_now_us();
+    __atomic_fetch_add(&f->reads, 1, __ATOMIC_RELAXED);
+    if (now - __atomic_load_n(&f->atime, __ATOMIC_RELAXED) >= 1000000) __atomic_store_n(&f->atime, now, __ATOMIC_RELAXED);
+    vblob_t* b = __atomic_load_n(&f->blob, __ATOMIC_ACQUIRE);
+    if (b) {
+        if (!__atomic_load_n(&f->hot, __ATOMIC_RELAXED)) __atomic_store_n(&f->hot, 1, __ATOMIC_RELAXED);
+        STAT_INC(ST_TIER_HITS);
+        return b;
+    }
+    FILE_LOCK(f);
+    b = tier_resident_locked(f);
+    FILE_UNLOCK(f);
+    tier_balance();
+    return b;
+}
+
+/* size without faulting the body in */
+static size_t vfile_size(vfile_t* f) {
+    vblob_t* b = __atomic_load_n(&f->blob, __ATOMIC_ACQUIRE);
+    if (b) return __atomic_load_n(&b->size, __ATOMIC_ACQUIRE);
+    FILE_LOCK(f);
+    size_t n = f->blob ? f->blob->size : f->cold_size;
+    FILE_UNLOCK(f);
+    return n;
+}
+
+/* the (blob id, size) pair naming f's content; the file lock is held */
+static void vfile_version_locked(vfile_t* f, unsigned long long* id, size_t* size) {
+    *id = f->blob ? f->blob->id : f->cold_id;
+    *size = f->blob ? f->blob->size : f->cold_size;
+}
+
+static void vfile_free(void* p) {
+    vfile_t* f = p;
+    if (f->blob) blob_unref(f->blob);
+#ifndef _WIN32
+    pthread_mutex_destroy(&f->mtx);
+#endif
+    free(f);
+}
+
+/* a new entry owning blob b (or an empty one) */
+static vfile_t* vfile_new(const char* name, vblob_t* b) {
+    vfile_t* f = calloc(1, sizeof(*f));
+    if (!f || (!b && !(b = blob_new(0)))) { free(f); return NULL; }
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->blob = b;
+    f->refs = 1;
+    f->ctime = f->mtime = f->atime = sos_now_us();
+#ifndef _WIN32
+    pthread_mutex_init(&f->mtx, NULL);
+#endif
+    return f;
+}
+
+/* takes a reference unless the entry is already on its way out; call
+   inside an RCU section */
+static int vfile_tryref(vfile_t* f) {
+    unsigned r = __atomic_load_n(&f->refs, __ATOMIC_RELAXED);
+    do {
+        if (r == 0) return 0;
+    } while (!__atomic_compare_exchange_n(&f->refs, &r, r + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return 1;
+}
+
+/* drops a reference; the last one retires the entry */
+static void vfile_unref(vfile_t* f) {
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    /* readers still inside their section fault in an empty body */
+    FILE_LOCK(f);
+    tier_forget_locked(f);
+    size_t cap = f->blob ? f->blob->cap : 0;
+    FILE_UNLOCK(f);
+    rcu_retire(f, vfile_free, cap);
+}
+
+/* fills pred with the link at each level that precedes the first name
+   not below name; *pred[0] is that entry. Namespace lock held. */
+static void name_index_seek(name_index_t* x, const char* name, vfile_t** pred[NAME_INDEX_LEVELS]) {
+    vfile_t* p = NULL;
+    for (int i = NAME_INDEX_LEVELS - 1; i >= 0; --i) {
+        vfile_t** link = p ? &p->next[i] : &x->head[i];
+        while (*link && strcmp((*link)->name, name) < 0) {
+            p = *link;
+            link = &p->next[i];
+        }
+        pred[i] = link;
+    }
+}
+
+/* first entry whose name is not below name */
+static vfile_t* name_index_lower(name_index_t* x, const char* name) {
+    vfile_t** pred[NAME_INDEX_LEVELS];
+    name_index_seek(x, name, pred);
+    return *pred[0];
+}
+
+static void name_index_insert(name_index_t* x, vfile_t* f) {
+    vfile_t** pred[NAME_INDEX_LEVELS];
+    name_index_seek(x, f->name, pred);
+    /* xorshift; each level holds a quarter of the one below */
+    x->rng ^= x->rng << 13;
+    x->rng ^= x->rng >> 17;
+    x->rng ^= x->rng << 5;
+    int levels = 1;
+    while (levels < NAME_INDEX_LEVELS && ((x->rng >> (2 * levels)) & 3) == 0) levels++;
+    for (int i = 0; i < levels; ++i) {
+        f->next[i] = *pred[i];
+        *pred[i] = f;
+    }
+    x->count++;
+}
+
+static void name_index_remove(name_index_t* x, vfile_t* f) {
+    vfile_t** pred[NAME_INDEX_LEVELS];
+    name_index_seek(x, f->name, pred);
+    for (int i = 0; i < NAME_INDEX_LEVELS; ++i)
+        if (*pred[i] == f) *pred[i] = f->next[i];
+    x->count--;
+}
+
+/* publishes a new entry in a free slot; namespace lock held */
+static void vfile_link_locked(int slot, vfile_t* f) {
+    name_index_insert(&sos_cur->names, f);
+    __atomic_store_n(&sos_cur->vfs[slot], f, __ATOMIC_RELEASE);
+}
+
+/* takes the entry out of the namespace; the namespace lock is held */
+static void vfile_unlink_locked(int slot) {
+    vfile_t* f = sos_cur->vfs[slot];
+    name_index_remove(&sos_cur->names, f);
+    __atomic_store_n(&sos_cur->vfs[slot], NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&f->unlinked, 1, __ATOMIC_RELEASE);
+}
+
+/* Watches. A watch task subscribes to one name, or to every name that
+   starts with a prefix. Writers post changes into the subscribers' queues
+   through a hash index: one pass over the name yields the hash of each
+   of its prefixes, and only lengths that some prefix watch uses are
+   probed. With no watches a change costs one load. The scheduler runs
+   the queued reactions on the next tick, and the shell ticks after every
+   command, so a reaction follows the command that caused it. Changes from
+   other threads (HTTP, replication, jobs) also make the wake pipe
+   readable, for a loop that waits on it to tick. */
+#ifndef _WIN32
+#define WATCH_LOCK() pthread_mutex_lock(&sos_cur->watches.mtx)
+#define WATCH_UNLOCK() pthread_mutex_unlock(&sos_cur->watches.mtx)
+#else
+#define WATCH_LOCK() ((void)0)
+#define WATCH_UNLOCK() ((void)0)
+#endif
+
+static SOS_TLS watch_t* watch_running;    /* its own reaction's changes are not posted back */
+
+/* returns 1 if the change was queued */
+static int watch_enqueue(watch_t* w, int op, const char* name) {
+    if (w == watch_running) return 0;
+    if (w->count) {
+        /* a burst of the same change to the same file runs the reaction once */
+        watch_event_t* last = &w->q[(w->head + w->count - 1) % WATCH_QUEUE];
+        if (last->op == op && strcmp(last->name, name) == 0) return 0;
+    }
+    if (w->count == WATCH_QUEUE) { w->dropped++; STAT_INC(ST_WATCH_DROPPED); return 0; }
+    watch_event_t* e = &w->q[(w->head + w->count) % WATCH_QUEUE];
+    e->op = op;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    __atomic_store_n(&w->count, w->count + 1, __ATOMIC_RELEASE);
+    STAT_INC(ST_WATCH_EVENTS);
+    return 1;
+}
+
+static void watch_post(int op, const char* name) {
+    watch_index_t* ix = &sos_cur->watches;
+    if (!__atomic_load_n(&ix->count, __ATOMIC_ACQUIRE) || op == SOS_MUT_RESET) return;
+    size_t len = strlen(name);
+    int queued = 0;
+    WATCH_LOCK();
+    unsigned long long h = FNV64_INIT;
+    for (size_t l = 0; l <= len; ++l) {
+        if (l == len || ix->nlen[l]) {
+            for (watch_t* w = ix->bucket[h % WATCH_BUCKETS]; w; w = w->next) {
+                if (strlen(w->key) != l || memcmp(w->key, name, l) != 0) continue;
+                if (w->prefix || l == len) queued |= watch_enqueue(w, op, name);
+            }
+        }
+        if (l < len) h = fnv1a64(name + l, 1, h);
+    }
+#ifndef _WIN32
+    if (queued && !ix->woken && ix->wake[1] >= 0) {
+        ix->woken = 1;
+        if (write(ix->wake[1], "", 1) < 0) { /* already readable */ }
+    }
+#else
+    (void)queued;
+#endif
+    WATCH_UNLOCK();
+}
+
+/* empties the wake pipe before a tick runs what it announced */
+static void watch_unwake(void) {
+#ifndef _WIN32
+    watch_index_t* ix = &sos_cur->watches;
+    WATCH_LOCK();
+    if (ix->woken) {
+        char c[16];
+        while (read(ix->wake[0], c, sizeof(c)) > 0) {}
+        ix->woken = 0;
+    }
+    WATCH_UNLOCK();
+#endif
+}
+
+static void watch_index_add(watch_t* w) {
+    watch_index_t* ix = &sos_cur->watches;
+    size_t len = strlen(w->key);
+    WATCH_LOCK();
+    watch_t** b = &ix->bucket[fnv1a64(w->key, len, FNV64_INIT) % WATCH_BUCKETS];
+    w->next = *b;
+    *b = w;
+    if (w->prefix) ix->nlen[len]++;
+    __atomic_store_n(&ix->count, ix->count + 1, __ATOMIC_RELEASE);
+    WATCH_UNLOCK();
+}
+
+static void watch_index_remove(watch_t* w) {
+    watch_index_t* ix = &sos_cur->watches;
+    size_t len = strlen(w->key);
+    WATCH_LOCK();
+    for (watch_t** p = &ix->bucket[fnv1a64(w->key, len, FNV64_INIT) % WATCH_BUCKETS]; *p; p = &(*p)->next) {
+        if (*p != w) continue;
+        *p = w->next;
+        if (w->prefix) ix->nlen[len]--;
+        __atomic_store_n(&ix->count, ix->count - 1, __ATOMIC_RELEASE);
+        break;
+    }
+    WATCH_UNLOCK();
+}
+
+/* reports a change to the watches and the mutation hook; writers call it
+   with the file lock held, so each file's changes are reported in the
+   order they land */
+static void vfs_notify(int op, const char* name, unsigned long long off, const void* data, size_t len) {
+    watch_post(op, name);
+    sos_mutation_fn fn = __atomic_load_n(&sos_cur->mut_hook, __ATOMIC_ACQUIRE);
+    if (fn) fn(sos_cur, op, name, off, data, len, __atomic_load_n(&sos_cur->mut_user, __ATOMIC_RELAXED));
+}
+
+/* unlinks every entry; the namespace lock is held */
+static void vfs_clear_locked() {
+    for (int i = 0; i < FS_MAX_FILES; ++i) {
+        vfile_t* f = sos_cur->vfs[i];
+        if (!f) continue;
+        FILE_LOCK(f);
+        vfile_unlink_locked(i);
+        FILE_UNLOCK(f);
+        vfile_unref(f);
+    }
+}
+
+/* VFS persistence. Format v3: "SOSVFS3\n", u32 file count, then per file
+   u32 name length, name, u64 size, i64 ctime, mtime, atime, u64 reads,
+   content. v2 ("SOSVFS2\n") is the same without the four metadata
+   fields. vfs_load_state() also reads the original format, a raw dump of
+   FS_MAX_FILES fixed-size records. */
+#define VFS_STATE_MAGIC "SOSVFS3\n"
+#define VFS_STATE_MAGIC_V2 "SOSVFS2\n"
+
+typedef struct {
+    char name[MAX_NAME];
+    char content[FS_LEGACY_CONTENT];
+    int used;
+} vfile_v1_t;
+
+/* marks the files of an image as saved, unless they were replaced since */
+static void vfs_mark_saved(const vfs_snap_t* snap, int n, unsigned long long removals) {
+    VFS_LOCK();
+    for (int i = 0; i < n; ++i) {
+        vfile_t* f = sos_cur->vfs[snap[i].slot];
+        if (f != snap[i].f) continue;
+        FILE_LOCK(f);
+        f->saved_id = snap[i].id;
+        f->saved_size = snap[i].size;
+        FILE_UNLOCK(f);
+    }
+    sos_cur->saved_removals = removals;
+    VFS_UNLOCK();
+}
+
+/* writes the state file through a temporary and a rename */
+static int vfs_write_image() {
+    char tmp[sizeof(sos_cur->state_path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", sos_cur->state_path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    unsigned long long t0 = now_us(), bytes = 12;
+    uint32_t count = 0;
+    vfs_snap_t snap[FS_MAX_FILES];
+    /* the namespace lock keeps the file set fixed; contents are snapshotted per file */
+    VFS_LOCK();
+    rcu_enter();
+    unsigned long long removals = sos_cur->removals;
+    for (int i = 0; i < FS_MAX_FILES; ++i) if (sos_cur->vfs[i]) count++;
+    fwrite(VFS_STATE_MAGIC, 1, 8, f);
+    fwrite(&count, sizeof(count), 1, f);
+    int n = 0;
+    for (int i = 0; i < FS_MAX_FILES; ++i) {
+        vfile_t* vf = sos_cur->vfs[i];
+        if (!vf) continue;
+        /* evicted bodies are copied from the backing store, not faulted in */
+        FILE_LOCK(vf);
+        vblob_t* b = vf->blob;
+        if (b) blob_pin(b);
+        snap[n].slot = i;
+        snap[n].f = vf;
+        vfile_version_locked(vf, &snap[n].id, &snap[n].size);
+        uint32_t nlen = (uint32_t)strlen(vf->name);
+        uint64_t size = snap[n++].size;
+        fwrite(&nlen, sizeof(nlen), 1, f);
+        fwrite(vf->name, 1, nlen, f);
+        fwrite(&size, sizeof(size), 1, f);
+        int64_t meta[4] = { vf->ctime, __atomic_load_n(&vf->mtime, __ATOMIC_RELAXED),
+                            __atomic_load_n(&vf->atime, __ATOMIC_RELAXED),
+                            (int64_t)__atomic_load_n(&vf->reads, __ATOMIC_RELAXED) };
+        fwrite(meta, sizeof(meta), 1, f);
+        if (b) {
+            FILE_UNLOCK(vf);
+            if (size) fwrite(b->data, 1, (size_t)size, f);
+            blob_unref(b);
+        } else {
+            tier_t* t = &sos_cur->tier;
+            char chunk[65536];
+            for (uint64_t done = 0; done < size; ) {
+                size_t len = size - done < sizeof(chunk) ? (size_t)(size - done) : sizeof(chunk);
+                TIER_IO_LOCK(t);
+                if (!tier_pread(t, vf->cold_off + (long long)done, chunk, len)) memset(chunk, 0, len);
+                TIER_IO_UNLOCK(t);
+                fwrite(chunk, 1, len, f);
+                done += len;
+            }
+            FILE_UNLOCK(vf);
+        }
+        bytes += sizeof(nlen) + nlen + sizeof(size) + sizeof(meta) + size;
+    }
+    rcu_leave();
+    VFS_UNLOCK();
+    if (fclose(f) != 0) { remove(tmp); return -1; }
+#ifdef _WIN32
+    remove(sos_cur->state_path);
+#endif
+    int rc = rename(tmp, sos_cur->state_path) == 0 ? 0 : -1;
+    if (rc == 0) vfs_mark_saved(snap, n, removals);
+    STAT_INC(ST_SAVES);
+    STAT_ADD(ST_SAVE_BYTES, bytes);
+    STAT_ADD(ST_SAVE_US, now_us() - t0);
+    return rc;
+}
+
+/* fills empty slots straight from the state file; vfs_init() holds the namespace lock */
+static void vfs_load_state() {
+    if (sos_cur->state_path[0] == '\0') return;
+    FILE *f = fopen(sos_cur->state_path, "rb");
+    if (!f) return;
+    unsigned long long t0 = now_us();
+    char magic[8];
+    int v3 = 0;
+    if (fread(magic, 1, 8, f) == 8 && ((v3 = memcmp(magic, VFS_STATE_MAGIC, 8) == 0) || memcmp(magic, VFS_STATE_MAGIC_V2, 8) == 0)) {
+        uint32_t count = 0;
+        if (fread(&count, sizeof(count), 1, f) != 1) count = 0;
+        for (uint32_t i = 0, slot = 0; i < count && slot < FS_MAX_FILES; ++i) {
+            uint32_t nlen;
+            uint64_t size;
+            char name[MAX_NAME];
+            if (fread(&nlen, sizeof(nlen), 1, f) != 1 || nlen == 0 || nlen >= MAX_NAME) break;
+            int64_t meta[4];
+            if (fread(name, 1, nlen, f) != nlen || fread(&size, sizeof(size), 1, f) != 1 || size > FS_MAX_CONTENT) break;
+            if (v3 && fread(meta, sizeof(meta), 1, f) != 1) break;
+            name[nlen] = '\0';
+            vblob_t *b = blob_new((size_t)size);
+            if (!b || fread(b->data, 1, (size_t)size, f) != size) { free(b); break; }
+            b->data[size] = '\0';
+            b->size = (size_t)size;
+            vfile_t *vf = vfile_new(name, b);
+            if (!vf) { free(b); break; }
+            vf->saved_id = b->id;
+            vf->saved_size = b->size;
+            if (v3) {
+                vf->ctime = meta[0];
+                vf->mtime = meta[1];
+                vf->atime = meta[2];
+                vf->reads = (unsigned long long)meta[3];
+            }
+            vfile_link_locked((int)slot++, vf);
+        }
+    } else {
+        /* v1: int count followed by the raw fixed-size array */
+        static vfile_v1_t old[FS_MAX_FILES];
+        int files = 0;
+        rewind(f);
+        if (fread(&files, sizeof(int), 1, f) == 1) {
+            size_t got = fread(old, sizeof(vfile_v1_t), FS_MAX_FILES, f);
+            for (size_t i = 0; i < got; ++i) {
+                if (!old[i].used) continue;
+                old[i].name[MAX_NAME-1] = '\0';
+                old[i].content[FS_LEGACY_CONTENT-1] = '\0';
+                size_t len = strlen(old[i].content);
+                vblob_t *b = blob_new(len);
+                vfile_t *vf = b ? vfile_new(old[i].name, b) : NULL;
+                if (!vf) { free(b); continue; }
+                memcpy(b->data, old[i].content, len + 1);
+                b->size = len;
+                vfile_link_locked((int)i, vf);
+            }
+        }
+    }
+    long bytes = ftell(f);
+    fclose(f);
+    STAT_INC(ST_LOADS);
+    STAT_ADD(ST_LOAD_BYTES, bytes > 0 ? bytes : 0);
+    STAT_ADD(ST_LOAD_US, now_us() - t0);
+}
+
+/* Background saves (bgsave, autosave). The parent holds the namespace,
+   every file and the tier store locked across fork(), so the child's
+   copy-on-write view is one consistent point in time and none of those
+   locks is stuck in the child; the pause is the fork itself, reported as
+   persist.fork_us. The child writes the image with the ordinary writer
+   and exits; the parent reaps it on a scheduler tick. A file whose
+   (blob id, size) still matches the last image is clean, and a save with
+   nothing dirty and no removals is skipped. Foreground saves first wait
+   for a running child. */
+#ifndef _WIN32
+#define BGSAVE_LOCK() pthread_mutex_lock(&sos_cur->bgsave.mtx)
+#define BGSAVE_UNLOCK() pthread_mutex_unlock(&sos_cur->bgsave.mtx)
+#else
+#define BGSAVE_LOCK() ((void)0)
+#define BGSAVE_UNLOCK() ((void)0)
+#endif
+
+/* files changed since the last image, plus one if any were removed;
+   fills snap with the current versions. Namespace lock held; with
+   keep_locked every file is left locked. */
+static int vfs_dirty_locked(vfs_snap_t* snap, int* nsnap, int keep_locked) {
+    int dirty = 0, n = 0;
+    for (int i = 0; i < FS_MAX_FILES; ++i) {
+        vfile_t* f = sos_cur->vfs[i];
+        if (!f) continue;
+        FILE_LOCK(f);
+        snap[n].slot = i;
+        snap[n].f = f;
+        vfile_version_locked(f, &snap[n].id, &snap[n].size);
+        dirty += snap[n].id != f->saved_id || snap[n].size != f->saved_size;
+        n++;
+        if (!keep_locked) FILE_UNLOCK(f);
+    }
+    *nsnap = n;
+    return dirty + (sos_cur->removals != sos_cur->saved_removals);
+}
+
+static int bgsave_start_locked(int announce);
+
+/* collects a finished child; with block, waits for it. BGSAVE_LOCK held. */
+static void bgsave_reap_locked(int block) {
+#ifndef _WIN32
+    bgsave_t* bg = &sos_cur->bgsave;
+    if (!bg->pid) return;
+    int st = 0;
+    pid_t r;
+    while ((r = waitpid(bg->pid, &st, block ? 0 : WNOHANG)) < 0 && errno == EINTR) {}
+    if (r == 0) return;
+    int ok = r == bg->pid && WIFEXITED(st) && WEXITSTATUS(st) == 0;
+    unsigned long long now = now_us();
+    if (ok) {
+        struct stat sb;
+        vfs_mark_saved(bg->snap, bg->nsnap, bg->removals);
+        bg->last_ok = now;
+        STAT_INC(ST_SAVES);
+        STAT_ADD(ST_SAVE_BYTES, stat(sos_cur->state_path, &sb) == 0 ? (unsigned long long)sb.st_size : 0);
+        STAT_ADD(ST_SAVE_US, now - bg->started);
+    } else STAT_INC(ST_BGSAVE_FAILED);
+    if (bg->announce || !ok)
+        printf("[bgsave] %s (pid %d, %.1f ms)\n", ok ? "state saved" : "background save failed", bg->pid, (now - bg->started) / 1000.0);
+    bg->pid = 0;
+    /* blocking callers save, reload or shut down themselves */
+    if (bg->pending && !block) bgsave_start_locked(0);
+    bg->pending = 0;
+#else
+    (void)block;
+#endif
+}
+
+/* starts a background save: the child's pid, 0 if nothing changed since
+   the last image, -1 on error. BGSAVE_LOCK held, no child running. On
+   Windows there is no fork(); the save runs in the foreground. */
+static int bgsave_start_locked(int announce) {
+    bgsave_t* bg = &sos_cur->bgsave;
+    bg->last_try = now_us();
+    if (sos_cur->state_path[0] == '\0') return -1;
+#ifndef _WIN32
+    unsigned long long t0 = now_us();
+    /* registers this thread's counters and RCU reader before the fork, so
+       the child never needs their global locks */
+    STAT_ADD(ST_BGSAVES, 0);
+    rcu_enter();
+    VFS_LOCK();
+    int dirty = vfs_dirty_locked(bg->snap, &bg->nsnap, 1);
+    TIER_IO_LOCK(&sos_cur->tier);
+    pid_t pid = dirty ? fork() : -2;
+    if (pid == 0) {
+        TIER_IO_UNLOCK(&sos_cur->tier);
+        for (int i = 0; i < bg->nsnap; ++i) FILE_UNLOCK(bg->snap[i].f);
+        VFS_UNLOCK();
+        _exit(vfs_write_image() == 0 ? 0 : 1);
+    }
+    bg->removals = sos_cur->removals;
+    TIER_IO_UNLOCK(&sos_cur->tier);
+    for (int i = 0; i < bg->nsnap; ++i) FILE_UNLOCK(bg->snap[i].f);
+    VFS_UNLOCK();
+    rcu_leave();
+    if (pid == -2) { STAT_INC(ST_SAVES_SKIPPED); return 0; }
+    if (pid < 0) { STAT_INC(ST_BGSAVE_FAILED); return -1; }
+    STAT_INC(ST_BGSAVES);
+    STAT_ADD(ST_FORK_US, now_us() - t0);
+    bg->pid = (int)pid;
+    bg->announce = announce;
+    bg->dirty = (unsigned)dirty;
+    bg->started = t0;
+    return bg->pid;
+#else
+    (void)announce;
+    VFS_LOCK();
+    int n, dirty = vfs_dirty_locked(bg->snap, &n, 0);
+    VFS_UNLOCK();
+    if (!dirty) { STAT_INC(ST_SAVES_SKIPPED); return 0; }
+    int rc = vfs_write_image();
+    if (rc == 0) bg->last_ok = now_us();
+    return rc;
+#endif
+}
+
+/* foreground save: waits for a background one, then writes the image
+   unless nothing changed since it */
+static int vfs_save_state() {
+    if (sos_cur->state_path[0] == '\0') return -1;
+    BGSAVE_LOCK();
+    bgsave_reap_locked(1);
+    VFS_LOCK();
+    int n, dirty = vfs_dirty_locked(sos_cur->bgsave.snap, &n, 0);
+    VFS_UNLOCK();
+    int rc = 0;
+    if (!dirty) STAT_INC(ST_SAVES_SKIPPED);
+    else if ((rc = vfs_write_image()) == 0) sos_cur->bgsave.last_ok = now_us();
+    BGSAVE_UNLOCK();
+    return rc;
+}
+
+/* a background save soon: now, or once the running one is done */
+static void bgsave_request() {
+    if (sos_cur->state_path[0] == '\0') return;
+    BGSAVE_LOCK();
+    bgsave_reap_locked(0);
+    if (sos_cur->bgsave.pid) sos_cur->bgsave.pending = 1;
+    else bgsave_start_locked(0);
+    BGSAVE_UNLOCK();
+}
+
+/* scheduler hook: reaps a finished child and starts autosaves */
+static void bgsave_poll() {
+    bgsave_t* bg = &sos_cur->bgsave;
+    if (!__atomic_load_n(&bg->pid, __ATOMIC_RELAXED) && !__atomic_load_n(&bg->interval, __ATOMIC_RELAXED)) return;
+    BGSAVE_LOCK();
+    bgsave_reap_locked(0);
+    if (bg->interval && !bg->pid && now_us() - bg->last_try >= bg->interval * 1000000ULL) bgsave_start_locked(0);
+    BGSAVE_UNLOCK();
+}
+
+/* VFS */
+static void vfs_init() {
+    /* a running child would rename its older image over the one read here */
+    BGSAVE_LOCK();
+    bgsave_reap_locked(1);
+    VFS_LOCK();
+    vfs_clear_locked();
+    vfs_load_state();
+    if (!sos_cur->vfs[0]) {
+        const char* welcome = "Shreyas Systems - Shreyas' OS powering Shreyas INDUSTRIES.\n";
+        vblob_t* b = blob_new(strlen(welcome));
+        if (b) {
+            memcpy(b->data, welcome, strlen(welcome) + 1);
+            b->size = strlen(welcome);
+        }
+        vfile_t* f = b ? vfile_new("welcome.txt", b) : NULL;
+        if (!f) free(b);
+        else vfile_link_locked(0, f);
+    }
+    sos_cur->saved_removals = sos_cur->removals;
+    vfs_notify(SOS_MUT_RESET, "", 0, NULL, 0);
+    VFS_UNLOCK();
+    BGSAVE_UNLOCK();
+}
+
+/* lock-free; the entry stays valid until the caller's rcu_leave() */
+static vfile_t* vfs_find(const char* name) {
+    if (!name || name[0] == '\0') return NULL;
+    vfile_t** files = sos_cur->vfs;
+    vfile_t* f = NULL;
+    int i = 0;
+    for (; i < FS_MAX_FILES; ++i) {
+        f = __atomic_load_n(&files[i], __ATOMIC_ACQUIRE);
+        if (f && strcmp(f->name, name) == 0) break;
+    }
+    STAT_INC(ST_VFS_LOOKUPS);
+    STAT_ADD(ST_VFS_PROBES, i < FS_MAX_FILES ? i + 1 : FS_MAX_FILES);
+    return i < FS_MAX_FILES ? f : NULL;
+}
+
+/* finds or creates an entry; call inside an RCU section */
+static vfile_t* vfs_open_entry(const char* name) {
+    vfile_t* f = vfs_find(name);
+    if (f) return f;
+    VFS_LOCK();
+    f = vfs_find(name);     /* another writer may have created it */
+    for (int i = 0; !f && i < FS_MAX_FILES; ++i) {
+        if (sos_cur->vfs[i]) continue;
+        f = vfile_new(name, NULL);
+        if (f) vfile_link_locked(i, f);
+        break;
+    }
+    VFS_UNLOCK();
+    return f;
+}
+
+typedef struct {
+    char name[MAX_NAME];
+    size_t size;
+    long long mtime, atime;
+    unsigned long long reads;
+} ls_item_t;
+
+/* transactions (below): a shell command run by the owner of the open
+   shell transaction stages its name-based writes there. The tx_* calls
+   return -1 (tx_pin 0) once the transaction has ended, and the caller
+   then goes to the VFS itself. */
+static SOS_TLS sos_tx_t* tx_cur;
+static int tx_pread(sos_tx_t* tx, const char* name, size_t off, size_t len, strbuf_t* out);
+static int tx_pin(sos_tx_t* tx, const char* name, vblob_t** b, size_t* size);
+static int tx_write(sos_tx_t* tx, const char* name, const char* data, size_t len);
+static int tx_pwrite(sos_tx_t* tx, const char* name, size_t off, const char* data, size_t len, int append);
+static int tx_truncate(sos_tx_t* tx, const char* name, size_t size);
+static int tx_remove(sos_tx_t* tx, const char* name);
+static int tx_list(sos_tx_t* tx, ls_item_t** items, int* n, const char* prefix, int exact, const char* after);
+static int tx_stat(sos_tx_t* tx, const char* name, size_t* size, long long* mtime);
+
+static int ls_by_mtime(const void* a, const void* b) {
+    const ls_item_t *x = a, *y = b;
+    if (x->mtime != y->mtime) return x->mtime > y->mtime ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static int ls_by_name(const void* a, const void* b) {
+    return strcmp(((const ls_item_t*)a)->name, ((const ls_item_t*)b)->name);
+}
+
+static void ls_time(char* buf, size_t n, long long us) {
+    time_t t = (time_t)(us / 1000000);
+    struct tm tm = *localtime(&t);
+    strftime(buf, n, "%b %d %H:%M", &tm);
+}
+
+/* ls [-l] [-t] [-n count] [-a after] [name|prefix*]: a range scan of the
+   name index from the prefix (or just past the -a cursor), so the cost
+   follows the matches, not the table; -t sorts the matches by mtime */
+static void vfs_list(const char* args) {
+    char buf[512], prefix[MAX_NAME] = "", after[MAX_NAME] = "";
+    int lng = 0, bytime = 0, exact = 0, usage = 0;
+    long limit = -1;
+    snprintf(buf, sizeof(buf), "%s", args);
+    for (char* tok = strtok(buf, " \t"); tok && !usage; tok = strtok(NULL, " \t")) {
+        if (strcmp(tok, "-n") == 0 || strcmp(tok, "-a") == 0) {
+            char* v = strtok(NULL, " \t");
+            if (!v) usage = 1;
+            else if (tok[1] == 'n') limit = strtol(v, NULL, 10);
+            else snprintf(after, sizeof(after), "%s", v);
+        } else if (tok[0] == '-' && tok[1]) {
+            for (const char* c = tok + 1; *c; ++c) {
+                if (*c == 'l') lng = 1;
+                else if (*c == 't') bytime = 1;
+                else usage = 1;
+            }
+        } else if (prefix[0]) usage = 1;
+        else {
+            size_t len = strlen(tok);
+            exact = tok[len - 1] != '*';
+            snprintf(prefix, sizeof(prefix), "%.*s", (int)(exact ? len : len - 1), tok);
+        }
+    }
+    if (usage || limit == 0 || limit < -1) { sh_printf("Usage: ls [-l] [-t] [-n count] [-a after] [name|prefix*]\n"); return; }
+    ls_item_t* items = malloc(FS_MAX_FILES * sizeof(*items));
+    if (!items) return;
+    size_t plen = strlen(prefix);
+    int n = 0, more = 0;
+    sos_tx_t* tx = tx_cur;      /* staged files count too, so the limit applies after them */
+    VFS_LOCK();
+    vfile_t* f = name_index_lower(&sos_cur->names, strcmp(after, prefix) > 0 ? after : prefix);
+    while (f && after[0] && strcmp(f->name, after) <= 0) f = f->next[0];
+    for (; f && strncmp(f->name, prefix, plen) == 0; f = f->next[0]) {
+        if (exact && f->name[plen]) break;
+        if (!bytime && !tx && limit > 0 && n == limit) { more = 1; break; }
+        ls_item_t* it = &items[n++];
+        memcpy(it->name, f->name, MAX_NAME);
+        it->size = vfile_size(f);
+        it->mtime = __atomic_load_n(&f->mtime, __ATOMIC_RELAXED);
+        it->atime = __atomic_load_n(&f->atime, __ATOMIC_RELAXED);
+        it->reads = __atomic_load_n(&f->reads, __ATOMIC_RELAXED);
+    }
+    VFS_UNLOCK();
+    if (tx) {
+        tx_list(tx, &items, &n, prefix, exact, after);
+        if (!bytime && limit > 0 && n > limit) { n = (int)limit; more = 1; }
+    }
+    if (bytime) {
+        qsort(items, (size_t)n, sizeof(*items), ls_by_mtime);
+        if (limit > 0 && n > limit) { n = (int)limit; more = 1; }
+    }
+    strbuf_t out = {0};
+    unsigned long long total = 0;
+    if (!lng) sb_append(&out, "Files:\n", 7);
+    else {
+        const char* head = "    SIZE  MODIFIED      ACCESSED       READS  NAME\n";
+        sb_append(&out, head, strlen(head));
+    }
+    for (int i = 0; i < n; ++i) {
+        char line[MAX_NAME + 96], mt[32], at[32];
+        int len;
+        if (lng) {
+            ls_time(mt, sizeof(mt), items[i].mtime);
+            ls_time(at, sizeof(at), items[i].atime);
+            len = snprintf(line, sizeof(line), "%8zu  %s  %s  %6llu  %s\n", items[i].size, mt, at, items[i].reads, items[i].name);
+        } else len = snprintf(line, sizeof(line), " - %s\n", items[i].name);
+        sb_append(&out, line, (size_t)len);
+        total += items[i].size;
+    }
+    if (lng) {
+        int len = snprintf(buf, sizeof(buf), "%d file%s, %llu bytes\n", n, n == 1 ? "" : "s", total);
+        sb_append(&out, buf, (size_t)len);
+    }
+    if (more && !bytime) {
+        int len = snprintf(buf, sizeof(buf), "(more: ls -a %s)\n", items[n - 1].name);
+        sb_append(&out, buf, (size_t)len);
+    } else if (more) sb_append(&out, "(more: raise -n)\n", 17);
+    if (out.len) sh_write(out.data, out.len);
+    sb_free(&out);
+    free(items);
+}
+
+/* stat <file> */
+static void cmd_stat(const char* name) {
+    if (!name[0]) { sh_printf("Usage: stat <file>\n"); return; }
+    size_t size = 0;
+    long long staged_at = 0;
+    int staged = tx_cur ? tx_stat(tx_cur, name, &size, &staged_at) : -1;
+    rcu_enter();
+    vfile_t* f = staged ? vfs_find(name) : NULL;
+    if (!f && staged <= 0) { rcu_leave(); sh_printf("stat: %s: no such file\n", name); return; }
+    unsigned long long id = 0, reads = 0;
+    int resident = 1, dirty = 0;
+    long long t[3] = { staged_at, staged_at, staged_at };
+    if (f) {
+        size_t fsize;
+        FILE_LOCK(f);
+        vfile_version_locked(f, &id, &fsize);
+        resident = f->blob != NULL;
+        dirty = id != f->saved_id || fsize != f->saved_size;
+        t[0] = f->ctime;
+        if (staged < 0) t[1] = f->mtime, size = fsize;
+        t[2] = f->atime;
+        reads = f->reads;
+        FILE_UNLOCK(f);
+    }
+    rcu_leave();
+    static const char* const label[3] = { "Created: ", "Modified:", "Accessed:" };
+    sh_printf("  File:     %s\n  Size:     %zu bytes (%s)\n", name, size,
+              staged > 0 ? "staged in this transaction" : resident ? "resident" : "evicted");
+    for (int i = 0; i < 3; ++i) {
+        time_t sec = (time_t)(t[i] / 1000000);
+        struct tm tm = *localtime(&sec);
+        char when[64];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        sh_printf("  %s %s.%06lld\n", label[i], when, t[i] % 1000000);
+    }
+    if (staged > 0) sh_printf("  Reads:    %llu\n  Version:  uncommitted\n", reads);
+    else sh_printf("  Reads:    %llu\n  Version:  %llu%s\n", reads, id, dirty ? " (not saved)" : "");
+}
+
+static void stats_render(strbuf_t* out, int json);
+
+/* synthetic files are generated on read and cannot be written or removed */
+static int vfs_readonly(const char* name) {
+    return name && strcmp(name, STATS_FILE) == 0;
+}
+
+/* tx_commit switches its files one at a time, with the namespace lock
+   held and commit_seq odd. A lock-free read that starts meanwhile waits
+   for the lock, so a reader that has seen one file of a commit sees the
+   rest of it too. */
+static SOS_TLS int tx_publishing;
+
+static void tx_wait_published() {
+    while ((__atomic_load_n(&sos_cur->commit_seq, __ATOMIC_ACQUIRE) & 1) && !tx_publishing) {
+        VFS_LOCK();
+        VFS_UNLOCK();
+    }
+}
+
+/* copies up to len bytes from off out without locking, so callers can
+   stream them while writers carry on; returns 0 if the file does not exist */
+static int vfs_pread(const char* name, size_t off, size_t len, strbuf_t* out) {
+    if (vfs_readonly(name)) {
+        strbuf_t all = {0};
+        stats_render(&all, 0);
+        if (off < all.len) sb_append(out, all.data + off, len < all.len - off ? len : all.len - off);
+        sb_free(&all);
+        return 1;
+    }
+    if (tx_cur) {
+        int found = tx_pread(tx_cur, name, off, len, out);
+        if (found >= 0) return found;
+    }
+    tx_wait_published();
+    size_t n = 0;
+    rcu_enter();
+    vfile_t* f = vfs_find(name);
+    vblob_t* b = f ? vfile_blob(f) : NULL;
+    if (b) n = blob_copy(b, off, len, out);
+    rcu_leave();
+    STAT_INC(ST_VFS_READS);
+    STAT_ADD(ST_VFS_BYTES_READ, n);
+    return f != NULL;
+}
+
+static int vfs_read_copy(const char* name, strbuf_t* out) {
+    return vfs_pread(name, 0, (size_t)-1, out);
+}
+
+/* takes a reference on a file's current blob, whose first *size bytes
+   then stay valid and unchanged until blob_unref(); NULL if absent */
+static vblob_t* vfs_pin_blob(const char* name, size_t* size) {
+    vblob_t* b = NULL;
+    if (tx_cur && tx_pin(tx_cur, name, &b, size)) return b;
+    tx_wait_published();
+    rcu_enter();
+    vfile_t* f = vfs_find(name);
+    if (f) {
+        /* the reference taken inside the section outlives the file's */
+        b = vfile_blob(f);
+        if (b) {
+            blob_pin(b);
+            *size = __atomic_load_n(&b->size, __ATOMIC_ACQUIRE);
+        }
+    }
+    rcu_leave();
+    return b;
+}
+
+/* the (blob id, size) pair naming a file's current content; 0 if absent */
+static int vfs_version(const char* name, unsigned long long* id, size_t* size) {
+    rcu_enter();
+    vfile_t* f = vfs_find(name);
+    vblob_t* b = f ? __atomic_load_n(&f->blob, __ATOMIC_ACQUIRE) : NULL;
+    if (b) {
+        *id = __atomic_load_n(&b->id, __ATOMIC_RELAXED);
+        *size = __atomic_load_n(&b->size, __ATOMIC_ACQUIRE);
+    } else if (f) {
+        FILE_LOCK(f);
+        vfile_version_locked(f, id, size);
+        FILE_UNLOCK(f);
+    }
+    rcu_leave();
+    return f != NULL;
+}
+
+/* installs a new blob; the file lock is held */
+static void vfs_publish_locked(vfile_t* f, vblob_t* b) {
+    vblob_t* old = f->blob;
+    tier_forget_locked(f);      /* an evicted body is superseded */
+    __atomic_store_n(&f->blob, b, __ATOMIC_RELEASE);
+    __atomic_store_n(&f->hot, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&f->mtime, sos_now_us(), __ATOMIC_RELAXED);
+    if (old) rcu_retire(old, blob_unref, old->cap);
+}
+
+/* replaces a file's bytes, creating it if needed; 0 if the VFS is full */
+static int vfs_write_raw(const char* name, const char* data, size_t len) {
+    if (vfs_readonly(name)) return 0;
+    if (len > FS_MAX_CONTENT) len = FS_MAX_CONTENT;
+    int staged = tx_cur ? tx_write(tx_cur, name, data, len) : -1;
+    if (staged >= 0) return staged;
+    STAT_INC(ST_VFS_WRITES);
+    STAT_ADD(ST_VFS_BYTES_WRITTEN, len);
+    vblob_t* b = blob_new(len);
+    if (!b) return 0;
+    if (len) memcpy(b->data, data, len);
+    b->data[len] = '\0';
+    b->size = len;
+    rcu_enter();
+    vfile_t* f;
+    /* a remove that got in first leaves f unlinked: write a new entry */
+    while ((f = vfs_open_entry(name)) != NULL) {
+        FILE_LOCK(f);
+        if (!__atomic_load_n(&f->unlinked, __ATOMIC_ACQUIRE)) break;
+        FILE_UNLOCK(f);
+    }
+    if (f) {
+        vfs_publish_locked(f, b);
+        vfs_notify(SOS_MUT_WRITE, f->name, 0, b->data, len);
+        FILE_UNLOCK(f);
+    }
+    rcu_leave();
+    if (!f) free(b);
+    else tier_balance();
+    return f != NULL;
+}
+
+static void vfs_write_bytes(const char* name, const char* data, size_t len) {
+    if (!name || name[0]=='\0') return;
+    int ok = vfs_write_raw(name, data ? data : "", data ? len : 0);
+    if (!ok) sh_printf(vfs_readonly(name) ? "%s is read-only\n" : "VFS full\n", name);
+}
+
+static void vfs_write(const char* name, const char* data) {
+    vfs_write_bytes(name, data, data ? strlen(data) : 0);
+}
+
+/* appends in place while the blob has room (readers only see bytes up
+   to the size they loaded); otherwise grows into a new blob. Call inside
+   an RCU section or with a reference on f. */
+static int vfs_append_file(vfile_t* f, const char* data, size_t add) {
+    int ok = 1;
+    STAT_INC(ST_VFS_APPENDS);
+    STAT_ADD(ST_VFS_BYTES_WRITTEN, add);
+    FILE_LOCK(f);
+    vblob_t* b = tier_resident_locked(f);
+    if (!b) { FILE_UNLOCK(f); return 0; }
+    size_t size = b->size;
+    if (size + add > FS_MAX_CONTENT) add = FS_MAX_CONTENT - size;
+    if (add > 0 && size + add <= b->cap) {
+        memcpy(b->data + size, data, add);
+        b->data[size + add] = '\0';
+        __atomic_store_n(&b->size, size + add, __ATOMIC_RELEASE);
+        __atomic_store_n(&f->mtime, sos_now_us(), __ATOMIC_RELAXED);
+        if (!__atomic_load_n(&f->unlinked, __ATOMIC_ACQUIRE)) vfs_notify(SOS_MUT_APPEND, f->name, size, data, add);
+    } else if (add > 0) {
+        size_t cap = b->cap ? b->cap : 64;
+        while (cap < size + add) cap *= 2;
+        vblob_t* nb = blob_new(cap);
+        if (nb) {
+            memcpy(nb->data, b->data, size);
+            memcpy(nb->data + size, data, add);
+            nb->data[size + add] = '\0';
+            nb->size = size + add;
+            vfs_publish_locked(f, nb);
+            if (!__atomic_load_n(&f->unlinked, __ATOMIC_ACQUIRE)) vfs_notify(SOS_MUT_APPEND, f->name, size, data, add);
+        }
+        ok = nb != NULL;
+    }
+    FILE_UNLOCK(f);
+    tier_balance();
+    return ok;
+}
+
+static int vfs_append_raw(const char* name, const char* data, size_t add) {
+    if (vfs_readonly(name)) return 0;
+    if (!data) add = 0;
+    int staged = tx_cur ? tx_pwrite(tx_cur, name, 0, data, add, 1) : -1;
+    if (staged >= 0) return staged;
+    rcu_enter();
+    vfile_t* f = vfs_open_entry(name);
+    int ok = f && vfs_append_file(f, data, add);
+    rcu_leave();
+    return ok;
+}
+
+static void vfs_append_bytes(const char* name, const char* data, size_t add) {
+    if (!name || name[0]=='\0') return;
+    int ok = vfs_append_raw(name, data, add);
+    if (!ok) sh_printf(vfs_readonly(name) ? "%s is read-only\n" : "VFS full\n", name);
+}
+
+static void vfs_append(const char* name, const char* data) {
+    vfs_append_bytes(name, data, data ? strlen(data) : 0);
+}
+
+/* makes f's content its first newsize bytes with data at off, zero-filling
+   between the old end and off; the file lock is held. Only the touched
+   range is written unless the blob is pinned or has to grow. */
+static int vfs_splice_locked(vfile_t* f, size_t off, const char* data, size_t len, size_t newsize) {
+    vblob_t* b = tier_resident_locked(f);
+    if (!b) return 0;
+    size_t size = b->size, keep = size < newsize ? size : newsize;
+    int inner = (off < size && len > 0) || newsize < size;
+    if (newsize <= b->cap && (!inner || blob_change_begin(b))) {
+        if (off > keep) memset(b->data + keep, 0, off - keep);
+        if (len) memcpy(b->data + off, data, len);
+        b->data[newsize] = '\0';
+        __atomic_store_n(&b->size, newsize, __ATOMIC_RELEASE);
+        if (inner) blob_change_end(b);
+        __atomic_store_n(&f->mtime, sos_now_us(), __ATOMIC_RELAXED);
+        return 1;
+    }
+    size_t cap = newsize < size ? newsize : b->cap;
+    if (cap < newsize || cap == 0) {
+        cap = cap ? cap : 64;
+        while (cap < newsize) cap *= 2;
+    }
+    vblob_t* nb = blob_new(cap);
+    if (!nb) return 0;
+    memcpy(nb->data, b->data, keep);
+    if (off > keep) memset(nb->data + keep, 0, off - keep);
+    if (len) memcpy(nb->data + off, data, len);
+    nb->data[newsize] = '\0';
+    nb->size = newsize;
+    vfs_publish_locked(f, nb);
+    return 1;
+}
+
+/* writes len bytes at off, zero-filling any gap past the end; call
+   inside an RCU section or with a reference on f */
+static int vfs_pwrite_file(vfile_t* f, size_t off, const char* data, size_t len) {
+    if (off > FS_MAX_CONTENT) return 0;
+    if (!data) len = 0;
+    if (len > FS_MAX_CONTENT - off) len = FS_MAX_CONTENT - off;
+    STAT_INC(ST_VFS_PWRITES);
+    STAT_ADD(ST_VFS_BYTES_WRITTEN, len);
+    FILE_LOCK(f);
+    vblob_t* b = tier_resident_locked(f);
+    size_t size = b ? b->size : 0;
+    int ok = b && vfs_splice_locked(f, off, data, len, off + len > size ? off + len : size);
+    if (ok && !__atomic_load_n(&f->unlinked, __ATOMIC_ACQUIRE)) vfs_notify(SOS_MUT_PWRITE, f->name, off, data, len);
+    FILE_UNLOCK(f);
+    tier_balance();
+    return ok;
+}
+
+/* creates the file if needed; 0 if the VFS is full */
+static int vfs_pwrite_raw(const char* name, size_t off, const char* data, size_t len) {
+    if (vfs_readonly(name) || off > FS_MAX_CONTENT) return 0;
+    int staged = tx_cur ? tx_pwrite(tx_cur, name, off, data, len, 0) : -1;
+    if (staged >= 0) return staged;
+    rcu_enter();
+    vfile_t* f = vfs_open_entry(name);
+    int ok = f && vfs_pwrite_file(f, off, data, len);
+    rcu_leave();
+    return ok;
+}
+
+/* cuts a file to size bytes or zero-extends it */
+static int vfs_truncate_file(vfile_t* f, size_t size) {
+    if (size > FS_MAX_CONTENT) return 0;
+    STAT_INC(ST_VFS_TRUNCATES);
+    FILE_LOCK(f);
+    int ok = vfs_splice_locked(f, size, NULL, 0, size);
+    if (ok && !__atomic_load_n(&f->unlinked, __ATOMIC_ACQUIRE)) vfs_notify(SOS_MUT_TRUNCATE, f->name, size, NULL, 0);
+    FILE_UNLOCK(f);
+    tier_balance();
+    return ok;
+}
+
+/* 0 if the file does not exist */
+static int vfs_truncate_raw(const char* name, size_t size) {
+    if (vfs_readonly(name)) return 0;
+    int staged = tx_cur ? tx_truncate(tx_cur, name, size) : -1;
+    if (staged >= 0) return staged;
+    rcu_enter();
+    vfile_t* f = vfs_find(name);
+    int ok = f && vfs_truncate_file(f, size);
+    rcu_leave();
+    return ok;
+}
+
+static int vfs_remove(const char* name) {
+    int staged = tx_cur ? tx_remove(tx_cur, name) : -1;
+    if (staged >= 0) return staged;
+    VFS_LOCK();
+    vfile_t* f = NULL;
+    for (int i = 0; i < FS_MAX_FILES && !f; ++i) {
+        if (!sos_cur->vfs[i] || strcmp(sos_cur->vfs[i]->name, name) != 0) continue;
+        f = sos_cur->vfs[i];
+        /* under the file lock, so the hook sees no change to f after this */
+        FILE_LOCK(f);
+        vfile_unlink_locked(i);
+        sos_cur->removals++;
+        vfs_notify(SOS_MUT_REMOVE, name, 0, NULL, 0);
+        FILE_UNLOCK(f);
+    }
+    VFS_UNLOCK();
+    /* writers and open fds still holding the entry carry on with the
+       unlinked copy; the last of them frees it */
+    if (f) vfile_unref(f);
+    STAT_INC(ST_VFS_REMOVES);
+    return f != NULL;
+}
+
+/* Transactions. Name-based writes, appends, pwrites, truncates and
+   removes are staged per file in the transaction: each touched file gets
+   a private blob holding its new content (or is marked removed), and
+   reads through the same transaction see those. Commit takes the
+   namespace lock and every touched file's lock, checks that no file
+   moved from the version it was staged against, and installs all of the
+   blobs in one pass; the state image, bgsave's fork, ls and
+   sos_vfs_list all take the namespace lock, so they see a transaction
+   whole or not at all, and lock-free readers wait out the pass (see
+   tx_wait_published), so none sees part of it. The batch then goes to
+   disk as one background save. */
+typedef struct {
+    char name[MAX_NAME];
+    vblob_t* blob;                  /* staged content, a private reference; NULL = removed */
+    int existed;                    /* the file existed when first staged ... */
+    unsigned long long base_id;     /* ... with this version; commit fails if it moved */
+    size_t base_size;
+    long long mtime;                /* sos_now_us() of the last staged change */
+} tx_entry_t;
+
+struct sos_tx {
+    sos_ctx_t* ctx;
+    char owner[64];                 /* the shell user whose commands stage here */
+    tx_entry_t* e;
+    size_t n, cap;
+    int refs;                       /* the shell's slot and each command line using it */
+    int closed;                     /* committed or aborted; under the lock */
+#ifndef _WIN32
+    pthread_mutex_t mtx;            /* pipeline stages share the shell's */
+#endif
+};
+
+#ifndef _WIN32
+#define TX_LOCK(tx) pthread_mutex_lock(&(tx)->mtx)
+#define TX_UNLOCK(tx) pthread_mutex_unlock(&(tx)->mtx)
+#else
+#define TX_LOCK(tx) ((void)0)
+#define TX_UNLOCK(tx) ((void)0)
+#endif
+
+static sos_tx_t* tx_new(const char* owner) {
+    sos_tx_t* tx = calloc(1, sizeof(*tx));
+    if (!tx) return NULL;
+    tx->ctx = sos_cur;
+    tx->refs = 1;
+    snprintf(tx->owner, sizeof(tx->owner), "%s", owner ? owner : "");
+#ifndef _WIN32
+    pthread_mutex_init(&tx->mtx, NULL);
+#endif
+    return tx;
+}
+
+static void tx_free(sos_tx_t* tx) {
+    if (!tx) return;
+    for (size_t i = 0; i < tx->n; ++i) if (tx->e[i].blob) blob_unref(tx->e[i].blob);
+    free(tx->e);
+#ifndef _WIN32
+    pthread_mutex_destroy(&tx->mtx);
+#endif
+    free(tx);
+}
+
+static void tx_release(sos_tx_t* tx) {
+    if (tx && __atomic_sub_fetch(&tx->refs, 1, __ATOMIC_ACQ_REL) == 0) tx_free(tx);
+}
+
+/* ends the transaction without applying it */
+static void tx_close(sos_tx_t* tx) {
+    TX_LOCK(tx);
+    for (size_t i = 0; i < tx->n; ++i) if (tx->e[i].blob) blob_unref(tx->e[i].blob);
+    tx->n = 0;
+    tx->closed = 1;
+    TX_UNLOCK(tx);
+}
+
+/* TX_LOCK held */
+static tx_entry_t* tx_find(sos_tx_t* tx, const char* name) {
+    for (size_t i = 0; i < tx->n; ++i) if (strcmp(tx->e[i].name, name) == 0) return &tx->e[i];
+    return NULL;
+}
+
+/* the entry for name, staged now if needed: with load, its blob starts as
+   a copy of the file's current bytes. NULL if out of memory. TX_LOCK held. */
+static tx_entry_t* tx_stage(sos_tx_t* tx, const char* name, int load) {
+    tx_entry_t* e = tx_find(tx, name);
+    if (e) return e;
+    if (tx->n == tx->cap) {
+        size_t cap = tx->cap ? tx->cap * 2 : 16;
+        tx_entry_t* ne = realloc(tx->e, cap * sizeof(*ne));
+        if (!ne) return NULL;
+        tx->e = ne;
+        tx->cap = cap;
+    }
+    e = &tx->e[tx->n];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    sos_tx_t* outer = tx_cur;
+    tx_cur = NULL;          /* the committed file, not this transaction's view */
+    if (load) {
+        size_t size = 0;
+        vblob_t* b = vfs_pin_blob(name, &size);
+        e->existed = b != NULL;
+        /* pinned, so no in-place change can move the id away from these bytes */
+        e->base_id = b ? __atomic_load_n(&b->id, __ATOMIC_RELAXED) : 0;
+        e->base_size = size;
+        e->blob = blob_new(size);
+        if (e->blob && size) memcpy(e->blob->data, b->data, size);
+        if (e->blob) e->blob->data[size] = '\0', e->blob->size = size;
+        if (b) blob_unref(b);
+    } else e->existed = vfs_version(name, &e->base_id, &e->base_size);
+    tx_cur = outer;
+    if (load && !e->blob) return NULL;
+    tx->n++;
+    return e;
+}
+
+/* makes e's blob private with room for need bytes; 0 if out of memory */
+static int tx_reserve(tx_entry_t* e, size_t need) {
+    vblob_t* b = e->blob;
+    if (b && b->refs == 1 && b->cap >= need) return 1;
+    size_t size = b ? b->size : 0, cap = b && b->cap ? b->cap : 64;
+    while (cap < need) cap *= 2;
+    vblob_t* nb = blob_new(cap);
+    if (!nb) return 0;
+    if (size) memcpy(nb->data, b->data, size);
+    nb->data[size] = '\0';
+    nb->size = size;
+    if (b) blob_unref(b);
+    e->blob = nb;
+    return 1;
+}
+
+/* 1/0 as vfs_pread() if the transaction staged name, -1 if it did not */
+static int tx_pread(sos_tx_t* tx, const char* name, size_t off, size_t len, strbuf_t* out) {
+    TX_LOCK(tx);
+    tx_entry_t* e = tx->closed ? NULL : tx_find(tx, name);
+    int found = e ? e->blob != NULL : -1;
+    if (found > 0) blob_copy(e->blob, off, len, out);
+    TX_UNLOCK(tx);
+    return found;
+}
+
+/* as vfs_pin_blob() for a staged file; 0 if name is not staged */
+static int tx_pin(sos_tx_t* tx, const char* name, vblob_t** b, size_t* size) {
+    TX_LOCK(tx);
+    tx_entry_t* e = tx->closed ? NULL : tx_find(tx, name);
+    if (e) {
+        *b = e->blob;
+        if (*b) {
+            blob_pin(*b);
+            *size = (*b)->size;
+        }
+    }
+    TX_UNLOCK(tx);
+    return e != NULL;
+}
+
+static int tx_write(sos_tx_t* tx, const char* name, const char* data, size_t len) {
+    vblob_t* nb = blob_new(len);
+    if (!nb) return 0;
+    if (len) memcpy(nb->data, data, len);
+    nb->data[len] = '\0';
+    nb->size = len;
+    TX_LOCK(tx);
+    if (tx->closed) { TX_UNLOCK(tx); free(nb); return -1; }
+    tx_entry_t* e = tx_stage(tx, name, 0);
+    if (e) {
+        if (e->blob) blob_unref(e->blob);
+        e->blob = nb;
+        e->mtime = sos_now_us();
+    } else free(nb);
+    TX_UNLOCK(tx);
+    return e != NULL;
+}
+
+/* writes at off, or at the end with append; creates the file */
+static int tx_pwrite(sos_tx_t* tx, const char* name, size_t off, const char* data, size_t len, int append) {
+    if (!data) len = 0;
+    TX_LOCK(tx);
+    if (tx->closed) { TX_UNLOCK(tx); return -1; }
+    tx_entry_t* e = tx_stage(tx, name, 1);
+    size_t size = e && e->blob ? e->blob->size : 0;
+    if (append) off = size;
+    if (off > FS_MAX_CONTENT) off = FS_MAX_CONTENT;
+    if (len > FS_MAX_CONTENT - off) len = FS_MAX_CONTENT - off;
+    size_t end = off + len > size ? off + len : size;
+    int ok = e && tx_reserve(e, end);
+    if (ok) {
+        vblob_t* b = e->blob;
+        if (off > size) memset(b->data + size, 0, off - size);
+        if (len) memcpy(b->data + off, data, len);
+        b->data[end] = '\0';
+        b->size = end;
+        e->mtime = sos_now_us();
+    }
+    TX_UNLOCK(tx);
+    return ok;
+}
+
+/* 0 if the file does not exist in the transaction's view */
+static int tx_truncate(sos_tx_t* tx, const char* name, size_t size) {
+    if (size > FS_MAX_CONTENT) return 0;
+    TX_LOCK(tx);
+    if (tx->closed) { TX_UNLOCK(tx); return -1; }
+    tx_entry_t* e = tx_find(tx, name);
+    int ok = e ? e->blob != NULL : 0;
+    if (!e) {
+        unsigned long long id;
+        size_t cur;
+        sos_tx_t* outer = tx_cur;
+        tx_cur = NULL;
+        ok = vfs_version(name, &id, &cur);
+        tx_cur = outer;
+        if (ok) ok = (e = tx_stage(tx, name, 1)) != NULL;
+    }
+    if (ok) ok = tx_reserve(e, size);
+    if (ok) {
+        vblob_t* b = e->blob;
+        if (size > b->size) memset(b->data + b->size, 0, size - b->size);
+        b->data[size] = '\0';
+        b->size = size;
+        e->mtime = sos_now_us();
+    }
+    TX_UNLOCK(tx);
+    return ok;
+}
+
+/* 0 if the file does not exist in the transaction's view */
+static int tx_remove(sos_tx_t* tx, const char* name) {
+    TX_LOCK(tx);
+    if (tx->closed) { TX_UNLOCK(tx); return -1; }
+    tx_entry_t* e = tx_find(tx, name);
+    int ok = e ? e->blob != NULL : 0;
+    if (!e) {
+        e = tx_stage(tx, name, 0);
+        ok = e && e->existed;
+        if (e && !e->existed) tx->n--;      /* nothing to remove, nothing to check */
+    }
+    if (ok) {
+        if (e->blob) blob_unref(e->blob);
+        e->blob = NULL;
+        e->mtime = sos_now_us();
+    }
+    TX_UNLOCK(tx);
+    return ok;
+}
+
+/* ls inside the transaction: its staged files replace, join or drop out
+   of the committed matches in *items, which end up sorted by name */
+static int tx_list(sos_tx_t* tx, ls_item_t** items, int* n, const char* prefix, int exact, const char* after) {
+    size_t plen = strlen(prefix);
+    TX_LOCK(tx);
+    ls_item_t* it = tx->closed || !tx->n ? *items : realloc(*items, ((size_t)*n + tx->n) * sizeof(**items));
+    if (!it) { TX_UNLOCK(tx); return 0; }
+    *items = it;
+    int m = *n;
+    for (size_t i = 0; i < tx->n && !tx->closed; ++i) {
+        tx_entry_t* e = &tx->e[i];
+        if (strncmp(e->name, prefix, plen) != 0 || (exact && e->name[plen])) continue;
+        if (after[0] && strcmp(e->name, after) <= 0) continue;
+        int k = 0;
+        while (k < m && strcmp(it[k].name, e->name) != 0) k++;
+        if (!e->blob) {
+            if (k < m) it[k] = it[--m];
+            continue;
+        }
+        if (k == m) {
+            memset(&it[m], 0, sizeof(it[m]));
+            memcpy(it[m].name, e->name, MAX_NAME);
+            it[m++].atime = e->mtime;
+        }
+        it[k].size = e->blob->size;
+        it[k].mtime = e->mtime;
+    }
+    TX_UNLOCK(tx);
+    qsort(it, (size_t)m, sizeof(*it), ls_by_name);
+    *n = m;
+    return 1;
+}
+
+/* -1 if name is not staged, 0 if the transaction removed it, else 1 with
+   its staged size and the time of the last staged change */
+static int tx_stat(sos_tx_t* tx, const char* name, size_t* size, long long* mtime) {
+    TX_LOCK(tx);
+    tx_entry_t* e = tx->closed ? NULL : tx_find(tx, name);
+    int found = e ? e->blob != NULL : -1;
+    if (found > 0) {
+        *size = e->blob->size;
+        *mtime = e->mtime;
+    }
+    TX_UNLOCK(tx);
+    return found;
+}
+
+/* applies every staged change at once, or none: 0 on success, -1 if a
+   staged file changed since (*why names it), -2 if the VFS is full or
+   memory ran out. The transaction is left empty and closed either way. */
+static int tx_commit(sos_tx_t* tx, char* why, size_t whylen) {
+    vfile_t* cur[FS_MAX_FILES * 2];
+    vfile_t* made[FS_MAX_FILES];
+    vfile_t* dead[FS_MAX_FILES];
+    int rc = 0, nmade = 0, ndead = 0, fresh = 0, gone = 0, used = 0;
+    size_t locked = 0;
+    TX_LOCK(tx);
+    if (tx->n > FS_MAX_FILES * 2) rc = -2;
+    VFS_LOCK();
+    for (size_t i = 0; i < tx->n && rc == 0; ++i, ++locked) {
+        tx_entry_t* e = &tx->e[i];
+        vfile_t* f = name_index_lower(&sos_cur->names, e->name);
+        cur[i] = f && strcmp(f->name, e->name) == 0 ? f : NULL;
+        if (cur[i]) FILE_LOCK(cur[i]);
+        fresh += e->blob && !cur[i];
+        gone += !e->blob && cur[i];
+        unsigned long long id = 0;
+        size_t size = 0;
+        if (cur[i]) vfile_version_locked(cur[i], &id, &size);
+        if ((cur[i] != NULL) != e->existed || (cur[i] && (id != e->base_id || size != e->base_size))) {
+            snprintf(why, whylen, "%s", e->name);
+            rc = -1;
+        }
+    }
+    for (int i = 0; i < FS_MAX_FILES; ++i) used += sos_cur->vfs[i] != NULL;
+    if (rc == 0 && used - gone + fresh > FS_MAX_FILES) rc = -2;
+    /* entries for new files are made up front so nothing fails half way */
+    for (size_t i = 0; i < tx->n && rc == 0; ++i) {
+        if (!tx->e[i].blob || cur[i]) continue;
+        vfile_t* f = vfile_new(tx->e[i].name, tx->e[i].blob);
+        if (f) made[nmade++] = f;
+        else rc = -2;
+    }
+    if (rc == 0) {
+        /* readers that start now wait for the lock (tx_wait_published) */
+        __atomic_store_n(&sos_cur->commit_seq, sos_cur->commit_seq + 1, __ATOMIC_RELEASE);
+        tx_publishing = 1;      /* the mutation hook may read on this thread */
+        for (size_t i = 0; i < tx->n; ++i) {
+            tx_entry_t* e = &tx->e[i];
+            vfile_t* f = cur[i];
+            if (!e->blob && f) {
+                for (int slot = 0; slot < FS_MAX_FILES; ++slot) if (sos_cur->vfs[slot] == f) { vfile_unlink_locked(slot); break; }
+                sos_cur->removals++;
+                vfs_notify(SOS_MUT_REMOVE, e->name, 0, NULL, 0);
+                dead[ndead++] = f;
+            } else if (e->blob && f) {
+                vfs_publish_locked(f, e->blob);
+                vfs_notify(SOS_MUT_WRITE, e->name, 0, e->blob->data, e->blob->size);
+            }
+        }
+        int slot = 0, m = 0;
+        for (size_t i = 0; i < tx->n; ++i) {
+            if (!tx->e[i].blob || cur[i]) continue;
+            vfile_t* f = made[m++];
+            while (sos_cur->vfs[slot]) slot++;
+            FILE_LOCK(f);
+            vfile_link_locked(slot, f);
+            vfs_notify(SOS_MUT_WRITE, f->name, 0, f->blob->data, f->blob->size);
+            FILE_UNLOCK(f);
+        }
+        /* the blobs now belong to the files */
+        for (size_t i = 0; i < tx->n; ++i) tx->e[i].blob = NULL;
+        tx_publishing = 0;
+        __atomic_store_n(&sos_cur->commit_seq, sos_cur->commit_seq + 1, __ATOMIC_RELEASE);
+    } else {
+        for (int i = 0; i < nmade; ++i) { made[i]->blob = NULL; vfile_free(made[i]); }
+    }
+    for (size_t i = 0; i < locked; ++i) if (cur[i]) FILE_UNLOCK(cur[i]);
+    VFS_UNLOCK();
+    size_t files = tx->n;
+    for (size_t i = 0; i < tx->n; ++i) if (tx->e[i].blob) blob_unref(tx->e[i].blob);
+    tx->n = 0;
+    tx->closed = 1;
+    TX_UNLOCK(tx);
+    for (int i = 0; i < ndead; ++i) vfile_unref(dead[i]);
+    if (rc == 0) {
+        STAT_INC(ST_TX_COMMITS);
+        STAT_ADD(ST_TX_FILES, files);
+        tier_balance();
+        if (files) bgsave_request();
+    } else STAT_INC(rc == -1 ? ST_TX_CONFLICTS : ST_TX_ABORTS);
+    return rc;
+}
+
+/* File descriptors. An fd holds a counted reference on its entry, so a
+   file removed while open stays readable and writable through the fd
+   until the last close (its changes are no longer reported then). Each
+   fd owns one VFD_BUF buffer, used as a read-ahead window or to collect
+   sequential writes, so streaming touches the file once per buffer.
+   Builtin tasks get their own table while they run; everything else
+   uses the instance's. An fd must not be used by two threads at once. */
+#ifndef _WIN32
+#define VFD_LOCK(t) pthread_mutex_lock(&(t)->mtx)
+#define VFD_UNLOCK(t) pthread_mutex_unlock(&(t)->mtx)
+#else
+#define VFD_LOCK(t) ((void)0)
+#define VFD_UNLOCK(t) ((void)0)
+#endif
+
+static SOS_TLS task_t* vfd_task;   /* the builtin task being run, if any */
+
+static void vfd_table_init(vfd_table_t* t) {
+    memset(t->fd, 0, sizeof(t->fd));
+#ifndef _WIN32
+    pthread_mutex_init(&t->mtx, NULL);
+#endif
+}
+
+/* NULL only if a task's table cannot be allocated */
+static vfd_table_t* vfd_table() {
+    if (!vfd_task) return &sos_cur->fds;
+    if (!vfd_task->fds && (vfd_task->fds = malloc(sizeof(vfd_table_t))) != NULL) vfd_table_init(vfd_task->fds);
+    return vfd_task->fds;
+}
+
+static vfd_t* vfd_get(int fd) {
+    vfd_table_t* t = vfd_table();
+    if (!t || fd < 0 || fd >= VFD_MAX) return NULL;
+    VFD_LOCK(t);
+    vfd_t* d = t->fd[fd];
+    VFD_UNLOCK(t);
+    return d;
+}
+
+static size_t vfd_size(vfd_t* d) {
+    rcu_enter();
+    size_t n = vfile_size(d->f);
+    rcu_leave();
+    return n;
+}
+
+static size_t vfd_pread(vfd_t* d, size_t off, char* dst, size_t len) {
+    tx_wait_published();
+    rcu_enter();
+    vblob_t* b = vfile_blob(d->f);
+    size_t n = b ? blob_read(b, off, dst, len) : 0;
+    rcu_leave();
+    STAT_INC(ST_VFS_READS);
+    STAT_ADD(ST_VFS_BYTES_READ, n);
+    return n;
+}
+
+/* writes len bytes at the cursor, or at the end for SOS_O_APPEND */
+static int vfd_put(vfd_t* d, size_t at, const char* data, size_t len) {
+    if (!(d->flags & SOS_O_APPEND)) return vfs_pwrite_file(d->f, at, data, len);
+    int ok = vfs_append_file(d->f, data, len);
+    d->pos = vfd_size(d);
+    return ok;
+}
+
+/* writes out the collected bytes; 0 if the VFS refused them */
+static int vfd_flush(vfd_t* d) {
+    if (d->wlen == 0) return 1;
+    size_t n = d->wlen;
+    d->wlen = 0;
+    return vfd_put(d, d->wstart, d->buf, n);
+}
+
+static int vfd_open(const char* name, int flags) {
+    vfd_table_t* t = vfd_table();
+    if (!t || !(flags & (SOS_O_READ | SOS_O_WRITE)) || vfs_readonly(name)) return -1;
+    vfd_t* d = calloc(1, sizeof(*d));
+    if (!d) return -1;
+    rcu_enter();
+    vfile_t* f = (flags & SOS_O_WRITE) && (flags & SOS_O_CREATE) ? vfs_open_entry(name) : vfs_find(name);
+    if (f && !vfile_tryref(f)) f = NULL;
+    rcu_leave();
+    if (!f) { free(d); return -1; }
+    d->f = f;
+    d->flags = flags;
+    int fd = -1;
+    VFD_LOCK(t);
+    for (int i = 0; i < VFD_MAX && fd < 0; ++i) if (!t->fd[i]) { t->fd[i] = d; fd = i; }
+    VFD_UNLOCK(t);
+    if (fd < 0) { vfile_unref(f); free(d); return -1; }
+    if ((flags & SOS_O_WRITE) && (flags & SOS_O_TRUNC)) vfs_truncate_file(f, 0);
+    return fd;
+}
+
+static long long vfd_read(int fd, void* buf, size_t n) {
+    vfd_t* d = vfd_get(fd);
+    if (!d || !(d->flags & SOS_O_READ) || !vfd_flush(d)) return -1;
+    char* dst = buf;
+    size_t got = 0;
+    while (got < n) {
+        if (d->pos >= d->rstart && d->pos < d->rstart + d->rlen) {
+            size_t k = d->rstart + d->rlen - d->pos;
+            if (k > n - got) k = n - got;
+            memcpy(dst + got, d->buf + (d->pos - d->rstart), k);
+            got += k;
+            d->pos += k;
+            continue;
+        }
+        if (n - got >= VFD_BUF) {
+            /* large reads go straight to the caller */
+            size_t k = vfd_pread(d, d->pos, dst + got, n - got);
+            got += k;
+            d->pos += k;
+            break;
+        }
+        if (!d->buf && !(d->buf = malloc(VFD_BUF))) break;
+        d->rstart = d->pos;
+        d->rlen = vfd_pread(d, d->pos, d->buf, VFD_BUF);
+        if (d->rlen == 0) break;
+    }
+    return (long long)got;
+}
+
+static long long vfd_write(int fd, const void* buf, size_t n) {
+    vfd_t* d = vfd_get(fd);
+    if (!d || !(d->flags & SOS_O_WRITE)) return -1;
+    d->rlen = 0;    /* the buffer collects writes from here on */
+    int gap = d->wlen && !(d->flags & SOS_O_APPEND) && d->wstart + d->wlen != d->pos;
+    if ((gap || d->wlen + n > VFD_BUF) && !vfd_flush(d)) return -1;
+    if (n >= VFD_BUF) {
+        if (!vfd_put(d, d->pos, buf, n)) return -1;
+        if (!(d->flags & SOS_O_APPEND)) d->pos += n;
+        return (long long)n;
+    }
+    if (!d->buf && !(d->buf = malloc(VFD_BUF))) return -1;
+    if (d->wlen == 0) d->wstart = d->pos;
+    memcpy(d->buf + d->wlen, buf, n);
+    d->wlen += n;
+    d->pos += n;
+    return (long long)n;
+}
+
+static long long vfd_seek(int fd, long long off, int whence) {
+    vfd_t* d = vfd_get(fd);
+    if (!d || !vfd_flush(d)) return -1;
+    long long base = whence == SOS_SEEK_SET ? 0
+                   : whence == SOS_SEEK_CUR ? (long long)d->pos
+                   : whence == SOS_SEEK_END ? (long long)vfd_size(d) : -1;
+    if (base < 0 || base + off < 0) return -1;
+    d->pos = (size_t)(base + off);
+    return (long long)d->pos;
+}
+
+static int vfd_close_in(vfd_table_t* t, int fd) {
+    if (!t || fd < 0 || fd >= VFD_MAX) return -1;
+    VFD_LOCK(t);
+    vfd_t* d = t->fd[fd];
+    t->fd[fd] = NULL;
+    VFD_UNLOCK(t);
+    if (!d) return -1;
+    int ok = vfd_flush(d);
+    vfile_unref(d->f);
+    free(d->buf);
+    free(d);
+    return ok ? 0 : -1;
+}
+
+static int vfd_close(int fd) {
+    return vfd_close_in(vfd_table(), fd);
+}
+
+static void vfd_close_all(vfd_table_t* t) {
+    for (int i = 0; i < VFD_MAX; ++i) if (t->fd[i]) vfd_close_in(t, i);
+}
+
+static void vfd_list_table(vfd_table_t* t, const char* owner) {
+    VFD_LOCK(t);
+    for (int i = 0; i < VFD_MAX; ++i) {
+        vfd_t* d = t->fd[i];
+        if (!d) continue;
+        int fl = d->flags;
+        sh_printf("%-12s %3d %c%c%c %10zu  %s%s\n", owner, i,
+                  fl & SOS_O_READ ? 'r' : '-', fl & SOS_O_WRITE ? 'w' : '-', fl & SOS_O_APPEND ? 'a' : '-',
+                  d->pos, d->f->name, __atomic_load_n(&d->f->unlinked, __ATOMIC_ACQUIRE) ? " (deleted)" : "");
+    }
+    VFD_UNLOCK(t);
+}
+
+static void show_lsof() {
+    sh_printf("%-12s %3s %3s %10s  %s\n", "OWNER", "FD", "MODE", "POS", "FILE");
+    vfd_list_table(&sos_cur->fds, "-");
+    /* collected first: the listing can outgrow a pipe whose reader waits for the task lock */
+    strbuf_t out = {0};
+    sh_io_t io = { NULL, NULL, &out, 0 }, *outer = sh_io;
+    sh_io = &io;
+    TASKS_LOCK();
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        task_t* t = &sos_cur->tasks[i];
+        if (t->id && t->fds) vfd_list_table(t->fds, t->name);
+    }
+    TASKS_UNLOCK();
+    sh_io = outer;
+    if (out.len) sh_write(out.data, out.len);
+    sb_free(&out);
+}
+
+/* Counter export: "key=value" lines in a fixed order, or one JSON object.
+   Also readable as the synthetic read-only VFS file STATS_FILE. */
+static void stats_render(strbuf_t* out, int json) {
+    stat_block_t s;
+    stat_collect(&s);
+    unsigned long long used = 0, bytes = 0;
+    rcu_enter();
+    for (int i = 0; i < FS_MAX_FILES; ++i) {
+        vfile_t* f = __atomic_load_n(&sos_cur->vfs[i], __ATOMIC_ACQUIRE);
+        if (!f) continue;
+        used++;
+        bytes += vfile_size(f);
+    }
+    rcu_leave();
+    char line[160];
+    int n;
+    if (json) sb_append(out, "{", 1);
+#define STATS_EMIT(key, val) do { \
+        n = json ? snprintf(line, sizeof(line), "%s\"%s\": %llu", out->len > 1 ? ", " : "", (key), (unsigned long long)(val)) \
+                 : snprintf(line, sizeof(line), "%s=%llu\n", (key), (unsigned long long)(val)); \
+        sb_append(out, line, (size_t)n); \
+    } while (0)
+    STATS_EMIT("vfs.slots_used", used);
+    STATS_EMIT("vfs.slots_total", FS_MAX_FILES);
+    STATS_EMIT("vfs.bytes_stored", bytes);
+    STATS_EMIT("tier.budget", __atomic_load_n(&sos_cur->tier.budget, __ATOMIC_RELAXED));
+    STATS_EMIT("tier.resident", tier_resident());
+    TIER_IO_LOCK(&sos_cur->tier);
+    long long store_end = sos_cur->tier.end;
+    TIER_IO_UNLOCK(&sos_cur->tier);
+    STATS_EMIT("tier.store_bytes", store_end);
+    for (int i = 0; i < ST_COUNT; ++i) STATS_EMIT(stat_names[i], s.v[i]);
+    for (int i = 0; i <= ST_NCMDS; ++i) {
+        char key[48];
+        snprintf(key, sizeof(key), "cmd.%s", i < ST_NCMDS ? stat_cmd_names[i] : "other");
+        STATS_EMIT(key, s.cmd[i]);
+    }
+#undef STATS_EMIT
+    if (json) sb_append(out, "}\n", 2);
+}
+
+/* stats [-j]: counters since startup, summed over all threads */
+static void cmd_stats(const char* arg) {
+    strbuf_t out = {0};
+    stats_render(&out, strcmp(arg, "-j") == 0 || strcmp(arg, "--json") == 0);
+    if (out.len) sh_write(out.data, out.len);
+    sb_free(&out);
+}
+
+/* vfs_budget [MB]: shows or sets the memory budget for file bodies */
+static void cmd_vfs_budget(const char* arg) {
+    tier_t* t = &sos_cur->tier;
+    if (arg[0]) {
+        char* end;
+        double mb = strtod(arg, &end);
+        if (end == arg || *end || mb < 0) { sh_printf("Usage: vfs_budget [MB, 0 = unlimited]\n"); return; }
+        __atomic_store_n(&t->budget, (size_t)(mb * 1024 * 1024), __ATOMIC_RELAXED);
+        tier_balance();
+    }
+    size_t budget = __atomic_load_n(&t->budget, __ATOMIC_RELAXED);
+    TIER_IO_LOCK(t);
+    long long store = t->end;
+    TIER_IO_UNLOCK(t);
+    if (budget) sh_printf("Budget: %.2f MB", budget / 1048576.0);
+    else sh_printf("Budget: unlimited");
+    sh_printf(" | resident %.2f MB | backing store %.2f MB\n", tier_resident() / 1048576.0, store / 1048576.0);
+}
+
+/* bgsave: saves the VFS from a forked child */
+static void cmd_bgsave() {
+    bgsave_t* bg = &sos_cur->bgsave;
+    if (sos_cur->state_path[0] == '\0') { sh_printf("bgsave: this instance keeps its VFS in memory only\n"); return; }
+    BGSAVE_LOCK();
+    bgsave_reap_locked(0);
+    if (bg->pid) sh_printf("Background save already in progress (pid %d)\n", bg->pid);
+    else {
+        int rc = bgsave_start_locked(1);
+#ifndef _WIN32
+        if (rc > 0) sh_printf("Background saving started (pid %d, %u changed)\n", rc, bg->dirty);
+        else if (rc == 0) sh_printf("Nothing changed since the last save\n");
+        else sh_printf("bgsave: cannot fork: %s\n", strerror(errno));
+#else
+        sh_printf(rc == 0 ? "State saved in the foreground (no fork on Windows)\n" : "bgsave: save failed\n");
+#endif
+    }
+    BGSAVE_UNLOCK();
+}
+
+/* autosave [seconds|off]: background saves every interval while anything changed */
+static void cmd_autosave(const char* arg) {
+    bgsave_t* bg = &sos_cur->bgsave;
+    if (arg[0]) {
+        char* end;
+        long sec = strcmp(arg, "off") == 0 ? 0 : strtol(arg, &end, 10);
+        if (strcmp(arg, "off") != 0 && (end == arg || *end || sec < 1 || sec > 86400)) {
+            sh_printf("Usage: autosave [seconds 1-86400 | off]\n");
+            return;
+        }
+        __atomic_store_n(&bg->interval, (unsigned)sec, __ATOMIC_RELAXED);
+    }
+    vfs_snap_t snap[FS_MAX_FILES];
+    int n;
+    BGSAVE_LOCK();
+    VFS_LOCK();
+    int dirty = vfs_dirty_locked(snap, &n, 0);
+    VFS_UNLOCK();
+    if (bg->interval) sh_printf("Autosave: every %u s", bg->interval);
+    else sh_printf("Autosave: off");
+    sh_printf(" | %d of %d files changed", dirty - (sos_cur->removals != sos_cur->saved_removals), n);
+    if (sos_cur->removals != sos_cur->saved_removals) sh_printf(", removals pending");
+    if (bg->last_ok) sh_printf(" | last save %.0f s ago", (now_us() - bg->last_ok) / 1e6);
+    if (bg->pid) sh_printf(" | saving (pid %d)", bg->pid);
+    sh_printf("\n");
+    BGSAVE_UNLOCK();
+}
+
+/* the shell transaction, if the current user opened it, with a
+   reference the caller drops with tx_release() */
+static sos_tx_t* tx_shell() {
+    const char* user = sh_user ? sh_user : sos_cur->env_USER;
+    VFS_LOCK();
+    sos_tx_t* tx = sos_cur->shell_tx;
+    if (tx && strcmp(tx->owner, user) != 0) tx = NULL;
+    if (tx) __atomic_add_fetch(&tx->refs, 1, __ATOMIC_RELAXED);
+    VFS_UNLOCK();
+    return tx;
+}
+
+/* begin: stage this user's writes until commit or abort */
+static void cmd_begin() {
+    const char* user = sh_user ? sh_user : sos_cur->env_USER;
+    sos_tx_t* tx = tx_new(user);
+    if (!tx) { sh_printf("begin: out of memory\n"); return; }
+    VFS_LOCK();
+    sos_tx_t* open = sos_cur->shell_tx;
+    if (!open) sos_cur->shell_tx = tx;
+    VFS_UNLOCK();
+    if (!open) { sh_printf("Transaction started; changes stay private until 'commit'\n"); return; }
+    if (strcmp(open->owner, user) == 0) sh_printf("begin: a transaction is already open (%zu files staged)\n", open->n);
+    else sh_printf("begin: %s has a transaction open\n", open->owner);
+    tx_free(tx);
+}
+
+/* commit/abort: detaches the user's transaction and applies or drops it.
+   Other stages of the same line may still hold it; they find it closed
+   and go to the VFS, and the last of them frees it. */
+static void cmd_end_tx(int apply) {
+    sos_tx_t* tx = tx_shell();
+    int mine = 0;
+    if (tx) {
+        VFS_LOCK();
+        mine = sos_cur->shell_tx == tx;     /* another stage may have ended it first */
+        if (mine) sos_cur->shell_tx = NULL;
+        VFS_UNLOCK();
+    }
+    if (!mine) {
+        tx_release(tx);
+        sh_printf("%s: no transaction open; use 'begin'\n", apply ? "commit" : "abort");
+        return;
+    }
+    tx_cur = NULL;
+    TX_LOCK(tx);
+    size_t n = tx->n;
+    TX_UNLOCK(tx);
+    if (!apply) {
+        tx_close(tx);
+        STAT_INC(ST_TX_ABORTS);
+        sh_printf("Transaction aborted; %zu staged file%s dropped\n", n, n == 1 ? "" : "s");
+    } else {
+        char why[MAX_NAME] = "";
+        int rc = tx_commit(tx, why, sizeof(why));
+        if (rc == 0) sh_printf("Committed %zu file%s\n", n, n == 1 ? "" : "s");
+        else if (rc == -1) sh_printf("Commit failed: %s changed since it was staged; nothing applied\n", why);
+        else sh_printf("Commit failed: VFS full or out of memory; nothing applied\n");
+    }
+    tx_release(tx);     /* the shell's */
+    tx_release(tx);     /* ours */
+}
+
+/* tasks and scheduler */
+static void task_clock_builtin() {
+    time_t t = sos_now();
+    struct tm tm = *localtime(&t);
+    printf("[clock] %02d:%02d:%02d\n", tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+static void task_heartbeat_builtin() {
+    static int hb = 0;
+    hb++;
+    if (hb % 5 == 0) printf("[heartbeat] system alive...\n");
+}
+
+static void task_logger_builtin() {
+    printf("[logger] simple logger tick\n");
+}
+
+static int find_free_task_slot() {
+    for (int i = 0; i < MAX_TASKS; ++i) if (sos_cur->tasks[i].id == 0) return i;
+    for (int i = 0; i < MAX_TASKS; ++i) if (!sos_cur->tasks[i].active && sos_cur->tasks[i].type != TASK_BUILD && sos_cur->tasks[i].type != TASK_JOB && sos_cur->tasks[i].type != TASK_WATCH) return i;
+    return -1;
+}
+
+/* claims a slot for a task of the given type; returns its id or 0 */
+static int spawn_task(const char* name, int type) {
+    TASKS_LOCK();
+    int idx = sos_cur->task_count < MAX_TASKS ? find_free_task_slot() : -1;
+    if (idx == -1) { TASKS_UNLOCK(); return 0; }
+    memset(&sos_cur->tasks[idx], 0, sizeof(sos_cur->tasks[idx]));
+    sos_cur->tasks[idx].id = sos_cur->next_task_id++;
+    strncpy(sos_cur->tasks[idx].name, name, sizeof(sos_cur->tasks[idx].name)-1);
+    sos_cur->tasks[idx].type = type;
+    sos_cur->tasks[idx].active = 1;
+    sos_cur->task_count++;
+    int id = sos_cur->tasks[idx].id;
+    TASKS_UNLOCK();
+    return id;
+}
+
+static void task_release(task_t* t) {
+    TASKS_LOCK();
+    if (t->fds) {
+        vfd_close_all(t->fds);
+#ifndef _WIN32
+        pthread_mutex_destroy(&t->fds->mtx);
+#endif
+        free(t->fds);
+        t->fds = NULL;
+    }
+    if (t->watch) {
+        watch_index_remove(t->watch);
+        free(t->watch);
+        t->watch = NULL;
+    }
+    t->active = 0;
+    t->id = 0;
+    t->name[0] = '\0';
+    t->msg[0] = '\0';
+    t->fn = NULL;
+    t->ticks = 0;
+    sos_cur->task_count--;
+    TASKS_UNLOCK();
+}
+
+static int spawn_builtin(const char* name, builtin_fn fn) {
+    TASKS_LOCK();
+    int idx = sos_cur->task_count < MAX_TASKS ? find_free_task_slot() : -1;
+    if (idx == -1) { TASKS_UNLOCK(); return 0; }
+    sos_cur->tasks[idx].id = sos_cur->next_task_id++;
+    strncpy(sos_cur->tasks[idx].name, name, sizeof(sos_cur->tasks[idx].name)-1);
+    sos_cur->tasks[idx].name[sizeof(sos_cur->tasks[idx].name)-1] = '\0';
+    sos_cur->tasks[idx].type = TASK_BUILTIN;
+    sos_cur->tasks[idx].fn = fn;
+    sos_cur->tasks[idx].msg[0] = '\0';
+    sos_cur->tasks[idx].interval = 0;
+    sos_cur->tasks[idx].ticks = 0;
+    sos_cur->tasks[idx].active = 1;
+    sos_cur->task_count++;
+    int id = sos_cur->tasks[idx].id;
+    TASKS_UNLOCK();
+    return id;
+}
+
+static int spawn_message_task(const char* name, unsigned interval, const char* message) {
+    TASKS_LOCK();
+    int idx = sos_cur->task_count < MAX_TASKS ? find_free_task_slot() : -1;
+    if (idx == -1) { TASKS_UNLOCK(); return 0; }
+    sos_cur->tasks[idx].id = sos_cur->next_task_id++;
+    strncpy(sos_cur->tasks[idx].name, name, sizeof(sos_cur->tasks[idx].name)-1);
+    sos_cur->tasks[idx].name[sizeof(sos_cur->tasks[idx].name)-1] = '\0';
+    sos_cur->tasks[idx].type = TASK_MESSAGE;
+    sos_cur->tasks[idx].fn = NULL;
+    strncpy(sos_cur->tasks[idx].msg, message ? message : "", sizeof(sos_cur->tasks[idx].msg)-1);
+    sos_cur->tasks[idx].msg[sizeof(sos_cur->tasks[idx].msg)-1] = '\0';
+    if (interval == 0) interval = 1;
+    sos_cur->tasks[idx].interval = interval;
+    sos_cur->tasks[idx].ticks = 0;
+    sos_cur->tasks[idx].active = 1;
+    sos_cur->task_count++;
+    int id = sos_cur->tasks[idx].id;
+    TASKS_UNLOCK();
+    return id;
+}
+
+static task_t* task_find_by_id(int id) {
+    for (int i = 0; i < MAX_TASKS; ++i) if (sos_cur->tasks[i].id == id) return &sos_cur->tasks[i];
+    return NULL;
+}
+
+/* pattern is a file name, or a prefix ending in '*'; returns the task id or 0 */
+static int spawn_watch(const char* pattern, const char* command) {
+    size_t len = strlen(pattern);
+    int prefix = len > 0 && pattern[len - 1] == '*';
+    if (prefix) len--;
+    if (len >= MAX_NAME || strlen(command) >= MAX_MSG) return 0;
+    watch_t* w = calloc(1, sizeof(*w));
+    if (!w) return 0;
+    TASKS_LOCK();
+    int id = spawn_task(pattern, TASK_WATCH);
+    if (!id) { TASKS_UNLOCK(); free(w); return 0; }
+    memcpy(w->key, pattern, len);
+    w->prefix = prefix;
+    task_t* t = task_find_by_id(id);
+    snprintf(t->msg, sizeof(t->msg), "%s", command);
+    t->watch = w;
+    watch_index_add(w);
+    TASKS_UNLOCK();
+    return id;
+}
+
+static void shell_run_line(const char* line);
+
+/* runs the reaction once for each queued change; returns how many ran */
+static unsigned long long watch_run(task_t* t) {
+    watch_t* w = t->watch;
+    watch_event_t ev[WATCH_QUEUE];
+    WATCH_LOCK();
+    unsigned n = w->count;
+    for (unsigned i = 0; i < n; ++i) ev[i] = w->q[(w->head + i) % WATCH_QUEUE];
+    w->head = (w->head + n) % WATCH_QUEUE;
+    __atomic_store_n(&w->count, 0, __ATOMIC_RELEASE);
+    WATCH_UNLOCK();
+    int id = t->id;
+    unsigned long long runs = 0;
+    strbuf_t cmd = {0};
+    /* the reaction may kill its own task, which frees w */
+    for (unsigned i = 0; i < n && t->id == id; ++i) {
+        cmd.len = 0;
+        for (const char* p = t->msg; *p; ++p) {
+            if (p[0] == '{' && p[1] == '}') { sb_append(&cmd, ev[i].name, strlen(ev[i].name)); p++; }
+            else sb_append(&cmd, p, 1);
+        }
+        sb_append(&cmd, "", 0);
+        watch_running = w;
+        shell_run_line(cmd.data);
+        watch_running = NULL;
+        runs++;
+    }
+    sb_free(&cmd);
+    return runs;
+}
+
+#ifndef _WIN32
+static void build_poll(task_t* t);
+static void build_cancel(task_t* t);
+static void build_status(int job, char* out, size_t sz);
+static void job_poll(task_t* t);
+static void job_cancel(task_t* t);
+static void job_signal(task_t* t, int sig);
+static void job_status(int job, char* out, size_t sz);
+#endif
+
+static void scheduler_tick() {
+    task_t* tasks = sos_cur->tasks;
+    unsigned long long runs = 0;
+    watch_unwake();
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        task_t* t = &tasks[i];
+        if (t->id == 0) continue;
+#ifndef _WIN32
+        /* builds keep running while suspended; only the report waits for a tick */
+        if (t->type == TASK_BUILD) { t->ticks++; build_poll(t); continue; }
+        if (t->type == TASK_JOB) { t->ticks++; job_poll(t); continue; }
+#endif
+        if (!t->active) continue;
+        t->ticks++;
+        if (t->type == TASK_BUILTIN && t->fn) {
+            vfd_task = t;
+            t->fn();
+            vfd_task = NULL;
+            runs++;
+        }
+        else if (t->type == TASK_WATCH) {
+            if (__atomic_load_n(&t->watch->count, __ATOMIC_ACQUIRE)) runs += watch_run(t);
+        }
+        else if (t->type == TASK_MESSAGE) {
+            if (t->interval > 0 && (t->ticks % t->interval) == 0) {
+                printf("[task %d: %s] %s\n", t->id, t->name, t->msg);
+                runs++;
+            }
+        }
+    }
+    bgsave_poll();
+    STAT_INC(ST_SCHED_TICKS);
+    STAT_ADD(ST_TASK_RUNS, runs);
+}
+
+/* utilities prototypes */
+static void show_help();
+static void show_ps();
+static void kill_task(int id);
+static void suspend_task(int id);
+static void resume_task(int id);
+static void show_uptime();
+static void power_button_ui();
+static void clear_screen();
+static void cmd_edit(const char* filename);
+static void export_to_disk(const char* diskfile, const char* vfsfile);
+static void import_from_disk(const char* vfsfile, const char* diskfile);
+static void show_ips();
+static void vm_sysinfo();
+static void compile_file(const char* filename, const char* flags);
+static void run_command(const char* cmdrest);
+
+/* minimal sysinfo */
+static void cmd_sysinfo() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    sh_printf("CPU cores (Logical): %u\n", si.dwNumberOfProcessors);
+    MEMORYSTATUSEX ms; ms.dwLength = sizeof(ms);
+    GlobalMemoryStatusEx(&ms);
+    sh_printf("Memory: %llu MB total, %llu MB available\n", (unsigned long long)(ms.ullTotalPhys/1024/1024), (unsigned long long)(ms.ullAvailPhys/1024/1024));
+#else
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    sh_printf("CPU cores (Logical): %ld\n", cores);
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && page_size > 0) {
+        unsigned long long total = (unsigned long long)pages * (unsigned long long)page_size;
+        sh_printf("Memory approx: %llu MB\n", (unsigned long long)(total / 1024 / 1024));
+    }
+#endif
+    vm_sysinfo();
+    show_uptime();
+}
+
+/* calendar - simple textual month calendar */
+static void cmd_cal(int year, int month) {
+    if (month < 1 || month > 12) { sh_printf("Invalid month\n"); return; }
+    struct tm tm = {0};
+    tm.tm_mday = 1;
+    tm.tm_mon = month - 1;
+    tm.tm_year = year - 1900;
+    mktime(&tm);
+    int start_wday = tm.tm_wday; /* 0=Sun */
+    int mdays;
+    if (month==2) {
+        int y = year;
+        int leap = ( (y%4==0 && y%100!=0) || (y%400==0) );
+        mdays = leap ? 29 : 28;
+    } else if (month==4 || month==6 || month==9 || month==11) mdays = 30;
+    else mdays = 31;
+    sh_printf("     %d-%02d\n", year, month);
+    sh_printf("Su Mo Tu We Th Fr Sa\n");
+    int day = 1;
+    for (int i = 0; i < start_wday; ++i) sh_printf("   ");
+    for (int i = start_wday; i < 7; ++i) {
+        sh_printf("%2d ", day++);
+    }
+    sh_printf("\n");
+    while (day <= mdays) {
+        for (int i = 0; i < 7 && day <= mdays; ++i) {
+            sh_printf("%2d ", day++);
+        }
+        sh_printf("\n");
+    }
+}
+
+/* whoami/hostname/date */
+static void cmd_whoami() { sh_printf("%s\n", sh_user ? sh_user : sos_cur->env_USER); }
+static void cmd_hostname() { sh_printf("%s\n", sos_cur->env_HOSTNAME); }
+static void cmd_date() {
+    time_t t = sos_now();
+    struct tm tm = *localtime(&t);
+    char buf[128];
+    strftime(buf, sizeof(buf), "%a %b %d %H:%M:%S %Y", &tm);
+    sh_printf("%s\n", buf);
+}
+
+/* show uptime */
+static void show_uptime() {
+    time_t now = sos_now();
+    long diff = (long)difftime(now, sos_cur->start_time);
+    int days = diff / (24*3600);
+    int hours = (diff % (24*3600)) / 3600;
+    int mins = (diff % 3600) / 60;
+    int secs = diff % 60;
+    sh_printf("Uptime: %d days, %02d:%02d:%02d\n", days, hours, mins, secs);
+}
+
+/* power UI */
+static void power_button_ui() {
+    sh_printf("\n+-----------------------+\n");
+    sh_printf("|       [ POWER ]       |\n");
+    sh_printf("+-----------------------+\n");
+    sh_printf("Press 'p' then Enter to power off, or just press Enter to cancel: ");
+    char buf[16];
+    if (!fgets(buf, sizeof(buf), stdin)) return;
+    if (buf[0] == 'p' || buf[0] == 'P') {
+        sh_printf("Power button pressed. Shutting down Shreyas OS...\n");
+        vfs_save_state();
+        sos_cur->running = SOS_HALTED;
+    } else sh_printf("Power cancelled.\n");
+}
+
+/* clear */
+static void clear_screen() {
+#ifdef _WIN32
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (hOut == INVALID_HANDLE_VALUE) { sh_printf("\n"); return; }
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo(hOut, &csbi)) { system("cls"); return; }
+    DWORD cellCount = csbi.dwSize.X * csbi.dwSize.Y;
+    COORD homeCoords = {0,0};
+    DWORD count;
+    FillConsoleOutputCharacter(hOut, ' ', cellCount, homeCoords, &count);
+    SetConsoleCursorPosition(hOut, homeCoords);
+#else
+    sh_printf("\x1b[2J\x1b[H");
+    fflush(stdout);
+#endif
+}
+
+/* editor: a piece table over the pinned original blob and an append-only
+   buffer of typed text. Edits splice piece descriptors, so they cost the
+   size of the edit, not of the file; each buffer keeps a sorted index of
+   its newline offsets so lines are found without scanning the text. A
+   piece also remembers where its bytes sit in the saved file, so saving
+   writes back only the pieces that moved or are new. */
+enum { ED_ORIG = 0, ED_ADD = 1 };
+#define ED_NOWHERE ((size_t)-1)
+
+typedef struct { int buf; size_t off, len, home; } ed_piece_t;
+
+typedef struct {
+    size_t pos, ins;        /* ins bytes were put at pos ... */
+    ed_piece_t* old;        /* ... in place of these pieces */
+    size_t nold;
+} ed_undo_t;
+
+typedef struct {
+    const char* name;
+    vblob_t* orig;          /* pinned: its bytes cannot change under us */
+    strbuf_t add;
+    size_t* nl[2];
+    size_t nnl[2], capnl[2];
+    ed_piece_t* pc;
+    size_t npc, cappc;
+    ed_undo_t* undo;
+    size_t nundo, capundo;
+    size_t len, newlines, cur;
+    int dirty;
+    int exists;             /* the file existed when last opened or saved */
+    unsigned long long base_id;
+    size_t base_len;        /* size of the content last read or saved */
+} editor_t;
+
+/* grows an array to at least need elements; NULL if out of memory */
+static void* ed_grow(void* p, size_t* cap, size_t need, size_t elem) {
+    if (need <= *cap) return p;
+    size_t n = *cap ? *cap * 2 : 16;
+    while (n < need) n *= 2;
+    void* q = realloc(p, n * elem);
+    if (q) *cap = n;
+    return q;
+}
+
+static const char* ed_data(const editor_t* e, int buf) {
+    return buf == ED_ADD ? e->add.data : e->orig->data;
+}
+
+/* index of buf's first newline at or after off */
+static size_t ed_nl_lower(const editor_t* e, int buf, size_t off) {
+    size_t lo = 0, hi = e->nnl[buf];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e->nl[buf][mid] < off) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static size_t ed_piece_nl(const editor_t* e, const ed_piece_t* p) {
+    return ed_nl_lower(e, p->buf, p->off + p->len) - ed_nl_lower(e, p->buf, p->off);
+}
+
+/* indexes the newlines of bytes just added to buf */
+static int ed_index(editor_t* e, int buf, size_t off, size_t len) {
+    if (len == 0) return 1;
+    const char* d = ed_data(e, buf);
+    const char* end = d + off + len;
+    for (const char* s = d + off; (s = memchr(s, '\n', (size_t)(end - s))) != NULL; ++s) {
+        size_t* nl = ed_grow(e->nl[buf], &e->capnl[buf], e->nnl[buf] + 1, sizeof(*nl));
+        if (!nl) return 0;
+        e->nl[buf] = nl;
+        e->nl[buf][e->nnl[buf]++] = (size_t)(s - d);
+    }
+    return 1;
+}
+
+static char ed_byte(const editor_t* e, size_t pos) {
+    for (size_t i = 0; i < e->npc; pos -= e->pc[i++].len)
+        if (pos < e->pc[i].len) return ed_data(e, e->pc[i].buf)[e->pc[i].off + pos];
+    return '\0';
+}
+
+static size_t ed_lines(const editor_t* e) {
+    return e->newlines + (e->len && ed_byte(e, e->len - 1) != '\n');
+}
+
+/* offset where line n (1-based) starts; the end of the text past the last */
+static size_t ed_line_start(const editor_t* e, size_t n) {
+    if (n <= 1) return 0;
+    size_t need = n - 1, pos = 0;
+    for (size_t i = 0; i < e->npc; ++i) {
+        const ed_piece_t* p = &e->pc[i];
+        size_t c = ed_piece_nl(e, p);
+        if (need <= c) return pos + e->nl[p->buf][ed_nl_lower(e, p->buf, p->off) + need - 1] - p->off + 1;
+        need -= c;
+        pos += p->len;
+    }
+    return e->len;
+}
+
+/* index of the piece starting at pos, splitting the one that spans it;
+   the caller reserved room for one more piece */
+static size_t ed_split(editor_t* e, size_t pos) {
+    size_t at = 0;
+    for (size_t i = 0; i < e->npc; at += e->pc[i++].len) {
+        if (at == pos) return i;
+        if (pos < at + e->pc[i].len) {
+            ed_piece_t* p = &e->pc[i];
+            memmove(p + 2, p + 1, (e->npc - i - 1) * sizeof(*p));
+            p[1] = (ed_piece_t){ p->buf, p->off + (pos - at), p->len - (pos - at),
+                                 p->home == ED_NOWHERE ? ED_NOWHERE : p->home + (pos - at) };
+            p->len = pos - at;
+            e->npc++;
+            return i + 1;
+        }
+    }
+    return e->npc;
+}
+
+/* replaces text [a, b) with the given pieces, optionally recording undo */
+static int ed_replace(editor_t* e, size_t a, size_t b, const ed_piece_t* ins, size_t nins, int record) {
+    ed_piece_t* pc = ed_grow(e->pc, &e->cappc, e->npc + nins + 2, sizeof(*pc));
+    if (!pc) return 0;
+    e->pc = pc;
+    if (record) {
+        ed_undo_t* undo = ed_grow(e->undo, &e->capundo, e->nundo + 1, sizeof(*undo));
+        if (!undo) return 0;
+        e->undo = undo;
+    }
+    size_t i = ed_split(e, a), j = ed_split(e, b), nold = j - i, inslen = 0;
+    for (size_t k = 0; k < nins; ++k) inslen += ins[k].len;
+    if (record) {
+        ed_undo_t* u = &e->undo[e->nundo];
+        u->old = NULL;
+        if (nold && !(u->old = malloc(nold * sizeof(*u->old)))) return 0;
+        if (nold) memcpy(u->old, e->pc + i, nold * sizeof(*u->old));
+        u->nold = nold;
+        u->pos = a;
+        u->ins = inslen;
+        e->nundo++;
+    }
+    for (size_t k = 0; k < nins; ++k) e->newlines += ed_piece_nl(e, &ins[k]);
+    for (size_t k = i; k < j; ++k) e->newlines -= ed_piece_nl(e, &e->pc[k]);
+    memmove(e->pc + i + nins, e->pc + j, (e->npc - j) * sizeof(*e->pc));
+    if (nins) memcpy(e->pc + i, ins, nins * sizeof(*ins));
+    e->npc = e->npc - nold + nins;
+    e->len = e->len - (b - a) + inslen;
+    e->dirty = 1;
+    return 1;
+}
+
+static void ed_copy(const editor_t* e, size_t a, size_t b, strbuf_t* out) {
+    size_t at = 0;
+    for (size_t i = 0; i < e->npc && at < b; at += e->pc[i++].len) {
+        const ed_piece_t* p = &e->pc[i];
+        size_t s = a > at ? a - at : 0, t = b - at < p->len ? b - at : p->len;
+        if (s < t) sb_append(out, ed_data(e, p->buf) + p->off + s, t - s);
+    }
+}
+
+/* reads lines up to a lone '.' into the add buffer as one piece */
+static ed_piece_t ed_read_text(editor_t* e, int lead_nl) {
+    ed_piece_t p = { ED_ADD, e->add.len, 0, ED_NOWHERE };
+    if (lead_nl) sb_append(&e->add, "\n", 1);
+    char line[512];
+    int bol = 1;
+    while (fgets(line, sizeof(line), stdin)) {
+        if (bol && (strcmp(line, ".\n") == 0 || strcmp(line, ".\r\n") == 0 || strcmp(line, ".") == 0)) break;
+        size_t n = strlen(line);
+        sb_append(&e->add, line, n);
+        bol = n && line[n-1] == '\n';
+    }
+    if (!bol) sb_append(&e->add, "\n", 1);
+    p.len = e->add.len - p.off;
+    if (!ed_index(e, ED_ADD, p.off, p.len)) p.len = 0;
+    return p;
+}
+
+/* parses "[a][,[b]]" where an address is N, '.' or '$'; 0 if invalid */
+static int ed_range(const editor_t* e, const char* s, size_t* a, size_t* b) {
+    size_t* dst[2] = { a, b };
+    size_t last = ed_lines(e);
+    *a = *b = e->cur;
+    for (int k = 0; k < 2; ++k) {
+        while (*s == ' ') s++;
+        if (*s == '.') { *dst[k] = e->cur; s++; }
+        else if (*s == '$') { *dst[k] = last; s++; }
+        else if (isdigit((unsigned char)*s)) *dst[k] = strtoull(s, (char**)&s, 10);
+        else if (k == 0 && *s == ',') *a = 1;
+        else if (k == 1) *b = last;
+        if (k == 0) *b = *a;
+        while (*s == ' ') s++;
+        if (k == 0 && *s != ',') break;
+        if (k == 0) s++;
+    }
+    while (*s == ' ' || *s == '\n' || *s == '\r') s++;
+    return *s == '\0' && *a >= 1 && *a <= *b && *b <= last;
+}
+
+static void ed_print(editor_t* e, size_t a, size_t b) {
+    strbuf_t text = {0};
+    ed_copy(e, ed_line_start(e, a), ed_line_start(e, b + 1), &text);
+    const char* s = text.data;
+    for (size_t n = a; n <= b && s; ++n) {
+        const char* nl = memchr(s, '\n', text.len - (size_t)(s - text.data));
+        size_t len = nl ? (size_t)(nl - s) : text.len - (size_t)(s - text.data);
+        sh_printf("%6zu  %.*s\n", n, (int)len, s);
+        s = nl ? nl + 1 : NULL;
+    }
+    sb_free(&text);
+    e->cur = b;
+}
+
+/* commits the text: the runs of pieces that are not already in place
+   are written at their offsets, then the file is cut to length */
+static int ed_save(editor_t* e, int force) {
+    unsigned long long id = 0;
+    size_t size = 0;
+    int exists = vfs_version(e->name, &id, &size);
+    int same = exists == e->exists && (!exists || (id == e->base_id && size == e->base_len));
+    if (!same && !force) {
+        sh_printf("'%s' changed since it was read; w! overwrites it\n", e->name);
+        return 0;
+    }
+    strbuf_t text = {0};
+    int ok = 1;
+    size_t sent = 0;
+    if (same && exists) {
+        size_t at = 0, run = 0;
+        for (size_t i = 0; i <= e->npc && ok; ++i) {
+            const ed_piece_t* p = i < e->npc ? &e->pc[i] : NULL;
+            if (p && p->home != at) {
+                if (text.len == 0) run = at;
+                sb_append(&text, ed_data(e, p->buf) + p->off, p->len);
+            } else if (text.len) {
+                ok = vfs_pwrite_raw(e->name, run, text.data, text.len);
+                sent += text.len;
+                text.len = 0;
+            }
+            if (p) at += p->len;
+        }
+        if (ok && e->len < e->base_len) ok = vfs_truncate_raw(e->name, e->len);
+    } else {
+        ed_copy(e, 0, e->len, &text);
+        ok = vfs_write_raw(e->name, text.data ? text.data : "", text.len);
+        sent = text.len;
+    }
+    sb_free(&text);
+    if (!ok) { sh_printf("VFS full\n"); return 0; }
+    e->exists = vfs_version(e->name, &e->base_id, &e->base_len);
+    /* the file now matches the pieces; undone ones match nothing */
+    for (size_t i = 0, at = 0; i < e->npc; at += e->pc[i++].len) e->pc[i].home = at;
+    for (size_t i = 0; i < e->nundo; ++i)
+        for (size_t k = 0; k < e->undo[i].nold; ++k) e->undo[i].old[k].home = ED_NOWHERE;
+    e->dirty = 0;
+    sh_printf("Saved '%s' (%zu bytes, %zu written)\n", e->name, e->len, sent);
+    return 1;
+}
+
+static void ed_free(editor_t* e) {
+    if (e->orig) blob_unref(e->orig);
+    sb_free(&e->add);
+    free(e->nl[ED_ORIG]);
+    free(e->nl[ED_ADD]);
+    free(e->pc);
+    for (size_t i = 0; i < e->nundo; ++i) free(e->undo[i].old);
+    free(e->undo);
+}
+
+static void cmd_edit(const char* filename) {
+    if (!filename || filename[0]=='\0') { sh_printf("Usage: edit <file>\n"); return; }
+    if (vfs_readonly(filename)) { sh_printf("%s is read-only\n", filename); return; }
+    editor_t e = {0};
+    e.name = filename;
+    e.orig = vfs_pin_blob(filename, &e.base_len);
+    e.exists = e.orig != NULL;
+    if (e.orig) e.base_id = e.orig->id;
+    ed_piece_t whole = { ED_ORIG, 0, e.base_len, 0 };
+    if (e.base_len && (!ed_index(&e, ED_ORIG, 0, e.base_len) || !ed_replace(&e, 0, 0, &whole, 1, 0))) {
+        sh_printf("edit: out of memory\n");
+        ed_free(&e);
+        return;
+    }
+    e.dirty = 0;
+    e.cur = ed_lines(&e);
+    sh_printf("Editing '%s': %zu lines, %zu bytes. Type h for help.\n", filename, ed_lines(&e), e.len);
+    char line[512];
+    while (1) {
+        if (!fgets(line, sizeof(line), stdin)) {
+            if (e.dirty) ed_save(&e, 0);
+            break;
+        }
+        char* c = line;
+        while (*c == ' ' || *c == '\t') c++;
+        c[strcspn(c, "\r\n")] = '\0';
+        size_t a, b, last = ed_lines(&e);
+        char op = *c;
+        const char* arg = *c ? c + 1 : c;
+        if (isdigit((unsigned char)op) || op == '.' || op == '$') { op = 'g'; arg = c; }
+        if (op == '\0') continue;
+        if (strcmp(c, "q") == 0) {
+            if (!e.dirty) break;
+            sh_printf("Unsaved changes; w saves them, q! discards them\n");
+        } else if (strcmp(c, "q!") == 0) break;
+        else if (strcmp(c, "w") == 0 || strcmp(c, "w!") == 0) ed_save(&e, c[1] == '!');
+        else if (strcmp(c, "wq") == 0 || strcmp(c, "x") == 0) { if (!e.dirty || ed_save(&e, 0)) break; }
+        else if (strcmp(c, "=") == 0) sh_printf("%zu lines, %zu bytes, %zu pieces, line %zu\n", last, e.len, e.npc, e.cur);
+        else if (strcmp(c, "h") == 0) {
+            sh_printf("  N | g N        go to line N and print it\n"
+                      "  p [a[,b]]      print lines ('.' current, '$' last, ',' all)\n"
+                      "  i [N] | a [N]  insert before | after line N; end the text with a lone '.'\n"
+                      "  c [a[,b]]      replace lines with new text\n"
+                      "  d [a[,b]]      delete lines\n"
+                      "  u              undo the last change\n"
+                      "  =              line, byte and piece counts\n"
+                      "  w | w!         save (w! also when the file changed meanwhile)\n"
+                      "  q | q! | wq    quit, quit discarding changes, save and quit\n");
+        } else if (op == 'u' && c[1] == '\0') {
+            if (e.nundo == 0) { sh_printf("Nothing to undo\n"); continue; }
+            ed_undo_t u = e.undo[--e.nundo];
+            ed_replace(&e, u.pos, u.pos + u.ins, u.old, u.nold, 0);
+            free(u.old);
+            size_t n = ed_lines(&e);
+            if (e.cur > n) e.cur = n;
+        } else if (op == 'g' && ed_range(&e, arg, &a, &b) && a == b) ed_print(&e, a, a);
+        else if (op == 'p' && ed_range(&e, arg, &a, &b)) ed_print(&e, a, b);
+        else if (op == 'd' && ed_range(&e, arg, &a, &b)) {
+            ed_replace(&e, ed_line_start(&e, a), ed_line_start(&e, b + 1), NULL, 0, 1);
+            size_t n = ed_lines(&e);
+            e.cur = a <= n ? a : n;
+        } else if (op == 'c' && ed_range(&e, arg, &a, &b)) {
+            ed_piece_t p = ed_read_text(&e, 0);
+            ed_replace(&e, ed_line_start(&e, a), ed_line_start(&e, b + 1), &p, p.len ? 1 : 0, 1);
+            e.cur = p.len ? a + ed_piece_nl(&e, &p) - 1 : a - 1;
+        } else if (op == 'i' || op == 'a') {
+            /* an empty file accepts i, and a after line 0 inserts at the top */
+            size_t n = e.cur;
+            const char* s = arg;
+            while (*s == ' ') s++;
+            if (*s == '$') { n = last; s++; }
+            else if (isdigit((unsigned char)*s)) n = strtoull(s, (char**)&s, 10);
+            else if (*s == '.') s++;
+            if (op == 'i' && n == 0 && last == 0) n = 1;
+            if (*s != '\0' || (op == 'i' ? n < 1 || n > (last ? last : 1) : n > last)) { sh_printf("Invalid address\n"); continue; }
+            size_t pos = ed_line_start(&e, op == 'i' ? n : n + 1);
+            /* text added after an unterminated last line starts a new one */
+            int lead = pos == e.len && e.len && ed_byte(&e, e.len - 1) != '\n';
+            ed_piece_t p = ed_read_text(&e, lead);
+            if (p.len) ed_replace(&e, pos, pos, &p, 1, 1);
+            e.cur = (op == 'i' ? n - 1 : n) + ed_piece_nl(&e, &p) - (size_t)lead;
+        } else sh_printf("? (h for help)\n");
+    }
+    ed_free(&e);
+}
+
+/* import/export */
+/* export/import stream through an fd, so memory stays at one buffer */
+static void export_to_disk(const char* diskfile, const char* vfsfile) {
+    if (!diskfile || !vfsfile) { sh_printf("Usage: export <file_on_disk> <vfs_file>\n"); return; }
+    int fd = vfd_open(vfsfile, SOS_O_READ);
+    if (fd < 0) { sh_printf("VFS file not found: %s\n", vfsfile); return; }
+    FILE* fp = fopen(diskfile, "wb");
+    if (!fp) { sh_printf("Failed to open disk file for writing: %s\n", diskfile); vfd_close(fd); return; }
+    char chunk[8192];
+    long long n;
+    while ((n = vfd_read(fd, chunk, sizeof(chunk))) > 0) fwrite(chunk, 1, (size_t)n, fp);
+    fclose(fp);
+    vfd_close(fd);
+    sh_printf("Exported %s -> %s\n", vfsfile, diskfile);
+}
+
+static void import_from_disk(const char* vfsfile, const char* diskfile) {
+    if (!diskfile || !vfsfile) { sh_printf("Usage: import <vfs_file> <file_on_disk>\n"); return; }
+    FILE* fp = fopen(diskfile, "rb");
+    if (!fp) { sh_printf("Failed to open disk file: %s\n", diskfile); return; }
+    int fd = vfd_open(vfsfile, SOS_O_WRITE | SOS_O_CREATE | SOS_O_TRUNC);
+    if (fd < 0) { sh_printf(vfs_readonly(vfsfile) ? "%s is read-only\n" : "VFS full\n", vfsfile); fclose(fp); return; }
+    char chunk[8192];
+    size_t n, total = 0;
+    int ok = 1;
+    while (ok && (n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        ok = vfd_write(fd, chunk, n) == (long long)n;
+        total += n;
+    }
+    fclose(fp);
+    if (vfd_close(fd) != 0 || !ok) sh_printf("VFS full\n");
+    else sh_printf("Imported %s -> %s (%zu bytes)\n", diskfile, vfsfile, total);
+}
+
+/* IP display (no packet manipulation) */
+static void show_ips() {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2,2), &wsa) != 0) { sh_printf("WSAStartup failed\n"); return; }
+    char name[256];
+    if (gethostname(name, sizeof(name)) == SOCKET_ERROR) { sh_printf("Unable to get host name\n"); WSACleanup(); return; }
+    struct hostent *he = gethostbyname(name);
+    if (!he) { sh_printf("gethostbyname failed\n"); WSACleanup(); return; }
+    sh_printf("Local IPv4 addresses:\n");
+    char **addr_list = he->h_addr_list;
+    for (int i = 0; addr_list[i] != NULL; ++i) {
+        struct in_addr addr;
+        memcpy(&addr.s_addr, addr_list[i], sizeof(addr.s_addr));
+        sh_printf(" - %s\n", inet_ntoa(addr));
+    }
+    WSACleanup();
+#else
+    struct ifaddrs *ifaddr, *ifa;
+    if (getifaddrs(&ifaddr) == -1) { sh_printf("getifaddrs failed\n"); return; }
+    sh_printf("Local IP addresses:\n");
+    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr) continue;
+        if (ifa->ifa_addr->sa_family == AF_INET) {
+            char host[NI_MAXHOST];
+            int s = getnameinfo(ifa->ifa_addr, sizeof(struct sockaddr_in), host, NI_MAXHOST, NULL, 0, NI_NUMERICSERV);
+            if (s == 0) sh_printf(" - %s: %s\n", ifa->ifa_name, host);
+        }
+    }
+    freeifaddrs(ifaddr);
+#endif
+    sh_printf("Note: This command only displays local addresses. Manipulating live packets is not provided.\n");
+}
+
+/* child processes: spawned with posix_spawnp, never through /bin/sh */
+#ifndef _WIN32
+extern char **environ;
+
+/* runs argv[0] from PATH without a shell; stdin is /dev/null and
+   stdout+stderr go to logpath. Returns the pid or -1. */
+static pid_t spawn_logged(char* const argv[], const char* logpath) {
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, 2, logpath, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&fa, 2, 1);
+    pid_t pid;
+    int rc = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    return rc == 0 ? pid : -1;
+}
+
+static int pipe_cloexec(int fds[2]) {
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+/* runs argv with 'in' on its stdin and collects stdout and stderr in
+   full. All three pipes are serviced from one poll() loop so a child
+   that writes a lot of diagnostics before reading its input cannot
+   deadlock us. Returns the exit status, 128+signal, or -1. */
+static int proc_capture(char* const argv[], const char* in, size_t inlen, strbuf_t* out, strbuf_t* err) {
+    int pin[2], pout[2], perr[2];
+    if (pipe_cloexec(pin) != 0) return -1;
+    if (pipe_cloexec(pout) != 0) { close(pin[0]); close(pin[1]); return -1; }
+    if (pipe_cloexec(perr) != 0) { close(pin[0]); close(pin[1]); close(pout[0]); close(pout[1]); return -1; }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, pin[0], 0);
+    posix_spawn_file_actions_adddup2(&fa, pout[1], 1);
+    posix_spawn_file_actions_adddup2(&fa, perr[1], 2);
+    pid_t pid;
+    int rc = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(pin[0]); close(pout[1]); close(perr[1]);
+    if (rc != 0) {
+        close(pin[1]); close(pout[0]); close(perr[0]);
+        errno = rc;
+        return -1;
+    }
+    fcntl(pin[1], F_SETFL, fcntl(pin[1], F_GETFL) | O_NONBLOCK);
+    int fin = pin[1], fout = pout[0], ferr = perr[0];
+    size_t sent = 0;
+    if (inlen == 0) { close(fin); fin = -1; }
+    char chunk[16384];
+    while (fin >= 0 || fout >= 0 || ferr >= 0) {
+        struct pollfd pf[3];
+        int n = 0;
+        if (fin >= 0) { pf[n].fd = fin; pf[n].events = POLLOUT; n++; }
+        if (fout >= 0) { pf[n].fd = fout; pf[n].events = POLLIN; n++; }
+        if (ferr >= 0) { pf[n].fd = ferr; pf[n].events = POLLIN; n++; }
+        if (poll(pf, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (!pf[i].revents) continue;
+            if (pf[i].fd == fin) {
+                ssize_t w = write(fin, in + sent, inlen - sent);
+                if (w > 0) sent += (size_t)w;
+                if ((w < 0 && errno != EAGAIN && errno != EINTR) || sent == inlen) { close(fin); fin = -1; }
+            } else {
+                ssize_t r = read(pf[i].fd, chunk, sizeof(chunk));
+                if (r > 0) { sb_append(pf[i].fd == fout ? out : err, chunk, (size_t)r); continue; }
+                if (r < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+                close(pf[i].fd);
+                if (pf[i].fd == fout) fout = -1; else ferr = -1;
+            }
+        }
+    }
+    if (fin >= 0) close(fin);
+    if (fout >= 0) close(fout);
+    if (ferr >= 0) close(ferr);
+    int status;
+    while (waitpid(pid, &status, 0) < 0) if (errno != EINTR) return -1;
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+}
+#endif
+
+/* like split_args, but single or double quotes group words; quotes are removed in place */
+static void split_args_quoted(char* s, char** argv, int* argc, int max) {
+    while (*s && *argc < max - 1) {
+        while (*s == ' ' || *s == '\t') s++;
+        if (!*s) break;
+        char *dst = s, quote = 0;
+        argv[(*argc)++] = s;
+        for (; *s && (quote || (*s != ' ' && *s != '\t')); ++s) {
+            if (quote && *s == quote) quote = 0;
+            else if (!quote && (*s == '"' || *s == '\'')) quote = *s;
+            else *dst++ = *s;
+        }
+        if (*s) s++;
+        *dst = '\0';
+    }
+}
+
+/* splits flags on whitespace into argv[*argc...]; flags is modified */
+static void split_args(char* flags, char** argv, int* argc, int max) {
+    char* save = NULL;
+    for (char* tok = strtok_r(flags, " \t", &save); tok && *argc < max - 1; tok = strtok_r(NULL, " \t", &save))
+        argv[(*argc)++] = tok;
+}
+
+/* Build cache for compile: binaries and diagnostics live in BCACHE_DIR,
+   keyed by a hash of the source bytes, its file name and the compiler
+   flags. The index is kept in memory (loaded on first compile) and
+   rewritten after each change; entries are evicted least-recently-used
+   once the cache grows past BCACHE_BUDGET. Failed compiles are cached
+   too. The cache is shared by every instance and thread in the process:
+   bcache_mtx guards the index and the files it names, and gcc writes to
+   a private temporary that is renamed into place, so a reader never
+   sees half a binary and two misses on one key do not clash. */
+typedef struct {
+    unsigned long long key;
+    unsigned long long bytes;   /* binary + diagnostics */
+    unsigned long long used;    /* LRU clock */
+    int rc;
+} bcache_entry_t;
+
+static bcache_entry_t bcache[BCACHE_MAX_ENTRIES];
+static int bcache_n = 0;
+static int bcache_loaded = 0;
+static unsigned long long bcache_clock = 0;
+static unsigned long long bcache_hits = 0, bcache_misses = 0;
+static unsigned bcache_tmp_seq = 0;     /* names gcc's temporaries; atomic */
+#ifndef _WIN32
+static pthread_mutex_t bcache_mtx = PTHREAD_MUTEX_INITIALIZER;
+#define BCACHE_LOCK() pthread_mutex_lock(&bcache_mtx)
+#define BCACHE_UNLOCK() pthread_mutex_unlock(&bcache_mtx)
+#else
+#define BCACHE_LOCK() ((void)0)
+#define BCACHE_UNLOCK() ((void)0)
+#endif
+
+static void bcache_paths(unsigned long long key, char* bin, char* log, size_t sz) {
+#ifdef _WIN32
+    snprintf(bin, sz, BCACHE_DIR "/%016llx.exe", key);
+#else
+    snprintf(bin, sz, BCACHE_DIR "/%016llx.bin", key);
+#endif
+    snprintf(log, sz, BCACHE_DIR "/%016llx.log", key);
+}
+
+static void bcache_save_index() {
+    FILE* f = fopen(BCACHE_DIR "/index.tmp", "wb");
+    if (!f) return;
+    fprintf(f, "shreyas-bcache 1 %llu\n", bcache_clock);
+    for (int i = 0; i < bcache_n; ++i)
+        fprintf(f, "%016llx %d %llu %llu\n", bcache[i].key, bcache[i].rc, bcache[i].bytes, bcache[i].used);
+    fclose(f);
+#ifdef _WIN32
+    remove(BCACHE_DIR "/index");
+#endif
+    rename(BCACHE_DIR "/index.tmp", BCACHE_DIR "/index");
+}
+
+static void bcache_load() {
+    if (bcache_loaded) return;
+    bcache_loaded = 1;
+    disk_mkdir(BCACHE_DIR);
+    FILE* f = fopen(BCACHE_DIR "/index", "rb");
+    if (!f) return;
+    if (fscanf(f, "shreyas-bcache 1 %llu", &bcache_clock) == 1) {
+        bcache_entry_t e;
+        while (bcache_n < BCACHE_MAX_ENTRIES && fscanf(f, "%llx %d %llu %llu", &e.key, &e.rc, &e.bytes, &e.used) == 4)
+            bcache[bcache_n++] = e;
+    }
+    fclose(f);
+}
+
+static void bcache_drop(int i) {
+    char bin[256], log[256];
+    bcache_paths(bcache[i].key, bin, log, sizeof(bin));
+    remove(bin);
+    remove(log);
+    bcache[i] = bcache[--bcache_n];
+}
+
+/* 'reserve' leaves room for one more entry */
+static void bcache_evict(int reserve) {
+    for (;;) {
+        unsigned long long total = 0;
+        int lru = -1;
+        for (int i = 0; i < bcache_n; ++i) {
+            total += bcache[i].bytes;
+            if (lru < 0 || bcache[i].used < bcache[lru].used) lru = i;
+        }
+        if (lru < 0 || (total <= BCACHE_BUDGET && bcache_n + reserve <= BCACHE_MAX_ENTRIES)) return;
+        bcache_drop(lru);
+    }
+}
+
+static int bcache_lookup(unsigned long long key) {
+    for (int i = 0; i < bcache_n; ++i) if (bcache[i].key == key) return i;
+    return -1;
+}
+
+/* moves a finished temporary over its cache path */
+static void bcache_install(const char* tmp, const char* path) {
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (rename(tmp, path) != 0) remove(tmp);
+}
+
+static void cmd_buildcache(const char* arg) {
+    BCACHE_LOCK();
+    bcache_load();
+    if (strcmp(arg, "clear") == 0) {
+        while (bcache_n > 0) bcache_drop(bcache_n - 1);
+        bcache_save_index();
+        BCACHE_UNLOCK();
+        sh_printf("Build cache cleared\n");
+        return;
+    }
+    unsigned long long total = 0;
+    for (int i = 0; i < bcache_n; ++i) total += bcache[i].bytes;
+    int n = bcache_n;
+    unsigned long long hits = bcache_hits, misses = bcache_misses;
+    BCACHE_UNLOCK();
+    sh_printf("Build cache: %d entries, %llu KB of %llu KB budget, %llu hits, %llu misses this session\n",
+              n, total / 1024, BCACHE_BUDGET / 1024, hits, misses);
+}
+
+/* compile/run from VFS. The source is streamed to gcc over a pipe
+   (-x c -) and its output is captured through pipes; the diagnostics are
+   stored in the VFS as <file>.log and the binary as <stem>.out, with the
+   disk copy kept in the build cache for run. */
+static int compile_exec(const char* filename, const strbuf_t* src, const char* flags, const char* bin, strbuf_t* diag) {
+    strbuf_t input = {0};
+    char line[MAX_NAME + 16];
+    snprintf(line, sizeof(line), "#line 1 \"%s\"\n", filename);   /* diagnostics name the VFS file */
+    sb_append(&input, line, strlen(line));
+    sb_append(&input, src->data, src->len);
+    int rc;
+#ifndef _WIN32
+    char flagbuf[1024];
+    char* argv[128];
+    int argc = 0;
+    snprintf(flagbuf, sizeof(flagbuf), "%s", flags);
+    argv[argc++] = "gcc";
+    argv[argc++] = "-o";
+    argv[argc++] = (char*)bin;
+    argv[argc++] = "-x";
+    argv[argc++] = "c";
+    argv[argc++] = "-";
+    argv[argc++] = "-x";        /* flags follow the source, so -l libraries resolve its symbols */
+    argv[argc++] = "none";
+    split_args(flagbuf, argv, &argc, 120);
+    argv[argc] = NULL;
+    strbuf_t out = {0};
+    rc = proc_capture(argv, input.data, input.len, &out, diag);
+    if (rc < 0) {
+        char msg[160];
+        snprintf(msg, sizeof(msg), "failed to start gcc: %s\n", strerror(errno));
+        sb_append(diag, msg, strlen(msg));
+    }
+    if (out.len) sb_append(diag, out.data, out.len);
+    sb_free(&out);
+#else
+    /* no posix_spawn here: fall back to a temp file and the shell */
+    char tmpdisk[256], errpath[256];
+    snprintf(tmpdisk, sizeof(tmpdisk), BCACHE_DIR "/%ld.c", (long)_getpid());
+    snprintf(errpath, sizeof(errpath), BCACHE_DIR "/%ld.err", (long)_getpid());
+    FILE* fp = fopen(tmpdisk, "wb");
+    if (!fp) { sb_free(&input); return -1; }
+    fwrite(input.data, 1, input.len, fp);
+    fclose(fp);
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "gcc \"%s\" %s -o \"%s\" 2> \"%s\"", tmpdisk, flags, bin, errpath);
+    rc = system(cmd);
+    remove(tmpdisk);
+    FILE* errf = fopen(errpath, "rb");
+    if (errf) {
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), errf)) > 0) sb_append(diag, chunk, n);
+        fclose(errf);
+    }
+    remove(errpath);
+#endif
+    sb_free(&input);
+    return rc;
+}
+
+static void compile_file(const char* filename, const char* flags) {
+    if (!filename || filename[0]=='\0') { sh_printf("Usage: compile <file.c> [gcc flags]\n"); return; }
+    strbuf_t src = {0};
+    if (!vfs_read_copy(filename, &src)) { sh_printf("File not found in VFS: %s\n", filename); return; }
+    if (!flags) flags = "";
+    /* the name too: #line puts it into __FILE__ and the diagnostics */
+    unsigned long long key = fnv1a64(src.data, src.len, FNV64_INIT);
+    key = fnv1a64("", 1, key);
+    key = fnv1a64(filename, strlen(filename) + 1, key);
+    key = fnv1a64(flags, strlen(flags), key);
+
+    char bin[256], log[256];
+    bcache_paths(key, bin, log, sizeof(bin));
+    BCACHE_LOCK();
+    bcache_load();
+    int idx = bcache_lookup(key);
+    int hit = idx >= 0 && (bcache[idx].rc != 0 || disk_file_size(bin) >= 0);
+    strbuf_t diag = {0};
+    if (hit) {
+        bcache_hits++;
+        FILE* errf = fopen(log, "rb");   /* only present when gcc printed something */
+        if (errf) {
+            char chunk[4096];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), errf)) > 0) sb_append(&diag, chunk, n);
+            fclose(errf);
+        }
+    } else {
+        bcache_misses++;
+        if (idx >= 0) bcache_drop(idx);
+        BCACHE_UNLOCK();
+        /* gcc runs unlocked, into names no other compile uses */
+        char tbin[300], tlog[300];
+        unsigned seq = __atomic_add_fetch(&bcache_tmp_seq, 1, __ATOMIC_RELAXED);
+#ifdef _WIN32
+        snprintf(tbin, sizeof(tbin), "%s.%ld.%u.tmp.exe", bin, (long)_getpid(), seq);
+#else
+        snprintf(tbin, sizeof(tbin), "%s.%ld.%u.tmp", bin, (long)getpid(), seq);
+#endif
+        snprintf(tlog, sizeof(tlog), "%s.%ld.%u.tmp", log, (long)getpid(), seq);
+        int rc = compile_exec(filename, &src, flags, tbin, &diag);
+        long long bsz = disk_file_size(tbin);
+        if (rc == 0 && bsz < 0) rc = -1;
+        if (diag.len > 0) {
+            FILE* lf = fopen(tlog, "wb");
+            if (lf) { fwrite(diag.data, 1, diag.len, lf); fclose(lf); }
+        }
+        BCACHE_LOCK();
+        if (bsz >= 0) bcache_install(tbin, bin);
+        else remove(bin);
+        if (diag.len > 0) bcache_install(tlog, log);
+        else remove(log);
+        idx = bcache_lookup(key);       /* a racing miss on the same key may have added it */
+        if (idx < 0) {
+            bcache_evict(1);
+            idx = bcache_n++;
+            bcache[idx].key = key;
+        }
+        bcache[idx].rc = rc;
+        bcache[idx].bytes = (unsigned long long)((bsz > 0 ? bsz : 0) + diag.len);
+    }
+    bcache[idx].used = ++bcache_clock;
+    int rc = bcache[idx].rc;
+    /* the binary goes back into the VFS next to its source; read it
+       before anything can evict it */
+    strbuf_t image = {0};
+    FILE* bf = rc == 0 ? fopen(bin, "rb") : NULL;
+    if (bf) {
+        char chunk[16384];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), bf)) > 0) sb_append(&image, chunk, n);
+        fclose(bf);
+    }
+    bcache_evict(0);
+    bcache_save_index();
+    BCACHE_UNLOCK();
+    sb_free(&src);
+
+    char vname[MAX_NAME + 8];
+    snprintf(vname, sizeof(vname), "%s.log", filename);
+    if (diag.len > 0) {
+        vfs_write_bytes(vname, diag.data, diag.len);
+        sh_printf("Compiler output:\n%.*s%s", (int)diag.len, diag.data, diag.data[diag.len-1] == '\n' ? "" : "\n");
+    } else {
+        vfs_remove(vname);
+    }
+    sb_free(&diag);
+    if (rc != 0) { sh_printf("Compile failed with code %d%s\n", rc, hit ? " (cached)" : ""); return; }
+
+    snprintf(vname, sizeof(vname), "%s", filename);
+    char* dot = strrchr(vname, '.');
+    if (dot && dot != vname) *dot = '\0';
+    strncat(vname, ".out", sizeof(vname) - strlen(vname) - 1);
+    if (image.len > 0 && image.len <= FS_MAX_CONTENT) vfs_write_bytes(vname, image.data, image.len);
+    sh_printf("Compiled successfully to %s (%zu bytes; runnable as %s)%s\n", vname, image.len, bin, hit ? " (cached)" : "");
+    sb_free(&image);
+}
+
+/* Parallel builds: build [-j N] [cflags] <target> <files...> [-l...]
+   or build -f <manifest>. Sources and the headers they #include "..."
+   are snapshotted from the VFS when the build starts; a background
+   thread then materializes them under BUILD_DIR/<target>/src and runs up
+   to N gcc processes at once. Object files are named by a hash of the
+   unit, its transitive VFS headers and the flags, so a unit only
+   recompiles when one of those changed. The build shows up in ps as a
+   task and reports back through the scheduler when it finishes. */
+#ifndef _WIN32
+enum { UNIT_PENDING, UNIT_RUNNING, UNIT_DONE, UNIT_FAILED, UNIT_UPTODATE };
+
+typedef struct {
+    char name[MAX_NAME];
+    strbuf_t src;
+    unsigned long long key;
+    pid_t pid;
+    int state;
+} build_unit_t;
+
+typedef struct {
+    char name[MAX_NAME];
+    strbuf_t src;
+} build_header_t;
+
+typedef struct {
+    int used;
+    int finished;           /* set by the build thread, under build_mtx */
+    volatile int cancel;
+    char target[MAX_NAME];
+    char cflags[512], ldflags[512];
+    int jobs;
+    build_unit_t units[BUILD_MAX_UNITS];
+    int nunits;
+    build_header_t headers[BUILD_MAX_UNITS];
+    int nheaders;
+    int running, compiled, uptodate, failed, linked;
+    const char* phase;
+    strbuf_t log;
+    unsigned long long t_start, t_end;
+    pthread_t th;
+} build_job_t;
+
+static build_job_t builds[MAX_BUILDS];
+static pthread_mutex_t build_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int build_header_index(build_job_t* b, const char* name) {
+    for (int i = 0; i < b->nheaders; ++i) if (strcmp(b->headers[i].name, name) == 0) return i;
+    return -1;
+}
+
+/* hashes the transitive #include "..." closure of src that lives in the
+   VFS, snapshotting any header not seen yet */
+static unsigned long long build_hash_deps(build_job_t* b, const strbuf_t* src, unsigned long long h, int depth, unsigned char* seen) {
+    const char* p = src->data;
+    while (p && (p = strstr(p, "#include")) != NULL) {
+        p += 8;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '"') continue;
+        const char* end = strchr(p + 1, '"');
+        if (!end || end - p - 1 >= MAX_NAME) continue;
+        char name[MAX_NAME];
+        memcpy(name, p + 1, (size_t)(end - p - 1));
+        name[end - p - 1] = '\0';
+        if (strchr(name, '/') || strchr(name, '\\')) continue;
+        int hi = build_header_index(b, name);
+        if (hi < 0) {
+            if (b->nheaders == BUILD_MAX_UNITS) continue;
+            build_header_t* hd = &b->headers[b->nheaders];
+            memset(hd, 0, sizeof(*hd));
+            if (!vfs_read_copy(name, &hd->src)) continue;
+            snprintf(hd->name, sizeof(hd->name), "%s", name);
+            hi = b->nheaders++;
+        }
+        if (seen[hi]) continue;
+        seen[hi] = 1;
+        h = fnv1a64(name, strlen(name) + 1, h);
+        h = fnv1a64(b->headers[hi].src.data, b->headers[hi].src.len, h);
+        if (depth < 32) h = build_hash_deps(b, &b->headers[hi].src, h, depth + 1, seen);
+    }
+    return h;
+}
+
+static void build_status(int job, char* out, size_t sz) {
+    build_job_t* b = &builds[job];
+    pthread_mutex_lock(&build_mtx);
+    snprintf(out, sz, "%s %d/%d (%d running)", b->phase,
+             b->compiled + b->uptodate + b->failed, b->nunits, b->running);
+    pthread_mutex_unlock(&build_mtx);
+}
+
+static void build_write_file(const char* path, const strbuf_t* data) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return;
+    if (data->len) fwrite(data->data, 1, data->len, f);
+    fclose(f);
+}
+
+static void build_collect_log(build_job_t* b, const char* unit, const char* logpath) {
+    FILE* f = fopen(logpath, "rb");
+    if (!f) return;
+    char chunk[4096];
+    size_t n;
+    int first = 1;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        pthread_mutex_lock(&build_mtx);
+        if (first) { sb_append(&b->log, "== ", 3); sb_append(&b->log, unit, strlen(unit)); sb_append(&b->log, "\n", 1); first = 0; }
+        sb_append(&b->log, chunk, n);
+        pthread_mutex_unlock(&build_mtx);
+    }
+    fclose(f);
+    remove(logpath);
+}
+
+static void build_obj_path(build_job_t* b, build_unit_t* u, char* out, size_t sz) {
+    snprintf(out, sz, BUILD_DIR "/%s/obj/%s-%016llx.o", b->target, u->name, u->key);
+}
+
+static void* build_thread(void* arg) {
+    build_job_t* b = (build_job_t*)arg;
+    char path[512], logpath[800];
+    snprintf(path, sizeof(path), BUILD_DIR);
+    disk_mkdir(path);
+    snprintf(path, sizeof(path), BUILD_DIR "/%s", b->target);
+    disk_mkdir(path);
+    snprintf(path, sizeof(path), BUILD_DIR "/%s/src", b->target);
+    disk_mkdir(path);
+    snprintf(path, sizeof(path), BUILD_DIR "/%s/obj", b->target);
+    disk_mkdir(path);
+    for (int i = 0; i < b->nheaders; ++i) {
+        snprintf(path, sizeof(path), BUILD_DIR "/%s/src/%s", b->target, b->headers[i].name);
+        build_write_file(path, &b->headers[i].src);
+    }
+    for (int i = 0; i < b->nunits; ++i) {
+        build_obj_path(b, &b->units[i], path, sizeof(path));
+        if (disk_file_size(path) >= 0) {
+            pthread_mutex_lock(&build_mtx);
+            b->units[i].state = UNIT_UPTODATE;
+            b->uptodate++;
+            pthread_mutex_unlock(&build_mtx);
+        }
+    }
+
+    int next = 0;
+    for (;;) {
+        int progressed = 0;
+        if (b->cancel) {
+            for (int i = 0; i < b->nunits; ++i) if (b->units[i].state == UNIT_RUNNING) kill(b->units[i].pid, SIGTERM);
+        }
+        while (!b->cancel && b->running < b->jobs && next < b->nunits) {
+            build_unit_t* u = &b->units[next++];
+            if (u->state != UNIT_PENDING) continue;
+            char src[512], obj[512], flags[512];
+            snprintf(src, sizeof(src), BUILD_DIR "/%s/src/%s", b->target, u->name);
+            build_write_file(src, &u->src);
+            build_obj_path(b, u, obj, sizeof(obj));
+            snprintf(logpath, sizeof(logpath), "%s.log", obj);
+            char* argv[96];
+            int argc = 0;
+            argv[argc++] = "gcc";
+            strncpy(flags, b->cflags, sizeof(flags)-1);
+            flags[sizeof(flags)-1] = '\0';
+            split_args(flags, argv, &argc, 90);
+            argv[argc++] = "-c";
+            argv[argc++] = src;
+            argv[argc++] = "-o";
+            argv[argc++] = obj;
+            argv[argc] = NULL;
+            u->pid = spawn_logged(argv, logpath);
+            pthread_mutex_lock(&build_mtx);
+            if (u->pid > 0) { u->state = UNIT_RUNNING; b->running++; }
+            else { u->state = UNIT_FAILED; b->failed++; }
+            pthread_mutex_unlock(&build_mtx);
+            progressed = 1;
+        }
+        for (int i = 0; i < b->nunits; ++i) {
+            build_unit_t* u = &b->units[i];
+            int st;
+            if (u->state != UNIT_RUNNING || waitpid(u->pid, &st, WNOHANG) != u->pid) continue;
+            int ok = WIFEXITED(st) && WEXITSTATUS(st) == 0;
+            build_obj_path(b, u, path, sizeof(path));
+            snprintf(logpath, sizeof(logpath), "%s.log", path);
+            build_collect_log(b, u->name, logpath);
+            if (!ok) remove(path);
+            pthread_mutex_lock(&build_mtx);
+            b->running--;
+            if (ok) { u->state = UNIT_DONE; b->compiled++; }
+            else { u->state = UNIT_FAILED; b->failed++; }
+            pthread_mutex_unlock(&build_mtx);
+            progressed = 1;
+        }
+        if (b->running == 0 && (next >= b->nunits || b->cancel)) break;
+        if (!progressed) sleep_ms(2);
+    }
+
+    if (!b->cancel && b->failed == 0) {
+        /* relink only if the set of objects or the link flags changed */
+        unsigned long long lk = fnv1a64(b->ldflags, strlen(b->ldflags), FNV64_INIT);
+        for (int i = 0; i < b->nunits; ++i) lk = fnv1a64(&b->units[i].key, sizeof(b->units[i].key), lk);
+        char out[512], keypath[512], flags[512];
+        snprintf(out, sizeof(out), BUILD_DIR "/%s/%s", b->target, b->target);
+        snprintf(keypath, sizeof(keypath), BUILD_DIR "/%s/link.key", b->target);
+        unsigned long long old = 0;
+        FILE* kf = fopen(keypath, "rb");
+        if (kf) { if (fscanf(kf, "%llx", &old) != 1) old = 0; fclose(kf); }
+        if (old != lk || disk_file_size(out) < 0) {
+            pthread_mutex_lock(&build_mtx);
+            b->phase = "linking";
+            pthread_mutex_unlock(&build_mtx);
+            char objs[BUILD_MAX_UNITS][512];
+            char* argv[BUILD_MAX_UNITS + 96];
+            int argc = 0;
+            argv[argc++] = "gcc";
+            for (int i = 0; i < b->nunits; ++i) { build_obj_path(b, &b->units[i], objs[i], sizeof(objs[i])); argv[argc++] = objs[i]; }
+            strncpy(flags, b->ldflags, sizeof(flags)-1);
+            flags[sizeof(flags)-1] = '\0';
+            split_args(flags, argv, &argc, BUILD_MAX_UNITS + 90);
+            argv[argc++] = "-o";
+            argv[argc++] = out;
+            argv[argc] = NULL;
+            snprintf(logpath, sizeof(logpath), "%s.link.log", out);
+            pid_t pid = spawn_logged(argv, logpath);
+            int st = 0;
+            int ok = pid > 0 && waitpid(pid, &st, 0) == pid && WIFEXITED(st) && WEXITSTATUS(st) == 0;
+            build_collect_log(b, "link", logpath);
+            if (ok) {
+                kf = fopen(keypath, "wb");
+                if (kf) { fprintf(kf, "%016llx\n", lk); fclose(kf); }
+            }
+            pthread_mutex_lock(&build_mtx);
+            b->linked = ok ? 1 : -1;
+            pthread_mutex_unlock(&build_mtx);
+        }
+    }
+
+    /* drop objects from earlier versions of these units */
+    snprintf(path, sizeof(path), BUILD_DIR "/%s/obj", b->target);
+    DIR* d = opendir(path);
+    if (d) {
+        struct dirent* de;
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] == '.') continue;
+            int keep = 0;
+            for (int i = 0; i < b->nunits && !keep; ++i) {
+                char obj[512];
+                build_obj_path(b, &b->units[i], obj, sizeof(obj));
+                keep = strcmp(strrchr(obj, '/') + 1, de->d_name) == 0;
+            }
+            if (!keep) {
+                snprintf(logpath, sizeof(logpath), "%s/%s", path, de->d_name);
+                remove(logpath);
+            }
+        }
+        closedir(d);
+    }
+
+    pthread_mutex_lock(&build_mtx);
+    b->phase = b->cancel ? "cancelled" : (b->failed || b->linked < 0) ? "failed" : "done";
+    b->t_end = now_us();
+    b->finished = 1;
+    pthread_mutex_unlock(&build_mtx);
+    return NULL;
+}
+
+static void build_free(build_job_t* b) {
+    for (int i = 0; i < b->nunits; ++i) sb_free(&b->units[i].src);
+    for (int i = 0; i < b->nheaders; ++i) sb_free(&b->headers[i].src);
+    sb_free(&b->log);
+    pthread_mutex_lock(&build_mtx);
+    b->used = 0;
+    pthread_mutex_unlock(&build_mtx);
+}
+
+/* scheduler hook: reports and releases a build task once its thread is done */
+static void build_poll(task_t* t) {
+    build_job_t* b = &builds[t->job];
+    pthread_mutex_lock(&build_mtx);
+    int finished = b->finished;
+    pthread_mutex_unlock(&build_mtx);
+    if (!finished) return;
+    pthread_join(b->th, NULL);
+    char logname[MAX_NAME + 16];
+    snprintf(logname, sizeof(logname), "%s.build.log", b->target);
+    if (b->log.len) vfs_write(logname, b->log.data);
+    printf("[build %d: %s] %s: %d compiled, %d up to date, %d failed%s in %.2f s\n",
+           t->id, b->target, b->phase, b->compiled, b->uptodate, b->failed,
+           b->linked > 0 ? ", linked" : b->linked < 0 ? ", link failed" : "",
+           (b->t_end - b->t_start) / 1e6);
+    if (b->linked > 0 || (b->linked == 0 && !b->failed && !b->cancel))
+        printf("[build %d: %s] output: " BUILD_DIR "/%s/%s\n", t->id, b->target, b->target, b->target);
+    if (b->log.len) printf("[build %d: %s] diagnostics in VFS file %s\n", t->id, b->target, logname);
+    build_free(b);
+    task_release(t);
+}
+
+static void build_cancel(task_t* t) {
+    build_job_t* b = &builds[t->job];
+    b->cancel = 1;
+    pthread_join(b->th, NULL);
+    build_free(b);
+}
+
+/* "key value..." lines: target, sources, cflags, ldflags, jobs; '#' comments */
+static int build_parse_manifest(const char* name, build_job_t* b, char srcs[][MAX_NAME], int* nsrc) {
+    strbuf_t m = {0};
+    if (!vfs_read_copy(name, &m)) { sh_printf("Manifest not found: %s\n", name); return 0; }
+    char* save = NULL;
+    for (char* ln = strtok_r(m.data, "\n", &save); ln; ln = strtok_r(NULL, "\n", &save)) {
+        char key[32] = {0};
+        int off = 0;
+        if (ln[0] == '#' || sscanf(ln, "%31s %n", key, &off) < 1) continue;
+        char* val = ln + off;
+        if (strcmp(key, "target") == 0) sscanf(val, "%95s", b->target);
+        else if (strcmp(key, "cflags") == 0) strncpy(b->cflags, val, sizeof(b->cflags)-1);
+        else if (strcmp(key, "ldflags") == 0) strncpy(b->ldflags, val, sizeof(b->ldflags)-1);
+        else if (strcmp(key, "jobs") == 0) b->jobs = atoi(val);
+        else if (strcmp(key, "sources") == 0) {
+            char* s2 = NULL;
+            for (char* tok = strtok_r(val, " \t", &s2); tok && *nsrc < BUILD_MAX_UNITS; tok = strtok_r(NULL, " \t", &s2))
+                strncpy(srcs[(*nsrc)++], tok, MAX_NAME-1);
+        }
+    }
+    sb_free(&m);
+    return 1;
+}
+
+static void cmd_build(const char* args) {
+    const char* usage = "Usage: build [-j N] [cflags] <target> <files...> [-lLIB]  |  build -f <manifest> [-j N]";
+    /* pipeline stages and other instances may start builds at once: a
+       slot is claimed (used = 2) under build_mtx, and only goes live
+       (used = 1) together with the check that its target is not running */
+    int slot = -1;
+    pthread_mutex_lock(&build_mtx);
+    for (int i = 0; i < MAX_BUILDS; ++i) if (!builds[i].used) { slot = i; break; }
+    if (slot >= 0) {
+        memset(&builds[slot], 0, sizeof(builds[slot]));
+        builds[slot].used = 2;
+    }
+    pthread_mutex_unlock(&build_mtx);
+    if (slot < 0) { sh_printf("Too many builds running (max %d)\n", MAX_BUILDS); return; }
+    build_job_t* b = &builds[slot];
+    char srcs[BUILD_MAX_UNITS][MAX_NAME];
+    int nsrc = 0, jobs = 0;
+    char buf[2048], *save = NULL;
+    strncpy(buf, args, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+    for (char* tok = strtok_r(buf, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        if (strcmp(tok, "-j") == 0) { char* n = strtok_r(NULL, " \t", &save); jobs = n ? atoi(n) : 0; }
+        else if (strncmp(tok, "-j", 2) == 0) jobs = atoi(tok + 2);
+        else if (strcmp(tok, "-f") == 0) {
+            char* m = strtok_r(NULL, " \t", &save);
+            char mname[MAX_NAME] = {0};
+            if (m) strncpy(mname, m, sizeof(mname)-1);
+            if (!m || !build_parse_manifest(mname, b, srcs, &nsrc)) { if (!m) sh_printf("%s\n", usage); build_free(b); return; }
+        }
+        else if (strncmp(tok, "-l", 2) == 0 || strncmp(tok, "-L", 2) == 0) {
+            if (b->ldflags[0]) strncat(b->ldflags, " ", sizeof(b->ldflags) - strlen(b->ldflags) - 1);
+            strncat(b->ldflags, tok, sizeof(b->ldflags) - strlen(b->ldflags) - 1);
+        }
+        else if (tok[0] == '-') {
+            if (b->cflags[0]) strncat(b->cflags, " ", sizeof(b->cflags) - strlen(b->cflags) - 1);
+            strncat(b->cflags, tok, sizeof(b->cflags) - strlen(b->cflags) - 1);
+        }
+        else if (b->target[0] == '\0') strncpy(b->target, tok, sizeof(b->target)-1);
+        else if (nsrc < BUILD_MAX_UNITS) strncpy(srcs[nsrc++], tok, MAX_NAME-1);
+    }
+    if (b->target[0] == '\0' || nsrc == 0) { sh_printf("%s\n", usage); build_free(b); return; }
+    if (strchr(b->target, '/') || strcmp(b->target, "..") == 0) { sh_printf("Invalid target name: %s\n", b->target); build_free(b); return; }
+    int dup = 0;
+    pthread_mutex_lock(&build_mtx);
+    for (int i = 0; i < MAX_BUILDS && !dup; ++i)
+        dup = builds[i].used == 1 && strcmp(builds[i].target, b->target) == 0;
+    if (!dup) b->used = 1;
+    pthread_mutex_unlock(&build_mtx);
+    if (dup) { sh_printf("Build '%s' is already running\n", b->target); build_free(b); return; }
+    if (jobs > 0) b->jobs = jobs;
+    if (b->jobs <= 0) { long n = sysconf(_SC_NPROCESSORS_ONLN); b->jobs = n > 0 ? (int)n : 1; }
+
+    for (int i = 0; i < nsrc; ++i) {
+        build_unit_t* u = &b->units[b->nunits];
+        if (strchr(srcs[i], '/')) { sh_printf("Invalid source name: %s\n", srcs[i]); build_free(b); return; }
+        strncpy(u->name, srcs[i], sizeof(u->name)-1);
+        if (!vfs_read_copy(u->name, &u->src)) { sh_printf("File not found in VFS: %s\n", u->name); build_free(b); return; }
+        unsigned char seen[BUILD_MAX_UNITS] = {0};
+        unsigned long long h = fnv1a64(b->cflags, strlen(b->cflags) + 1, FNV64_INIT);
+        h = fnv1a64(u->src.data, u->src.len, h);
+        u->key = build_hash_deps(b, &u->src, h, 0, seen);
+        u->state = UNIT_PENDING;
+        b->nunits++;
+    }
+
+    char tname[MAX_NAME];
+    snprintf(tname, sizeof(tname), "build:%s", b->target);
+    TASKS_LOCK();   /* until the task points at its build */
+    int id = spawn_task(tname, TASK_BUILD);
+    if (!id) { TASKS_UNLOCK(); sh_printf("Task limit reached.\n"); build_free(b); return; }
+    task_find_by_id(id)->job = slot;
+    TASKS_UNLOCK();
+    b->phase = "compiling";
+    b->t_start = now_us();
+    if (pthread_create(&b->th, NULL, build_thread, b) != 0) {
+        sh_printf("Failed to start build thread\n");
+        build_free(b);
+        task_release(task_find_by_id(id));
+        return;
+    }
+    sh_printf("Build '%s' started in background: %d units, %d headers, -j%d (task id=%d)\n",
+              b->target, b->nunits, b->nheaders, b->jobs, id);
+}
+#else
+static void cmd_build(const char* args) {
+    (void)args;
+    sh_printf("build: background builds are not supported on this platform; use compile\n");
+}
+#endif
+
+/* Background jobs: run -b [-o file] <cmd...>. The command is spawned
+   without a shell, stdout and stderr share one pipe, and a single I/O
+   thread polls every job's pipe and appends what arrives to the job's
+   VFS file. The same thread reaps exited children with wait4() so the
+   rusage is captured; the scheduler reports and releases finished jobs. */
+#ifndef _WIN32
+typedef struct {
+    int used;
+    int orphan;             /* killtask removed the task; the loop frees the slot */
+    sos_ctx_t* ctx;         /* instance whose VFS receives the output */
+    char cmd[512];
+    char out[MAX_NAME];     /* VFS file receiving stdout+stderr */
+    pid_t pid;
+    int fd;                 /* read end of the output pipe, -1 after EOF */
+    int finished, status;
+    unsigned long long bytes, t_start, t_end;
+    struct rusage ru;
+} bgjob_t;
+
+static bgjob_t bgjobs[MAX_JOBS];
+static pthread_mutex_t job_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cv = PTHREAD_COND_INITIALIZER;
+static int job_wake[2] = { -1, -1 };
+static int job_loop_started = 0;
+
+static void* job_loop(void* arg) {
+    (void)arg;
+    char buf[65536];
+    for (;;) {
+        struct pollfd pf[MAX_JOBS + 1];
+        int slot[MAX_JOBS + 1];
+        int n = 0, reap = 0;
+        pf[n].fd = job_wake[0]; pf[n].events = POLLIN; slot[n++] = -1;
+        pthread_mutex_lock(&job_mtx);
+        for (int i = 0; i < MAX_JOBS; ++i) {
+            if (!bgjobs[i].used || bgjobs[i].finished) continue;
+            if (bgjobs[i].fd >= 0) { pf[n].fd = bgjobs[i].fd; pf[n].events = POLLIN; slot[n++] = i; }
+            else reap = 1;
+        }
+        pthread_mutex_unlock(&job_mtx);
+        /* a child may close its output before it exits; poll for that with a timeout */
+        if (poll(pf, n, reap ? 20 : -1) < 0 && errno != EINTR) continue;
+        if (pf[0].revents) { char c[64]; while (read(job_wake[0], c, sizeof(c)) > 0) {} }
+        for (int k = 1; k < n; ++k) {
+            if (!pf[k].revents) continue;
+            bgjob_t* j = &bgjobs[slot[k]];
+            ssize_t r = read(pf[k].fd, buf, sizeof(buf));
+            if (r > 0) {
+                /* under job_mtx so sos_destroy() cannot free the context mid-append */
+                pthread_mutex_lock(&job_mtx);
+                if (!j->orphan) {
+                    sos_cur = j->ctx;
+                    vfs_append_bytes(j->out, buf, (size_t)r);
+                    j->bytes += (unsigned long long)r;
+                }
+                pthread_mutex_unlock(&job_mtx);
+            } else if (r == 0 || (errno != EINTR && errno != EAGAIN)) {
+                close(pf[k].fd);
+                pthread_mutex_lock(&job_mtx);
+                j->fd = -1;
+                pthread_mutex_unlock(&job_mtx);
+            }
+        }
+        pthread_mutex_lock(&job_mtx);
+        for (int i = 0; i < MAX_JOBS; ++i) {
+            bgjob_t* j = &bgjobs[i];
+            if (!j->used || j->finished || j->fd >= 0) continue;
+            int st;
+            struct rusage ru;
+            if (wait4(j->pid, &st, WNOHANG, &ru) != j->pid) continue;
+            j->status = WIFEXITED(st) ? WEXITSTATUS(st) : WIFSIGNALED(st) ? 128 + WTERMSIG(st) : -1;
+            j->ru = ru;
+            j->t_end = now_us();
+            j->finished = 1;
+            if (j->orphan) j->used = 0;
+        }
+        pthread_cond_broadcast(&job_cv);
+        pthread_mutex_unlock(&job_mtx);
+    }
+    return NULL;
+}
+
+static void job_status(int job, char* out, size_t sz) {
+    bgjob_t* j = &bgjobs[job];
+    pthread_mutex_lock(&job_mtx);
+    if (j->finished) snprintf(out, sz, "exited %d, %llu bytes -> %s", j->status, j->bytes, j->out);
+    else snprintf(out, sz, "running pid %d, %.1f s, %llu bytes -> %s",
+                  (int)j->pid, (now_us() - j->t_start) / 1e6, j->bytes, j->out);
+    pthread_mutex_unlock(&job_mtx);
+}
+
+/* scheduler hook: reports and releases a job once it has been reaped */
+static void job_poll(task_t* t) {
+    bgjob_t* j = &bgjobs[t->job];
+    pthread_mutex_lock(&job_mtx);
+    int finished = j->finished;
+    pthread_mutex_unlock(&job_mtx);
+    if (!finished) return;
+    printf("[job %d] '%s' exited with code %d in %.2f s (user %.2f s, sys %.2f s, max RSS %ld KB), %llu bytes in VFS file %s\n",
+           t->id, j->cmd, j->status, (j->t_end - j->t_start) / 1e6,
+           j->ru.ru_utime.tv_sec + j->ru.ru_utime.tv_usec / 1e6,
+           j->ru.ru_stime.tv_sec + j->ru.ru_stime.tv_usec / 1e6,
+           j->ru.ru_maxrss, j->bytes, j->out);
+    pthread_mutex_lock(&job_mtx);
+    j->used = 0;
+    pthread_mutex_unlock(&job_mtx);
+    task_release(t);
+}
+
+static void job_signal(task_t* t, int sig) {
+    bgjob_t* j = &bgjobs[t->job];
+    pthread_mutex_lock(&job_mtx);
+    if (!j->finished) kill(j->pid, sig);
+    pthread_mutex_unlock(&job_mtx);
+}
+
+/* killtask: terminate the child; the I/O thread still drains and reaps it */
+static void job_cancel(task_t* t) {
+    bgjob_t* j = &bgjobs[t->job];
+    pthread_mutex_lock(&job_mtx);
+    if (j->finished) j->used = 0;
+    else { kill(j->pid, SIGCONT); kill(j->pid, SIGTERM); j->orphan = 1; }
+    pthread_mutex_unlock(&job_mtx);
+}
+
+static void job_start(const char* args) {
+    const char* usage = "Usage: run -b [-o <vfs_file>] <command> [args...]";
+    char buf[512], out[MAX_NAME] = {0};
+    snprintf(buf, sizeof(buf), "%s", args);
+    char* p = buf + strspn(buf, " \t");
+    if (strncmp(p, "-o", 2) == 0 && (p[2] == ' ' || p[2] == '\t')) {
+        p += 2 + strspn(p + 2, " \t");
+        size_t len = strcspn(p, " \t");
+        if (len == 0 || len >= sizeof(out)) { sh_printf("%s\n", usage); return; }
+        memcpy(out, p, len);
+        p += len + strspn(p + len, " \t");
+    }
+    if (*p == '\0') { sh_printf("%s\n", usage); return; }
+    int slot = -1;
+    for (int i = 0; i < MAX_JOBS; ++i) if (!bgjobs[i].used) { slot = i; break; }
+    if (slot < 0) { sh_printf("Too many background jobs (max %d)\n", MAX_JOBS); return; }
+    if (!job_loop_started) {
+        pthread_t th;
+        if (pipe_cloexec(job_wake) != 0) { sh_printf("Failed to create job pipe\n"); return; }
+        fcntl(job_wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(job_wake[1], F_SETFL, O_NONBLOCK);
+        if (pthread_create(&th, NULL, job_loop, NULL) != 0) { sh_printf("Failed to start job thread\n"); return; }
+        pthread_detach(th);
+        job_loop_started = 1;
+    }
+
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "%s", p);
+    char* argv[64];
+    int argc = 0;
+    split_args_quoted(p, argv, &argc, 64);
+    argv[argc] = NULL;
+    char tname[MAX_NAME];
+    snprintf(tname, sizeof(tname), "job:%.90s", argv[0]);
+    TASKS_LOCK();   /* until the task points at its job */
+    int id = spawn_task(tname, TASK_JOB);
+    if (!id) { TASKS_UNLOCK(); sh_printf("Task limit reached.\n"); return; }
+    if (out[0] == '\0') snprintf(out, sizeof(out), "job%d.out", id);
+
+    int po[2];
+    if (pipe_cloexec(po) != 0) {
+        task_release(task_find_by_id(id));
+        TASKS_UNLOCK();
+        sh_printf("pipe failed: %s\n", strerror(errno));
+        return;
+    }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&fa, po[1], 1);
+    posix_spawn_file_actions_adddup2(&fa, po[1], 2);
+    pid_t pid;
+    int rc = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(po[1]);
+    if (rc != 0) {
+        close(po[0]);
+        task_release(task_find_by_id(id));
+        TASKS_UNLOCK();
+        sh_printf("Failed to start '%s': %s\n", argv[0], strerror(rc));
+        return;
+    }
+    task_find_by_id(id)->job = slot;
+    TASKS_UNLOCK();
+    vfs_write_bytes(out, "", 0);
+    pthread_mutex_lock(&job_mtx);
+    bgjob_t* j = &bgjobs[slot];
+    memset(j, 0, sizeof(*j));
+    snprintf(j->cmd, sizeof(j->cmd), "%s", cmd);
+    snprintf(j->out, sizeof(j->out), "%s", out);
+    j->pid = pid;
+    j->ctx = sos_cur;
+    j->fd = po[0];
+    j->t_start = now_us();
+    j->used = 1;
+    pthread_mutex_unlock(&job_mtx);
+    if (write(job_wake[1], "", 1) < 0) { /* loop is already awake */ }
+    sh_printf("[job %d] started pid %d, output -> VFS file %s\n", id, (int)pid, out);
+}
+
+static void cmd_jobs() {
+    int any = 0;
+    TASKS_LOCK();
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        if (sos_cur->tasks[i].id == 0 || sos_cur->tasks[i].type != TASK_JOB) continue;
+        char state[192];
+        job_status(sos_cur->tasks[i].job, state, sizeof(state));
+        sh_printf(" [%d] %-40.40s %s\n", sos_cur->tasks[i].id, bgjobs[sos_cur->tasks[i].job].cmd, state);
+        any = 1;
+    }
+    TASKS_UNLOCK();
+    if (!any) sh_printf("No background jobs\n");
+}
+
+/* 1 once the job has been reaped, 0 if it is stopped, -1 if the wait
+   was interrupted (sos_interrupt); polls every 100 ms for those two */
+static int job_wait(int job) {
+    bgjob_t* j = &bgjobs[job];
+    int r = 1;
+    pthread_mutex_lock(&job_mtx);
+    while (!j->finished) {
+        siginfo_t si;
+        memset(&si, 0, sizeof(si));
+        /* WNOWAIT leaves the stop to be seen again; the reaper is unaffected */
+        if (waitid(P_PID, (id_t)j->pid, &si, WSTOPPED | WNOHANG | WNOWAIT) == 0 && si.si_pid == j->pid) { r = 0; break; }
+        if (__atomic_load_n(&sos_cur->interrupted, __ATOMIC_RELAXED)) { r = -1; break; }
+        struct timespec dl;
+        clock_gettime(CLOCK_REALTIME, &dl);
+        unsigned long long ns = (unsigned long long)dl.tv_nsec + 100000000ull;
+        dl.tv_sec += (time_t)(ns / 1000000000ull);
+        dl.tv_nsec = (long)(ns % 1000000000ull);
+        pthread_cond_timedwait(&job_cv, &job_mtx, &dl);
+    }
+    pthread_mutex_unlock(&job_mtx);
+    return r;
+}
+
+/* wait [id]: blocks until the job (or every job) has exited, then reports
+   it; a stopped job is reported instead of waited for, and Ctrl-C
+   (sos_interrupt) ends the wait. The task lock is not held while
+   waiting, so ps, killtask and ticks on other threads carry on; the task
+   is looked up again before it is reported. */
+static void cmd_wait(const char* arg) {
+    int id = arg && arg[0] ? atoi(arg) : 0;
+    int ids[MAX_TASKS], n = 0;
+    TASKS_LOCK();
+    if (id > 0) {
+        task_t* t = task_find_by_id(id);
+        if (!t || t->type != TASK_JOB) { TASKS_UNLOCK(); sh_printf("No such job: %s\n", arg); return; }
+    }
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        task_t* t = &sos_cur->tasks[i];
+        if (t->id != 0 && t->type == TASK_JOB && (!id || t->id == id)) ids[n++] = t->id;
+    }
+    TASKS_UNLOCK();
+    for (int i = 0; i < n; ++i) {
+        TASKS_LOCK();
+        task_t* t = task_find_by_id(ids[i]);
+        int job = t && t->type == TASK_JOB ? t->job : -1;
+        TASKS_UNLOCK();
+        if (job < 0) continue;          /* killed or reported meanwhile */
+        int r = job_wait(job);
+        if (r < 0) { sh_printf("wait: interrupted\n"); return; }
+        if (r == 0) { sh_printf("wait: job %d is stopped (resume %d)\n", ids[i], ids[i]); continue; }
+        TASKS_LOCK();
+        t = task_find_by_id(ids[i]);
+        if (t && t->type == TASK_JOB && t->job == job) job_poll(t);
+        TASKS_UNLOCK();
+    }
+}
+#else
+static void job_start(const char* args) {
+    (void)args;
+    sh_printf("run -b: background jobs are not supported on this platform\n");
+}
+static void cmd_jobs() { sh_printf("No background jobs\n"); }
+static void cmd_wait(const char* arg) { (void)arg; }
+#endif
+
+/* Host metrics sampler: vmstat [interval]. One background thread reads
+   /proc/stat, /proc/meminfo, /proc/loadavg and (when the kernel has PSI)
+   /proc/pressure/memory every interval. The files are opened once and
+   re-read with pread() at offset 0, so a sample costs four syscalls and
+   no path lookups. Samples land in a fixed ring of VMSTAT_RING entries;
+   the sampler is process-wide, like the job I/O thread. */
+#ifndef _WIN32
+typedef struct {
+    time_t t;
+    unsigned us, sy, wa, id;            /* CPU time over the interval, in 0.1% */
+    unsigned running, blocked;
+    unsigned long long mem_total, mem_avail, swap_used;   /* KB */
+    unsigned load[3];                   /* load average x100 */
+    int psi;                            /* memory "some" avg10 x100, -1 if unavailable */
+    unsigned long long ticks;           /* scheduler ticks during the interval */
+} vmsample_t;
+
+static vmsample_t vm_ring[VMSTAT_RING];
+static unsigned vm_head, vm_count;      /* next slot, samples held */
+static pthread_mutex_t vm_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vm_cv = PTHREAD_COND_INITIALIZER;
+static int vm_started, vm_stop;
+static unsigned vm_interval_ms = 1000;
+static int vm_fd_stat = -1, vm_fd_mem = -1, vm_fd_load = -1, vm_fd_psi = -1;
+
+/* whole-file read into buf; /proc/stat is large on big hosts, the tail may be cut */
+static size_t vm_read(int fd, char* buf, size_t sz) {
+    ssize_t n = fd >= 0 ? pread(fd, buf, sz - 1, 0) : -1;
+    if (n < 0) n = 0;
+    buf[n] = '\0';
+    return (size_t)n;
+}
+
+static unsigned long long vm_field(const char* buf, const char* key) {
+    const char* p = strstr(buf, key);
+    return p ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+/* busy/total jiffies: user+nice, system+irq+softirq+steal, iowait, idle */
+static void vm_cpu(const char* buf, unsigned long long c[4]) {
+    unsigned long long v[8] = {0};
+    if (strncmp(buf, "cpu ", 4) == 0)
+        sscanf(buf + 4, "%llu %llu %llu %llu %llu %llu %llu %llu",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+    c[0] = v[0] + v[1];
+    c[1] = v[2] + v[5] + v[6] + v[7];
+    c[2] = v[4];
+    c[3] = v[3];
+}
+
+static void vm_sample(vmsample_t* s, unsigned long long prev[4], unsigned long long* prev_ticks) {
+    static char buf[1 << 17];
+    unsigned long long c[4], d[4], total = 0;
+    memset(s, 0, sizeof(*s));
+    s->t = time(NULL);
+
+    vm_read(vm_fd_stat, buf, sizeof(buf));
+    vm_cpu(buf, c);
+    for (int i = 0; i < 4; ++i) { d[i] = c[i] - prev[i]; total += d[i]; prev[i] = c[i]; }
+    if (total) {
+        s->us = (unsigned)(d[0] * 1000 / total);
+        s->sy = (unsigned)(d[1] * 1000 / total);
+        s->wa = (unsigned)(d[2] * 1000 / total);
+        s->id = (unsigned)(d[3] * 1000 / total);
+    }
+    s->running = (unsigned)vm_field(buf, "procs_running ");
+    s->blocked = (unsigned)vm_field(buf, "procs_blocked ");
+
+    vm_read(vm_fd_mem, buf, sizeof(buf));
+    s->mem_total = vm_field(buf, "MemTotal:");
+    s->mem_avail = vm_field(buf, "MemAvailable:");
+    s->swap_used = vm_field(buf, "SwapTotal:") - vm_field(buf, "SwapFree:");
+
+    vm_read(vm_fd_load, buf, sizeof(buf));
+    double la[3] = {0};
+    sscanf(buf, "%lf %lf %lf", &la[0], &la[1], &la[2]);
+    for (int i = 0; i < 3; ++i) s->load[i] = (unsigned)(la[i] * 100 + 0.5);
+
+    s->psi = -1;
+    if (vm_read(vm_fd_psi, buf, sizeof(buf))) {
+        const char* p = strstr(buf, "some avg10=");
+        if (p) s->psi = (int)(atof(p + 11) * 100 + 0.5);
+    }
+
+    stat_block_t st;
+    stat_collect(&st);
+    s->ticks = st.v[ST_SCHED_TICKS] - *prev_ticks;
+    *prev_ticks = st.v[ST_SCHED_TICKS];
+}
+
+static void* vm_loop(void* arg) {
+    (void)arg;
+    unsigned long long prev[4], prev_ticks;
+    vmsample_t s;
+    vm_sample(&s, prev, &prev_ticks);   /* baseline for the first interval */
+    pthread_mutex_lock(&vm_mtx);
+    while (!vm_stop) {
+        struct timespec dl;
+        clock_gettime(CLOCK_REALTIME, &dl);
+        unsigned long long ns = (unsigned long long)dl.tv_nsec + (unsigned long long)vm_interval_ms * 1000000ull;
+        dl.tv_sec += (time_t)(ns / 1000000000ull);
+        dl.tv_nsec = (long)(ns % 1000000000ull);
+        /* an interval change or stop wakes us early */
+        if (pthread_cond_timedwait(&vm_cv, &vm_mtx, &dl) != ETIMEDOUT) continue;
+        pthread_mutex_unlock(&vm_mtx);
+        vm_sample(&s, prev, &prev_ticks);
+        pthread_mutex_lock(&vm_mtx);
+        vm_ring[vm_head] = s;
+        vm_head = (vm_head + 1) % VMSTAT_RING;
+        if (vm_count < VMSTAT_RING) vm_count++;
+    }
+    close(vm_fd_stat); close(vm_fd_mem); close(vm_fd_load);
+    if (vm_fd_psi >= 0) close(vm_fd_psi);
+    vm_fd_stat = vm_fd_mem = vm_fd_load = vm_fd_psi = -1;
+    vm_started = 0;
+    pthread_mutex_unlock(&vm_mtx);
+    return NULL;
+}
+
+/* called with vm_mtx held */
+static int vm_start_locked() {
+    vm_stop = 0;
+    if (vm_started) return 1;
+    vm_fd_stat = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    vm_fd_mem = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    vm_fd_load = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    vm_fd_psi = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    pthread_t th;
+    if (vm_fd_stat < 0 || vm_fd_mem < 0 || vm_fd_load < 0 || pthread_create(&th, NULL, vm_loop, NULL) != 0) {
+        if (vm_fd_stat >= 0) close(vm_fd_stat);
+        if (vm_fd_mem >= 0) close(vm_fd_mem);
+        if (vm_fd_load >= 0) close(vm_fd_load);
+        if (vm_fd_psi >= 0) close(vm_fd_psi);
+        vm_fd_stat = vm_fd_mem = vm_fd_load = vm_fd_psi = -1;
+        return 0;
+    }
+    pthread_detach(th);
+    vm_started = 1;
+    vm_head = vm_count = 0;
+    return 1;
+}
+
+static void vm_print_row(const vmsample_t* s) {
+    struct tm tm = *localtime(&s->t);
+    char psi[16];
+    if (s->psi >= 0) snprintf(psi, sizeof(psi), "%u.%02u", (unsigned)s->psi / 100, (unsigned)s->psi % 100);
+    else snprintf(psi, sizeof(psi), "-");
+    sh_printf("%02d:%02d:%02d %3u %3u %3u %3u %3u %3u %8llu %5u%% %6llu %6s %3u.%02u %3u.%02u %3u.%02u %6llu\n",
+              tm.tm_hour, tm.tm_min, tm.tm_sec, s->running, s->blocked,
+              (s->us + 5) / 10, (s->sy + 5) / 10, (s->wa + 5) / 10, (s->id + 5) / 10,
+              (s->mem_total - s->mem_avail) / 1024,
+              s->mem_total ? (unsigned)(s->mem_avail * 100 / s->mem_total) : 0,
+              s->swap_used / 1024, psi,
+              s->load[0] / 100, s->load[0] % 100, s->load[1] / 100, s->load[1] % 100,
+              s->load[2] / 100, s->load[2] % 100, s->ticks);
+}
+
+/* vmstat [seconds|stop]: (re)starts the sampler and prints the newest samples */
+static void cmd_vmstat(const char* arg) {
+    if (strcmp(arg, "stop") == 0) {
+        pthread_mutex_lock(&vm_mtx);
+        int was = vm_started;
+        vm_stop = 1;
+        pthread_cond_broadcast(&vm_cv);
+        pthread_mutex_unlock(&vm_mtx);
+        sh_printf(was ? "Sampler stopped\n" : "Sampler is not running\n");
+        return;
+    }
+    if (arg[0] != '\0') {
+        double sec = atof(arg);
+        if (sec < 0.1 || sec > 3600) { sh_printf("Usage: vmstat [interval 0.1-3600 s | stop]\n"); return; }
+        pthread_mutex_lock(&vm_mtx);
+        vm_interval_ms = (unsigned)(sec * 1000 + 0.5);
+        pthread_cond_broadcast(&vm_cv);
+        pthread_mutex_unlock(&vm_mtx);
+    }
+    vmsample_t rows[VMSTAT_SHOW];
+    unsigned n = 0, held, interval;
+    unsigned long long busy_sum = 0;
+    unsigned busy_max = 0, load_max = 0;
+    pthread_mutex_lock(&vm_mtx);
+    int was = vm_started && !vm_stop;
+    if (!vm_start_locked()) {
+        pthread_mutex_unlock(&vm_mtx);
+        sh_printf("vmstat: cannot open /proc/stat, /proc/meminfo or /proc/loadavg\n");
+        return;
+    }
+    held = vm_count;
+    interval = vm_interval_ms;
+    for (unsigned i = 0; i < held; ++i) {
+        const vmsample_t* s = &vm_ring[(vm_head + VMSTAT_RING - held + i) % VMSTAT_RING];
+        unsigned busy = 1000 - s->id;
+        busy_sum += busy;
+        if (busy > busy_max) busy_max = busy;
+        if (s->load[0] > load_max) load_max = s->load[0];
+        if (held - i <= VMSTAT_SHOW) rows[n++] = *s;
+    }
+    pthread_mutex_unlock(&vm_mtx);
+
+    if (!was) sh_printf("Sampler started, every %.1f s (ring holds %d samples)\n", interval / 1000.0, VMSTAT_RING);
+    if (held == 0) { sh_printf("No samples yet; run vmstat again shortly\n"); return; }
+    sh_printf("Every %.1f s, %u samples held; cpu busy avg %.1f%% max %.1f%%, load1 max %u.%02u\n",
+              interval / 1000.0, held, busy_sum / (double)held / 10.0, busy_max / 10.0, load_max / 100, load_max % 100);
+    sh_printf("time       r   b  us  sy  wa  id  used_MB  avail swapMB memPSI  load1  load5 load15  ticks\n");
+    for (unsigned i = 0; i < n; ++i) vm_print_row(&rows[i]);
+}
+
+/* sysinfo: the newest sample, if the sampler is running */
+static void vm_sysinfo() {
+    vmsample_t s;
+    pthread_mutex_lock(&vm_mtx);
+    int ok = vm_count > 0;
+    if (ok) s = vm_ring[(vm_head + VMSTAT_RING - 1) % VMSTAT_RING];
+    pthread_mutex_unlock(&vm_mtx);
+    if (!ok) { sh_printf("Host load: run vmstat to start the sampler\n"); return; }
+    sh_printf("CPU busy: %.1f%% (iowait %.1f%%), load %u.%02u %u.%02u %u.%02u\n",
+              (1000 - s.id) / 10.0, s.wa / 10.0, s.load[0] / 100, s.load[0] % 100,
+              s.load[1] / 100, s.load[1] % 100, s.load[2] / 100, s.load[2] % 100);
+    sh_printf("Memory available: %llu MB of %llu MB, swap used %llu MB\n",
+              s.mem_avail / 1024, s.mem_total / 1024, s.swap_used / 1024);
+}
+#else
+static void cmd_vmstat(const char* arg) { (void)arg; sh_printf("vmstat is not available on Windows\n"); }
+static void vm_sysinfo() {}
+#endif
+
+static void run_command(const char* cmdrest) {
+    if (!cmdrest || cmdrest[0]=='\0') { sh_printf("Usage: run [-b] <command>\n"); return; }
+    if (strncmp(cmdrest, "-b", 2) == 0 && (cmdrest[2] == ' ' || cmdrest[2] == '\t' || cmdrest[2] == '\0')) { job_start(cmdrest + 2); return; }
+    sh_printf("Running command: %s\n", cmdrest);
+    int rc = system(cmdrest);
+    sh_printf("Command exited with code %d\n", rc);
+}
+
+/* text tools - read a VFS file, or the previous pipeline stage when no file is given */
+typedef struct {
+    strbuf_t mem;       /* copy of the VFS file */
+    size_t mpos;
+    shpipe_t *pipe;     /* piped input */
+    char buf[4096];
+    size_t pos, len;
+} sh_src_t;
+
+static int sh_src_open(sh_src_t* s, const char* file, const char* usage) {
+    memset(s, 0, sizeof(*s));
+    if (file && file[0]) {
+        if (vfs_read_copy(file, &s->mem)) return 1;
+        sh_printf("File not found: %s\n", file);
+        return 0;
+    }
+    if (sh_io && sh_io->in) { s->pipe = sh_io->in; return 1; }
+    sh_printf("%s\n", usage);
+    return 0;
+}
+
+static void sh_src_close(sh_src_t* s) { sb_free(&s->mem); }
+
+/* raw chunk read; returns 0 at end of input */
+static size_t sh_src_read(sh_src_t* s, const char** chunk) {
+    if (sh_broken()) return 0;
+    if (!s->pipe) {
+        size_t n = s->mem.len - s->mpos;
+        *chunk = s->mem.data + s->mpos;
+        s->mpos = s->mem.len;
+        return n;
+    }
+    if (s->pos == s->len) {
+        s->len = shpipe_read(s->pipe, s->buf, sizeof(s->buf));
+        s->pos = 0;
+    }
+    *chunk = s->buf + s->pos;
+    size_t n = s->len - s->pos;
+    s->pos = s->len;
+    return n;
+}
+
+/* next line without its '\n'; returns 0 at end of input */
+static int sh_src_line(sh_src_t* s, strbuf_t* line) {
+    line->len = 0;
+    sb_append(line, "", 0);
+    if (sh_broken()) return 0;
+    if (!s->pipe) {
+        if (s->mpos >= s->mem.len) return 0;
+        const char* start = s->mem.data + s->mpos;
+        const char* nl = memchr(start, '\n', s->mem.len - s->mpos);
+        size_t n = nl ? (size_t)(nl - start) : s->mem.len - s->mpos;
+        sb_append(line, start, n);
+        s->mpos += n + (nl ? 1 : 0);
+        return 1;
+    }
+    int got = 0;
+    for (;;) {
+        if (s->pos == s->len) {
+            s->len = shpipe_read(s->pipe, s->buf, sizeof(s->buf));
+            s->pos = 0;
+            if (s->len == 0) return got;
+        }
+        const char* start = s->buf + s->pos;
+        const char* nl = memchr(start, '\n', s->len - s->pos);
+        size_t n = nl ? (size_t)(nl - start) : s->len - s->pos;
+        sb_append(line, start, n);
+        got = 1;
+        s->pos += n;
+        if (nl) { s->pos++; return 1; }
+    }
+}
+
+static void sh_put_line(const strbuf_t* line) {
+    sh_write(line->data, line->len);
+    sh_write("\n", 1);
+}
+
+static void cmd_cat(const char* file) {
+    if (file && file[0]) {
+        strbuf_t sb = {0};
+        if (vfs_read_copy(file, &sb)) {
+            sh_write(sb.data, sb.len);
+            if (sb.len == 0 || sb.data[sb.len-1] != '\n') sh_write("\n", 1);
+        }
+        else sh_printf("File not found: %s\n", file);
+        sb_free(&sb);
+        return;
+    }
+    sh_src_t src;
+    if (!sh_src_open(&src, NULL, "Usage: cat <file>")) return;
+    const char* chunk;
+    size_t n;
+    while ((n = sh_src_read(&src, &chunk)) > 0) sh_write(chunk, n);
+    sh_src_close(&src);
+}
+
+static void cmd_grep(const char* pattern, const char* rest) {
+    if (!pattern || pattern[0]=='\0') { sh_printf("Usage: grep <text> [file]\n"); return; }
+    char file[MAX_NAME] = {0};
+    if (rest) sscanf(rest, "%95s", file);
+    sh_src_t src;
+    if (!sh_src_open(&src, file, "Usage: grep <text> [file]")) return;
+    strbuf_t line = {0};
+    while (sh_src_line(&src, &line)) if (strstr(line.data, pattern)) sh_put_line(&line);
+    sb_free(&line);
+    sh_src_close(&src);
+}
+
+static void cmd_wc(const char* file) {
+    sh_src_t src;
+    if (!sh_src_open(&src, file, "Usage: wc [file]")) return;
+    unsigned long long lines = 0, words = 0, bytes = 0;
+    int inword = 0;
+    const char* chunk;
+    size_t n;
+    while ((n = sh_src_read(&src, &chunk)) > 0) {
+        bytes += n;
+        for (size_t i = 0; i < n; ++i) {
+            if (chunk[i] == '\n') lines++;
+            if (isspace((unsigned char)chunk[i])) inword = 0;
+            else if (!inword) { inword = 1; words++; }
+        }
+    }
+    sh_src_close(&src);
+    sh_printf("%7llu %7llu %7llu\n", lines, words, bytes);
+}
+
+/* head/tail -c: a file is read as just the requested range */
+static void head_tail_bytes(int tail, long count, const char* file, const char* usage) {
+    strbuf_t out = {0};
+    if (file[0]) {
+        unsigned long long id;
+        size_t size = 0;
+        if (vfs_readonly(file)) {
+            /* generated on each read: render it all, then cut the window */
+            vfs_pread(file, 0, (size_t)-1, &out);
+            size_t keep = out.len < (size_t)count ? out.len : (size_t)count;
+            if (tail && keep) memmove(out.data, out.data + out.len - keep, keep);
+            out.len = keep;
+        } else {
+            if (!vfs_version(file, &id, &size)) { sh_printf("File not found: %s\n", file); return; }
+            size_t off = tail && size > (size_t)count ? size - (size_t)count : 0;
+            vfs_pread(file, off, (size_t)count, &out);
+            if (tail && out.len > (size_t)count) { memmove(out.data, out.data + out.len - count, (size_t)count); out.len = (size_t)count; }
+        }
+    } else {
+        sh_src_t src;
+        if (!sh_src_open(&src, NULL, usage)) return;
+        const char* chunk;
+        size_t n;
+        while ((tail || out.len < (size_t)count) && (n = sh_src_read(&src, &chunk)) > 0) {
+            if (!tail && n > (size_t)count - out.len) n = (size_t)count - out.len;
+            sb_append(&out, chunk, n);
+            /* tail keeps at most twice the window buffered */
+            if (tail && out.len > 2 * (size_t)count) {
+                memmove(out.data, out.data + out.len - count, (size_t)count);
+                out.len = (size_t)count;
+            }
+        }
+        sh_src_close(&src);
+        if (out.len > (size_t)count) { memmove(out.data, out.data + out.len - count, (size_t)count); out.len = (size_t)count; }
+    }
+    if (out.len) sh_write(out.data, out.len);
+    sb_free(&out);
+}
+
+/* head/tail [-n N | -c N] [file] */
+static void cmd_head_tail(int tail, const char* a1, const char* a2) {
+    long count = 10;
+    char file[MAX_NAME] = {0};
+    const char* usage = tail ? "Usage: tail [-n N | -c N] [file]" : "Usage: head [-n N | -c N] [file]";
+    if (strcmp(a1, "-n") == 0 || strcmp(a1, "-c") == 0) {
+        if (sscanf(a2, "%ld %95s", &count, file) < 1 || count < 0) { sh_printf("%s\n", usage); return; }
+        if (a1[1] == 'c') { head_tail_bytes(tail, count, file, usage); return; }
+    } else if (a1[0]) strncpy(file, a1, sizeof(file)-1);
+    sh_src_t src;
+    if (!sh_src_open(&src, file, usage)) return;
+    strbuf_t line = {0};
+    if (!tail) {
+        for (long i = 0; i < count && sh_src_line(&src, &line); ++i) sh_put_line(&line);
+    } else if (count > 0) {
+        /* keep the last N lines in a ring */
+        strbuf_t* ring = calloc((size_t)count, sizeof(strbuf_t));
+        long seen = 0;
+        if (ring) {
+            while (sh_src_line(&src, &line)) {
+                strbuf_t* slot = &ring[seen % count];
+                slot->len = 0;
+                sb_append(slot, line.data, line.len);
+                seen++;
+            }
+            long first = seen > count ? seen - count : 0;
+            for (long i = first; i < seen; ++i) sh_put_line(&ring[i % count]);
+            for (long i = 0; i < count; ++i) sb_free(&ring[i]);
+            free(ring);
+        }
+    }
+    sb_free(&line);
+    sh_src_close(&src);
+}
+
+/* patch <file> <offset> <text> */
+static void cmd_patch(const char* file, const char* rest) {
+    char* text;
+    unsigned long long off = strtoull(rest, &text, 10);
+    if (!file[0] || text == rest || *text != ' ') { sh_printf("Usage: patch <file> <offset> <text>\n"); return; }
+    text++;
+    if (vfs_readonly(file)) sh_printf("%s is read-only\n", file);
+    else if (off > FS_MAX_CONTENT) sh_printf("Offset past the %u MB file limit\n", FS_MAX_CONTENT >> 20);
+    else if (!vfs_pwrite_raw(file, (size_t)off, text, strlen(text))) sh_printf("VFS full\n");
+    else sh_printf("Patched %s: %zu bytes at offset %llu\n", file, strlen(text), off);
+}
+
+/* watch <file|prefix*> <command>; a quoted command may contain | and > */
+static void cmd_watch(const char* pattern, const char* command) {
+    char c[MAX_MSG];
+    size_t n = strlen(command);
+    if (n >= 2 && command[0] == '"' && command[n - 1] == '"') { command++; n -= 2; }
+    if (!pattern[0] || n == 0) { sh_printf("Usage: watch <file|prefix*> <command>\n"); return; }
+    if (n >= sizeof(c)) { sh_printf("Command too long\n"); return; }
+    if (strlen(pattern) >= MAX_NAME) { sh_printf("Name too long\n"); return; }
+    memcpy(c, command, n);
+    c[n] = '\0';
+    int id = spawn_watch(pattern, c);
+    if (id) sh_printf("Watching %s: task id=%d\n", pattern, id);
+    else sh_printf("Task limit reached.\n");
+}
+
+/* truncate <file> <size> */
+static void cmd_truncate(const char* file, const char* size) {
+    char* end;
+    unsigned long long n = strtoull(size, &end, 10);
+    if (!file[0] || end == size) { sh_printf("Usage: truncate <file> <size>\n"); return; }
+    if (vfs_readonly(file)) sh_printf("%s is read-only\n", file);
+    else if (n > FS_MAX_CONTENT) sh_printf("Size past the %u MB file limit\n", FS_MAX_CONTENT >> 20);
+    else if (!vfs_truncate_raw(file, (size_t)n)) sh_printf("File not found: %s\n", file);
+    else sh_printf("Truncated %s to %llu bytes\n", file, n);
+}
+
+static void cmd_write(const char* file, const char* text) {
+    if (file[0] == '\0' || text[0] == '\0') sh_printf("Usage: write <file> <text>\n");
+    else if (vfs_readonly(file)) sh_printf("%s is read-only\n", file);
+    else { vfs_write(file, text); sh_printf("Written to %s\n", file); }
+}
+
+static void cmd_append(const char* file, const char* text) {
+    if (file[0] == '\0' || text[0] == '\0') sh_printf("Usage: append <file> <text>\n");
+    else if (vfs_readonly(file)) sh_printf("%s is read-only\n", file);
+    else { vfs_append(file, text); sh_printf("Appended to %s\n", file); }
+}
+
+static void cmd_touch(const char* file) {
+    if (file[0] == '\0') sh_printf("Usage: touch <file>\n");
+    else if (vfs_readonly(file)) sh_printf("%s is read-only\n", file);
+    else { vfs_write(file, ""); sh_printf("Touched %s\n", file); }
+}
+
+static void cmd_rm(const char* file) {
+    if (file[0] == '\0') sh_printf("Usage: rm <file>\n");
+    else if (vfs_readonly(file)) sh_printf("%s is read-only\n", file);
+    else if (vfs_remove(file)) sh_printf("Removed %s\n", file);
+    else sh_printf("File not found: %s\n", file);
+}
+
+static void cmd_echo(const char* a1, const char* a2) {
+    if (a1[0] == '\0') sh_printf("\n");
+    else if (a2[0] != '\0') sh_printf("%s %s\n", a1, a2);
+    else sh_printf("%s\n", a1);
+}
+
+static int cmp_lines(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void cmd_sort(const char* file) {
+    sh_src_t src;
+    if (!sh_src_open(&src, file, "Usage: sort [file]")) return;
+    strbuf_t line = {0};
+    char** lines = NULL;
+    size_t n = 0, cap = 0;
+    while (sh_src_line(&src, &line)) {
+        if (n == cap) {
+            size_t ncap = cap ? cap * 2 : 64;
+            char** p = realloc(lines, ncap * sizeof(char*));
+            if (!p) break;
+            lines = p;
+            cap = ncap;
+        }
+        lines[n] = malloc(line.len + 1);
+        if (!lines[n]) break;
+        memcpy(lines[n], line.data, line.len + 1);
+        n++;
+    }
+    qsort(lines, n, sizeof(char*), cmp_lines);
+    for (size_t i = 0; i < n; ++i) { sh_printf("%s\n", lines[i]); free(lines[i]); }
+    free(lines);
+    sb_free(&line);
+    sh_src_close(&src);
+}
+
+static void cmd_uniq(const char* file) {
+    sh_src_t src;
+    if (!sh_src_open(&src, file, "Usage: uniq [file]")) return;
+    strbuf_t line = {0}, prev = {0};
+    int have_prev = 0;
+    while (sh_src_line(&src, &line)) {
+        if (have_prev && prev.len == line.len && memcmp(prev.data, line.data, line.len) == 0) continue;
+        sh_put_line(&line);
+        prev.len = 0;
+        sb_append(&prev, line.data, line.len);
+        have_prev = 1;
+    }
+    sb_free(&line);
+    sb_free(&prev);
+    sh_src_close(&src);
+}
+
+/* tee <file>: pass input through and also store it in the VFS */
+static void cmd_tee(const char* file) {
+    if (!file || file[0]=='\0' || !sh_io || !sh_io->in) { sh_printf("Usage: ... | tee <file>\n"); return; }
+    sh_src_t src;
+    if (!sh_src_open(&src, NULL, "Usage: ... | tee <file>")) return;
+    strbuf_t copy = {0};
+    const char* chunk;
+    size_t n;
+    sb_append(&copy, "", 0);
+    while ((n = sh_src_read(&src, &chunk)) > 0) {
+        sb_append(&copy, chunk, n);
+        sh_write(chunk, n);
+    }
+    vfs_write_bytes(file, copy.data, copy.len);
+    sb_free(&copy);
+    sh_src_close(&src);
+}
+
+/* core help/man */
+static void show_help() {
+    sh_printf("\x1b[36mShreyas OS - Command Reference (short)\x1b[0m\n");
+    sh_printf("  help                                - show this help menu\n");
+    sh_printf("  ls [-l] [-t] [-n N] [prefix*]       - list files by name (-l sizes and times, -t newest first)\n");
+    sh_printf("  stat <file>                         - show a file's size, times, reads and version\n");
+    sh_printf("  cat <file>                          - display contents of a file\n");
+    sh_printf("  write <file> <text>                 - create/overwrite a file with text\n");
+    sh_printf("  append <file> <text>                - append text to a file\n");
+    sh_printf("  patch <file> <offset> <text>        - overwrite bytes at offset, growing the file if needed\n");
+    sh_printf("  truncate <file> <size>              - cut a file to size bytes or zero-extend it\n");
+    sh_printf("  touch <file>                        - create an empty file\n");
+    sh_printf("  rm <file>                           - delete a file\n");
+    sh_printf("  edit <file>                         - line editor (goto, insert, delete, replace, undo)\n");
+    sh_printf("  lsof                                - list open file descriptors\n");
+    sh_printf("  spawn <builtin>                     - start builtin task (clock, heartbeat, logger)\n");
+    sh_printf("  addtask <name> <interval> <message> - create repeating message task\n");
+    sh_printf("  ps                                  - list running tasks\n");
+    sh_printf("  watch <file|prefix*> <command>      - run command ({} = changed file) whenever a file changes\n");
+    sh_printf("  killtask <id>                       - terminate a task by id\n");
+    sh_printf("  suspend <id>                        - suspend a task\n");
+    sh_printf("  resume <id>                         - resume a suspended task\n");
+    sh_printf("  uptime                              - show system uptime\n");
+    sh_printf("  poweroff                            - shutdown the OS (saves state)\n");
+    sh_printf("  bgsave                              - save state from a forked child, without blocking\n");
+    sh_printf("  autosave [seconds|off]              - background-save changed state periodically\n");
+    sh_printf("  begin / commit / abort              - stage file changes and apply them all at once\n");
+    sh_printf("  script [-c] <file> [args]           - run a script file (variables, if/while/for, functions)\n");
+    sh_printf("  reboot                              - reboot the OS\n");
+    sh_printf("  powerbtn                            - emulate pressing power button\n");
+    sh_printf("  clear                               - clear the terminal screen\n");
+    sh_printf("  echo <text>                         - print text to console\n");
+    sh_printf("  version                             - show OS version\n");
+    sh_printf("  compile <file> [flags]              - compile C source file in VFS (cached by content)\n");
+    sh_printf("  buildcache [clear]                  - show or clear the compile cache\n");
+    sh_printf("  build [-j N] <target> <files...>    - parallel background build of VFS sources\n");
+    sh_printf("  build -f <manifest> [-j N]          - build from a manifest file in the VFS\n");
+    sh_printf("  run <command>                       - run a system command\n");
+    sh_printf("  run -b [-o file] <command>          - run a command in the background, output to VFS\n");
+    sh_printf("  jobs                                - list background jobs\n");
+    sh_printf("  wait [id]                           - wait for background jobs to finish (Ctrl-C stops waiting)\n");
+    sh_printf("  ip                                  - display local IP addresses\n");
+    sh_printf("  export <file_on_disk> <vfs_file>    - save a VFS file to disk\n");
+    sh_printf("  import <vfs_file> <file_on_disk>    - load a file from disk into VFS\n");
+    sh_printf("  date                                - show date/time\n");
+    sh_printf("  cal [month] [year]                  - show calendar for month/year\n");
+    sh_printf("  sysinfo                             - show basic CPU/memory/uptime\n");
+    sh_printf("  vmstat [interval|stop]              - sample CPU, memory and load in the background\n");
+    sh_printf("  vfs_budget [MB]                     - show or set the memory budget for file contents\n");
+    sh_printf("  whoami                              - display current user\n");
+    sh_printf("  hostname                            - display hostname\n");
+    sh_printf("  history [N|prefix]                  - show recent history, or entries starting with prefix\n");
+    sh_printf("  history -r <text>                   - reverse search history for text\n");
+    sh_printf("  !! / !N / !prefix / !?text          - repeat a command from history\n");
+    sh_printf("  man <cmd>                           - short manual for command\n");
+    sh_printf("  fastboot [on|off]                   - skip the boot animation on reboot\n");
+    sh_printf("  bootprof                            - show time spent in each boot phase\n");
+    sh_printf("  stats [-j]                          - show operational counters (JSON with -j)\n");
+    sh_printf("  grep <text> [file]                  - print lines containing text\n");
+    sh_printf("  wc [file]                           - count lines, words and bytes\n");
+    sh_printf("  head|tail [-n N | -c N] [file]      - first/last N lines (default 10) or bytes\n");
+    sh_printf("  sort [file] / uniq [file]           - sort lines / drop repeated lines\n");
+    sh_printf("  tee <file>                          - copy piped input into a file\n");
+    sh_printf("  cmd1 | cmd2 > file                  - pipe commands, redirect into VFS ('>>' appends)\n");
+}
+
+/* man pages (short) */
+static void cmd_man(const char* cmd) {
+    if (!cmd || cmd[0] == '\0') { sh_printf("Usage: man <cmd>\n"); return; }
+    if (strcmp(cmd, "ls")==0) sh_printf("ls [-l] [-t] [-n count] [-a after] [name|prefix*]: lists files in name order from an ordered index, so a prefix costs only its matches. -l adds size, modification and access time and read count; -t orders by modification time, newest first; -n shows at most count files and -a starts after the given name, for paging\n");
+    else if (strcmp(cmd, "stat")==0) sh_printf("stat <file>: size, creation, modification and access times, read count, content version (blob id), whether the body is resident or evicted (vfs_budget) and whether it changed since the last save\n");
+    else if (strcmp(cmd, "lsof")==0) sh_printf("lsof: lists open file descriptors by owner (\"-\" for the instance, else the task name), with mode, position and file; \"(deleted)\" marks files removed while open\n");
+    else if (strcmp(cmd, "cat")==0) sh_printf("cat <file>: print file contents\n");
+    else if (strcmp(cmd, "write")==0) sh_printf("write <file> <text>: create/overwrite file\n");
+    else if (strcmp(cmd, "compile")==0) sh_printf("compile <file> [flags]: compile C source inside VFS using system gcc (source is piped in, no temp files); diagnostics are saved as <file>.log and the binary as <stem>.out in the VFS; unchanged source+flags reuse the cached binary and diagnostics in %s/\n", BCACHE_DIR);
+    else if (strcmp(cmd, "pipe")==0 || strcmp(cmd, "|")==0) sh_printf("cmd1 | cmd2 | ... [> file]: stages run concurrently over in-memory pipes; '>' writes and '>>' appends the last stage's output to a VFS file\n");
+    else if (strcmp(cmd, "fastboot")==0) sh_printf("fastboot [on|off]: skip the boot animation; also enabled by --fast or SHREYAS_FASTBOOT=1\n");
+    else if (strcmp(cmd, "build")==0) sh_printf("build [-j N] [cflags] <target> <files...> [-lLIB] | build -f <manifest>: compiles units in parallel in the background (see ps), rebuilding only units whose source, VFS headers or flags changed, then links %s/<target>/<target>. Manifest lines: target, sources, cflags, ldflags, jobs\n", BUILD_DIR);
+    else if (strcmp(cmd, "history")==0) sh_printf("history [N|prefix] | history -r <text>: history persists in %s across sessions; searches go newest first\n", HISTORY_FILE);
+    else if (strcmp(cmd, "run")==0) sh_printf("run <command> | run -b [-o file] <command>: -b spawns the command without a shell as a background job (see jobs/ps); stdout and stderr stream into a VFS file (default job<id>.out). On exit the job reports wall, user and system time and peak RSS. wait, killtask, suspend and resume work on jobs\n");
+    else if (strcmp(cmd, "vmstat")==0) sh_printf("vmstat [seconds|stop]: starts a background sampler (default every 1 s) reading /proc/stat, /proc/meminfo, /proc/loadavg and /proc/pressure/memory, keeps the last %d samples and prints the newest %d: runnable/blocked procs, CPU user/system/iowait/idle %%, memory used and available, swap, memory pressure (PSI some avg10), load averages and scheduler ticks per interval. An interval argument changes the sampling period\n", VMSTAT_RING, VMSTAT_SHOW);
+    else if (strcmp(cmd, "bgsave")==0) sh_printf("bgsave: forks a child that writes the state file from its copy-on-write snapshot of the VFS while the shell keeps running; the shell only pauses for the fork (persist.fork_us). Skipped when no file changed or was removed since the last save. The result is reported on a later command. poweroff and reboot wait for a running background save and write nothing when it left no changes\n");
+    else if (strcmp(cmd, "script")==0) sh_printf("script <file> [args] | script -c <file>: runs a VFS file one statement per line: name = expr (also += -=), local name [= expr] inside a func, if/elif/else/end, while expr/end, for v in words/end, for v = a to b [step s]/end, break, continue, return [expr], func name/end. Expressions: 64-bit integers (overflow stops the script), \"text with $vars\", 'raw', names, f(args), len(x), - ! * / %% + - .. (join) == != < <= > >= (numeric when both sides are integers) && ||. Any other line is a command; $name ${name} $1..$9 $# $@ $0 and $(command) expand in it, \\$ is a literal $. Functions are called as commands or in expressions; variables are global unless local. The file is compiled to bytecode once per version and cached (-c only compiles and reports); write, append, echo, cat, rm, touch and other file builtins are called directly, anything else goes through the shell. Ctrl-C (sos_interrupt) stops a running script\n");
+    else if (strcmp(cmd, "begin")==0 || strcmp(cmd, "commit")==0 || strcmp(cmd, "abort")==0) sh_printf("begin, commit, abort: after begin, your write, append, pwrite-style edits, truncate and rm only change a private copy that your own cat/head/grep/ls/stat see; other users, tasks and saves keep seeing the old files. commit applies every staged file at once (readers, listings and state saves see all of them or none) and schedules one background save for the batch; it fails, applying nothing, if another writer changed one of those files since you first touched it. abort drops the changes. One transaction at a time per instance; fd writes are not staged\n");
+    else if (strcmp(cmd, "autosave")==0) sh_printf("autosave [seconds|off]: runs bgsave every interval (checked on scheduler ticks) whenever files changed since the last save. Without an argument shows the interval, how many files are unsaved and when the last save finished\n");
+    else if (strcmp(cmd, "vfs_budget")==0) sh_printf("vfs_budget [MB]: caps the memory held by file contents. When it is exceeded the least recently used files (CLOCK) are moved to a temporary backing file and read back in on their next access; names, sizes and versions stay put. 0 removes the cap. Without an argument shows the budget, resident bytes and backing store size; stats shows tier.* hit, miss and eviction counters\n");
+    else if (strcmp(cmd, "stats")==0) sh_printf("stats [-j]: counters since startup - VFS operations, bytes and lookup probes, slot use, scheduler ticks and task runs, commands by name, state save/load bytes and time. Prints key=value lines, or JSON with -j; the same key=value text is the read-only file %s\n", STATS_FILE);
+    else if (strcmp(cmd, "watch")==0) sh_printf("watch <file|prefix*> <command>: starts a watch task that runs command after every write, append, patch, truncate or remove of the file, or of any file starting with prefix. {} in the command becomes the changed file name; quote the command to use | or >. Repeats of the same change before the reaction runs are merged; the reaction's own changes do not retrigger it. Changes made elsewhere (HTTP, replication, jobs) run it while the prompt waits. Remove with killtask\n");
+    else if (strcmp(cmd, "patch")==0) sh_printf("patch <file> <offset> <text>: writes text at offset, creating the file and zero-filling any gap past its end. Only that range is written and reported to replicas\n");
+    else if (strcmp(cmd, "truncate")==0) sh_printf("truncate <file> <size>: cuts a file to size bytes or zero-extends it\n");
+    else if (strcmp(cmd, "head")==0 || strcmp(cmd, "tail")==0) sh_printf("head|tail [-n N | -c N] [file]: first/last N lines (default 10), or N bytes with -c; a file is then read as just that byte range\n");
+    else if (strcmp(cmd, "edit")==0) sh_printf("edit <file>: line editor working on a piece table over the file, so edits cost the size of the change. Commands: N or g N (go to line), p [a,b] (print; '.' current, '$' last, ',' all), i/a [N] (insert before/after line, text ends with a lone '.'), c [a,b] (replace lines), d [a,b] (delete lines), u (undo), = (counts), w/w! (save; w! even if the file changed since it was read), q/q!/wq. Saving writes back only the changed byte ranges. End of input saves and quits\n");
+    else if (strcmp(cmd, "grep")==0) sh_printf("grep <text> [file]: print lines of file (or piped input) containing text\n");
+    else sh_printf("No manual entry for %s\n", cmd);
+}
+
+/* ps/kill/suspend/resume */
+static void show_ps() {
+    static const char* type_names[] = { "builtin", "message", "build", "job", "watch" };
+    sh_printf("Tasks (max %d):\n", MAX_TASKS);
+    TASKS_LOCK();   /* a line per task: well under a pipe's capacity */
+    for (int i = 0; i < MAX_TASKS; ++i) {
+        if (sos_cur->tasks[i].id != 0) {
+            char state[128];
+            snprintf(state, sizeof(state), "%s", sos_cur->tasks[i].active ? "active" : "suspended");
+            if (sos_cur->tasks[i].type == TASK_WATCH) {
+                watch_t* w = sos_cur->tasks[i].watch;
+                size_t n = strlen(state);
+                snprintf(state + n, sizeof(state) - n, ", %u queued, %u dropped | %s",
+                         __atomic_load_n(&w->count, __ATOMIC_ACQUIRE), __atomic_load_n(&w->dropped, __ATOMIC_RELAXED),
+                         sos_cur->tasks[i].msg);
+            }
+#ifndef _WIN32
+            if (sos_cur->tasks[i].type == TASK_BUILD) build_status(sos_cur->tasks[i].job, state, sizeof(state));
+            if (sos_cur->tasks[i].type == TASK_JOB) {
+                job_status(sos_cur->tasks[i].job, state, sizeof(state));
+                if (!sos_cur->tasks[i].active) strncat(state, " (stopped)", sizeof(state) - strlen(state) - 1);
+            }
+#endif
+            sh_printf(" ID=%d | %-12s | type=%s | ticks=%u | interval=%u | %s\n",
+                   sos_cur->tasks[i].id,
+                   sos_cur->tasks[i].name,
+                   type_names[sos_cur->tasks[i].type],
+                   sos_cur->tasks[i].ticks,
+                   sos_cur->tasks[i].interval,
+                   state);
+        }
+    }
+    TASKS_UNLOCK();
+}
+
+static int task_kill(task_t* t) {
+    if (!t) return 0;
+#ifndef _WIN32
+    if (t->type == TASK_BUILD) build_cancel(t);
+    if (t->type == TASK_JOB) job_cancel(t);
+#endif
+    task_release(t);
+    return 1;
+}
+
+static void kill_task(int id) {
+    TASKS_LOCK();
+    int found = task_kill(task_find_by_id(id));
+    TASKS_UNLOCK();
+    if (found) sh_printf("Task %d removed.\n", id);
+    else sh_printf("Task %d not found.\n", id);
+}
+
+static void suspend_task(int id) {
+    TASKS_LOCK();
+    task_t* t = task_find_by_id(id);
+    if (t) {
+        t->active = 0;
+#ifndef _WIN32
+        if (t->type == TASK_JOB) job_signal(t, SIGSTOP);
+#endif
+    }
+    TASKS_UNLOCK();
+    if (!t) sh_printf("Task %d not found.\n", id);
+    else sh_printf("Task %d suspended.\n", id);
+}
+
+static void resume_task(int id) {
+    TASKS_LOCK();
+    task_t* t = task_find_by_id(id);
+    if (t) {
+        t->active = 1;
+#ifndef _WIN32
+        if (t->type == TASK_JOB) job_signal(t, SIGCONT);
+#endif
+    }
+    TASKS_UNLOCK();
+    if (!t) sh_printf("Task %d not found.\n", id);
+    else sh_printf("Task %d resumed.\n", id);
+}
+
+/* scheduler wrapper */
+static void scheduler_tick_wrapper() { scheduler_tick(); }
+
+/* everything after the command word */
+/* Scripts. "script <file> [args]" runs a VFS file written in a small
+   line-based language (see "man script"). Each file version is compiled
+   once into bytecode for a stack VM and cached by name, blob id and
+   size. Loops, variables and expressions never leave the VM; command
+   lines whose first word is fixed call the script's functions or the
+   common builtins directly with their expanded arguments, and only the
+   rest are handed to the shell as one line. */
+#define SC_STACK 1024           /* values: operands, call arguments, locals */
+#define SC_MAX_CALLS 64
+#define SC_MAX_CAPTURE 8        /* nested $( ) at run time */
+#define SC_MAX_BLOCKS 32
+#define SC_MAX_NESTED 8         /* script commands run by scripts */
+#define SC_NAME 64
+
+enum {
+    SC_HALT, SC_PUSH_INT, SC_PUSH_STR, SC_LOAD, SC_STORE, SC_ARG, SC_ARGC, SC_ARGS,
+    SC_ADD, SC_SUB, SC_MUL, SC_DIV, SC_MOD, SC_NEG, SC_NOT, SC_CAT, SC_LEN, SC_INTERP,
+    SC_EQ, SC_NE, SC_LT, SC_LE, SC_GT, SC_GE, SC_FORCMP,
+    SC_JMP, SC_JZ, SC_AND, SC_OR, SC_FORIN,
+    SC_CALL, SC_RET, SC_CALLCMD, SC_BUILTIN, SC_DYNCMD, SC_SHELL, SC_CAPTURE, SC_CAPTURED,
+};
+
+/* jumps keep their target in a; variable operands are slots: >= 0 a
+   global, < 0 local -(n + 1) of the running function */
+typedef struct { int op, a, b, c; } sc_ins_t;
+typedef struct { char* s; size_t len; } sc_str_t;
+typedef struct { char name[SC_NAME]; int entry, nlocals; } sc_func_t;
+
+struct sc_prog {
+    sc_ins_t* code;
+    int* lines;                 /* source line of each instruction */
+    int ncode, capcode;
+    sc_str_t* strs;
+    int nstrs, capstrs;
+    sc_func_t* funcs;
+    int nfuncs;
+    int nglobals;
+    int refs;                   /* the cache's and each run's */
+};
+
+static void sc_prog_release(sc_prog_t* p) {
+    if (!p || __atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    for (int i = 0; i < p->nstrs; ++i) free(p->strs[i].s);
+    free(p->strs);
+    free(p->code);
+    free(p->lines);
+    free(p->funcs);
+    free(p);
+}
+
+/* builtins a script calls without going through the shell: (first word, rest) */
+static void sc_cat(const char* a1, const char* a2) { (void)a2; cmd_cat(a1); }
+static void sc_head(const char* a1, const char* a2) { cmd_head_tail(0, a1, a2); }
+static void sc_rm(const char* a1, const char* a2) { (void)a2; cmd_rm(a1); }
+static void sc_tail(const char* a1, const char* a2) { cmd_head_tail(1, a1, a2); }
+static void sc_touch(const char* a1, const char* a2) { (void)a2; cmd_touch(a1); }
+static void sc_wc(const char* a1, const char* a2) { (void)a2; cmd_wc(a1); }
+
+static const struct { const char* name; void (*fn)(const char*, const char*); } sc_builtins[] = {    /* sorted */
+    {"append", cmd_append}, {"cat", sc_cat}, {"echo", cmd_echo}, {"grep", cmd_grep}, {"head", sc_head},
+    {"patch", cmd_patch}, {"rm", sc_rm}, {"tail", sc_tail}, {"touch", sc_touch}, {"truncate", cmd_truncate},
+    {"wc", sc_wc}, {"write", cmd_write},
+};
+#define SC_NBUILTINS ((int)(sizeof(sc_builtins) / sizeof(sc_builtins[0])))
+
+static int sc_builtin(const char* name) {
+    int lo = 0, hi = SC_NBUILTINS - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2, d = strcmp(name, sc_builtins[mid].name);
+        if (d == 0) return mid;
+        if (d < 0) hi = mid - 1;
+        else lo = mid + 1;
+    }
+    return -1;
+}
+
+static int sc_func(const sc_prog_t* p, const char* name, size_t len) {
+    for (int i = 0; i < p->nfuncs; ++i)
+        if (strlen(p->funcs[i].name) == len && memcmp(p->funcs[i].name, name, len) == 0) return i;
+    return -1;
+}
+
+/* Compiler: one statement per line, expressions by recursive descent */
+typedef struct {
+    char kind;                  /* 'i'f, 'w'hile, 'f'or-in, 'n'umeric for, 'F'unc */
+    int line, top;
+    int jz;                     /* pending exit jump; for 'F' the jump over the body */
+    int ends, conts;            /* chains of jumps to the end / to the next iteration */
+    int var, step, has_else;
+} sc_block_t;
+
+typedef struct {
+    sc_prog_t* p;
+    int line;
+    char err[160];
+    char (*gnames)[SC_NAME];    /* "" = a hidden loop slot */
+    int capg;
+    char (*lnames)[SC_NAME];    /* the function being compiled */
+    int nlocals, capl;
+    int fn;                     /* -1 at top level */
+    sc_block_t blk[SC_MAX_BLOCKS];
+    int nblk;
+} sc_comp_t;
+
+static char* trim_ws(char* s);
+static void sc_command(sc_comp_t* c, const char* text);
+static void sc_expr(sc_comp_t* c, const char** s);
+
+static void sc_fail(sc_comp_t* c, const char* fmt, ...) {
+    if (c->err[0]) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(c->err, sizeof(c->err), fmt, ap);
+    va_end(ap);
+}
+
+static int sc_emit(sc_comp_t* c, int op, int a, int b, int cc) {
+    sc_prog_t* p = c->p;
+    if (p->ncode == p->capcode) {
+        int cap = p->capcode ? p->capcode * 2 : 256;
+        sc_ins_t* code = realloc(p->code, (size_t)cap * sizeof(*code));
+        if (code) p->code = code;
+        int* lines = code ? realloc(p->lines, (size_t)cap * sizeof(*lines)) : NULL;
+        if (lines) p->lines = lines;
+        if (!code || !lines) { sc_fail(c, "out of memory"); return 0; }
+        p->capcode = cap;
+    }
+    p->code[p->ncode] = (sc_ins_t){ op, a, b, cc };
+    p->lines[p->ncode] = c->line;
+    return p->ncode++;
+}
+
+static void sc_patch(sc_comp_t* c, int chain, int target) {
+    while (chain >= 0) {
+        int next = c->p->code[chain].a;
+        c->p->code[chain].a = target;
+        chain = next;
+    }
+}
+
+static void sc_push_str(sc_comp_t* c, const char* s, size_t len) {
+    sc_prog_t* p = c->p;
+    if (p->nstrs == p->capstrs) {
+        int cap = p->capstrs ? p->capstrs * 2 : 32;
+        sc_str_t* strs = realloc(p->strs, (size_t)cap * sizeof(*strs));
+        if (!strs) { sc_fail(c, "out of memory"); return; }
+        p->strs = strs;
+        p->capstrs = cap;
+    }
+    char* d = malloc(len + 1);
+    if (!d) { sc_fail(c, "out of memory"); return; }
+    if (len) memcpy(d, s, len);
+    d[len] = '\0';
+    p->strs[p->nstrs] = (sc_str_t){ d, len };
+    sc_emit(c, SC_PUSH_STR, p->nstrs++, 0, 0);
+}
+
+static int sc_add_name(sc_comp_t* c, char (**names)[SC_NAME], int* n, int* cap, const char* name) {
+    if (*n == *cap) {
+        int ncap = *cap ? *cap * 2 : 16;
+        char (*nn)[SC_NAME] = realloc(*names, (size_t)ncap * SC_NAME);
+        if (!nn) { sc_fail(c, "out of memory"); return 0; }
+        *names = nn;
+        *cap = ncap;
+    }
+    snprintf((*names)[*n], SC_NAME, "%s", name);
+    return (*n)++;
+}
+
+/* a variable's slot: a local of the function being compiled, else a
+   global, created on first use */
+static int sc_var(sc_comp_t* c, const char* name) {
+    if (c->fn >= 0)
+        for (int i = c->nlocals - 1; i >= 0; --i) if (strcmp(c->lnames[i], name) == 0) return -i - 1;
+    for (int i = 0; i < c->p->nglobals; ++i) if (strcmp(c->gnames[i], name) == 0) return i;
+    return sc_add_name(c, &c->gnames, &c->p->nglobals, &c->capg, name);
+}
+
+/* two adjacent slots no name can reach: sc_slot_next() gives the second */
+static int sc_hidden(sc_comp_t* c) {
+    if (c->fn >= 0) {
+        int i = sc_add_name(c, &c->lnames, &c->nlocals, &c->capl, "");
+        sc_add_name(c, &c->lnames, &c->nlocals, &c->capl, "");
+        return -i - 1;
+    }
+    int i = sc_add_name(c, &c->gnames, &c->p->nglobals, &c->capg, "");
+    sc_add_name(c, &c->gnames, &c->p->nglobals, &c->capg, "");
+    return i;
+}
+
+static int sc_slot_next(int slot) { return slot >= 0 ? slot + 1 : slot - 1; }
+
+static void sc_ws(const char** s) {
+    while (**s == ' ' || **s == '\t') (*s)++;
+}
+
+/* length of the identifier at s, copied to out; 0 if there is none */
+static int sc_ident(sc_comp_t* c, const char* s, char* out) {
+    int n = 0;
+    if (!isalpha((unsigned char)s[0]) && s[0] != '_') return 0;
+    while (isalnum((unsigned char)s[n]) || s[n] == '_') n++;
+    if (n >= SC_NAME) { sc_fail(c, "name too long: %.20s...", s); return 0; }
+    memcpy(out, s, (size_t)n);
+    out[n] = '\0';
+    return n;
+}
+
+/* s starts with keyword kw as a whole word: the text after it, else NULL */
+static const char* sc_kw(const char* s, const char* kw) {
+    size_t n = strlen(kw);
+    if (strncmp(s, kw, n) != 0 || (s[n] && s[n] != ' ' && s[n] != '\t')) return NULL;
+    s += n;
+    sc_ws(&s);
+    return s;
+}
+
+/* the ')' closing a "$(" whose body starts at s */
+static const char* sc_close_paren(const char* s) {
+    int depth = 1, inq = 0;
+    for (; *s; ++s) {
+        if (*s == '\\' && s[1]) s++;
+        else if (*s == '"') inq = !inq;
+        else if (inq) continue;
+        else if (*s == '(') depth++;
+        else if (*s == ')' && --depth == 0) return s;
+    }
+    return NULL;
+}
+
+/* an unquoted '|' or '>' outside $( ): the line needs the shell's pipelines */
+static int sc_has_pipe(const char* s) {
+    int inq = 0;
+    for (; *s; ++s) {
+        if (*s == '\\' && s[1]) s++;
+        else if (*s == '"') inq = !inq;
+        else if (inq) continue;
+        else if (s[0] == '$' && s[1] == '(') {
+            const char* e = sc_close_paren(s + 2);
+            if (!e) return 0;
+            s = e;
+        }
+        else if (*s == '|' || *s == '>') return 1;
+    }
+    return 0;
+}
+
+static int sc_is_dollar(const char* s) {
+    unsigned char ch = (unsigned char)s[1];
+    return ch == '(' || ch == '{' || ch == '#' || ch == '@' || isalnum(ch) || ch == '_';
+}
+
+/* $name ${name} $1..$9 $# $@ $(command); *s at the '$' */
+static void sc_dollar(sc_comp_t* c, const char** s) {
+    const char* p = *s + 1;
+    char name[SC_NAME];
+    if (*p == '(') {
+        const char* e = sc_close_paren(p + 1);
+        if (!e) { sc_fail(c, "missing ')' after $("); return; }
+        size_t n = (size_t)(e - p - 1);
+        char* inner = malloc(n + 1);
+        if (!inner) { sc_fail(c, "out of memory"); return; }
+        memcpy(inner, p + 1, n);
+        inner[n] = '\0';
+        sc_emit(c, SC_CAPTURE, 0, 0, 0);
+        sc_command(c, trim_ws(inner));
+        sc_emit(c, SC_CAPTURED, 0, 0, 0);
+        free(inner);
+        *s = e + 1;
+        return;
+    }
+    int brace = *p == '{', n;
+    if (brace) p++;
+    if (*p == '#') { sc_emit(c, SC_ARGC, 0, 0, 0); p++; }
+    else if (*p == '@') { sc_emit(c, SC_ARGS, 0, 0, 0); p++; }
+    else if (isdigit((unsigned char)*p)) { sc_emit(c, SC_ARG, *p - '0', 0, 0); p++; }
+    else if ((n = sc_ident(c, p, name)) > 0) { sc_emit(c, SC_LOAD, sc_var(c, name), 0, 0); p += n; }
+    else { sc_fail(c, "bad variable after '$'"); return; }
+    if (brace && *p++ != '}') { sc_fail(c, "missing '}'"); return; }
+    *s = p;
+}
+
+/* text with $ expansions as one value. With quote, a "..." literal
+   ending at the quote (\n \t \\ \" \$ escapes); else a command line. */
+static void sc_template(sc_comp_t* c, const char** s, char quote) {
+    strbuf_t lit = {0};
+    int parts = 0;
+    const char* p = *s;
+    while (!c->err[0]) {
+        if (*p == '\0') {
+            if (quote) sc_fail(c, "missing closing %c", quote);
+            break;
+        }
+        if (quote && *p == quote) { p++; break; }
+        if (*p == '\\' && p[1]) {
+            const char* e = p[1] == '$' ? "$" : !quote ? NULL : p[1] == 'n' ? "\n" : p[1] == 't' ? "\t"
+                          : p[1] == '\\' ? "\\" : p[1] == '"' ? "\"" : NULL;
+            if (e) { sb_append(&lit, e, 1); p += 2; continue; }
+        } else if (*p == '$' && sc_is_dollar(p)) {
+            if (lit.len) { sc_push_str(c, lit.data, lit.len); parts++; lit.len = 0; }
+            sc_dollar(c, &p);
+            parts++;
+            continue;
+        }
+        sb_append(&lit, p++, 1);
+    }
+    if (lit.len || parts == 0) { sc_push_str(c, lit.data ? lit.data : "", lit.len); parts++; }
+    if (parts > 1) sc_emit(c, SC_INTERP, parts, 0, 0);
+    sb_free(&lit);
+    *s = p;
+}
+
+static void sc_primary(sc_comp_t* c, const char** s) {
+    sc_ws(s);
+    const char* p = *s;
+    char name[SC_NAME];
+    int n;
+    if (isdigit((unsigned char)*p)) {
+        const char* e = p;
+        while (isdigit((unsigned char)*e)) e++;
+        if (isalpha((unsigned char)*e) || *e == '_') { sc_fail(c, "bad number"); return; }
+        if (e - p < 10) sc_emit(c, SC_PUSH_INT, atoi(p), 0, 0);
+        else {
+            errno = 0;
+            strtoll(p, NULL, 10);
+            if (errno == ERANGE) { sc_fail(c, "number too large: %.*s", (int)(e - p), p); return; }
+            sc_push_str(c, p, (size_t)(e - p));     /* converted when used */
+        }
+        *s = e;
+    } else if (*p == '"') {
+        *s = p + 1;
+        sc_template(c, s, '"');
+    } else if (*p == '\'') {
+        const char* e = strchr(p + 1, '\'');
+        if (!e) { sc_fail(c, "missing closing '"); return; }
+        sc_push_str(c, p + 1, (size_t)(e - p - 1));
+        *s = e + 1;
+    } else if (*p == '$' && sc_is_dollar(p)) {
+        sc_dollar(c, s);
+    } else if (*p == '(') {
+        *s = p + 1;
+        sc_expr(c, s);
+        sc_ws(s);
+        if (**s != ')') sc_fail(c, "missing ')'");
+        else (*s)++;
+    } else if ((n = sc_ident(c, p, name)) > 0) {
+        *s = p + n;
+        if (**s != '(') { sc_emit(c, SC_LOAD, sc_var(c, name), 0, 0); return; }
+        int argc = 0;
+        (*s)++;
+        sc_ws(s);
+        while (**s != ')' && !c->err[0]) {
+            sc_expr(c, s);
+            argc++;
+            sc_ws(s);
+            if (**s == ',') (*s)++;
+            else if (**s != ')') sc_fail(c, "missing ')' in call to %s", name);
+        }
+        if (c->err[0]) return;
+        (*s)++;
+        int fn = sc_func(c->p, name, strlen(name));
+        if (fn >= 0) sc_emit(c, SC_CALL, fn, argc, 0);
+        else if (strcmp(name, "len") == 0 && argc == 1) sc_emit(c, SC_LEN, 0, 0, 0);
+        else sc_fail(c, "unknown function %s()", name);
+    } else sc_fail(c, *p ? "unexpected '%c'" : "expected a value", *p);
+}
+
+static void sc_unary(sc_comp_t* c, const char** s) {
+    sc_ws(s);
+    if (**s == '-') { (*s)++; sc_unary(c, s); sc_emit(c, SC_NEG, 0, 0, 0); }
+    else if (**s == '!' && (*s)[1] != '=') { (*s)++; sc_unary(c, s); sc_emit(c, SC_NOT, 0, 0, 0); }
+    else sc_primary(c, s);
+}
+
+static void sc_mul(sc_comp_t* c, const char** s) {
+    sc_unary(c, s);
+    for (sc_ws(s); !c->err[0] && (**s == '*' || **s == '/' || **s == '%'); sc_ws(s)) {
+        int op = **s == '*' ? SC_MUL : **s == '/' ? SC_DIV : SC_MOD;
+        (*s)++;
+        sc_unary(c, s);
+        sc_emit(c, op, 0, 0, 0);
+    }
+}
+
+static void sc_add(sc_comp_t* c, const char** s) {
+    sc_mul(c, s);
+    for (sc_ws(s); !c->err[0] && (**s == '+' || **s == '-'); sc_ws(s)) {
+        int op = **s == '+' ? SC_ADD : SC_SUB;
+        (*s)++;
+        sc_mul(c, s);
+        sc_emit(c, op, 0, 0, 0);
+    }
+}
+
+static void sc_concat(sc_comp_t* c, const char** s) {
+    sc_add(c, s);
+    for (sc_ws(s); !c->err[0] && (*s)[0] == '.' && (*s)[1] == '.'; sc_ws(s)) {
+        *s += 2;
+        sc_add(c, s);
+        sc_emit(c, SC_CAT, 0, 0, 0);
+    }
+}
+
+static void sc_compare(sc_comp_t* c, const char** s) {
+    static const struct { const char* op; int code; } ops[] = {
+        {"==", SC_EQ}, {"!=", SC_NE}, {"<=", SC_LE}, {">=", SC_GE}, {"<", SC_LT}, {">", SC_GT},
+    };
+    sc_concat(c, s);
+    sc_ws(s);
+    for (int i = 0; i < 6 && !c->err[0]; ++i) {
+        size_t n = strlen(ops[i].op);
+        if (strncmp(*s, ops[i].op, n) != 0) continue;
+        *s += n;
+        sc_concat(c, s);
+        sc_emit(c, ops[i].code, 0, 0, 0);
+        break;
+    }
+}
+
+/* && and || keep the deciding operand and skip the other */
+static void sc_and(sc_comp_t* c, const char** s) {
+    sc_compare(c, s);
+    for (sc_ws(s); !c->err[0] && (*s)[0] == '&' && (*s)[1] == '&'; sc_ws(s)) {
+        *s += 2;
+        int j = sc_emit(c, SC_AND, -1, 0, 0);
+        sc_compare(c, s);
+        c->p->code[j].a = c->p->ncode;
+    }
+}
+
+static void sc_expr(sc_comp_t* c, const char** s) {
+    sc_and(c, s);
+    for (sc_ws(s); !c->err[0] && (*s)[0] == '|' && (*s)[1] == '|'; sc_ws(s)) {
+        *s += 2;
+        int j = sc_emit(c, SC_OR, -1, 0, 0);
+        sc_and(c, s);
+        c->p->code[j].a = c->p->ncode;
+    }
+}
+
+/* an expression that must be the rest of the line */
+static void sc_expr_line(sc_comp_t* c, const char* s) {
+    if (!*s) { sc_fail(c, "expected an expression"); return; }
+    sc_expr(c, &s);
+    sc_ws(&s);
+    if (*s) sc_fail(c, "unexpected '%s'", s);
+}
+
+/* a command line: a script function, a direct builtin, or the shell */
+static void sc_command(sc_comp_t* c, const char* text) {
+    const char* p = text;
+    if (!*text) return;
+    size_t n = strcspn(text, " \t");
+    int pipe = sc_has_pipe(text);
+    if (pipe || memchr(text, '$', n)) {
+        sc_template(c, &p, 0);
+        sc_emit(c, pipe ? SC_SHELL : SC_DYNCMD, 0, 0, 0);
+        return;
+    }
+    char word[SC_NAME] = "";
+    if (n < SC_NAME) memcpy(word, text, n);
+    const char* rest = text + n;
+    sc_ws(&rest);
+    int fn = sc_func(c->p, text, n), b = sc_builtin(word);
+    if (fn >= 0) {
+        sc_template(c, &rest, 0);
+        sc_emit(c, SC_CALLCMD, fn, 0, 0);
+    } else if (b >= 0) {
+        sc_template(c, &rest, 0);
+        sc_emit(c, SC_BUILTIN, b, stat_command_index(word), 0);
+    } else {
+        sc_template(c, &p, 0);
+        sc_emit(c, SC_SHELL, 0, 0, 0);
+    }
+}
+
+static sc_block_t* sc_loop(sc_comp_t* c) {
+    for (int i = c->nblk - 1; i >= 0 && c->blk[i].kind != 'F'; --i)
+        if (c->blk[i].kind != 'i') return &c->blk[i];
+    return NULL;
+}
+
+static sc_block_t* sc_open(sc_comp_t* c, char kind) {
+    if (c->nblk == SC_MAX_BLOCKS) { sc_fail(c, "blocks nested too deeply"); return NULL; }
+    sc_block_t* b = &c->blk[c->nblk++];
+    memset(b, 0, sizeof(*b));
+    b->kind = kind;
+    b->line = c->line;
+    b->top = c->p->ncode;
+    b->jz = b->ends = b->conts = -1;
+    return b;
+}
+
+static void sc_end(sc_comp_t* c) {
+    if (c->nblk == 0) { sc_fail(c, "'end' without a block"); return; }
+    sc_block_t* b = &c->blk[--c->nblk];
+    sc_prog_t* p = c->p;
+    switch (b->kind) {
+    case 'i':
+        if (b->jz >= 0) p->code[b->jz].a = p->ncode;
+        sc_patch(c, b->ends, p->ncode);
+        break;
+    case 'n':
+        sc_patch(c, b->conts, p->ncode);
+        b->conts = -1;
+        sc_emit(c, SC_LOAD, b->var, 0, 0);
+        sc_emit(c, SC_LOAD, b->step, 0, 0);
+        sc_emit(c, SC_ADD, 0, 0, 0);
+        sc_emit(c, SC_STORE, b->var, 0, 0);
+        /* fall through */
+    case 'w':
+    case 'f':
+        sc_patch(c, b->conts, b->top);
+        sc_emit(c, SC_JMP, b->top, 0, 0);
+        p->code[b->jz].a = p->ncode;
+        sc_patch(c, b->ends, p->ncode);
+        break;
+    case 'F':
+        sc_push_str(c, "", 0);
+        sc_emit(c, SC_RET, 0, 0, 0);
+        p->code[b->jz].a = p->ncode;
+        p->funcs[c->fn].nlocals = c->nlocals;
+        c->fn = -1;
+        break;
+    }
+}
+
+/* for NAME in WORDS | for NAME = A to B [step S] */
+static void sc_for(sc_comp_t* c, const char* s) {
+    char name[SC_NAME];
+    int n = sc_ident(c, s, name);
+    if (!n) { sc_fail(c, "usage: for NAME in WORDS | for NAME = A to B [step S]"); return; }
+    int var = sc_var(c, name);
+    const char* r;
+    s += n;
+    sc_ws(&s);
+    if ((r = sc_kw(s, "in")) != NULL) {
+        int list = sc_hidden(c);
+        sc_template(c, &r, 0);
+        sc_emit(c, SC_STORE, list, 0, 0);
+        sc_emit(c, SC_PUSH_INT, 0, 0, 0);
+        sc_emit(c, SC_STORE, sc_slot_next(list), 0, 0);
+        sc_block_t* b = sc_open(c, 'f');
+        if (b) b->jz = sc_emit(c, SC_FORIN, -1, list, var);
+        return;
+    }
+    if (*s != '=') { sc_fail(c, "usage: for NAME in WORDS | for NAME = A to B [step S]"); return; }
+    s++;
+    int lim = sc_hidden(c), step = sc_slot_next(lim);
+    sc_expr(c, &s);
+    sc_emit(c, SC_STORE, var, 0, 0);
+    sc_ws(&s);
+    if (!c->err[0] && !(r = sc_kw(s, "to"))) { sc_fail(c, "missing 'to'"); return; }
+    s = r;
+    sc_expr(c, &s);
+    sc_emit(c, SC_STORE, lim, 0, 0);
+    sc_ws(&s);
+    if ((r = sc_kw(s, "step")) != NULL) {
+        s = r;
+        sc_expr(c, &s);
+        sc_ws(&s);
+    } else sc_emit(c, SC_PUSH_INT, 1, 0, 0);
+    sc_emit(c, SC_STORE, step, 0, 0);
+    if (*s) { sc_fail(c, "unexpected '%s'", s); return; }
+    sc_block_t* b = sc_open(c, 'n');
+    if (!b) return;
+    b->var = var;
+    b->step = step;
+    sc_emit(c, SC_LOAD, var, 0, 0);
+    sc_emit(c, SC_LOAD, lim, 0, 0);
+    sc_emit(c, SC_LOAD, step, 0, 0);
+    sc_emit(c, SC_FORCMP, 0, 0, 0);
+    b->jz = sc_emit(c, SC_JZ, -1, 0, 0);
+}
+
+/* after "=", "+=" or "-=" following a name; NULL if s is no assignment */
+static const char* sc_assign(const char* s) {
+    sc_ws(&s);
+    if (s[0] == '=' && s[1] != '=') return s + 1;
+    if ((s[0] == '+' || s[0] == '-') && s[1] == '=') return s + 2;
+    return NULL;
+}
+
+static void sc_statement(sc_comp_t* c, const char* s) {
+    sc_block_t* b = c->nblk ? &c->blk[c->nblk - 1] : NULL;
+    const char* r;
+    char name[SC_NAME];
+    int n;
+    if ((r = sc_kw(s, "if")) != NULL) {
+        sc_expr_line(c, r);
+        if ((b = sc_open(c, 'i')) != NULL) b->jz = sc_emit(c, SC_JZ, -1, 0, 0);
+    } else if ((r = sc_kw(s, "elif")) != NULL || (r = sc_kw(s, "else")) != NULL) {
+        int is_else = s[2] == 's';
+        if (!b || b->kind != 'i' || b->has_else) { sc_fail(c, "'%s' without 'if'", is_else ? "else" : "elif"); return; }
+        b->ends = sc_emit(c, SC_JMP, b->ends, 0, 0);
+        c->p->code[b->jz].a = c->p->ncode;
+        b->jz = -1;
+        if (is_else) {
+            b->has_else = 1;
+            if (*r) sc_fail(c, "unexpected '%s'", r);
+        } else {
+            sc_expr_line(c, r);
+            b->jz = sc_emit(c, SC_JZ, -1, 0, 0);
+        }
+    } else if ((r = sc_kw(s, "while")) != NULL) {
+        int top = c->p->ncode;
+        sc_expr_line(c, r);
+        if ((b = sc_open(c, 'w')) != NULL) {
+            b->top = top;
+            b->jz = sc_emit(c, SC_JZ, -1, 0, 0);
+        }
+    } else if ((r = sc_kw(s, "for")) != NULL) {
+        sc_for(c, r);
+    } else if ((r = sc_kw(s, "end")) != NULL) {
+        if (*r) sc_fail(c, "unexpected '%s'", r);
+        else sc_end(c);
+    } else if ((r = sc_kw(s, "break")) != NULL || (r = sc_kw(s, "continue")) != NULL) {
+        sc_block_t* loop = sc_loop(c);
+        if (!loop) sc_fail(c, "'%.8s' outside a loop", s);
+        else if (s[0] == 'b') loop->ends = sc_emit(c, SC_JMP, loop->ends, 0, 0);
+        else loop->conts = sc_emit(c, SC_JMP, loop->conts, 0, 0);
+    } else if ((r = sc_kw(s, "return")) != NULL) {
+        if (*r) sc_expr_line(c, r);
+        else sc_push_str(c, "", 0);
+        sc_emit(c, c->fn >= 0 ? SC_RET : SC_HALT, 0, 0, 0);
+    } else if ((r = sc_kw(s, "func")) != NULL) {
+        n = sc_ident(c, r, name);
+        int fn = n ? sc_func(c->p, name, (size_t)n) : -1;
+        if (c->nblk) sc_fail(c, "functions must be defined at top level");
+        else if (!n || r[n]) sc_fail(c, "usage: func NAME");
+        else if (c->p->funcs[fn].entry >= 0) sc_fail(c, "%s is defined twice", name);
+        else if ((b = sc_open(c, 'F')) != NULL) {
+            b->jz = sc_emit(c, SC_JMP, -1, 0, 0);
+            c->p->funcs[fn].entry = c->p->ncode;
+            c->fn = fn;
+            c->nlocals = 0;
+        }
+    } else if ((r = sc_kw(s, "local")) != NULL) {
+        n = sc_ident(c, r, name);
+        if (c->fn < 0) { sc_fail(c, "'local' outside a function"); return; }
+        if (!n) { sc_fail(c, "usage: local NAME [= EXPR]"); return; }
+        int slot = 0;
+        for (int i = 0; i < c->nlocals; ++i) if (strcmp(c->lnames[i], name) == 0) slot = -i - 1;
+        if (!slot) slot = -sc_add_name(c, &c->lnames, &c->nlocals, &c->capl, name) - 1;
+        r += n;
+        sc_ws(&r);
+        if (*r == '=') sc_expr_line(c, r + 1);
+        else if (*r) { sc_fail(c, "unexpected '%s'", r); return; }
+        else sc_push_str(c, "", 0);
+        sc_emit(c, SC_STORE, slot, 0, 0);
+    } else if ((n = sc_ident(c, s, name)) > 0 && (r = sc_assign(s + n)) != NULL) {
+        int slot = sc_var(c, name), op = r[-2] == '+' ? SC_ADD : r[-2] == '-' ? SC_SUB : 0;
+        if (op) sc_emit(c, SC_LOAD, slot, 0, 0);
+        sc_expr_line(c, r);
+        if (op) sc_emit(c, op, 0, 0, 0);
+        sc_emit(c, SC_STORE, slot, 0, 0);
+    } else sc_command(c, s);
+}
+
+/* compiles a script; NULL with err set on a mistake */
+static sc_prog_t* sc_compile(const char* name, const char* src, size_t len, char* err, size_t errlen) {
+    sc_comp_t c;
+    memset(&c, 0, sizeof(c));
+    c.fn = -1;
+    c.p = calloc(1, sizeof(sc_prog_t));
+    char* buf = malloc(len + 1);
+    if (!c.p || !buf) {
+        free(c.p);
+        free(buf);
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+    memcpy(buf, src, len);
+    buf[len] = '\0';
+    /* functions first, so calls may come before definitions */
+    for (char* line = buf; line && !c.err[0]; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        const char* r;
+        char name[SC_NAME];
+        c.line++;
+        while (*line == ' ' || *line == '\t') line++;
+        if (!(r = sc_kw(line, "func")) || !sc_ident(&c, r, name)) continue;
+        if (sc_func(c.p, name, strlen(name)) >= 0) continue;    /* reported in order below */
+        sc_func_t* f = realloc(c.p->funcs, (size_t)(c.p->nfuncs + 1) * sizeof(*f));
+        if (!f) { sc_fail(&c, "out of memory"); break; }
+        c.p->funcs = f;
+        snprintf(f[c.p->nfuncs].name, SC_NAME, "%s", name);
+        f[c.p->nfuncs].entry = -1;
+        f[c.p->nfuncs++].nlocals = 0;
+    }
+    c.line = 0;
+    for (char* line = buf; line && !c.err[0];) {
+        char* next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        c.line++;
+        line = trim_ws(line);
+        if (line[0] && line[0] != '#') sc_statement(&c, line);
+        line = next;
+    }
+    if (!c.err[0] && c.nblk) {
+        sc_block_t* b = &c.blk[c.nblk - 1];
+        c.line = b->line;
+        sc_fail(&c, "missing 'end' for this %s", b->kind == 'i' ? "if" : b->kind == 'w' ? "while" : b->kind == 'F' ? "func" : "for");
+    }
+    sc_emit(&c, SC_HALT, 0, 0, 0);
+    free(buf);
+    free(c.gnames);
+    free(c.lnames);
+    c.p->refs = 1;
+    if (c.err[0]) {
+        snprintf(err, errlen, "script: %s:%d: %s", name, c.line, c.err);
+        sc_prog_release(c.p);
+        return NULL;
+    }
+    return c.p;
+}
+
+/* VM. A value is an integer or a string: owned, or borrowed from the
+   program's constants. */
+enum { SC_INT, SC_OWN, SC_REF };
+
+typedef struct {
+    int kind;
+    long long i;
+    char* s;
+    size_t len;
+} sc_val_t;
+
+typedef struct {
+    int fn;                     /* -1: the script itself */
+    int ret;                    /* pc to return to */
+    int base, nargs;            /* arguments at stack[base..] */
+    int loc;                    /* locals at stack[loc..] */
+    int discard;                /* called as a command: drop the result */
+} sc_frame_t;
+
+typedef struct {
+    strbuf_t sb;
+    sh_io_t io;
+    sh_io_t* outer;
+} sc_capture_t;
+
+typedef struct {
+    sc_prog_t* p;
+    const char* name;           /* $0 */
+    sc_val_t* stack;
+    sc_val_t* globals;
+    sc_frame_t frames[SC_MAX_CALLS];
+    int nframes;
+    sc_capture_t cap[SC_MAX_CAPTURE];
+    int ncap;
+    char err[160];
+} sc_vm_t;
+
+static SOS_TLS int sc_depth;   /* handed on to pipeline stages by sh_stage_t */
+
+static void sc_free(sc_val_t* v) {
+    if (v->kind == SC_OWN) free(v->s);
+    v->kind = SC_REF;
+    v->s = (char*)"";
+    v->len = 0;
+}
+
+static int sc_dup(sc_val_t* out, const char* s, size_t len) {
+    char* d = malloc(len + 1);
+    if (!d) return 0;
+    memcpy(d, s, len);
+    d[len] = '\0';
+    *out = (sc_val_t){ SC_OWN, 0, d, len };
+    return 1;
+}
+
+/* a value's text, NUL-terminated; integers are formatted into tmp */
+static const char* sc_text(const sc_val_t* v, char* tmp, size_t* len) {
+    if (v->kind != SC_INT) { *len = v->len; return v->s; }
+    *len = (size_t)snprintf(tmp, 24, "%lld", v->i);
+    return tmp;
+}
+
+static int sc_truthy(const sc_val_t* v) {
+    if (v->kind == SC_INT) return v->i != 0;
+    return v->len > 0 && !(v->len == 1 && v->s[0] == '0');
+}
+
+/* v as an integer, blanks around it ignored; "" counts as 0 unless strict.
+   Text past the range of long long is not a number. */
+static int sc_num(const sc_val_t* v, long long* out, int strict) {
+    if (v->kind == SC_INT) { *out = v->i; return 1; }
+    const char *s = v->s, *e = v->s + v->len;
+    while (s < e && isspace((unsigned char)*s)) s++;
+    while (e > s && isspace((unsigned char)e[-1])) e--;
+    if (s == e) { *out = 0; return !strict; }
+    int neg = *s == '-';
+    if (*s == '-' || *s == '+') s++;
+    if (s == e) return 0;
+    unsigned long long n = 0, max = neg ? (unsigned long long)LLONG_MAX + 1 : LLONG_MAX;
+    for (; s < e; ++s) {
+        if (*s < '0' || *s > '9') return 0;
+        if (n > (max - (unsigned)(*s - '0')) / 10) return 0;
+        n = n * 10 + (unsigned)(*s - '0');
+    }
+    *out = (long long)(neg ? 0 - n : n);
+    return 1;
+}
+
+/* a word that prints back unchanged as an integer: "-12", not "012" or "+1" */
+static int sc_canonical_int(const char* s, size_t len, long long* out) {
+    size_t i = s[0] == '-';
+    if (len == i || len - i > 18 || (s[i] == '0' && len - i > 1) || (i && s[1] == '0')) return 0;
+    long long v = 0;
+    for (size_t k = i; k < len; ++k) {
+        if (s[k] < '0' || s[k] > '9') return 0;
+        v = v * 10 + (s[k] - '0');
+    }
+    *out = i ? -v : v;
+    return 1;
+}
+
+/* splits text into words pushed as owned strings, or as integers when
+   they read back the same, so loop bounds are not parsed per iteration;
+   the count, or -1 */
+static int sc_push_words(sc_val_t* stack, int* sp, const char* text) {
+    int n = 0;
+    for (const char* p = text;;) {
+        p += strspn(p, " \t\r\n");
+        if (!*p) return n;
+        size_t len = strcspn(p, " \t\r\n");
+        long long v;
+        if (*sp == SC_STACK) return -1;
+        if (sc_canonical_int(p, len, &v)) stack[*sp] = (sc_val_t){ SC_INT, v, NULL, 0 };
+        else if (!sc_dup(&stack[*sp], p, len)) return -1;
+        (*sp)++;
+        n++;
+        p += len;
+    }
+}
+
+/* calls builtin b with the first word and the rest of text */
+static void sc_call_builtin(int b, const char* text) {
+    char a1[512];
+    text += strspn(text, " \t");
+    size_t n = strcspn(text, " \t\n");
+    if (n >= sizeof(a1)) n = sizeof(a1) - 1;
+    memcpy(a1, text, n);
+    a1[n] = '\0';
+    text += strcspn(text, " \t\n");
+    text += strspn(text, " \t");
+    sc_builtins[b].fn(a1, text);
+}
+
+static int sc_run(sc_vm_t* vm) {
+    sc_prog_t* p = vm->p;
+    const sc_ins_t* code = p->code;
+    sc_val_t* st = vm->stack;
+    sc_val_t* g = vm->globals;
+    sc_frame_t* fr = &vm->frames[0];
+    int sp = fr->loc, pc = 0, fn = 0, argc = 0, discard = 0;
+    unsigned long long ops = 0;
+    char tmp[24], tmp2[24];
+    size_t len, len2;
+    const char *t, *t2;
+#define SC_FAIL(...) do { snprintf(vm->err, sizeof(vm->err), __VA_ARGS__); goto fail; } while (0)
+#define SC_SLOT(v) ((v) >= 0 ? &g[(v)] : &st[fr->loc - (v) - 1])
+#define SC_PUSHV(v) do { if (sp == SC_STACK) SC_FAIL("stack overflow"); st[sp++] = (v); } while (0)
+    for (;;) {
+        const sc_ins_t* in = &code[pc++];
+        if ((++ops & 4095) == 0) {
+            if (__atomic_load_n(&sos_cur->interrupted, __ATOMIC_RELAXED)) SC_FAIL("interrupted");
+            if (sh_broken()) goto done;     /* nobody reads the output any more */
+        }
+        switch (in->op) {
+        case SC_HALT:
+            goto done;
+        case SC_PUSH_INT:
+            SC_PUSHV(((sc_val_t){ SC_INT, in->a, NULL, 0 }));
+            break;
+        case SC_PUSH_STR:
+            SC_PUSHV(((sc_val_t){ SC_REF, 0, p->strs[in->a].s, p->strs[in->a].len }));
+            break;
+        case SC_LOAD: {
+            sc_val_t* v = SC_SLOT(in->a);
+            if (sp == SC_STACK) SC_FAIL("stack overflow");
+            if (v->kind != SC_OWN) st[sp++] = *v;
+            else if (sc_dup(&st[sp], v->s, v->len)) sp++;
+            else SC_FAIL("out of memory");
+            break;
+        }
+        case SC_STORE: {
+            sc_val_t* v = SC_SLOT(in->a);
+            sc_free(v);
+            *v = st[--sp];
+            break;
+        }
+        case SC_ARG:
+            if (in->a == 0) {
+                const char* name = fr->fn >= 0 ? p->funcs[fr->fn].name : vm->name;
+                SC_PUSHV(((sc_val_t){ SC_REF, 0, (char*)name, strlen(name) }));
+            } else if (in->a <= fr->nargs) {
+                sc_val_t* v = &st[fr->base + in->a - 1];
+                if (sp == SC_STACK) SC_FAIL("stack overflow");
+                if (v->kind != SC_OWN) st[sp++] = *v;
+                else if (sc_dup(&st[sp], v->s, v->len)) sp++;
+                else SC_FAIL("out of memory");
+            } else SC_PUSHV(((sc_val_t){ SC_REF, 0, (char*)"", 0 }));
+            break;
+        case SC_ARGC:
+            SC_PUSHV(((sc_val_t){ SC_INT, fr->nargs, NULL, 0 }));
+            break;
+        case SC_ARGS: {
+            strbuf_t sb = {0};
+            sb_append(&sb, "", 0);
+            for (int i = 0; i < fr->nargs; ++i) {
+                t = sc_text(&st[fr->base + i], tmp, &len);
+                if (i) sb_append(&sb, " ", 1);
+                sb_append(&sb, t, len);
+            }
+            if (!sb.data) SC_FAIL("out of memory");
+            if (sp == SC_STACK) { sb_free(&sb); SC_FAIL("stack overflow"); }
+            st[sp++] = (sc_val_t){ SC_OWN, 0, sb.data, sb.len };
+            break;
+        }
+        case SC_ADD: case SC_SUB: case SC_MUL: case SC_DIV: case SC_MOD: {
+            sc_val_t *l = &st[sp - 2], *r = &st[sp - 1];
+            long long x, y, z;
+            if (!sc_num(l, &x, 0)) { t = sc_text(l, tmp, &len); SC_FAIL("not a number: '%.40s'", t); }
+            if (!sc_num(r, &y, 0)) { t = sc_text(r, tmp, &len); SC_FAIL("not a number: '%.40s'", t); }
+            if ((in->op == SC_DIV || in->op == SC_MOD) && y == 0) SC_FAIL("division by zero");
+            int over = 0;
+            switch (in->op) {
+            case SC_ADD: over = __builtin_add_overflow(x, y, &z); break;
+            case SC_SUB: over = __builtin_sub_overflow(x, y, &z); break;
+            case SC_MUL: over = __builtin_mul_overflow(x, y, &z); break;
+            case SC_DIV: if (y == -1) over = __builtin_sub_overflow(0LL, x, &z); else z = x / y; break;
+            default: z = y == -1 ? 0 : x % y; break;
+            }
+            if (over) SC_FAIL("integer overflow");
+            sc_free(l);
+            sc_free(r);
+            sp--;
+            *l = (sc_val_t){ SC_INT, z, NULL, 0 };
+            break;
+        }
+        case SC_NEG: {
+            sc_val_t* v = &st[sp - 1];
+            long long x;
+            if (!sc_num(v, &x, 0)) { t = sc_text(v, tmp, &len); SC_FAIL("not a number: '%.40s'", t); }
+            if (x == LLONG_MIN) SC_FAIL("integer overflow");
+            sc_free(v);
+            *v = (sc_val_t){ SC_INT, -x, NULL, 0 };
+            break;
+        }
+        case SC_NOT: {
+            int z = !sc_truthy(&st[sp - 1]);
+            sc_free(&st[sp - 1]);
+            st[sp - 1] = (sc_val_t){ SC_INT, z, NULL, 0 };
+            break;
+        }
+        case SC_LEN: {
+            t = sc_text(&st[sp - 1], tmp, &len);
+            sc_free(&st[sp - 1]);
+            st[sp - 1] = (sc_val_t){ SC_INT, (long long)len, NULL, 0 };
+            break;
+        }
+        case SC_CAT:
+        case SC_INTERP: {
+            int n = in->op == SC_CAT ? 2 : in->a;
+            size_t total = 0;
+            for (int i = sp - n; i < sp; ++i) { sc_text(&st[i], tmp, &len); total += len; }
+            char* d = malloc(total + 1);
+            if (!d) SC_FAIL("out of memory");
+            total = 0;
+            for (int i = sp - n; i < sp; ++i) {
+                t = sc_text(&st[i], tmp, &len);
+                memcpy(d + total, t, len);
+                total += len;
+                sc_free(&st[i]);
+            }
+            d[total] = '\0';
+            sp -= n;
+            st[sp++] = (sc_val_t){ SC_OWN, 0, d, total };
+            break;
+        }
+        case SC_EQ: case SC_NE: case SC_LT: case SC_LE: case SC_GT: case SC_GE: {
+            sc_val_t *l = &st[sp - 2], *r = &st[sp - 1];
+            long long x, y;
+            int d;
+            /* numerically when both sides are integers */
+            if (sc_num(l, &x, 1) && sc_num(r, &y, 1)) d = (x > y) - (x < y);
+            else {
+                t = sc_text(l, tmp, &len);
+                t2 = sc_text(r, tmp2, &len2);
+                d = memcmp(t, t2, len < len2 ? len : len2);
+                if (d == 0) d = (len > len2) - (len < len2);
+            }
+            int z = in->op == SC_EQ ? d == 0 : in->op == SC_NE ? d != 0 : in->op == SC_LT ? d < 0
+                  : in->op == SC_LE ? d <= 0 : in->op == SC_GT ? d > 0 : d >= 0;
+            sc_free(l);
+            sc_free(r);
+            sp--;
+            *l = (sc_val_t){ SC_INT, z, NULL, 0 };
+            break;
+        }
+        case SC_FORCMP: {
+            long long v, lim, step;
+            if (!sc_num(&st[sp - 3], &v, 0) || !sc_num(&st[sp - 2], &lim, 0) || !sc_num(&st[sp - 1], &step, 0))
+                SC_FAIL("for: bounds must be numbers");
+            for (int i = sp - 3; i < sp; ++i) sc_free(&st[i]);
+            sp -= 2;
+            st[sp - 1] = (sc_val_t){ SC_INT, step >= 0 ? v <= lim : v >= lim, NULL, 0 };
+            break;
+        }
+        case SC_JMP:
+            pc = in->a;
+            break;
+        case SC_JZ:
+            if (!sc_truthy(&st[--sp])) pc = in->a;
+            sc_free(&st[sp]);
+            break;
+        case SC_AND:
+        case SC_OR:
+            if (sc_truthy(&st[sp - 1]) == (in->op == SC_OR)) pc = in->a;
+            else sc_free(&st[--sp]);
+            break;
+        case SC_FORIN: {
+            sc_val_t *list = SC_SLOT(in->b), *pos = SC_SLOT(sc_slot_next(in->b)), w;
+            t = sc_text(list, tmp, &len);
+            size_t i = (size_t)pos->i;
+            while (i < len && isspace((unsigned char)t[i])) i++;
+            if (i >= len) { pc = in->a; break; }
+            size_t e = i;
+            while (e < len && !isspace((unsigned char)t[e])) e++;
+            if (!sc_dup(&w, t + i, e - i)) SC_FAIL("out of memory");
+            sc_val_t* v = SC_SLOT(in->c);
+            sc_free(v);
+            *v = w;
+            pos->i = (long long)e;
+            break;
+        }
+        case SC_CALL:
+            fn = in->a;
+            argc = in->b;
+            discard = 0;
+        call: {
+            const sc_func_t* f = &p->funcs[fn];
+            if (vm->nframes == SC_MAX_CALLS) SC_FAIL("calls nested too deeply");
+            if (sp + f->nlocals >= SC_STACK) SC_FAIL("stack overflow");
+            fr = &vm->frames[vm->nframes++];
+            *fr = (sc_frame_t){ fn, pc, sp - argc, argc, sp, discard };
+            for (int i = 0; i < f->nlocals; ++i) st[sp++] = (sc_val_t){ SC_REF, 0, (char*)"", 0 };
+            pc = f->entry;
+            break;
+        }
+        case SC_RET: {
+            sc_val_t v = st[--sp];
+            while (sp > fr->base) sc_free(&st[--sp]);
+            pc = fr->ret;
+            discard = fr->discard;
+            fr = &vm->frames[--vm->nframes - 1];
+            if (discard) sc_free(&v);
+            else st[sp++] = v;
+            break;
+        }
+        case SC_CALLCMD:
+        case SC_DYNCMD: {
+            sc_val_t v = st[--sp];
+            t = sc_text(&v, tmp, &len);
+            if (in->op == SC_CALLCMD) {
+                fn = in->a;
+            } else {
+                const char* w = t + strspn(t, " \t");
+                size_t n = strcspn(w, " \t\n");
+                char word[SC_NAME];
+                fn = sc_func(p, w, n);
+                if (fn < 0) {
+                    int b = -1;
+                    if (n < sizeof(word)) {
+                        memcpy(word, w, n);
+                        word[n] = '\0';
+                        b = sc_builtin(word);
+                    }
+                    if (b >= 0) {
+                        stat_command_at(stat_command_index(word));
+                        sc_call_builtin(b, w + n);
+                    } else shell_run_line(t);
+                    sc_free(&v);
+                    break;
+                }
+                t = w + n;
+            }
+            argc = sc_push_words(st, &sp, t);
+            sc_free(&v);
+            if (argc < 0) SC_FAIL("stack overflow");
+            discard = 1;
+            goto call;
+        }
+        case SC_BUILTIN: {
+            sc_val_t v = st[--sp];
+            stat_command_at(in->b);
+            sc_call_builtin(in->a, sc_text(&v, tmp, &len));
+            sc_free(&v);
+            break;
+        }
+        case SC_SHELL: {
+            sc_val_t v = st[--sp];
+            shell_run_line(sc_text(&v, tmp, &len));
+            sc_free(&v);
+            break;
+        }
+        case SC_CAPTURE: {
+            if (vm->ncap == SC_MAX_CAPTURE) SC_FAIL("$( ) nested too deeply");
+            sc_capture_t* c = &vm->cap[vm->ncap++];
+            memset(c, 0, sizeof(*c));
+            sb_append(&c->sb, "", 0);
+            c->io.capture = &c->sb;
+            c->outer = sh_io;
+            sh_io = &c->io;
+            break;
+        }
+        case SC_CAPTURED: {
+            sc_capture_t* c = &vm->cap[--vm->ncap];
+            sh_io = c->outer;
+            while (c->sb.len && (c->sb.data[c->sb.len - 1] == '\n' || c->sb.data[c->sb.len - 1] == '\r')) c->sb.len--;
+            if (!c->sb.data) SC_FAIL("out of memory");
+            c->sb.data[c->sb.len] = '\0';
+            if (sp == SC_STACK) { sb_free(&c->sb); SC_FAIL("stack overflow"); }
+            st[sp++] = (sc_val_t){ SC_OWN, 0, c->sb.data, c->sb.len };
+            break;
+        }
+        }
+    }
+#undef SC_FAIL
+#undef SC_SLOT
+#undef SC_PUSHV
+fail:
+    while (vm->ncap) {
+        sc_capture_t* c = &vm->cap[--vm->ncap];
+        sh_io = c->outer;
+        sb_free(&c->sb);
+    }
+    sh_printf("script: %s:%d: %s\n", vm->name, p->lines[pc - 1], vm->err);
+done:
+    while (sp > 0) sc_free(&st[--sp]);
+    STAT_ADD(ST_SCRIPT_OPS, ops);
+    return vm->err[0] ? -1 : 0;
+}
+
+#ifndef _WIN32
+#define SC_LOCK() pthread_mutex_lock(&sos_cur->scripts.mtx)
+#define SC_UNLOCK() pthread_mutex_unlock(&sos_cur->scripts.mtx)
+#else
+#define SC_LOCK() ((void)0)
+#define SC_UNLOCK() ((void)0)
+#endif
+
+/* the compiled program for a file's current content, from the cache when
+   it has not changed; NULL with err set */
+static sc_prog_t* sc_load(const char* name, char* err, size_t errlen) {
+    size_t size = 0;
+    vblob_t* b = vfs_pin_blob(name, &size);
+    if (!b) { snprintf(err, errlen, "File not found: %s", name); return NULL; }
+    unsigned long long id = __atomic_load_n(&b->id, __ATOMIC_RELAXED);
+    sc_cache_t* sc = &sos_cur->scripts;
+    sc_prog_t* p = NULL;
+    SC_LOCK();
+    for (int i = 0; i < SC_CACHE && !p; ++i) {
+        sc_cached_t* e = &sc->e[i];
+        if (e->prog && e->id == id && e->size == size && strcmp(e->name, name) == 0) {
+            p = e->prog;
+            __atomic_add_fetch(&p->refs, 1, __ATOMIC_RELAXED);
+            e->used = ++sc->clock;
+        }
+    }
+    SC_UNLOCK();
+    if (p) {
+        blob_unref(b);
+        STAT_INC(ST_SCRIPT_CACHE_HITS);
+        return p;
+    }
+    p = sc_compile(name, b->data, size, err, errlen);
+    blob_unref(b);
+    if (!p) return NULL;
+    STAT_INC(ST_SCRIPT_COMPILES);
+    /* replaces the file's older version, else the least recently used */
+    SC_LOCK();
+    sc_cached_t* victim = &sc->e[0];
+    for (int i = 0; i < SC_CACHE; ++i) {
+        sc_cached_t* e = &sc->e[i];
+        if (e->prog && strcmp(e->name, name) == 0) { victim = e; break; }
+        if (!e->prog ? victim->prog != NULL : victim->prog && e->used < victim->used) victim = e;
+    }
+    sc_prog_t* old = victim->prog;
+    snprintf(victim->name, sizeof(victim->name), "%s", name);
+    victim->id = id;
+    victim->size = size;
+    victim->prog = p;
+    victim->used = ++sc->clock;
+    __atomic_add_fetch(&p->refs, 1, __ATOMIC_RELAXED);
+    SC_UNLOCK();
+    sc_prog_release(old);
+    return p;
+}
+
+/* script <file> [args] | script -c <file> */
+static void cmd_script(const char* file, const char* args) {
+    char err[200], name[MAX_NAME] = {0};
+    int check = strcmp(file, "-c") == 0;
+    if (check) sscanf(args, "%95s", name);
+    else snprintf(name, sizeof(name), "%s", file);
+    if (!name[0]) { sh_printf("Usage: script <file> [args...] | script -c <file>\n"); return; }
+    if (sc_depth >= SC_MAX_NESTED) { sh_printf("script: scripts nested too deeply\n"); return; }
+    sc_prog_t* p = sc_load(name, err, sizeof(err));
+    if (!p) { sh_printf("%s\n", err); return; }
+    if (check) {
+        sh_printf("%s: %d instructions, %d functions, %d variables\n", name, p->ncode, p->nfuncs, p->nglobals);
+        sc_prog_release(p);
+        return;
+    }
+    sc_vm_t* vm = calloc(1, sizeof(*vm));
+    sc_val_t* stack = vm ? malloc(SC_STACK * sizeof(sc_val_t)) : NULL;
+    sc_val_t* globals = stack ? malloc(((size_t)p->nglobals + 1) * sizeof(sc_val_t)) : NULL;
+    if (globals) {
+        vm->p = p;
+        vm->name = name;
+        vm->stack = stack;
+        vm->globals = globals;
+        for (int i = 0; i < p->nglobals; ++i) globals[i] = (sc_val_t){ SC_REF, 0, (char*)"", 0 };
+        int sp = 0, argc = sc_push_words(stack, &sp, args);
+        vm->frames[0] = (sc_frame_t){ -1, 0, 0, argc < 0 ? sp : argc, sp, 0 };
+        vm->nframes = 1;
+        STAT_INC(ST_SCRIPT_RUNS);
+        sc_depth++;
+        sc_run(vm);
+        sc_depth--;
+        for (int i = 0; i < p->nglobals; ++i) sc_free(&globals[i]);
+    } else sh_printf("script: out of memory\n");
+    free(globals);
+    free(stack);
+    free(vm);
+    sc_prog_release(p);
+}
+
+static const char* trim_args(const char* line, const char* cmd) {
+    const char* p = strstr(line, cmd);
+    p = p ? p + strlen(cmd) : line;
+    return p + strspn(p, " \t");
+}
+
+/* runs a single command; output goes wherever sh_io points */
+static void shell_dispatch(const char* line) {
+    if (!line) return;
+    char cmd[128] = {0};
+    char a1[512] = {0};
+    char a2[1536] = {0};
+    sscanf(line, "%127s %511s %1535[^\n]", cmd, a1, a2);
+    if (cmd[0] != '\0' && cmd[0] != '!') stat_command(cmd);
+    if (strcmp(cmd, "help") == 0) show_help();
+    else if (strcmp(cmd, "ls") == 0) vfs_list(trim_args(line, "ls"));
+    else if (strcmp(cmd, "stat") == 0) cmd_stat(a1);
+    else if (strcmp(cmd, "cat") == 0) cmd_cat(a1);
+    else if (strcmp(cmd, "grep") == 0) cmd_grep(a1, a2);
+    else if (strcmp(cmd, "wc") == 0) cmd_wc(a1);
+    else if (strcmp(cmd, "head") == 0) cmd_head_tail(0, a1, a2);
+    else if (strcmp(cmd, "tail") == 0) cmd_head_tail(1, a1, a2);
+    else if (strcmp(cmd, "sort") == 0) cmd_sort(a1);
+    else if (strcmp(cmd, "uniq") == 0) cmd_uniq(a1);
+    else if (strcmp(cmd, "tee") == 0) cmd_tee(a1);
+    else if (strcmp(cmd, "write") == 0) cmd_write(a1, a2);
+    else if (strcmp(cmd, "append") == 0) cmd_append(a1, a2);
+    else if (strcmp(cmd, "patch") == 0) cmd_patch(a1, a2);
+    else if (strcmp(cmd, "truncate") == 0) cmd_truncate(a1, a2);
+    else if (strcmp(cmd, "touch") == 0) cmd_touch(a1);
+    else if (strcmp(cmd, "rm") == 0) cmd_rm(a1);
+    else if (strcmp(cmd, "spawn") == 0) {
+        if (strcmp(a1, "clock")==0) { int id = spawn_builtin("clock", task_clock_builtin); if (id) sh_printf("Spawned clock (id=%d)\n", id); else sh_printf("Failed to spawn\n"); }
+        else if (strcmp(a1, "heartbeat")==0) { int id = spawn_builtin("heartbeat", task_heartbeat_builtin); if (id) sh_printf("Spawned heartbeat (id=%d)\n", id); else sh_printf("Failed to spawn\n"); }
+        else if (strcmp(a1, "logger")==0) { int id = spawn_builtin("logger", task_logger_builtin); if (id) sh_printf("Spawned logger (id=%d)\n", id); else sh_printf("Failed to spawn\n"); }
+        else sh_printf("Unknown builtin: %s\n", a1);
+    }
+    else if (strcmp(cmd, "addtask") == 0) {
+        char name[MAX_NAME] = {0}; unsigned interval = 1; char msg[MAX_MSG] = {0};
+        if (sscanf(line, "%*s %63s %u %511[^\n]", name, &interval, msg) >= 2) {
+            if (name[0] == '\0' || msg[0] == '\0') sh_printf("Usage: addtask <name> <interval> <message>\n");
+            else { int id = spawn_message_task(name, interval, msg); if (id) sh_printf("Added message task '%s' id=%d interval=%u\n", name, id, interval); else sh_printf("Task limit reached.\n"); }
+        } else sh_printf("Usage: addtask <name> <interval> <message>\n");
+    }
+    else if (strcmp(cmd, "ps") == 0) show_ps();
+    else if (strcmp(cmd, "lsof") == 0) show_lsof();
+    else if (strcmp(cmd, "watch") == 0) cmd_watch(a1, a2);
+    else if (strcmp(cmd, "killtask") == 0) { int id = atoi(a1); if (id<=0) sh_printf("Usage: killtask <id>\n"); else kill_task(id); }
+    else if (strcmp(cmd, "suspend") == 0) { int id = atoi(a1); if (id<=0) sh_printf("Usage: suspend <id>\n"); else suspend_task(id); }
+    else if (strcmp(cmd, "resume") == 0) { int id = atoi(a1); if (id<=0) sh_printf("Usage: resume <id>\n"); else resume_task(id); }
+    else if (strcmp(cmd, "uptime")==0) show_uptime();
+    else if (strcmp(cmd, "poweroff")==0) { sh_printf("Shutting down Shreyas OS...\n"); vfs_save_state(); sos_cur->running = SOS_HALTED; }
+    else if (strcmp(cmd, "reboot")==0) { sh_printf("Rebooting Shreyas OS...\n"); vfs_save_state(); /* the front end re-runs its boot sequence */ sos_cur->running = SOS_REBOOT; }
+    else if (strcmp(cmd, "powerbtn")==0) power_button_ui();
+    else if (strcmp(cmd, "clear")==0) clear_screen();
+    else if (strcmp(cmd, "echo")==0) cmd_echo(a1, a2);
+    else if (strcmp(cmd, "version")==0) sh_printf("Shreyas OS Enhanced v2.0 - Stark Kernel CLI\n");
+    else if (strcmp(cmd, "edit")==0) cmd_edit(a1);
+    else if (strcmp(cmd, "compile")==0) compile_file(a1, a2);
+    else if (strcmp(cmd, "buildcache")==0) cmd_buildcache(a1);
+    else if (strcmp(cmd, "build")==0) cmd_build(line + strspn(line, " \t") + 5);
+    else if (strcmp(cmd, "run")==0) { if (a1[0]=='\0') run_command(a2); else { char cmdbuf[2048]; if (a2[0] != '\0') snprintf(cmdbuf, sizeof(cmdbuf), "%s %s", a1, a2); else snprintf(cmdbuf, sizeof(cmdbuf), "%s", a1); run_command(cmdbuf); } }
+    else if (strcmp(cmd, "jobs")==0) cmd_jobs();
+    else if (strcmp(cmd, "wait")==0) cmd_wait(a1);
+    else if (strcmp(cmd, "ip")==0) show_ips();
+    else if (strcmp(cmd, "export")==0) { if (a1[0] && a2[0]) export_to_disk(a1,a2); else sh_printf("Usage: export <file_on_disk> <vfs_file>\n"); }
+    else if (strcmp(cmd, "import")==0) { if (a1[0] && a2[0]) import_from_disk(a1,a2); else sh_printf("Usage: import <vfs_file> <file_on_disk>\n"); }
+    else if (strcmp(cmd, "date")==0) cmd_date();
+    else if (strcmp(cmd, "cal")==0) {
+        int m = 0, y = 0;
+        if (a1[0]=='\0') { time_t t = sos_now(); struct tm tm = *localtime(&t); m = tm.tm_mon+1; y = tm.tm_year+1900; }
+        else if (sscanf(a1, "%d", &m)==1) { if (a2[0]=='\0') { time_t t = sos_now(); struct tm tm = *localtime(&t); y = tm.tm_year+1900; } else sscanf(a2, "%d", &y); }
+        cmd_cal(y, m);
+    }
+    else if (strcmp(cmd, "sysinfo")==0) cmd_sysinfo();
+    else if (strcmp(cmd, "vmstat")==0) cmd_vmstat(a1);
+    else if (strcmp(cmd, "vfs_budget")==0) cmd_vfs_budget(a1);
+    else if (strcmp(cmd, "bgsave")==0) cmd_bgsave();
+    else if (strcmp(cmd, "autosave")==0) cmd_autosave(a1);
+    else if (strcmp(cmd, "script")==0) cmd_script(a1, a2);
+    else if (strcmp(cmd, "begin")==0) cmd_begin();
+    else if (strcmp(cmd, "commit")==0) cmd_end_tx(1);
+    else if (strcmp(cmd, "abort")==0) cmd_end_tx(0);
+    else if (strcmp(cmd, "whoami")==0) cmd_whoami();
+    else if (strcmp(cmd, "hostname")==0) cmd_hostname();
+    else if (strcmp(cmd, "stats")==0) cmd_stats(a1);
+    else if (strcmp(cmd, "history")==0) show_history(strstr(line, "history") + 7);
+    else if (cmd[0] == '!') {
+        char tmp[2048];
+        strncpy(tmp, line + strspn(line, " \t"), sizeof(tmp)-1);
+        tmp[sizeof(tmp)-1] = '\0';
+        if (history_expand(tmp, sizeof(tmp)) && tmp[0] != '!') {
+            sh_printf("Repeating: %s\n", tmp);
+            shell_run_line(tmp);
+        }
+    }
+    else if (strcmp(cmd, "man")==0) cmd_man(a1);
+    else if (strcmp(cmd, "")==0) { /* ignore */ }
+    else if (sos_cur->hook && sos_cur->hook(sos_cur, cmd, trim_args(line, cmd), sos_cur->hook_user)) { /* front end command */ }
+    else sh_printf("Unknown command: %s. Try 'help'.\n", cmd);
+}
+
+/* Pipelines: "cmd1 | cmd2 | ... [> file | >> file]". Every stage is a full
+   command line on its own thread; stages are connected by shpipe_t buffers
+   and the redirection target is filled from memory, so nothing touches the
+   host disk. '|' and '>' inside double quotes are literal. */
+typedef struct {
+    const char* text;
+    sos_ctx_t* ctx;
+    const char* user;
+    sos_tx_t* tx;
+    int depth;                  /* sc_depth of the line running the pipeline */
+    sh_io_t io;
+    int close_in, close_out;    /* pipes owned by this pipeline */
+#ifndef _WIN32
+    pthread_t th;
+    int started;
+#endif
+} sh_stage_t;
+
+static void* sh_stage_main(void* arg) {
+    sh_stage_t* st = (sh_stage_t*)arg;
+    sos_cur = st->ctx;
+    sh_user = st->user;
+    tx_cur = st->tx;
+    sc_depth = st->depth;
+    sh_io = &st->io;
+    shell_dispatch(st->text);
+    sh_io = NULL;
+    if (st->close_out) shpipe_close_write(st->io.out);
+    if (st->close_in) shpipe_close_read(st->io.in);
+    return NULL;
+}
+
+static char* trim_ws(char* s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t n = strlen(s);
+    while (n > 0 && isspace((unsigned char)s[n-1])) s[--n] = '\0';
+    return s;
+}
+
+/* returns 0 if the line has no unquoted '|' or '>' and is a plain command */
+static int shell_run_pipeline(const char* line) {
+    char buf[2048];
+    strncpy(buf, line, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+    char* text[SH_MAX_STAGES];
+    int nstages = 1, append = 0, inq = 0;
+    char* redir = NULL;
+    text[0] = buf;
+    for (char* p = buf; *p; ++p) {
+        if (*p == '"') inq = !inq;
+        else if (inq) continue;
+        else if (*p == '|' || *p == '>') {
+            if (redir) { sh_printf("Syntax error: redirection must be last\n"); return 1; }
+            if (*p == '|') {
+                if (nstages == SH_MAX_STAGES) { sh_printf("Too many pipeline stages (max %d)\n", SH_MAX_STAGES); return 1; }
+                *p = '\0';
+                text[nstages++] = p + 1;
+            } else {
+                *p = '\0';
+                if (p[1] == '>') { append = 1; ++p; }
+                redir = p + 1;
+            }
+        }
+    }
+    if (nstages == 1 && !redir) return 0;
+
+    char target[MAX_NAME] = {0};
+    if (redir && sscanf(redir, "%95s", target) != 1) { sh_printf("Syntax error: missing file after '>'\n"); return 1; }
+    for (int i = 0; i < nstages; ++i) {
+        text[i] = trim_ws(text[i]);
+        if (text[i][0] == '\0') { sh_printf("Syntax error near '|'\n"); return 1; }
+    }
+
+    sh_io_t* outer = sh_io;
+    sh_stage_t st[SH_MAX_STAGES];
+    shpipe_t pipes[SH_MAX_STAGES];
+    strbuf_t capture = {0};
+    int npipes = 0;
+    memset(st, 0, sizeof(st));
+    for (; npipes < nstages - 1; ++npipes) {
+        if (!shpipe_init(&pipes[npipes])) { sh_printf("Out of memory for pipeline\n"); goto done; }
+    }
+    sb_append(&capture, "", 0);
+    for (int i = 0; i < nstages; ++i) {
+        st[i].text = text[i];
+        st[i].ctx = sos_cur;
+        st[i].user = sh_user;
+        st[i].tx = tx_cur;
+        st[i].depth = sc_depth;
+        if (i > 0) { st[i].io.in = &pipes[i-1]; st[i].close_in = 1; }
+        else st[i].io.in = outer ? outer->in : NULL;
+        if (i < nstages - 1) { st[i].io.out = &pipes[i]; st[i].close_out = 1; }
+        else if (redir) st[i].io.capture = &capture;
+        else if (outer) { st[i].io.out = outer->out; st[i].io.capture = outer->capture; }
+    }
+
+    if (nstages == 1) {
+        sh_stage_main(&st[0]);
+        sh_io = outer;
+    } else {
+#ifndef _WIN32
+        for (int i = 0; i < nstages; ++i) {
+            st[i].started = pthread_create(&st[i].th, NULL, sh_stage_main, &st[i]) == 0;
+            if (!st[i].started) {
+                sh_printf("Failed to start pipeline stage: %s\n", st[i].text);
+                if (st[i].close_out) shpipe_close_write(st[i].io.out);
+                if (st[i].close_in) shpipe_close_read(st[i].io.in);
+            }
+        }
+        for (int i = 0; i < nstages; ++i) if (st[i].started) pthread_join(st[i].th, NULL);
+#else
+        for (int i = 0; i < nstages; ++i) sh_stage_main(&st[i]);
+        sh_io = outer;
+#endif
+    }
+
+    /* a nested pipeline writing to its stage's pipe stops that stage too */
+    if (outer && st[nstages-1].io.broken) outer->broken = 1;
+    if (redir) {
+        if (append) vfs_append_bytes(target, capture.data, capture.len);
+        else vfs_write_bytes(target, capture.data, capture.len);
+    }
+done:
+    for (int i = 0; i < npipes; ++i) shpipe_destroy(&pipes[i]);
+    sb_free(&capture);
+    return 1;
+}
+
+static void shell_run_line(const char* line) {
+    if (!line) return;
+    /* a watch's reaction runs for nobody's transaction */
+    sos_tx_t* outer = tx_cur;
+    sos_tx_t* tx = watch_running ? NULL : tx_shell();
+    tx_cur = tx;
+    if (!shell_run_pipeline(line)) shell_dispatch(line);
+    tx_cur = outer;
+    tx_release(tx);     /* after every stage has joined */
+}
+
+static void shell_execute(const char* line) {
+    shell_run_line(line);
+    scheduler_tick_wrapper();
+}
+
+/* tiny hostname detection */
+static void detect_hostname() {
+#ifdef _WIN32
+    char name[128];
+    if (gethostname(name, sizeof(name)) == 0) strncpy(sos_cur->env_HOSTNAME, name, sizeof(sos_cur->env_HOSTNAME)-1);
+#else
+    struct utsname un;
+    if (uname(&un) == 0) strncpy(sos_cur->env_HOSTNAME, un.nodename, sizeof(sos_cur->env_HOSTNAME)-1);
+#endif
+}
+
+/* C API (sos.h). Every entry point makes its context current for the
+   duration of the call and restores the previous one on the way out. */
+#define SOS_ENTER(ctx) sos_ctx_t* sos_prev_ = sos_cur; sos_cur = (ctx)
+#define SOS_LEAVE() (sos_cur = sos_prev_)
+
+static int sos_name_ok(const char* name) {
+    return name && name[0] != '\0' && strlen(name) < MAX_NAME;
+}
+
+sos_ctx_t* sos_create(const char* state_path) {
+    sos_ctx_t* ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) return NULL;
+#ifndef _WIN32
+    pthread_mutex_init(&ctx->vfs_mtx, NULL);
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ctx->tasks_mtx, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+    vfd_table_init(&ctx->fds);
+#ifndef _WIN32
+    pthread_mutex_init(&ctx->watches.mtx, NULL);
+    if (pipe_cloexec(ctx->watches.wake) == 0) {
+        fcntl(ctx->watches.wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(ctx->watches.wake[1], F_SETFL, O_NONBLOCK);
+    } else ctx->watches.wake[0] = ctx->watches.wake[1] = -1;
+    pthread_mutex_init(&ctx->tier.io_mtx, NULL);
+    pthread_mutex_init(&ctx->tier.sweep_mtx, NULL);
+    pthread_mutex_init(&ctx->bgsave.mtx, NULL);
+    pthread_mutex_init(&ctx->scripts.mtx, NULL);
+#endif
+    ctx->bgsave.last_try = now_us();
+    ctx->next_task_id = 1;
+    ctx->names.rng = 0x9e3779b9u;
+    ctx->running = SOS_RUNNING;
+    ctx->start_time = time(NULL);
+    strcpy(ctx->env_USER, "Tony");
+    strcpy(ctx->env_HOSTNAME, "ShreyasOS");
+    if (state_path) snprintf(ctx->state_path, sizeof(ctx->state_path), "%s", state_path);
+    SOS_ENTER(ctx);
+    vfs_init();
+    SOS_LEAVE();
+    return ctx;
+}
+
+void sos_destroy(sos_ctx_t* ctx) {
+    if (!ctx) return;
+    SOS_ENTER(ctx);
+    BGSAVE_LOCK();
+    bgsave_reap_locked(1);
+    BGSAVE_UNLOCK();
+    for (int i = 0; i < MAX_TASKS; ++i) if (ctx->tasks[i].id) task_kill(&ctx->tasks[i]);
+    vfd_close_all(&ctx->fds);
+    for (int i = 0; i < FS_MAX_FILES; ++i) if (ctx->vfs[i]) vfile_free(ctx->vfs[i]);
+    tx_release(ctx->shell_tx);
+    for (int i = 0; i < SC_CACHE; ++i) sc_prog_release(ctx->scripts.e[i].prog);
+    SOS_LEAVE();
+    if (sos_cur == ctx) sos_cur = NULL;
+    if (ctx->tier.store) fclose(ctx->tier.store);
+    free(ctx->tier.holes);
+#ifndef _WIN32
+    pthread_mutex_destroy(&ctx->fds.mtx);
+    pthread_mutex_destroy(&ctx->watches.mtx);
+    if (ctx->watches.wake[0] >= 0) { close(ctx->watches.wake[0]); close(ctx->watches.wake[1]); }
+    pthread_mutex_destroy(&ctx->tier.io_mtx);
+    pthread_mutex_destroy(&ctx->tier.sweep_mtx);
+    pthread_mutex_destroy(&ctx->bgsave.mtx);
+    pthread_mutex_destroy(&ctx->scripts.mtx);
+    pthread_mutex_destroy(&ctx->vfs_mtx);
+    pthread_mutex_destroy(&ctx->tasks_mtx);
+#endif
+    free(ctx);
+}
+
+int sos_vfs_write(sos_ctx_t* ctx, const char* name, const void* data, size_t len) {
+    if (!ctx || !sos_name_ok(name) || (!data && len)) return -1;
+    SOS_ENTER(ctx);
+    int ok = vfs_write_raw(name, data ? (const char*)data : "", len);
+    SOS_LEAVE();
+    return ok ? 0 : -1;
+}
+
+int sos_vfs_append(sos_ctx_t* ctx, const char* name, const void* data, size_t len) {
+    if (!ctx || !sos_name_ok(name) || (!data && len)) return -1;
+    SOS_ENTER(ctx);
+    int ok = vfs_append_raw(name, (const char*)data, len);
+    SOS_LEAVE();
+    return ok ? 0 : -1;
+}
+
+int sos_vfs_read(sos_ctx_t* ctx, const char* name, char** data, size_t* len) {
+    if (!ctx || !name || !data) return -1;
+    strbuf_t sb = {0};
+    SOS_ENTER(ctx);
+    int found = vfs_read_copy(name, &sb);
+    SOS_LEAVE();
+    if (!found) return -1;
+    sb_append(&sb, "", 0);
+    if (!sb.data) return -1;
+    *data = sb.data;
+    if (len) *len = sb.len;
+    return 0;
+}
+
+int sos_vfs_pread(sos_ctx_t* ctx, const char* name, size_t offset, size_t len, char** data, size_t* got) {
+    if (!ctx || !name || !data) return -1;
+    strbuf_t sb = {0};
+    SOS_ENTER(ctx);
+    int found = vfs_pread(name, offset, len, &sb);
+    SOS_LEAVE();
+    if (!found) return -1;
+    sb_append(&sb, "", 0);
+    if (!sb.data) return -1;
+    *data = sb.data;
+    if (got) *got = sb.len;
+    return 0;
+}
+
+int sos_vfs_pwrite(sos_ctx_t* ctx, const char* name, size_t offset, const void* data, size_t len) {
+    if (!ctx || !sos_name_ok(name) || (!data && len)) return -1;
+    SOS_ENTER(ctx);
+    int ok = vfs_pwrite_raw(name, offset, (const char*)data, len);
+    SOS_LEAVE();
+    return ok ? 0 : -1;
+}
+
+int sos_vfs_truncate(sos_ctx_t* ctx, const char* name, size_t size) {
+    if (!ctx || !name) return -1;
+    SOS_ENTER(ctx);
+    int ok = vfs_truncate_raw(name, size);
+    SOS_LEAVE();
+    return ok ? 0 : -1;
+}
+
+int sos_fd_open(sos_ctx_t* ctx, const char* name, int flags) {
+    if (!ctx || !sos_name_ok(name)) return -1;
+    SOS_ENTER(ctx);
+    int fd = vfd_open(name, flags);
+    SOS_LEAVE();
+    return fd;
+}
+
+long long sos_fd_read(sos_ctx_t* ctx, int fd, void* buf, size_t len) {
+    if (!ctx || (!buf && len)) return -1;
+    SOS_ENTER(ctx);
+    long long n = vfd_read(fd, buf, len);
+    SOS_LEAVE();
+    return n;
+}
+
+long long sos_fd_write(sos_ctx_t* ctx, int fd, const void* buf, size_t len) {
+    if (!ctx || (!buf && len)) return -1;
+    SOS_ENTER(ctx);
+    long long n = vfd_write(fd, buf, len);
+    SOS_LEAVE();
+    return n;
+}
+
+long long sos_fd_seek(sos_ctx_t* ctx, int fd, long long offset, int whence) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    long long pos = vfd_seek(fd, offset, whence);
+    SOS_LEAVE();
+    return pos;
+}
+
+int sos_fd_close(sos_ctx_t* ctx, int fd) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    int rc = vfd_close(fd);
+    SOS_LEAVE();
+    return rc;
+}
+
+int sos_vfs_pin(sos_ctx_t* ctx, const char* name, const char** data, size_t* len,
+                unsigned long long* version, void** pin) {
+    if (!ctx || !name || !data || !len || !pin) return -1;
+    vblob_t* b = NULL;
+    size_t n = 0;
+    SOS_ENTER(ctx);
+    if (vfs_readonly(name)) {
+        /* generated content gets a private blob that dies with the pin */
+        strbuf_t sb = {0};
+        stats_render(&sb, 0);
+        if ((b = blob_new(sb.len)) != NULL) {
+            memcpy(b->data, sb.data, sb.len);
+            b->data[sb.len] = '\0';
+            b->size = n = sb.len;
+        }
+        sb_free(&sb);
+    } else b = vfs_pin_blob(name, &n);
+    SOS_LEAVE();
+    if (!b) return -1;
+    STAT_INC(ST_VFS_READS);
+    STAT_ADD(ST_VFS_BYTES_READ, n);
+    *data = b->data;
+    *len = n;
+    if (version) *version = b->id;
+    *pin = b;
+    return 0;
+}
+
+void sos_vfs_unpin(void* pin) {
+    if (pin) blob_unref(pin);
+}
+
+int sos_vfs_remove(sos_ctx_t* ctx, const char* name) {
+    if (!ctx || !name) return -1;
+    SOS_ENTER(ctx);
+    int found = vfs_remove(name);
+    SOS_LEAVE();
+    return found ? 0 : -1;
+}
+
+int sos_vfs_list(sos_ctx_t* ctx, void (*fn)(const char* name, size_t size, void* user), void* user) {
+    if (!ctx) return -1;
+    struct { char name[MAX_NAME]; size_t size; } *items = malloc(FS_MAX_FILES * sizeof(*items));
+    if (!items) return -1;
+    int n = 0;
+    SOS_ENTER(ctx);
+    VFS_LOCK();
+    for (vfile_t* f = ctx->names.head[0]; f && n < FS_MAX_FILES; f = f->next[0]) {
+        memcpy(items[n].name, f->name, MAX_NAME);
+        items[n++].size = vfile_size(f);
+    }
+    VFS_UNLOCK();
+    SOS_LEAVE();
+    /* callbacks run outside the read section so they may call back into the API */
+    if (fn) for (int i = 0; i < n; ++i) fn(items[i].name, items[i].size, user);
+    free(items);
+    return n;
+}
+
+int sos_vfs_save(sos_ctx_t* ctx) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    int rc = vfs_save_state();
+    SOS_LEAVE();
+    return rc;
+}
+
+int sos_vfs_reload(sos_ctx_t* ctx) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    vfs_init();
+    SOS_LEAVE();
+    return 0;
+}
+
+int sos_vfs_bgsave(sos_ctx_t* ctx) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    BGSAVE_LOCK();
+    bgsave_reap_locked(0);
+    int rc = ctx->bgsave.pid ? ctx->bgsave.pid : bgsave_start_locked(0);
+    BGSAVE_UNLOCK();
+    SOS_LEAVE();
+    return rc;
+}
+
+int sos_vfs_autosave(sos_ctx_t* ctx, unsigned seconds) {
+    if (!ctx) return -1;
+    __atomic_store_n(&ctx->bgsave.interval, seconds, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int sos_vfs_budget(sos_ctx_t* ctx, unsigned long long bytes) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    __atomic_store_n(&ctx->tier.budget, (size_t)bytes, __ATOMIC_RELAXED);
+    tier_balance();
+    SOS_LEAVE();
+    return 0;
+}
+
+sos_tx_t* sos_tx_begin(sos_ctx_t* ctx) {
+    if (!ctx) return NULL;
+    SOS_ENTER(ctx);
+    sos_tx_t* tx = tx_new(NULL);
+    SOS_LEAVE();
+    return tx;
+}
+
+/* runs one vfs call with tx as the calling thread's transaction */
+#define SOS_TX_ENTER(tx) SOS_ENTER((tx)->ctx); sos_tx_t* tx_outer_ = tx_cur; tx_cur = (tx)
+#define SOS_TX_LEAVE() tx_cur = tx_outer_; SOS_LEAVE()
+
+int sos_tx_write(sos_tx_t* tx, const char* name, const void* data, size_t len) {
+    if (!tx || !sos_name_ok(name) || (!data && len)) return -1;
+    SOS_TX_ENTER(tx);
+    int ok = vfs_write_raw(name, data ? (const char*)data : "", len);
+    SOS_TX_LEAVE();
+    return ok ? 0 : -1;
+}
+
+int sos_tx_append(sos_tx_t* tx, const char* name, const void* data, size_t len) {
+    if (!tx || !sos_name_ok(name) || (!data && len)) return -1;
+    SOS_TX_ENTER(tx);
+    int ok = vfs_append_raw(name, (const char*)data, len);
+    SOS_TX_LEAVE();
+    return ok ? 0 : -1;
+}
+
+int sos_tx_remove(sos_tx_t* tx, const char* name) {
+    if (!tx || !name) return -1;
+    SOS_TX_ENTER(tx);
+    int found = vfs_remove(name);
+    SOS_TX_LEAVE();
+    return found ? 0 : -1;
+}
+
+int sos_tx_read(sos_tx_t* tx, const char* name, char** data, size_t* len) {
+    if (!tx || !name || !data) return -1;
+    strbuf_t sb = {0};
+    SOS_TX_ENTER(tx);
+    int found = vfs_read_copy(name, &sb);
+    SOS_TX_LEAVE();
+    if (!found) return -1;
+    sb_append(&sb, "", 0);
+    if (!sb.data) return -1;
+    *data = sb.data;
+    if (len) *len = sb.len;
+    return 0;
+}
+
+int sos_tx_commit(sos_tx_t* tx) {
+    if (!tx) return -1;
+    char why[MAX_NAME];
+    SOS_ENTER(tx->ctx);
+    int rc = tx_commit(tx, why, sizeof(why));
+    SOS_LEAVE();
+    tx_free(tx);
+    return rc == 0 ? 0 : -1;
+}
+
+void sos_tx_abort(sos_tx_t* tx) {
+    if (!tx) return;
+    SOS_ENTER(tx->ctx);
+    STAT_INC(ST_TX_ABORTS);
+    SOS_LEAVE();
+    tx_free(tx);
+}
+
+int sos_task_spawn(sos_ctx_t* ctx, const char* name, unsigned interval, const char* message) {
+    if (!ctx || !name) return 0;
+    SOS_ENTER(ctx);
+    int id = spawn_message_task(name, interval, message);
+    SOS_LEAVE();
+    return id;
+}
+
+int sos_task_spawn_builtin(sos_ctx_t* ctx, const char* builtin) {
+    static const struct { const char* name; builtin_fn fn; } builtins[] = {
+        { "clock", task_clock_builtin },
+        { "heartbeat", task_heartbeat_builtin },
+        { "logger", task_logger_builtin },
+    };
+    if (!ctx || !builtin) return 0;
+    for (size_t i = 0; i < sizeof(builtins)/sizeof(builtins[0]); ++i) {
+        if (strcmp(builtin, builtins[i].name) != 0) continue;
+        SOS_ENTER(ctx);
+        int id = spawn_builtin(builtins[i].name, builtins[i].fn);
+        SOS_LEAVE();
+        return id;
+    }
+    return 0;
+}
+
+int sos_watch(sos_ctx_t* ctx, const char* pattern, const char* command) {
+    if (!ctx || !pattern || !pattern[0] || !command || !command[0]) return 0;
+    SOS_ENTER(ctx);
+    int id = spawn_watch(pattern, command);
+    SOS_LEAVE();
+    return id;
+}
+
+int sos_task_kill(sos_ctx_t* ctx, int id) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    int found = task_kill(task_find_by_id(id));
+    SOS_LEAVE();
+    return found ? 0 : -1;
+}
+
+void sos_tick(sos_ctx_t* ctx) {
+    if (!ctx) return;
+    SOS_ENTER(ctx);
+    scheduler_tick();
+    SOS_LEAVE();
+}
+
+int sos_watch_fd(sos_ctx_t* ctx) {
+#ifndef _WIN32
+    return ctx ? ctx->watches.wake[0] : -1;
+#else
+    (void)ctx;
+    return -1;
+#endif
+}
+
+int sos_stats(sos_ctx_t* ctx, int json, char** out, size_t* outlen) {
+    if (!ctx || !out) return -1;
+    strbuf_t sb = {0};
+    SOS_ENTER(ctx);
+    stats_render(&sb, json);
+    SOS_LEAVE();
+    sb_append(&sb, "", 0);
+    if (!sb.data) return -1;
+    *out = sb.data;
+    if (outlen) *outlen = sb.len;
+    return 0;
+}
+
+int sos_exec(sos_ctx_t* ctx, const char* line, char** out, size_t* outlen) {
+    return sos_exec_as(ctx, NULL, line, out, outlen);
+}
+
+int sos_exec_as(sos_ctx_t* ctx, const char* user, const char* line, char** out, size_t* outlen) {
+    if (!ctx || !line) return -1;
+    const char* outer_user = sh_user;
+    sh_io_t* outer = sh_io;
+    strbuf_t capture = {0};
+    sh_io_t io = { NULL, NULL, &capture, 0 };
+    if (out) {
+        sb_append(&capture, "", 0);
+        sh_io = &io;
+    }
+    sh_user = user;
+    if (sos_cur != ctx) __atomic_store_n(&ctx->interrupted, 0, __ATOMIC_RELAXED);
+    SOS_ENTER(ctx);
+    shell_execute(line);
+    SOS_LEAVE();
+    sh_io = outer;
+    sh_user = outer_user;
+    if (out) {
+        *out = capture.data;
+        if (outlen) *outlen = capture.len;
+    }
+    return 0;
+}
+
+int sos_printf(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = sh_vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+void sos_set_command_hook(sos_ctx_t* ctx, sos_command_fn fn, void* user) {
+    if (!ctx) return;
+    ctx->hook = fn;
+    ctx->hook_user = user;
+}
+
+void sos_set_mutation_hook(sos_ctx_t* ctx, sos_mutation_fn fn, void* user) {
+    if (!ctx) return;
+    /* user first, so a writer that sees the new hook also sees its argument */
+    __atomic_store_n(&ctx->mut_hook, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->mut_user, user, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->mut_hook, fn, __ATOMIC_RELEASE);
+}
+
+const char* sos_getenv(sos_ctx_t* ctx, const char* key) {
+    if (!ctx || !key) return NULL;
+    if (strcmp(key, "USER") == 0) return ctx->env_USER;
+    if (strcmp(key, "HOSTNAME") == 0) return ctx->env_HOSTNAME;
+    return NULL;
+}
+
+int sos_detect_hostname(sos_ctx_t* ctx) {
+    if (!ctx) return -1;
+    SOS_ENTER(ctx);
+    detect_hostname();
+    SOS_LEAVE();
+    return 0;
+}
+
+int sos_setenv(sos_ctx_t* ctx, const char* key, const char* value) {
+    if (!ctx || !key || !value) return -1;
+    if (strcmp(key, "USER") == 0) snprintf(ctx->env_USER, sizeof(ctx->env_USER), "%s", value);
+    else if (strcmp(key, "HOSTNAME") == 0) snprintf(ctx->env_HOSTNAME, sizeof(ctx->env_HOSTNAME), "%s", value);
+    else return -1;
+    return 0;
+}
+
+void sos_stats_command(const char* name) { if (name && name[0]) stat_command(name); }
+
+int sos_state(sos_ctx_t* ctx) { return ctx ? ctx->running : SOS_HALTED; }
+
+void sos_clock_set(sos_ctx_t* ctx, unsigned long long unix_us) {
+    if (!ctx) return;
+    SOS_ENTER(ctx);
+    /* uptime carries on across a switch between the wall and a virtual clock */
+    time_t before = sos_now();
+    int switched = (ctx->clock_us != 0) != (unix_us != 0);
+    __atomic_store_n(&ctx->clock_us, unix_us, __ATOMIC_RELAXED);
+    if (switched) ctx->start_time += sos_now() - before;
+    SOS_LEAVE();
+}
+
+long long sos_time(sos_ctx_t* ctx) {
+    if (!ctx) return (long long)time(NULL);
+    SOS_ENTER(ctx);
+    long long t = (long long)sos_now();
+    SOS_LEAVE();
+    return t;
+}
+
+void sos_set_state(sos_ctx_t* ctx, int state) { if (ctx) ctx->running = state; }
+
+void sos_interrupt(sos_ctx_t* ctx) { if (ctx) __atomic_store_n(&ctx->interrupted, 1, __ATOMIC_RELAXED); }
+
+void sos_history_add(const char* line) { save_history_line(line); }
+
+int sos_history_expand(char* line, size_t sz) { return history_expand(line, sz); }
+
+void sos_free(void* p) { free(p); }
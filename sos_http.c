@@ -0,0 +1,473 @@
+/* Loopback HTTP/1.1 file server: sos_http_start() (see sos.h).
+
+   A background thread runs a level-triggered epoll loop over the
+   listener and every connection. Connections are persistent (keep-alive
+   unless the client asks otherwise or speaks HTTP/1.0) and requests are
+   answered in order. GET bodies are never copied: the file's blob is
+   pinned with sos_vfs_pin() and written straight from VFS storage with
+   writev() next to the response header, so a hot file costs one lookup
+   and usually one system call per request. The ETag is the blob's
+   version and size, so revalidation (If-None-Match -> 304) never touches
+   the bytes. A connection is not read while a response is still
+   queued. Linux only. */
+#ifdef __linux__
+#define _GNU_SOURCE     /* accept4 */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sos.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define HTTP_MAX_CONNS 1024
+#define HTTP_HEAD_MAX 8192              /* request line plus headers */
+#define HTTP_HDR_MAX 512                /* response header */
+#define HTTP_MAX_BODY (64u << 20)       /* PUT limit, the VFS file size limit */
+#define HTTP_NAME_MAX 96
+#define HTTP_NO_LENGTH ((size_t)-1)     /* 204: no Content-Length at all */
+
+/* epoll data points at one of these; all start with their kind */
+enum { HTTP_LISTENER, HTTP_WAKE, HTTP_CONN };
+
+typedef struct {
+    int kind;
+    int fd;
+} http_fd_t;
+
+typedef struct {
+    int kind;
+    int fd;
+    char in[HTTP_HEAD_MAX];
+    size_t inlen;
+    /* PUT body being received */
+    char name[HTTP_NAME_MAX];
+    char* body;
+    size_t bodylen, bodywant;
+    int receiving;
+    /* response in flight: header, then data from a pinned blob or owned buffer */
+    char hdr[HTTP_HDR_MAX];
+    size_t hdrlen, hdroff;
+    const char* data;
+    size_t datalen, dataoff;
+    void* pin;
+    char* owned;
+    int keep, closing, reading, writing;
+} http_conn_t;
+
+static http_conn_t* conns[HTTP_MAX_CONNS];
+static int nconns = 0;
+static sos_ctx_t* http_ctx;
+static http_fd_t http_listener = { HTTP_LISTENER, -1 }, http_wake = { HTTP_WAKE, -1 };
+static int http_wake_w = -1, http_ep = -1, http_port = 0;
+static pthread_t http_thread;
+
+static void conn_rearm(http_conn_t* c) {
+    int writing = c->hdroff < c->hdrlen || c->dataoff < c->datalen;
+    int reading = !writing && !c->closing;
+    if (reading == c->reading && writing == c->writing) return;
+    struct epoll_event ev = {0};
+    ev.events = (reading ? EPOLLIN : 0) | (writing ? EPOLLOUT : 0) | EPOLLRDHUP;
+    ev.data.ptr = c;
+    epoll_ctl(http_ep, EPOLL_CTL_MOD, c->fd, &ev);
+    c->reading = reading;
+    c->writing = writing;
+}
+
+/* forgets the response that was just sent (or abandoned) */
+static void resp_release(http_conn_t* c) {
+    sos_vfs_unpin(c->pin);
+    free(c->owned);
+    c->pin = NULL;
+    c->owned = NULL;
+    c->data = NULL;
+    c->hdrlen = c->hdroff = c->datalen = c->dataoff = 0;
+}
+
+static void conn_free(http_conn_t* c) {
+    epoll_ctl(http_ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    for (int i = 0; i < nconns; ++i) {
+        if (conns[i] == c) { conns[i] = conns[--nconns]; break; }
+    }
+    resp_release(c);
+    free(c->body);
+    free(c);
+}
+
+/* status line and headers; body_len is the Content-Length even for HEAD and 304 */
+static void resp_head(http_conn_t* c, int status, const char* reason, const char* extra, size_t body_len) {
+    char clen[48] = "";
+    if (body_len != HTTP_NO_LENGTH) snprintf(clen, sizeof(clen), "Content-Length: %zu\r\n", body_len);
+    int n = snprintf(c->hdr, sizeof(c->hdr), "HTTP/1.1 %d %s\r\n%s%s%s\r\n",
+                     status, reason, clen, extra ? extra : "",
+                     c->keep ? "" : "Connection: close\r\n");
+    c->hdrlen = n > 0 && (size_t)n < sizeof(c->hdr) ? (size_t)n : 0;
+    c->hdroff = 0;
+}
+
+/* short plain-text answer, mostly errors */
+static void resp_text(http_conn_t* c, int status, const char* reason, const char* text) {
+    resp_head(c, status, reason, "Content-Type: text/plain\r\n", strlen(text));
+    c->data = text;
+    c->datalen = strlen(text);
+}
+
+/* one "bytes=a-b", "bytes=a-" or "bytes=-n" range of a len-byte file:
+   1 satisfiable, 0 not, -1 ignore the header and send everything */
+static int parse_range(const char* v, size_t len, size_t* start, size_t* end) {
+    if (strncasecmp(v, "bytes=", 6) != 0 || strchr(v, ',')) return -1;
+    v += 6;
+    char* e;
+    if (*v == '-') {
+        unsigned long long n = strtoull(v + 1, &e, 10);
+        if (e == v + 1) return -1;
+        if (n == 0 || len == 0) return 0;
+        *start = n >= len ? 0 : len - (size_t)n;
+        *end = len - 1;
+        return 1;
+    }
+    unsigned long long a = strtoull(v, &e, 10), b = ~0ull;
+    if (e == v || *e != '-') return -1;
+    if (e[1]) {
+        const char* bs = e + 1;
+        b = strtoull(bs, &e, 10);
+        if (e == bs || b < a) return -1;
+    }
+    if (a >= len) return 0;
+    *start = (size_t)a;
+    *end = b < len ? (size_t)b : len - 1;
+    return 1;
+}
+
+/* sos_vfs_list() callback: "name<TAB>size" lines into a growing string */
+static void list_add(const char* name, size_t size, void* user) {
+    char **buf = user;
+    char line[160];
+    int n = snprintf(line, sizeof(line), "%s\t%zu\n", name, size);
+    size_t have = *buf ? strlen(*buf) : 0;
+    char* p = realloc(*buf, have + (size_t)n + 1);
+    if (!p) return;
+    memcpy(p + have, line, (size_t)n + 1);
+    *buf = p;
+}
+
+static void http_get(http_conn_t* c, const char* name, int head, const char* range, const char* inm) {
+    if (!name[0]) {
+        char* list = NULL;
+        sos_vfs_list(http_ctx, list_add, &list);
+        c->owned = list;
+        resp_head(c, 200, "OK", "Content-Type: text/plain\r\n", list ? strlen(list) : 0);
+        c->data = head ? NULL : list;
+        c->datalen = head || !list ? 0 : strlen(list);
+        return;
+    }
+    const char* data;
+    size_t len;
+    unsigned long long ver;
+    void* pin;
+    if (sos_vfs_pin(http_ctx, name, &data, &len, &ver, &pin) != 0) { resp_text(c, 404, "Not Found", "No such file\n"); return; }
+    char extra[256], etag[48];
+    snprintf(etag, sizeof(etag), "\"%llx-%zx\"", ver, len);
+    if (inm && (strstr(inm, etag) || strcmp(inm, "*") == 0)) {
+        sos_vfs_unpin(pin);
+        snprintf(extra, sizeof(extra), "ETag: %s\r\n", etag);
+        resp_head(c, 304, "Not Modified", extra, len);
+        return;
+    }
+    size_t start = 0, end = len ? len - 1 : 0;
+    int r = range ? parse_range(range, len, &start, &end) : -1;
+    if (r == 0) {
+        sos_vfs_unpin(pin);
+        snprintf(extra, sizeof(extra), "Content-Range: bytes */%zu\r\n", len);
+        resp_head(c, 416, "Range Not Satisfiable", extra, 0);
+        return;
+    }
+    size_t n = len ? end - start + 1 : 0;
+    if (r == 1) {
+        snprintf(extra, sizeof(extra), "Content-Type: application/octet-stream\r\nETag: %s\r\n"
+                 "Accept-Ranges: bytes\r\nContent-Range: bytes %zu-%zu/%zu\r\n", etag, start, end, len);
+        resp_head(c, 206, "Partial Content", extra, n);
+    } else {
+        snprintf(extra, sizeof(extra), "Content-Type: application/octet-stream\r\nETag: %s\r\n"
+                 "Accept-Ranges: bytes\r\n", etag);
+        resp_head(c, 200, "OK", extra, n);
+    }
+    c->pin = pin;
+    c->data = data + start;
+    c->datalen = head ? 0 : n;
+}
+
+/* the whole PUT body has arrived */
+static void http_put_done(http_conn_t* c) {
+    int rc = sos_vfs_write(http_ctx, c->name, c->body, c->bodylen);
+    free(c->body);
+    c->body = NULL;
+    c->receiving = 0;
+    if (rc != 0) resp_text(c, 403, "Forbidden", "File is read-only or the VFS is full\n");
+    else resp_head(c, 204, "No Content", NULL, HTTP_NO_LENGTH);
+}
+
+/* %XX-decodes the part of target after /vfs/; 0 if it is not a VFS path */
+static int vfs_target(const char* target, char* name, size_t sz) {
+    if (strncmp(target, "/vfs/", 5) != 0 && strcmp(target, "/vfs") != 0) return 0;
+    const char* p = target[4] ? target + 5 : target + 4;
+    size_t n = 0;
+    for (; *p && *p != '?' && n + 1 < sz; ++p) {
+        unsigned v;
+        if (*p == '%' && p[1] && p[2] && sscanf(p + 1, "%2x", &v) == 1 && v) { name[n++] = (char)v; p += 2; }
+        else name[n++] = *p;
+    }
+    name[n] = '\0';
+    return *p == '\0' || *p == '?';
+}
+
+/* parses and answers one request from c->in; 0 if it is not complete yet */
+static int http_request(http_conn_t* c) {
+    char* end = NULL;
+    for (size_t i = 0; i + 1 < c->inlen; ++i) {
+        if (c->in[i] == '\n' && (c->in[i+1] == '\n' || (c->in[i+1] == '\r' && i + 2 < c->inlen && c->in[i+2] == '\n'))) {
+            end = c->in + i + (c->in[i+1] == '\n' ? 2 : 3);
+            break;
+        }
+    }
+    if (!end) {
+        if (c->inlen == sizeof(c->in)) {
+            c->keep = 0;
+            resp_text(c, 431, "Request Header Fields Too Large", "Request head too large\n");
+            c->closing = 1;
+            return 1;
+        }
+        return 0;
+    }
+    end[-1] = '\0';
+    size_t used = (size_t)(end - c->in);
+
+    /* request line, then the headers we care about */
+    char *line = c->in, *next = strchr(line, '\n');
+    *next++ = '\0';
+    char method[16] = "", target[2048] = "", version[16] = "";
+    sscanf(line, "%15s %2047s %15s", method, target, version);
+    c->keep = strcmp(version, "HTTP/1.1") == 0;
+    const char *range = NULL, *inm = NULL, *clen = NULL, *te = NULL, *expect = NULL;
+    for (line = next; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line[strcspn(line, "\r")] = '\0';
+        char* colon = strchr(line, ':');
+        if (!colon) continue;
+        *colon = '\0';
+        char* v = colon + 1 + strspn(colon + 1, " \t");
+        if (strcasecmp(line, "Range") == 0) range = v;
+        else if (strcasecmp(line, "If-None-Match") == 0) inm = v;
+        else if (strcasecmp(line, "Content-Length") == 0) clen = v;
+        else if (strcasecmp(line, "Transfer-Encoding") == 0) te = v;
+        else if (strcasecmp(line, "Expect") == 0) expect = v;
+        else if (strcasecmp(line, "Connection") == 0) {
+            if (strcasestr(v, "close")) c->keep = 0;
+            else if (strcasestr(v, "keep-alive")) c->keep = 1;
+        }
+    }
+
+    char name[HTTP_NAME_MAX];
+    int is_get = strcmp(method, "GET") == 0, is_head = strcmp(method, "HEAD") == 0;
+    if (!version[0] || strncmp(version, "HTTP/1.", 7) != 0) {
+        c->keep = 0;
+        resp_text(c, 400, "Bad Request", "Bad request\n");
+    } else if (!vfs_target(target, name, sizeof(name))) {
+        resp_text(c, 404, "Not Found", "Only /vfs/<name> is served\n");
+    } else if (is_get || is_head) {
+        http_get(c, name, is_head, range, inm);
+    } else if (strcmp(method, "DELETE") == 0) {
+        if (name[0] && sos_vfs_remove(http_ctx, name) == 0) resp_head(c, 204, "No Content", NULL, HTTP_NO_LENGTH);
+        else resp_text(c, 404, "Not Found", "No such file\n");
+    } else if (strcmp(method, "PUT") == 0) {
+        unsigned long long want = clen ? strtoull(clen, NULL, 10) : 0;
+        if (te) { c->keep = 0; resp_text(c, 501, "Not Implemented", "Chunked uploads are not supported\n"); }
+        else if (!clen) { c->keep = 0; resp_text(c, 411, "Length Required", "Content-Length required\n"); }
+        else if (!name[0]) resp_text(c, 405, "Method Not Allowed", "Cannot PUT the listing\n");
+        else if (want > HTTP_MAX_BODY) { c->keep = 0; resp_text(c, 413, "Content Too Large", "File too large\n"); }
+        else if (!(c->body = malloc(want ? (size_t)want : 1))) { c->keep = 0; resp_text(c, 503, "Service Unavailable", "Out of memory\n"); }
+        else {
+            snprintf(c->name, sizeof(c->name), "%s", name);
+            c->bodywant = (size_t)want;
+            c->bodylen = c->inlen - used < c->bodywant ? c->inlen - used : c->bodywant;
+            memcpy(c->body, end, c->bodylen);
+            used += c->bodylen;
+            c->receiving = 1;
+            if (c->bodylen == c->bodywant) http_put_done(c);
+            else if (expect && strcasecmp(expect, "100-continue") == 0) {
+                static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                send(c->fd, cont, sizeof(cont) - 1, MSG_NOSIGNAL);
+            }
+        }
+    } else {
+        resp_head(c, 405, "Method Not Allowed", "Allow: GET, HEAD, PUT, DELETE\r\n", 0);
+    }
+    memmove(c->in, c->in + used, c->inlen - used);
+    c->inlen -= used;
+    if (!c->keep && !c->receiving) c->closing = 1;
+    return 1;
+}
+
+/* writes the pending response; 1 once it is all out, 0 if the socket is full or gone */
+static int conn_flush(http_conn_t* c) {
+    while (c->hdroff < c->hdrlen || c->dataoff < c->datalen) {
+        struct iovec iov[2];
+        int n = 0;
+        if (c->hdroff < c->hdrlen) { iov[n].iov_base = c->hdr + c->hdroff; iov[n++].iov_len = c->hdrlen - c->hdroff; }
+        if (c->dataoff < c->datalen) { iov[n].iov_base = (void*)(c->data + c->dataoff); iov[n++].iov_len = c->datalen - c->dataoff; }
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)n;
+        ssize_t w = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (w <= 0) { c->closing = 2; return 0; }
+        size_t done = (size_t)w, h = c->hdrlen - c->hdroff;
+        if (done < h) { c->hdroff += done; continue; }
+        c->hdroff = c->hdrlen;
+        c->dataoff += done - h;
+    }
+    resp_release(c);
+    return 1;
+}
+
+/* reads what is available, then answers complete requests in order */
+static void conn_event(http_conn_t* c, unsigned events) {
+    /* a full buffer holds pipelined requests still to be answered */
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && (c->receiving || c->inlen < sizeof(c->in))) {
+        ssize_t n;
+        if (c->receiving) n = recv(c->fd, c->body + c->bodylen, c->bodywant - c->bodylen, 0);
+        else n = recv(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) { c->closing = 2; return; }
+        if (n > 0 && c->receiving) {
+            c->bodylen += (size_t)n;
+            if (c->bodylen == c->bodywant) {
+                http_put_done(c);
+                if (!c->keep) c->closing = 1;
+            }
+        } else if (n > 0) c->inlen += (size_t)n;
+    }
+    while (c->closing != 2) {
+        if (!conn_flush(c)) return;
+        if (c->closing || c->receiving || !http_request(c)) return;
+    }
+}
+
+static void conn_accept(int lfd) {
+    for (;;) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        http_conn_t* c = nconns < HTTP_MAX_CONNS ? calloc(1, sizeof(*c)) : NULL;
+        if (!c) { close(fd); continue; }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->kind = HTTP_CONN;
+        c->fd = fd;
+        c->reading = 1;
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(http_ep, EPOLL_CTL_ADD, fd, &ev) != 0) { close(fd); free(c); continue; }
+        conns[nconns++] = c;
+    }
+}
+
+static void* http_main(void* arg) {
+    (void)arg;
+    struct epoll_event evs[64];
+    for (;;) {
+        int n = epoll_wait(http_ep, evs, 64, -1);
+        if (n < 0) { if (errno == EINTR) continue; break; }
+        for (int i = 0; i < n; ++i) {
+            int kind = *(int*)evs[i].data.ptr;
+            if (kind == HTTP_WAKE) goto stop;
+            if (kind == HTTP_LISTENER) { conn_accept(http_listener.fd); continue; }
+            http_conn_t* c = evs[i].data.ptr;
+            conn_event(c, evs[i].events);
+            if (c->closing == 2 || (c->closing && c->hdrlen == 0 && c->datalen == 0)) { conn_free(c); continue; }
+            conn_rearm(c);
+        }
+    }
+stop:
+    while (nconns > 0) conn_free(conns[0]);
+    return NULL;
+}
+
+int sos_http_start(sos_ctx_t* ctx, int port) {
+    if (!ctx || port <= 0 || port > 65535 || http_port) return -1;
+    int wake[2] = { -1, -1 };
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = {0};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((unsigned short)port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(fd, 128) != 0) {
+        fprintf(stderr, "Cannot listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    http_ep = epoll_create1(EPOLL_CLOEXEC);
+    if (http_ep < 0 || pipe2(wake, O_CLOEXEC) != 0) goto fail;
+    http_listener.fd = fd;
+    http_wake.fd = wake[0];
+    http_wake_w = wake[1];
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &http_listener;
+    epoll_ctl(http_ep, EPOLL_CTL_ADD, fd, &ev);
+    ev.data.ptr = &http_wake;
+    epoll_ctl(http_ep, EPOLL_CTL_ADD, wake[0], &ev);
+    http_ctx = ctx;
+    if (pthread_create(&http_thread, NULL, http_main, NULL) != 0) goto fail;
+    http_port = port;
+    return 0;
+fail:
+    if (http_ep >= 0) close(http_ep);
+    if (wake[0] >= 0) { close(wake[0]); close(wake[1]); }
+    close(fd);
+    http_ep = -1;
+    return -1;
+}
+
+void sos_http_stop(void) {
+    if (!http_port) return;
+    char b = 0;
+    if (write(http_wake_w, &b, 1) != 1) return;
+    pthread_join(http_thread, NULL);
+    close(http_listener.fd);
+    close(http_wake.fd);
+    close(http_wake_w);
+    close(http_ep);
+    http_ep = -1;
+    http_port = 0;
+}
+
+int sos_http_port(void) { return http_port; }
+#else
+int sos_http_start(sos_ctx_t* ctx, int port) {
+    (void)ctx; (void)port;
+    fprintf(stderr, "The HTTP server needs Linux (epoll)\n");
+    return -1;
+}
+
+void sos_http_stop(void) {}
+
+int sos_http_port(void) { return 0; }
+#endif
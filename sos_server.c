@@ -0,0 +1,484 @@
+/* Multi-session remote shell: sos_serve() (see sos.h).
+
+   One thread runs a level-triggered epoll loop over the listening
+   sockets and every session. Sessions are line oriented: the first line
+   is the login name, every later line is a shell command run with
+   sos_exec_as() on the shared instance, so all sessions see the same VFS
+   and task table while each keeps its own user, prompt and output
+   buffer. Output is queued per session and flushed as the socket
+   accepts it; a session with too much unsent output stops being read
+   until it drains. Commands run on the loop thread one at a time, so a
+   slow command delays the other sessions but never interleaves with
+   them. A session that logs in as "@replica" speaks the sos_sync
+   protocol instead; followers also get every VFS mutation, which the
+   mutation hook queues from whichever thread made it and the loop
+   fans out when an eventfd wakes it. Linux only. */
+#ifdef __linux__
+#define _GNU_SOURCE     /* accept4 */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "sos.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define SRV_MAX_SESSIONS 1024
+#define SRV_LINE_MAX 2048
+#define SRV_OUT_HIGH (1u << 20)     /* stop reading a session above this much queued output */
+#define SRV_PROMPT_MAX 128
+#define SRV_REPLICA_MAX (256u << 20)   /* a follower further behind is dropped */
+
+/* epoll data points at one of these; all start with their kind */
+enum { SRV_LISTENER, SRV_SESSION, SRV_MUTATIONS, SRV_WATCHES };
+
+typedef struct {
+    int kind;
+    int fd;
+} listener_t;
+
+typedef struct {
+    int kind;
+    int fd;
+    int id;
+    char user[64];
+    char prompt[SRV_PROMPT_MAX];    /* "" uses the default [user@host time]$ */
+    char peer[64];
+    char in[SRV_LINE_MAX];
+    size_t inlen;
+    char* out;                      /* queued output, sent from outoff */
+    size_t outlen, outoff, outcap;
+    int logged_in, closing, reading, writing;
+    int replica, follow;            /* sync protocol session; wants mutations */
+    char* rin;                      /* sync frames not yet complete */
+    size_t rinlen, rincap;
+    unsigned long long commands;
+    time_t last;
+} session_t;
+
+static session_t* sessions[SRV_MAX_SESSIONS];
+static int nsessions = 0, next_session_id = 1;
+static volatile sig_atomic_t srv_stop = 0;
+
+/* mutations framed by the hook, waiting for the loop to fan them out */
+static pthread_mutex_t mut_mtx = PTHREAD_MUTEX_INITIALIZER;
+static char* mut_buf;
+static size_t mut_len, mut_cap;
+static listener_t mut_wake = { SRV_MUTATIONS, -1 };
+static int srv_followers = 0;
+static sos_ctx_t* srv_ctx;
+
+/* also stops a script a session left running, so the loop gets back to srv_stop */
+static void srv_on_signal(int sig) { (void)sig; srv_stop = 1; if (srv_ctx) sos_interrupt(srv_ctx); }
+
+static void out_append(session_t* s, const char* data, size_t n) {
+    if (s->outlen + n > s->outcap) {
+        size_t cap = s->outcap ? s->outcap : 4096;
+        while (cap < s->outlen + n) cap *= 2;
+        char* p = realloc(s->out, cap);
+        if (!p) { s->closing = 1; return; }
+        s->out = p;
+        s->outcap = cap;
+    }
+    memcpy(s->out + s->outlen, data, n);
+    s->outlen += n;
+}
+
+static void session_emit(void* user, const void* data, size_t n) { out_append(user, data, n); }
+
+static void mut_emit(void* user, const void* data, size_t n) {
+    (void)user;
+    if (mut_len + n > mut_cap) {
+        size_t cap = mut_cap ? mut_cap : 65536;
+        while (cap < mut_len + n) cap *= 2;
+        char* p = realloc(mut_buf, cap);
+        if (!p) return;
+        mut_buf = p;
+        mut_cap = cap;
+    }
+    memcpy(mut_buf + mut_len, data, n);
+    mut_len += n;
+}
+
+/* mutation hook: any thread, file lock held */
+static void srv_on_mutation(sos_ctx_t* ctx, int op, const char* name, unsigned long long offset,
+                            const void* data, size_t len, void* user) {
+    (void)ctx; (void)user;
+    if (!__atomic_load_n(&srv_followers, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&mut_mtx);
+    if (mut_wake.fd >= 0) {
+        sos_sync_mutation(op, name, offset, data, len, mut_emit, NULL);
+        uint64_t one = 1;
+        if (write(mut_wake.fd, &one, sizeof(one)) < 0) {}
+    }
+    pthread_mutex_unlock(&mut_mtx);
+}
+
+static void out_printf(session_t* s, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void out_printf(session_t* s, const char* fmt, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n > 0) out_append(s, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+static void send_prompt(sos_ctx_t* ctx, session_t* s) {
+    if (s->prompt[0]) { out_printf(s, "%s", s->prompt); return; }
+    time_t t = time(NULL);
+    struct tm tm = *localtime(&t);
+    out_printf(s, "\x1b[36m[%s@%s %02d:%02d:%02d]\x1b[0m$ ",
+               s->user, sos_getenv(ctx, "HOSTNAME"), tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/* keeps the epoll interest set in line with the session's buffers */
+static void session_rearm(int ep, session_t* s) {
+    int reading = s->outlen - s->outoff < SRV_OUT_HIGH && !s->closing;
+    int writing = s->outlen > s->outoff;
+    if (reading == s->reading && writing == s->writing) return;
+    struct epoll_event ev = {0};
+    ev.events = (reading ? EPOLLIN : 0) | (writing ? EPOLLOUT : 0) | EPOLLRDHUP;
+    ev.data.ptr = s;
+    epoll_ctl(ep, EPOLL_CTL_MOD, s->fd, &ev);
+    s->reading = reading;
+    s->writing = writing;
+}
+
+static void session_free(int ep, session_t* s) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    for (int i = 0; i < nsessions; ++i) {
+        if (sessions[i] == s) { sessions[i] = sessions[--nsessions]; break; }
+    }
+    if (s->follow) __atomic_sub_fetch(&srv_followers, 1, __ATOMIC_RELEASE);
+    free(s->rin);
+    free(s->out);
+    free(s);
+}
+
+/* writes as much queued output as the socket takes; 0 if the peer is gone */
+static int session_flush(session_t* s) {
+    while (s->outoff < s->outlen) {
+        ssize_t n = send(s->fd, s->out + s->outoff, s->outlen - s->outoff, MSG_NOSIGNAL);
+        if (n > 0) { s->outoff += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+        return 0;
+    }
+    s->outoff = s->outlen = 0;
+    return 1;
+}
+
+static void cmd_who(session_t* self) {
+    time_t now = time(NULL);
+    out_printf(self, "%-4s %-16s %-24s %8s %6s\n", "ID", "USER", "FROM", "COMMANDS", "IDLE");
+    for (int i = 0; i < nsessions; ++i) {
+        session_t* s = sessions[i];
+        if (!s->logged_in) continue;
+        out_printf(self, "%-4d %-16s %-24s %8llu %5lds%s\n", s->id, s->user, s->peer,
+                   s->commands, (long)(now - s->last), s == self ? " *" : "");
+    }
+}
+
+/* one complete input line */
+static void session_line(sos_ctx_t* ctx, session_t* s, char* line) {
+    size_t n = strlen(line);
+    if (n && line[n-1] == '\r') line[--n] = '\0';
+    s->last = time(NULL);
+    if (!s->logged_in) {
+        char* u = line + strspn(line, " \t");
+        u[strcspn(u, " \t")] = '\0';
+        if (strcmp(u, "@replica") == 0) {
+            /* no banner or prompt: everything after this line is sync frames */
+            snprintf(s->user, sizeof(s->user), "%s", u);
+            s->logged_in = s->replica = 1;
+            return;
+        }
+        snprintf(s->user, sizeof(s->user), "%s", u[0] ? u : sos_getenv(ctx, "USER"));
+        s->logged_in = 1;
+        out_printf(s, "Welcome %s (session %d).\n", s->user, s->id);
+        send_prompt(ctx, s);
+        return;
+    }
+    const char* cmd = line + strspn(line, " \t");
+    if (strcmp(cmd, "exit") == 0 || strcmp(cmd, "logout") == 0) {
+        out_printf(s, "Bye.\n");
+        s->closing = 1;
+        return;
+    }
+    s->commands++;
+    if (strcmp(cmd, "who") == 0) {
+        sos_stats_command("who");
+        cmd_who(s);
+    } else if (strncmp(cmd, "prompt", 6) == 0 && (cmd[6] == '\0' || cmd[6] == ' ')) {
+        sos_stats_command("prompt");
+        const char* p = cmd + 6 + strspn(cmd + 6, " ");
+        snprintf(s->prompt, sizeof(s->prompt), "%s%s", p, p[0] ? " " : "");
+    } else if (cmd[0]) {
+        char* out = NULL;
+        size_t len = 0;
+        sos_exec_as(ctx, s->user, cmd, &out, &len);
+        if (out) out_append(s, out, len);
+        sos_free(out);
+    }
+    if (sos_state(ctx) != SOS_RUNNING) return;
+    send_prompt(ctx, s);
+}
+
+/* sync frames from a replica session */
+static void replica_input(sos_ctx_t* ctx, session_t* s, const char* data, size_t n) {
+    if (s->rinlen + n > s->rincap) {
+        size_t cap = s->rincap ? s->rincap : 65536;
+        while (cap < s->rinlen + n) cap *= 2;
+        char* p = realloc(s->rin, cap);
+        if (!p) { s->closing = 2; return; }
+        s->rin = p;
+        s->rincap = cap;
+    }
+    memcpy(s->rin + s->rinlen, data, n);
+    s->rinlen += n;
+    int follow = s->follow;
+    size_t used = sos_sync_serve(ctx, s->rin, s->rinlen, &follow, session_emit, s);
+    if (used == (size_t)-1) { s->closing = 2; return; }
+    memmove(s->rin, s->rin + used, s->rinlen - used);
+    s->rinlen -= used;
+    if (follow && !s->follow) {
+        s->follow = 1;
+        __atomic_add_fetch(&srv_followers, 1, __ATOMIC_RELEASE);
+    }
+    s->last = time(NULL);
+}
+
+/* hands queued mutations to every follower */
+static void fan_out_mutations(int ep) {
+    uint64_t n;
+    if (read(mut_wake.fd, &n, sizeof(n)) < 0) {}
+    pthread_mutex_lock(&mut_mtx);
+    char* buf = mut_buf;
+    size_t len = mut_len;
+    mut_buf = NULL;
+    mut_len = mut_cap = 0;
+    pthread_mutex_unlock(&mut_mtx);
+    for (int i = 0; i < nsessions; ++i) {
+        session_t* s = sessions[i];
+        if (!s->follow || s->closing == 2 || !len) continue;
+        out_append(s, buf, len);
+        if (s->outlen - s->outoff > SRV_REPLICA_MAX || !session_flush(s)) s->closing = 2;
+        else session_rearm(ep, s);
+    }
+    free(buf);
+}
+
+static void session_read(sos_ctx_t* ctx, session_t* s) {
+    char buf[65536];
+    ssize_t n = recv(s->fd, buf, s->replica ? sizeof(buf) : 4096, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) { s->closing = 2; return; }
+    if (n < 0) return;
+    if (s->replica) { replica_input(ctx, s, buf, (size_t)n); return; }
+    for (ssize_t i = 0; i < n && !s->closing; ++i) {
+        if (buf[i] != '\n') {
+            if (s->inlen < sizeof(s->in) - 1) s->in[s->inlen++] = buf[i];
+            continue;
+        }
+        s->in[s->inlen] = '\0';
+        s->inlen = 0;
+        session_line(ctx, s, s->in);
+        if (s->replica) { replica_input(ctx, s, buf + i + 1, (size_t)(n - i - 1)); return; }
+        if (sos_state(ctx) != SOS_RUNNING) return;
+    }
+}
+
+static void session_accept(int ep, int lfd) {
+    for (;;) {
+        struct sockaddr_storage sa;
+        socklen_t salen = sizeof(sa);
+        int fd = accept4(lfd, (struct sockaddr*)&sa, &salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        if (nsessions >= SRV_MAX_SESSIONS) { close(fd); continue; }
+        session_t* s = calloc(1, sizeof(*s));
+        if (!s) { close(fd); continue; }
+        s->kind = SRV_SESSION;
+        s->fd = fd;
+        s->id = next_session_id++;
+        s->last = time(NULL);
+        if (sa.ss_family == AF_INET) {
+            struct sockaddr_in* in = (struct sockaddr_in*)&sa;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            snprintf(s->peer, sizeof(s->peer), "%s:%d", inet_ntoa(in->sin_addr), ntohs(in->sin_port));
+        } else snprintf(s->peer, sizeof(s->peer), "unix");
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = s;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0) { close(fd); free(s); continue; }
+        s->reading = 1;
+        sessions[nsessions++] = s;
+        out_printf(s, "Shreyas OS remote session %d\nlogin: ", s->id);
+        if (!session_flush(s)) session_free(ep, s);
+        else session_rearm(ep, s);
+    }
+}
+
+static int listen_unix(const char* path) {
+    struct sockaddr_un sa = {0};
+    if (strlen(path) >= sizeof(sa.sun_path)) { fprintf(stderr, "Socket path too long: %s\n", path); return -1; }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(fd, 128) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    chmod(path, 0600);
+    return fd;
+}
+
+/* loopback only: sessions are not authenticated */
+static int listen_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = {0};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((unsigned short)port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(fd, 128) != 0) {
+        fprintf(stderr, "Cannot listen on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int sos_serve(sos_ctx_t* ctx, const char* unix_path, int tcp_port) {
+    if (!ctx || ((!unix_path || !unix_path[0]) && tcp_port <= 0)) return -1;
+    int want = (unix_path && unix_path[0]) + (tcp_port > 0), nl = 0;
+    listener_t ls[2];
+    if (unix_path && unix_path[0] && (ls[nl].fd = listen_unix(unix_path)) >= 0) nl++;
+    if (tcp_port > 0 && (ls[nl].fd = listen_tcp(tcp_port)) >= 0) nl++;
+    int ep = nl == want ? epoll_create1(EPOLL_CLOEXEC) : -1;
+    if (ep < 0) {
+        for (int i = 0; i < nl; ++i) close(ls[i].fd);
+        return -1;
+    }
+    for (int i = 0; i < nl; ++i) {
+        struct epoll_event ev = {0};
+        ls[i].kind = SRV_LISTENER;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &ls[i];
+        epoll_ctl(ep, EPOLL_CTL_ADD, ls[i].fd, &ev);
+    }
+    mut_wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mut_wake.fd >= 0) {
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &mut_wake;
+        epoll_ctl(ep, EPOLL_CTL_ADD, mut_wake.fd, &ev);
+        sos_set_mutation_hook(ctx, srv_on_mutation, NULL);
+    }
+    /* watch reactions to changes no session made (HTTP, jobs) run at once */
+    listener_t watch_wake = { SRV_WATCHES, sos_watch_fd(ctx) };
+    if (watch_wake.fd >= 0) {
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &watch_wake;
+        epoll_ctl(ep, EPOLL_CTL_ADD, watch_wake.fd, &ev);
+    }
+
+    struct sigaction sa = {0};
+    struct sigaction old_int, old_term;
+    srv_ctx = ctx;
+    sa.sa_handler = srv_on_signal;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    srv_stop = 0;
+    if (unix_path && unix_path[0]) printf("Listening on %s\n", unix_path);
+    if (tcp_port > 0) printf("Listening on 127.0.0.1:%d\n", tcp_port);
+    fflush(stdout);
+
+    struct epoll_event evs[64];
+    while (!srv_stop) {
+        int n = epoll_wait(ep, evs, 64, -1);
+        if (n < 0) { if (errno == EINTR) continue; break; }
+        for (int i = 0; i < n; ++i) {
+            if (*(int*)evs[i].data.ptr == SRV_LISTENER) {
+                session_accept(ep, ((listener_t*)evs[i].data.ptr)->fd);
+                continue;
+            }
+            if (*(int*)evs[i].data.ptr == SRV_MUTATIONS) { fan_out_mutations(ep); continue; }
+            if (*(int*)evs[i].data.ptr == SRV_WATCHES) { sos_tick(ctx); continue; }
+            session_t* s = evs[i].data.ptr;
+            if (s->closing == 2) continue;      /* dropped earlier in this batch */
+            if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) session_read(ctx, s);
+            if (s->closing != 2 && !session_flush(s)) s->closing = 2;
+            if (s->closing && s->outlen == s->outoff) s->closing = 2;
+            if (s->closing != 2) session_rearm(ep, s);
+            if (sos_state(ctx) != SOS_RUNNING) break;
+        }
+        if (sos_state(ctx) == SOS_REBOOT) {
+            /* a session rebooted the instance: reload its VFS and carry on */
+            sos_vfs_reload(ctx);
+            sos_set_state(ctx, SOS_RUNNING);
+            for (int k = 0; k < nsessions; ++k) {
+                session_t* s = sessions[k];
+                if (s->replica || !s->logged_in || s->closing == 2) continue;  /* sync streams take frames only */
+                send_prompt(ctx, s);
+                if (!session_flush(s)) s->closing = 2;
+                else session_rearm(ep, s);
+            }
+        }
+        /* later entries of the batch may point at any session, so they go only now */
+        for (int k = 0; k < nsessions; ++k)
+            if (sessions[k]->closing == 2) session_free(ep, sessions[k--]);
+        if (sos_state(ctx) == SOS_HALTED) break;
+    }
+
+    while (nsessions > 0) {
+        session_t* s = sessions[0];
+        out_printf(s, "Server shutting down.\n");
+        session_flush(s);
+        session_free(ep, s);
+    }
+    /* writers on other threads may be inside the hook until the lock is ours */
+    sos_set_mutation_hook(ctx, NULL, NULL);
+    pthread_mutex_lock(&mut_mtx);
+    if (mut_wake.fd >= 0) close(mut_wake.fd);
+    mut_wake.fd = -1;
+    free(mut_buf);
+    mut_buf = NULL;
+    mut_len = mut_cap = 0;
+    pthread_mutex_unlock(&mut_mtx);
+    for (int i = 0; i < nl; ++i) close(ls[i].fd);
+    close(ep);
+    if (unix_path && unix_path[0]) unlink(unix_path);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    return 0;
+}
+#else
+int sos_serve(sos_ctx_t* ctx, const char* unix_path, int tcp_port) {
+    (void)ctx; (void)unix_path; (void)tcp_port;
+    fprintf(stderr, "Server mode needs Linux (epoll)\n");
+    return -1;
+}
+#endif
@@ -0,0 +1,664 @@
+/* VFS replication: sos_sync() and the primary side (see sos.h).
+
+   Frames are [u8 type][u32 length][payload], integers little-endian, a
+   name is a u16 length and its bytes.
+   replica -> primary:
+     'H' u8 follow                   hello; follow subscribes to mutations
+     'L'                             list request
+     'S' name u32 block u32 n, n x (u32 weak, u64 strong)
+                                     delta request against the replica's blocks
+   primary -> replica:
+     'L' u32 n, n x (name u64 size u64 digest)
+     'F' name u8 exists u64 size u64 digest u32 block, then ops:
+           'C' u32 first u32 count   copy replica blocks
+           'D' u32 len, bytes        literal data
+     'M' u8 op name u64 offset, data a mutation (SOS_MUT_*)
+   Block matching is rsync's: a rolling weak sum finds candidate offsets
+   in one pass over the primary's copy, a 64-bit FNV-1a confirms them,
+   and the whole-file digest checks the rebuilt file. A replica that
+   fails the check, gets an append at an offset it does not have, or a
+   ranged write to a file it lacks, asks for that file again, so a
+   follower converges on its own. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sos.h"
+
+#define SYNC_MIN_DELTA 8192             /* smaller files are sent whole */
+#define SYNC_MIN_BLOCK 1024
+#define SYNC_MAX_BLOCK 65536
+#define SYNC_MAX_FRAME ((64u << 20) + 65536)
+#define SYNC_NAME_MAX 96
+
+/* frame building */
+typedef struct {
+    char* p;
+    size_t len, cap;
+    int oom;
+} sbuf_t;
+
+static void sbuf_put(sbuf_t* b, const void* d, size_t n) {
+    if (b->oom) return;
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + n) cap *= 2;
+        char* p = realloc(b->p, cap);
+        if (!p) { b->oom = 1; return; }
+        b->p = p;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, d, n);
+    b->len += n;
+}
+
+static void put_le(sbuf_t* b, unsigned long long v, int bytes) {
+    unsigned char c[8];
+    for (int i = 0; i < bytes; ++i) c[i] = (unsigned char)(v >> (8 * i));
+    sbuf_put(b, c, (size_t)bytes);
+}
+
+#define put8(b, v) put_le((b), (v), 1)
+#define put16(b, v) put_le((b), (v), 2)
+#define put32(b, v) put_le((b), (v), 4)
+#define put64(b, v) put_le((b), (v), 8)
+
+static void put_name(sbuf_t* b, const char* name) {
+    size_t n = strlen(name);
+    put16(b, n);
+    sbuf_put(b, name, n);
+}
+
+/* starts a frame; frame_end() fills in its length */
+static size_t frame_begin(sbuf_t* b, int type) {
+    put8(b, (unsigned)type);
+    put32(b, 0);
+    return b->len;
+}
+
+static void frame_end(sbuf_t* b, size_t start) {
+    if (b->oom) return;
+    size_t n = b->len - start;
+    for (int i = 0; i < 4; ++i) b->p[start - 4 + i] = (char)(n >> (8 * i));
+}
+
+/* frame parsing; any overrun sets bad and yields zeros */
+typedef struct {
+    const unsigned char* p;
+    size_t left;
+    int bad;
+} rd_t;
+
+static const void* get_bytes(rd_t* r, size_t n) {
+    if (r->bad || r->left < n) { r->bad = 1; return NULL; }
+    const void* p = r->p;
+    r->p += n;
+    r->left -= n;
+    return p;
+}
+
+static unsigned long long get_le(rd_t* r, int bytes) {
+    const unsigned char* c = get_bytes(r, (size_t)bytes);
+    unsigned long long v = 0;
+    for (int i = 0; c && i < bytes; ++i) v |= (unsigned long long)c[i] << (8 * i);
+    return v;
+}
+
+#define get8(r) ((unsigned)get_le((r), 1))
+#define get16(r) ((size_t)get_le((r), 2))
+#define get32(r) ((unsigned)get_le((r), 4))
+#define get64(r) get_le((r), 8)
+
+static int get_name(rd_t* r, char* out) {
+    size_t n = get16(r);
+    const char* s = get_bytes(r, n);
+    if (!s || n == 0 || n >= SYNC_NAME_MAX) { r->bad = 1; return 0; }
+    memcpy(out, s, n);
+    out[n] = '\0';
+    return 1;
+}
+
+/* checksums */
+static unsigned long long fnv1a64(const void* data, size_t n) {
+    const unsigned char* p = data;
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 1099511628211ULL; }
+    return h;
+}
+
+/* rsync's weak sum: a = sum of bytes, b = sum of the running a, 16 bits each */
+static void weak_init(const unsigned char* p, size_t n, unsigned* a, unsigned* b) {
+    unsigned sa = 0, sb = 0;
+    for (size_t i = 0; i < n; ++i) { sa += p[i]; sb += sa; }
+    *a = sa;
+    *b = sb;
+}
+
+#define WEAK(a, b) (((a) & 0xffffu) | ((b) << 16))
+
+static size_t block_size(size_t len) {
+    size_t b = SYNC_MIN_BLOCK;
+    while (b < SYNC_MAX_BLOCK && b * b < len) b *= 2;
+    return b;
+}
+
+/* Primary side */
+static void collect_name(const char* name, size_t size, void* user) {
+    (void)size;
+    sbuf_put(user, name, strlen(name) + 1);
+}
+
+static void serve_list(sos_ctx_t* ctx, sos_emit_fn emit, void* user) {
+    sbuf_t names = {0}, out = {0};
+    sos_vfs_list(ctx, collect_name, &names);
+    size_t start = frame_begin(&out, 'L'), countat = out.len;
+    unsigned count = 0;
+    put32(&out, 0);
+    for (size_t off = 0; off < names.len; off += strlen(names.p + off) + 1) {
+        const char* data;
+        size_t len;
+        void* pin;
+        if (sos_vfs_pin(ctx, names.p + off, &data, &len, NULL, &pin) != 0) continue;
+        put_name(&out, names.p + off);
+        put64(&out, len);
+        put64(&out, fnv1a64(data, len));
+        sos_vfs_unpin(pin);
+        count++;
+    }
+    frame_end(&out, start);
+    if (!out.oom) {
+        for (int i = 0; i < 4; ++i) out.p[countat + i] = (char)(count >> (8 * i));
+        emit(user, out.p, out.len);
+    }
+    free(names.p);
+    free(out.p);
+}
+
+typedef struct {
+    sbuf_t* out;
+    unsigned run_first, run_count;
+} delta_t;
+
+static void flush_run(delta_t* d) {
+    if (!d->run_count) return;
+    put8(d->out, 'C');
+    put32(d->out, d->run_first);
+    put32(d->out, d->run_count);
+    d->run_count = 0;
+}
+
+static void emit_literal(delta_t* d, const char* p, size_t n) {
+    if (!n) return;
+    flush_run(d);
+    put8(d->out, 'D');
+    put32(d->out, n);
+    sbuf_put(d->out, p, n);
+}
+
+/* the ops that rebuild data from the replica's blocks */
+static void compute_delta(sbuf_t* out, const char* data, size_t len, size_t block, rd_t* sig, unsigned n) {
+    delta_t d = { out, 0, 0 };
+    unsigned* weak = n ? malloc(n * sizeof(*weak)) : NULL;
+    unsigned long long* strong = n ? malloc(n * sizeof(*strong)) : NULL;
+    size_t mask = 1;
+    while (mask < 2 * (size_t)n) mask <<= 1;
+    int *head = n ? malloc(mask * sizeof(*head)) : NULL, *next = n ? malloc(n * sizeof(*next)) : NULL;
+    mask--;
+    if (!n || !weak || !strong || !head || !next || len < block) {
+        emit_literal(&d, data, len);
+        goto done;
+    }
+    for (size_t i = 0; i <= mask; ++i) head[i] = -1;
+    for (unsigned i = 0; i < n; ++i) {
+        weak[i] = get32(sig);
+        strong[i] = get64(sig);
+    }
+    /* chains hold the lowest index first, so runs of copies stay contiguous */
+    for (int i = (int)n - 1; i >= 0; --i) {
+        size_t h = (weak[i] * 2654435761u) & mask;
+        next[i] = head[h];
+        head[h] = i;
+    }
+    const unsigned char* u = (const unsigned char*)data;
+    size_t p = 0, lit = 0;
+    unsigned a, b;
+    weak_init(u, block, &a, &b);
+    while (p + block <= len) {
+        unsigned w = WEAK(a, b);
+        int hit = -1, have_strong = 0;
+        unsigned long long s = 0;
+        for (int i = head[(w * 2654435761u) & mask]; i >= 0; i = next[i]) {
+            if (weak[i] != w) continue;
+            if (!have_strong) { s = fnv1a64(u + p, block); have_strong = 1; }
+            if (strong[i] == s) { hit = i; break; }
+        }
+        if (hit >= 0) {
+            emit_literal(&d, data + lit, p - lit);
+            if (d.run_count && d.run_first + d.run_count == (unsigned)hit) d.run_count++;
+            else { flush_run(&d); d.run_first = (unsigned)hit; d.run_count = 1; }
+            p += block;
+            lit = p;
+            if (p + block <= len) weak_init(u + p, block, &a, &b);
+            continue;
+        }
+        if (p + block < len) {
+            a = a - u[p] + u[p + block];
+            b = b - (unsigned)block * u[p] + a;
+        }
+        p++;
+    }
+    emit_literal(&d, data + lit, len - lit);
+    flush_run(&d);
+done:
+    free(weak);
+    free(strong);
+    free(head);
+    free(next);
+}
+
+static void serve_delta(sos_ctx_t* ctx, rd_t* r, sos_emit_fn emit, void* user) {
+    char name[SYNC_NAME_MAX];
+    if (!get_name(r, name)) return;
+    size_t block = get32(r);
+    unsigned n = get32(r);
+    if (r->bad || r->left != (size_t)n * 12 || (n && (block < SYNC_MIN_BLOCK || block > SYNC_MAX_BLOCK))) { r->bad = 1; return; }
+    const char* data;
+    size_t len;
+    void* pin;
+    sbuf_t out = {0};
+    size_t start = frame_begin(&out, 'F');
+    put_name(&out, name);
+    if (sos_vfs_pin(ctx, name, &data, &len, NULL, &pin) != 0) {
+        put8(&out, 0);
+    } else {
+        put8(&out, 1);
+        put64(&out, len);
+        put64(&out, fnv1a64(data, len));
+        put32(&out, block);
+        compute_delta(&out, data, len, block, r, n);
+        sos_vfs_unpin(pin);
+    }
+    frame_end(&out, start);
+    if (!out.oom) emit(user, out.p, out.len);
+    free(out.p);
+}
+
+size_t sos_sync_serve(sos_ctx_t* ctx, const char* in, size_t len, int* follow, sos_emit_fn emit, void* user) {
+    size_t used = 0;
+    while (len - used >= 5) {
+        rd_t hdr = { (const unsigned char*)in + used, 5, 0 };
+        int type = (int)get8(&hdr);
+        size_t flen = get32(&hdr);
+        if (flen > SYNC_MAX_FRAME) return (size_t)-1;
+        if (len - used - 5 < flen) break;
+        rd_t r = { (const unsigned char*)in + used + 5, flen, 0 };
+        if (type == 'H') { if (get8(&r) && follow) *follow = 1; }
+        else if (type == 'L') serve_list(ctx, emit, user);
+        else if (type == 'S') serve_delta(ctx, &r, emit, user);
+        else r.bad = 1;
+        if (r.bad) return (size_t)-1;
+        used += 5 + flen;
+    }
+    return used;
+}
+
+void sos_sync_mutation(int op, const char* name, unsigned long long offset, const void* data, size_t len,
+                       sos_emit_fn emit, void* user) {
+    sbuf_t out = {0};
+    size_t start = frame_begin(&out, 'M');
+    put8(&out, (unsigned)op);
+    put_name(&out, name ? name : "");
+    put64(&out, offset);
+    if (len) sbuf_put(&out, data, len);
+    frame_end(&out, start);
+    if (!out.oom) emit(user, out.p, out.len);
+    free(out.p);
+}
+
+/* Replica side */
+#ifndef _WIN32
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+typedef struct {
+    sos_ctx_t* ctx;
+    int fd, failed;
+    char* in;
+    size_t inlen, inoff, incap;
+    int listing;                /* a list request is outstanding */
+    int pending;                /* delta requests outstanding */
+    sos_sync_info_t info;       /* updated with atomics: sos_sync_status() reads it */
+} replica_t;
+
+#define INFO_ADD(r, field, n) __atomic_add_fetch(&(r)->info.field, (n), __ATOMIC_RELAXED)
+
+static replica_t* follower;
+static pthread_t follow_thread;
+static sos_sync_info_t last_info;
+
+static int sync_connect(const char* target) {
+    const char* colon = strrchr(target, ':');
+    if (strchr(target, '/') || !colon) {
+        struct sockaddr_un sa = {0};
+        if (strlen(target) >= sizeof(sa.sun_path)) return -1;
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, target);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) { close(fd); return -1; }
+        return fd;
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - target), target);
+    struct addrinfo hints = {0}, *res, *ai;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host[0] ? host : "127.0.0.1", colon + 1, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) { close(fd); fd = -1; }
+    }
+    freeaddrinfo(res);
+    int one = 1;
+    if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void emit_fd(void* user, const void* data, size_t n) {
+    replica_t* r = user;
+    const char* p = data;
+    while (n > 0 && !r->failed) {
+        ssize_t w = send(r->fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) { r->failed = 1; return; }
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+/* reads until the buffer holds n unconsumed bytes; 0 on EOF or error */
+static int fill(replica_t* r, size_t n) {
+    if (r->inoff) {
+        memmove(r->in, r->in + r->inoff, r->inlen - r->inoff);
+        r->inlen -= r->inoff;
+        r->inoff = 0;
+    }
+    if (n > r->incap) {
+        size_t cap = r->incap ? r->incap : 65536;
+        while (cap < n) cap *= 2;
+        char* p = realloc(r->in, cap);
+        if (!p) return 0;
+        r->in = p;
+        r->incap = cap;
+    }
+    while (r->inlen < n) {
+        ssize_t got = recv(r->fd, r->in + r->inlen, r->incap - r->inlen, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 0;
+        r->inlen += (size_t)got;
+    }
+    return 1;
+}
+
+static int read_frame(replica_t* r, int* type, rd_t* payload) {
+    if (!fill(r, 5)) return 0;
+    rd_t hdr = { (const unsigned char*)r->in, 5, 0 };
+    *type = (int)get8(&hdr);
+    size_t flen = get32(&hdr);
+    if (flen > SYNC_MAX_FRAME || !fill(r, 5 + flen)) return 0;
+    payload->p = (const unsigned char*)r->in + 5;
+    payload->left = flen;
+    payload->bad = 0;
+    r->inoff = 5 + flen;
+    return 1;
+}
+
+static void send_simple(replica_t* r, int type, int arg) {
+    sbuf_t out = {0};
+    size_t start = frame_begin(&out, type);
+    if (arg >= 0) put8(&out, (unsigned)arg);
+    frame_end(&out, start);
+    if (!out.oom) emit_fd(r, out.p, out.len);
+    free(out.p);
+}
+
+/* asks for a file, as block deltas against the local copy when worth it */
+static void request_file(replica_t* r, const char* name, int whole) {
+    const char* data = NULL;
+    size_t len = 0;
+    void* pin = NULL;
+    if (!whole) sos_vfs_pin(r->ctx, name, &data, &len, NULL, &pin);
+    size_t block = block_size(len);
+    unsigned n = pin && len >= SYNC_MIN_DELTA ? (unsigned)(len / block) : 0;
+    sbuf_t out = {0};
+    size_t start = frame_begin(&out, 'S');
+    put_name(&out, name);
+    put32(&out, n ? block : 0);
+    put32(&out, n);
+    for (unsigned i = 0; i < n; ++i) {
+        const unsigned char* p = (const unsigned char*)data + (size_t)i * block;
+        unsigned a, b;
+        weak_init(p, block, &a, &b);
+        put32(&out, WEAK(a, b));
+        put64(&out, fnv1a64(p, block));
+    }
+    sos_vfs_unpin(pin);
+    frame_end(&out, start);
+    if (!out.oom) emit_fd(r, out.p, out.len);
+    free(out.p);
+    r->pending++;
+}
+
+static void on_list(replica_t* r, rd_t* p) {
+    unsigned n = get32(p);
+    sbuf_t remote = {0}, local = {0};
+    for (unsigned i = 0; i < n && !p->bad; ++i) {
+        char name[SYNC_NAME_MAX];
+        if (!get_name(p, name)) break;
+        unsigned long long size = get64(p), digest = get64(p);
+        sbuf_put(&remote, name, strlen(name) + 1);
+        const char* data;
+        size_t len;
+        void* pin;
+        int same = sos_vfs_pin(r->ctx, name, &data, &len, NULL, &pin) == 0;
+        if (same) {
+            same = len == size && fnv1a64(data, len) == digest;
+            sos_vfs_unpin(pin);
+        }
+        INFO_ADD(r, files, 1);
+        if (!same) request_file(r, name, 0);
+    }
+    /* whatever the primary does not have goes */
+    sos_vfs_list(r->ctx, collect_name, &local);
+    for (size_t off = 0; off < local.len; off += strlen(local.p + off) + 1) {
+        int found = 0;
+        for (size_t k = 0; k < remote.len && !found; k += strlen(remote.p + k) + 1)
+            found = strcmp(remote.p + k, local.p + off) == 0;
+        if (!found && sos_vfs_remove(r->ctx, local.p + off) == 0) INFO_ADD(r, removed, 1);
+    }
+    free(remote.p);
+    free(local.p);
+    r->listing = 0;
+}
+
+/* rebuilds a file from the local copy and the primary's ops */
+static void on_delta(replica_t* r, rd_t* p) {
+    char name[SYNC_NAME_MAX];
+    if (!get_name(p, name)) return;
+    r->pending--;
+    if (!get8(p)) {
+        if (sos_vfs_remove(r->ctx, name) == 0) INFO_ADD(r, removed, 1);
+        return;
+    }
+    size_t size = (size_t)get64(p);
+    unsigned long long digest = get64(p);
+    size_t block = get32(p);
+    if (p->bad || size > SYNC_MAX_FRAME) { p->bad = 1; return; }
+    const char* basis = NULL;
+    size_t blen = 0;
+    void* pin = NULL;
+    sos_vfs_pin(r->ctx, name, &basis, &blen, NULL, &pin);
+    char* out = malloc(size ? size : 1);
+    size_t have = 0;
+    unsigned long long lit = 0, matched = 0;
+    int ok = out != NULL;
+    while (ok && p->left > 0) {
+        unsigned op = get8(p);
+        if (op == 'C') {
+            unsigned long long first = get32(p), count = get32(p);
+            unsigned long long off = first * block, n = count * block;
+            ok = !p->bad && block && off + n <= blen && have + n <= size;
+            if (ok) { memcpy(out + have, basis + off, (size_t)n); have += (size_t)n; matched += n; }
+        } else if (op == 'D') {
+            size_t n = get32(p);
+            const char* d = get_bytes(p, n);
+            ok = d && have + n <= size;
+            if (ok) { memcpy(out + have, d, n); have += n; lit += n; }
+        } else ok = 0;
+    }
+    sos_vfs_unpin(pin);
+    ok = ok && have == size && fnv1a64(out, size) == digest;
+    if (ok && sos_vfs_write(r->ctx, name, out, size) == 0) {
+        INFO_ADD(r, updated, 1);
+        INFO_ADD(r, literal_bytes, lit);
+        INFO_ADD(r, matched_bytes, matched);
+    } else if (!ok) {
+        /* the local copy changed under the request: fetch it whole */
+        request_file(r, name, 1);
+    }
+    free(out);
+}
+
+static void on_mutation(replica_t* r, rd_t* p) {
+    int op = (int)get8(p);
+    char name[SYNC_NAME_MAX] = "";
+    size_t n = get16(p);
+    const char* s = get_bytes(p, n);
+    if (s && n < sizeof(name)) { memcpy(name, s, n); name[n] = '\0'; }
+    unsigned long long offset = get64(p);
+    size_t len = p->left;
+    const char* data = get_bytes(p, len);
+    if (p->bad || (op != SOS_MUT_RESET && !name[0])) { p->bad = 1; return; }
+    INFO_ADD(r, mutations, 1);
+    if (op == SOS_MUT_WRITE) sos_vfs_write(r->ctx, name, data, len);
+    else if (op == SOS_MUT_REMOVE) sos_vfs_remove(r->ctx, name);
+    else if (op == SOS_MUT_RESET) { send_simple(r, 'L', -1); r->listing = 1; }
+    else if (op == SOS_MUT_APPEND) {
+        const char* cur;
+        size_t have = 0;
+        void* pin = NULL;
+        int exists = sos_vfs_pin(r->ctx, name, &cur, &have, NULL, &pin) == 0;
+        sos_vfs_unpin(pin);
+        if (exists && have == offset) sos_vfs_append(r->ctx, name, data, len);
+        else request_file(r, name, 0);
+    } else if (op == SOS_MUT_PWRITE || op == SOS_MUT_TRUNCATE) {
+        /* ranged changes apply to the copy the replica already has */
+        const char* cur;
+        size_t have = 0;
+        void* pin = NULL;
+        int exists = sos_vfs_pin(r->ctx, name, &cur, &have, NULL, &pin) == 0;
+        sos_vfs_unpin(pin);
+        if (!exists) request_file(r, name, 0);
+        else if (op == SOS_MUT_PWRITE) sos_vfs_pwrite(r->ctx, name, (size_t)offset, data, len);
+        else sos_vfs_truncate(r->ctx, name, (size_t)offset);
+    }
+}
+
+/* handles one frame from the primary; 0 ends the connection */
+static int replica_step(replica_t* r) {
+    int type;
+    rd_t p;
+    if (!read_frame(r, &type, &p)) return 0;
+    if (type == 'L') on_list(r, &p);
+    else if (type == 'F') on_delta(r, &p);
+    else if (type == 'M') on_mutation(r, &p);
+    else p.bad = 1;
+    return !p.bad && !r->failed;
+}
+
+static void* follow_main(void* arg) {
+    replica_t* r = arg;
+    while (replica_step(r)) {}
+    __atomic_store_n(&r->info.following, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void replica_free(replica_t* r) {
+    close(r->fd);
+    free(r->in);
+    free(r);
+}
+
+void sos_sync_stop(void) {
+    if (!follower) return;
+    shutdown(follower->fd, SHUT_RDWR);
+    pthread_join(follow_thread, NULL);
+    sos_sync_status(&last_info);
+    replica_free(follower);
+    follower = NULL;
+}
+
+void sos_sync_status(sos_sync_info_t* info) {
+    if (!info) return;
+    if (!follower) { *info = last_info; return; }
+    sos_sync_info_t* s = &follower->info;
+    info->files = __atomic_load_n(&s->files, __ATOMIC_RELAXED);
+    info->updated = __atomic_load_n(&s->updated, __ATOMIC_RELAXED);
+    info->removed = __atomic_load_n(&s->removed, __ATOMIC_RELAXED);
+    info->literal_bytes = __atomic_load_n(&s->literal_bytes, __ATOMIC_RELAXED);
+    info->matched_bytes = __atomic_load_n(&s->matched_bytes, __ATOMIC_RELAXED);
+    info->mutations = __atomic_load_n(&s->mutations, __ATOMIC_RELAXED);
+    info->following = __atomic_load_n(&s->following, __ATOMIC_ACQUIRE);
+}
+
+int sos_sync(sos_ctx_t* ctx, const char* target, int follow, sos_sync_info_t* info) {
+    if (!ctx || !target || !target[0]) return -1;
+    if (follower && __atomic_load_n(&follower->info.following, __ATOMIC_ACQUIRE)) return -1;
+    sos_sync_stop();    /* reaps a follower whose primary went away */
+    replica_t* r = calloc(1, sizeof(*r));
+    if (!r) return -1;
+    r->ctx = ctx;
+    r->fd = sync_connect(target);
+    if (r->fd < 0) { free(r); return -1; }
+    /* skip the shell banner, then log in as a replica */
+    static const char login[] = "login: ";
+    int ok = 0;
+    while (!ok && fill(r, r->inlen + 1))
+        ok = r->inlen >= sizeof(login) - 1 && memcmp(r->in + r->inlen - (sizeof(login) - 1), login, sizeof(login) - 1) == 0;
+    r->inlen = 0;
+    if (ok) {
+        emit_fd(r, "@replica\n", 9);
+        send_simple(r, 'H', follow ? 1 : 0);
+        send_simple(r, 'L', -1);
+        r->listing = 1;
+        while (ok && (r->listing || r->pending > 0)) ok = replica_step(r);
+    }
+    if (info) *info = r->info;
+    if (!ok) { replica_free(r); return -1; }
+    if (!follow) {
+        last_info = r->info;
+        replica_free(r);
+        return 0;
+    }
+    r->info.following = 1;
+    if (pthread_create(&follow_thread, NULL, follow_main, r) != 0) { replica_free(r); return -1; }
+    follower = r;
+    if (info) info->following = 1;
+    return 0;
+}
+#else
+int sos_sync(sos_ctx_t* ctx, const char* target, int follow, sos_sync_info_t* info) {
+    (void)ctx; (void)target; (void)follow; (void)info;
+    fprintf(stderr, "Replication needs POSIX sockets\n");
+    return -1;
+}
+
+void sos_sync_stop(void) {}
+
+void sos_sync_status(sos_sync_info_t* info) { if (info) memset(info, 0, sizeof(*info)); }
+#endif
@@ -0,0 +1,121 @@
+/* Replication under racing writes and removes.
+
+   Build from the repository root:
+     gcc -O2 tests/sync_race.c sos_core.c sos_server.c sos_sync.c -o sync_race -lpthread
+
+   Serves a primary on a Unix socket, follows it with a replica in the
+   same process, then races one write against one remove on each of a
+   batch of files. Whichever lands last decides whether the file exists,
+   and the followers must see the two in that order, so after each batch
+   the replica has exactly the primary's files. Exits 0 if it converges,
+   1 if not. Linux. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../sos.h"
+
+#define NAMES 100
+#define BATCHES 50
+#define SOCK "/tmp/sos_sync_race.sock"
+
+static sos_ctx_t* primary;
+static sos_ctx_t* replica;
+static int go[NAMES * BATCHES];     /* both racers are at step i once it reaches 2 */
+
+static void* serve_main(void* arg) {
+    (void)arg;
+    sos_serve(primary, SOCK, 0);
+    return NULL;
+}
+
+/* meets the other racer at step i, so each write lands on a remove */
+static void meet(int i) {
+    __atomic_add_fetch(&go[i], 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&go[i], __ATOMIC_ACQUIRE) < 2) sched_yield();
+}
+
+static void* writer(void* arg) {
+    char name[16];
+    int b = *(int*)arg;
+    for (int i = 0; i < NAMES; ++i) {
+        snprintf(name, sizeof(name), "f%d", i);
+        meet(b * NAMES + i);
+        sos_vfs_write(primary, name, "new", 3);
+    }
+    return NULL;
+}
+
+static void* remover(void* arg) {
+    char name[16];
+    int b = *(int*)arg;
+    for (int i = 0; i < NAMES; ++i) {
+        snprintf(name, sizeof(name), "f%d", i);
+        meet(b * NAMES + i);
+        sos_vfs_remove(primary, name);
+    }
+    return NULL;
+}
+
+/* 1 if the file is missing from both or has the same bytes in both */
+static int same(const char* name) {
+    char *a = NULL, *b = NULL;
+    size_t la = 0, lb = 0;
+    int ra = sos_vfs_read(primary, name, &a, &la);
+    int rb = sos_vfs_read(replica, name, &b, &lb);
+    int eq = ra == rb && (ra != 0 || (la == lb && memcmp(a, b, la) == 0));
+    sos_free(a);
+    sos_free(b);
+    return eq;
+}
+
+int main(void) {
+    signal(SIGPIPE, SIG_IGN);
+    unlink(SOCK);
+    primary = sos_create(NULL);
+    replica = sos_create(NULL);
+    if (!primary || !replica) return 1;
+    pthread_t srv, th[2];
+    pthread_create(&srv, NULL, serve_main, NULL);
+    for (int i = 0; i < 100 && access(SOCK, F_OK) != 0; ++i) usleep(10000);
+    if (sos_sync(replica, SOCK, 1, NULL) != 0) { fprintf(stderr, "cannot follow %s\n", SOCK); return 1; }
+
+    int ok = 1;
+    for (int b = 0; b < BATCHES && ok; ++b) {
+        char name[16];
+        for (int i = 0; i < NAMES; ++i) {
+            snprintf(name, sizeof(name), "f%d", i);
+            sos_vfs_write(primary, name, "old", 3);
+        }
+        pthread_create(&th[0], NULL, writer, &b);
+        pthread_create(&th[1], NULL, remover, &b);
+        pthread_join(th[0], NULL);
+        pthread_join(th[1], NULL);
+        /* the follower drains what is in flight; give it up to 10 s */
+        ok = 0;
+        for (int t = 0; t < 1000 && !ok; ++t) {
+            ok = 1;
+            for (int i = 0; i < NAMES && ok; ++i) {
+                snprintf(name, sizeof(name), "f%d", i);
+                ok = same(name);
+            }
+            if (!ok) usleep(10000);
+        }
+        if (!ok) printf("batch %d: replica differs on %s\n", b, name);
+    }
+    sos_sync_info_t info;
+    sos_sync_status(&info);
+    printf("%s after %llu mutations\n", ok ? "converged" : "DIVERGED", info.mutations);
+
+    sos_sync_stop();
+    pthread_kill(srv, SIGINT);
+    pthread_join(srv, NULL);
+    sos_destroy(replica);
+    sos_destroy(primary);
+    unlink(SOCK);
+    return ok ? 0 : 1;
+}
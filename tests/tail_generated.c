@@ -0,0 +1,48 @@
+/* head -c / tail -c on a generated file.
+
+   Build from the repository root:
+     gcc -O2 tests/tail_generated.c sos_core.c -o tail_generated -lpthread
+
+   .stats has no stored size: it is rendered on each read. tail -c N must
+   return the last N bytes of the rendering (which ends in a newline) and
+   head -c N the first N, the same as for a stored file. Exits 0 on
+   success, 1 with the mismatch printed. */
+#include <stdio.h>
+#include <string.h>
+
+#include "../sos.h"
+
+static int failures;
+
+static void expect(sos_ctx_t* ctx, const char* cmd, const char* want, size_t wantlen) {
+    char* out = NULL;
+    size_t len = 0;
+    sos_exec(ctx, cmd, &out, &len);
+    if (len != wantlen || memcmp(out, want, len) != 0) {
+        printf("FAIL %s: got '%.*s', want '%.*s'\n", cmd, (int)len, out, (int)wantlen, want);
+        failures++;
+    }
+    sos_free(out);
+}
+
+int main(void) {
+    sos_ctx_t* ctx = sos_create(NULL);
+    if (!ctx) return 1;
+    sos_vfs_write(ctx, "plain.txt", "0123456789\n", 11);
+    expect(ctx, "tail -c 5 plain.txt", "6789\n", 5);
+    expect(ctx, "head -c 3 plain.txt", "012", 3);
+    expect(ctx, "tail -c 50 plain.txt", "0123456789\n", 11);
+
+    /* the rendering starts with a counter name and ends with a newline */
+    expect(ctx, "head -c 4 .stats", "vfs.", 4);
+    expect(ctx, "tail -c 1 .stats", "\n", 1);
+    char* all = NULL;
+    size_t n = 0;
+    sos_exec(ctx, "tail -c 1000000 .stats", &all, &n);
+    if (n < 8 || all[n - 1] != '\n') { printf("FAIL tail -c 1000000 .stats: %zu bytes\n", n); failures++; }
+    sos_free(all);
+
+    sos_destroy(ctx);
+    if (!failures) printf("ok\n");
+    return failures ? 1 : 0;
+}